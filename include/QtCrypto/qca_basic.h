@@ -67,6 +67,12 @@ namespace QCA {
    The normal use of this class is expected to be through the
    static members - randomChar(), randomInt() and randomArray().
 
+   The static members are safe to call from any thread.  Each thread
+   gets its own generator, created from the global random provider on
+   first use, so threads do not contend with each other.  These
+   generators are discarded when the global random provider changes or
+   its plugin is unloaded.
+
    \ingroup UserAPI
  */
 class QCA_EXPORT Random : public Algorithm
@@ -154,6 +160,35 @@ SecureArray arry = QCA::Random::randomArray(30);
 	*/
 	static SecureArray randomArray(int size);
 
+	/**
+	   Set the size of the per-thread buffer used by the static members
+
+	   By default (a size of 0) every call to randomChar(), randomInt()
+	   or randomArray() asks the provider for exactly the bytes needed.
+	   Providers that have a significant per-call cost can be amortized
+	   by setting a buffer size, in which case that many bytes are
+	   fetched at once and handed out over later calls.  Bytes are wiped
+	   from the buffer as they are handed out.  Requests larger than the
+	   buffer always go to the provider directly.
+
+	   \param size the buffer size in bytes, or 0 to disable buffering
+
+	   This function was introduced in %QCA 2.2.
+
+	   \sa bufferSize
+	*/
+	static void setBufferSize(int size);
+
+	/**
+	   Returns the size of the per-thread buffer used by the static
+	   members, or 0 if buffering is disabled
+
+	   This function was introduced in %QCA 2.2.
+
+	   \sa setBufferSize
+	*/
+	static int bufferSize();
+
 private:
 	class Private;
 	Private *d;
@@ -287,6 +322,18 @@ public:
 	*/
 	void update(const QByteArray &a);
 
+	/**
+	   \overload
+
+	   Adds memory that is not owned by a MemoryRegion, such as
+	   part of a memory mapped file, without copying it first.
+
+	   \param a the data to add to the hash
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void update(const MemoryRegionView &a);
+
 	/**
 	   \overload
 
@@ -327,6 +374,35 @@ if ( f.open( QIODevice::ReadOnly ) )
 	*/
 	void update(QIODevice *file);
 
+	/**
+	   %Hash the contents of a file, returning the hash result
+
+	   This is a convenience method for hashing files that may be
+	   very large.  Where possible the file is memory mapped, so
+	   that it can be hashed without copying it.  Otherwise it is
+	   read in large chunks.
+
+	   \code
+QCA::MemoryRegion digest = QCA::Hash("sha1").hashFile("file.dat");
+if(digest.isEmpty())
+	printf("file.dat could not be read\n");
+	   \endcode
+
+	   Any data previously passed to update() is discarded.
+
+	   \param fileName the name of the file to hash
+	   \param readAhead if true, the file is read in a separate
+	   thread while the data already read is being hashed.  This
+	   can help for files on slow devices, where reading and hashing
+	   take a similar amount of time.
+
+	   \return the hash of the file, or an empty MemoryRegion if the
+	   file could not be read
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	MemoryRegion hashFile(const QString &fileName, bool readAhead = false);
+
 	/**
 	   Finalises input and returns the hash result
 
@@ -380,11 +456,176 @@ SecureArray outputArray = QCA::Hash("md2")::hash(sampleArray);
 	*/
 	QString hashToString(const MemoryRegion &array);
 
+	/**
+	   %Hash a number of independent messages, returning one
+	   hash result for each of them
+
+	   This is equivalent to calling hash() on every message in
+	   turn, but lets the provider avoid the per-message overhead
+	   where it can.  This is useful when many small records need
+	   to be fingerprinted.
+
+	   \code
+QList<QCA::MemoryRegion> records;
+...
+QList<QCA::MemoryRegion> digests = QCA::Hash("sha1").hashMany(records);
+	   \endcode
+
+	   Any data previously passed to update() is discarded, and
+	   the Hash is left in the reset state.
+
+	   \param regions the messages to hash
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	QList<MemoryRegion> hashMany(const QList<MemoryRegion> &regions);
+
+	/**
+	   \overload
+
+	   \param regions pointer to the first message to hash
+	   \param count the number of messages
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	QList<MemoryRegion> hashMany(const MemoryRegion *regions, int count);
+
 private:
 	class Private;
 	Private *d;
 };
 
+/**
+   \class TreeHash qca_basic.h QtCrypto
+
+   Hash tree (Merkle tree) computation over a large message
+
+   %TreeHash splits the message into leaves of a fixed size, hashes
+   the leaves in parallel using the global QThreadPool, and then
+   combines the leaf digests pairwise until a single root digest is
+   left.  This allows very large inputs to be hashed using all of the
+   available cores.
+
+   Leaf digests are calculated as H(0x00 || leaf), and inner nodes
+   as H(0x01 || left || right), following RFC 6962.  If a level has an
+   odd number of nodes, the last node is carried up to the next level
+   unchanged.  An empty message is hashed as a single empty leaf.  The
+   root digest depends on the leaf size, and is not the same as the
+   plain Hash of the message.
+
+   \code
+QCA::TreeHash tree("sha256", 1024 * 1024);
+QFile f("backup.img");
+if(f.open(QIODevice::ReadOnly))
+{
+	QByteArray buf;
+	while(!(buf = f.read(4 * 1024 * 1024)).isEmpty())
+		tree.update(buf);
+	QCA::MemoryRegion root = tree.final();
+	QList<QCA::MemoryRegion> leaves = tree.leafDigests();
+}
+   \endcode
+
+   The leaf digests can be stored alongside the root, so that a
+   single part of the message can later be checked with hashLeaf()
+   without hashing all of it.  rootFromLeaves() ties a list of leaf
+   digests back to the root.
+
+   Any provider that supports the underlying hash type can be used.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT TreeHash : public BufferedComputation
+{
+public:
+	/**
+	   Constructor
+
+	   \param type the hash type to use for the leaves and nodes
+	   (for example, "sha256")
+	   \param leafSize the size of each leaf, in bytes
+	   \param provider the name of the provider plugin to use for
+	   the hash (eg "qca-ossl")
+	*/
+	explicit TreeHash(const QString &type, int leafSize = 1024 * 1024, const QString &provider = QString());
+
+	~TreeHash();
+
+	/**
+	   Return the hash type
+	*/
+	QString type() const;
+
+	/**
+	   Return the leaf size, in bytes
+	*/
+	int leafSize() const;
+
+	/**
+	   Reset the tree, dumping all previous parts of the message
+	*/
+	virtual void clear();
+
+	/**
+	   Add data to the message
+
+	   Whole leaves are handed to the thread pool as they become
+	   available, so this will usually return before they are hashed.
+	   The data is copied, and does not need to stay valid.
+
+	   \param a the data to add
+	*/
+	virtual void update(const MemoryRegion &a);
+
+	/**
+	   \overload
+
+	   \param a the data to add
+	*/
+	void update(const MemoryRegionView &a);
+
+	/**
+	   Wait for all of the leaves to be hashed, and return the root
+	   digest
+
+	   As with Hash, call clear() before reusing the object.
+	*/
+	virtual MemoryRegion final();
+
+	/**
+	   Return the digests of the leaves, in message order
+
+	   This is only complete after final() has been called.
+	*/
+	QList<MemoryRegion> leafDigests() const;
+
+	/**
+	   Return the digest of a single leaf
+
+	   This can be compared against an entry of leafDigests() to check
+	   one part of a message.
+
+	   \param leaf the leaf data.  This should be leafSize() bytes,
+	   except for the last leaf of a message.
+	*/
+	MemoryRegion hashLeaf(const MemoryRegion &leaf);
+
+	/**
+	   Combine a list of leaf digests into the root digest
+
+	   \param leaves the leaf digests, in message order
+	*/
+	MemoryRegion rootFromLeaves(const QList<MemoryRegion> &leaves);
+
+private:
+	Q_DISABLE_COPY(TreeHash)
+
+	class Private;
+	Private *d;
+};
+
 /**
    \page hashing Hashing Algorithms
 
@@ -744,6 +985,66 @@ public:
 	*/
 	virtual MemoryRegion update(const MemoryRegion &a);
 
+	/**
+	   \overload
+
+	   Processes memory that is not owned by a MemoryRegion, such
+	   as part of a network buffer, without copying it first.
+
+	   \param a the data to encrypt / decrypt
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	MemoryRegion update(const MemoryRegionView &a);
+
+	/**
+	   Encrypt or decrypt into memory supplied by the caller,
+	   returning the number of bytes written
+
+	   This avoids allocating a new MemoryRegion for every chunk when
+	   streaming large amounts of data.
+
+	   \code
+QByteArray packet = ...;
+QByteArray buf(packet.size() + cipher.blockSize(), 0);
+int len = cipher.update(QCA::MemoryRegionView(packet), buf.data(), buf.size());
+if(len < 0)
+	return false;
+	   \endcode
+
+	   The result can also be written over the input, by passing
+	   in.data() as out.  This is supported for the CTR, CFB, OFB, GCM
+	   and CCM modes.  For ECB and CBC it is only safe if every chunk
+	   is a whole number of blocks and no padding is being removed,
+	   since otherwise the output can fall behind the input.
+
+	   \param in the data to encrypt / decrypt
+	   \param out where to write the result.  There must be room for
+	   at least in.size() + blockSize() bytes.
+	   \param outSize the number of bytes available at out
+
+	   \return the number of bytes written, or -1 if there was an
+	   error (in which case ok() returns false)
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int update(const MemoryRegionView &in, char *out, int outSize);
+
+	/**
+	   Complete the processing into memory supplied by the caller,
+	   returning the number of bytes written
+
+	   \param out where to write the result.  There must be room for
+	   at least blockSize() bytes.
+	   \param outSize the number of bytes available at out
+
+	   \return the number of bytes written, or -1 if there was an
+	   error (in which case ok() returns false)
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int final(char *out, int outSize);
+
 	/**
 	   complete the block of data, padding as required, and returning
 	   the completed block
@@ -910,6 +1211,18 @@ public:
 	*/
 	virtual void update(const MemoryRegion &array);
 
+	/**
+	   \overload
+
+	   Adds memory that is not owned by a MemoryRegion without
+	   copying it first.
+
+	   \param array the message contents
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void update(const MemoryRegionView &array);
+
 	/**
 	   Finalises input and returns the MAC result
 
@@ -976,6 +1289,11 @@ public:
 
 	   \note key length is ignored for some functions
 
+	   If the algorithm derives long keys as independent blocks, as
+	   PBKDF2 does, a key longer than one block has its blocks computed
+	   in parallel, using the calling thread and any idle threads of
+	   the global QThreadPool.
+
 	   \param secret the secret (password or passphrase)
 	   \param salt the salt to use
 	   \param keyLength the length of key to return
@@ -985,11 +1303,45 @@ public:
 	*/
 	SymmetricKey makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount);
 
+	/**
+	   Generate keys for a number of secret and salt pairs at once
+
+	   The keys are derived in parallel, using the calling thread and
+	   any idle threads of the global QThreadPool.  Each key is the
+	   same as makeKey() would return for its pair.
+
+	   \a secrets and \a salts are paired up in order, and must have
+	   the same number of entries, except that a list with a single
+	   entry is paired with every entry of the other list.  An empty
+	   list is returned if the lists don't match up.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param secrets the secrets (passwords or passphrases)
+	   \param salts the salts to use
+	   \param keyLength the length of each key to return
+	   \param iterationCount the number of iterations to perform
+
+	   \return the derived keys, in the order of the pairs
+	*/
+	QList<SymmetricKey> makeKeys(const QList<SecureArray> &secrets, const QList<InitializationVector> &salts, unsigned int keyLength, unsigned int iterationCount);
+
 	/**
 	   Generate the key from a specified secret and salt value
 
 	   \note key length is ignored for some functions
 
+	   For PBKDF1 and PBKDF2, the iteration count is worked out from
+	   the speed of the provider, which is measured the first time it is
+	   needed and then remembered for the rest of the process.  The
+	   speed can also be kept on disk for later runs, with
+	   setCalibrationProfile().  Later calls only spend a couple of
+	   milliseconds checking that the remembered speed is not far too
+	   low, and measure again if it is.  The interval is the time one
+	   thread would take to compute every block of the key in turn; the
+	   key itself may then be derived faster, in parallel.  At least
+	   1000 iterations are always used.
+
 	   \param secret the secret (password or passphrase)
 	   \param salt the salt to use
 	   \param keyLength the length of key to return
@@ -1004,6 +1356,86 @@ public:
 						 int msecInterval,
 						 unsigned int *iterationCount);
 
+	/**
+	   Returns the memory cost, in KiB
+
+	   This only applies to memory-hard functions, such as SCrypt and
+	   Argon2id, and is 0 for the others.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	unsigned int memoryCost() const;
+
+	/**
+	   Sets the memory cost, in KiB
+
+	   This is ignored by functions that are not memory-hard.  See the
+	   documentation of SCrypt and Argon2id for how each one uses it.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param kib the memory cost
+	*/
+	void setMemoryCost(unsigned int kib);
+
+	/**
+	   Returns the number of lanes, which can be computed in parallel
+
+	   This is 1 for functions without lanes.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int parallelism() const;
+
+	/**
+	   Sets the number of lanes
+
+	   The number of lanes is part of the definition of the key, so the
+	   same value must be used to derive the same key again.  The lanes
+	   are computed on the calling thread and any idle threads of the
+	   global QThreadPool.  This is ignored by functions without lanes.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param lanes the number of lanes
+	*/
+	void setParallelism(int lanes);
+
+	/**
+	   Sets the file that KDF speed measurements are kept in
+
+	   Measurements already in the file are loaded straight away, and
+	   new ones are added to it as they are made, so that a later run of
+	   the program can calibrate without measuring again.  The file is
+	   an INI file, which may also be used for other settings.  Pass an
+	   empty string to stop using a file.
+
+	   The measurements depend on the machine and provider they were
+	   made with.  They are stored per machine, and only those of the
+	   current machine are loaded.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param fileName the path of the profile
+	*/
+	static void setCalibrationProfile(const QString &fileName);
+
+	/**
+	   Returns the file that KDF speed measurements are kept in, or an
+	   empty string if there is none
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	static QString calibrationProfile();
+
+	/**
+	   Forgets all KDF speed measurements, including any kept in the
+	   calibration profile, so that they will be made again
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	static void clearCalibration();
+
 	/**
 	   Construct the name of the algorithm
 
@@ -1078,6 +1510,89 @@ public:
 		: KeyDerivationFunction(withAlgorithm(QStringLiteral("pbkdf2"), algorithm), provider) {}
 };
 
+/**
+   \class SCrypt qca_basic.h QtCrypto
+
+   The scrypt memory-hard password based key derivation function
+
+   This class implements scrypt, as specified in RFC7914.  The
+   iterationCount passed to makeKey() is the cost parameter N, which must
+   be a power of 2.  The block size r is 8, so each lane needs N KiB of
+   memory while it is computed.  parallelism() is the parallelization
+   parameter p.
+
+   The makeKey() overload taking a time interval doubles N, starting from
+   1024, for as long as the key still takes less than the interval to
+   derive.  It never chooses an N needing more than memoryCost() KiB per
+   lane.  The memory cost has no other effect.
+
+   The default provider implements this.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT SCrypt : public KeyDerivationFunction
+{
+public:
+	/**
+	   Standard constructor
+
+	   \param memoryCost the largest memory per lane, in KiB, that
+	   calibration may choose
+	   \param parallelism the number of lanes
+	   \param provider the name of the provider to use, if available
+	*/
+	explicit SCrypt(unsigned int memoryCost = 65536, int parallelism = 1, const QString &provider = QString())
+		: KeyDerivationFunction(QStringLiteral("scrypt"), provider)
+	{
+		setMemoryCost(memoryCost);
+		setParallelism(parallelism);
+	}
+};
+
+/**
+   \class Argon2id qca_basic.h QtCrypto
+
+   The Argon2id memory-hard password based key derivation function
+
+   This class implements Argon2id, version 1.3, as specified in RFC9106.
+   The iterationCount passed to makeKey() is the number of passes t,
+   memoryCost() is the memory size m in KiB, and parallelism() is the
+   number of lanes p.  The memory size must be at least 8 KiB per lane,
+   and the salt must be at least 8 bytes.  Otherwise an empty key is
+   returned.
+
+   The makeKey() overload taking a time interval keeps the memory cost,
+   and picks the number of passes from the time taken by a single pass.
+
+   The defaults, 64 MiB of memory and 4 lanes, are the second
+   recommended option of RFC9106, to be used with 3 passes.
+
+   The default provider implements this.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT Argon2id : public KeyDerivationFunction
+{
+public:
+	/**
+	   Standard constructor
+
+	   \param memoryCost the memory size, in KiB
+	   \param parallelism the number of lanes
+	   \param provider the name of the provider to use, if available
+	*/
+	explicit Argon2id(unsigned int memoryCost = 65536, int parallelism = 4, const QString &provider = QString())
+		: KeyDerivationFunction(QStringLiteral("argon2id"), provider)
+	{
+		setMemoryCost(memoryCost);
+		setParallelism(parallelism);
+	}
+};
+
 }
 
 #endif
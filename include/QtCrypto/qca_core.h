@@ -175,6 +175,117 @@ QCA_EXPORT void deinit();
 */
 QCA_EXPORT bool haveSecureMemory();
 
+/**
+   Policy for growing the secure memory pool
+
+   Secure memory is locked into RAM in regions of a configurable
+   size, and a new region is added whenever the pool runs out.
+   Most operating systems limit how much memory a process may lock
+   (RLIMIT_MEMLOCK on Unix), and once that limit is reached, new
+   regions can no longer be locked.  The policy decides what
+   happens then.
+
+   \sa setSecureMemoryPolicy(), secureMemoryStats()
+*/
+enum SecureMemoryPolicy
+{
+	SecureMemoryGrow,    ///< Keep growing, using memory that could not be locked if necessary
+	SecureMemoryFailFast ///< Abort the process rather than use memory that could not be locked
+};
+
+/**
+   \class SecureMemoryStats qca_core.h QtCrypto
+
+   Usage of the secure memory pool, as returned by secureMemoryStats()
+
+   A non-zero bytesUnlocked or fallbackEvents means that some secure
+   memory may be swapped out to disk.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT SecureMemoryStats
+{
+public:
+	/**
+	   Bytes in the pool that are locked into RAM
+	*/
+	qint64 bytesLocked;
+
+	/**
+	   Bytes in the pool that could not be locked
+	*/
+	qint64 bytesUnlocked;
+
+	/**
+	   Total size of the pool, locked or not
+	*/
+	qint64 bytesInPool;
+
+	/**
+	   Bytes of the pool currently allocated, including rounding
+	   of each allocation to the pool's chunk sizes
+	*/
+	qint64 bytesInUse;
+
+	/**
+	   The largest size the pool has had
+	*/
+	qint64 peakBytesInPool;
+
+	/**
+	   The number of times secure memory fell back to memory that is
+	   not locked.  This includes starting up without the ability to
+	   lock memory at all.
+	*/
+	int fallbackEvents;
+
+	/**
+	   Creates an empty set of statistics
+	*/
+	SecureMemoryStats();
+
+	/**
+	   The fraction of the pool that is not in use, from 0 to 1
+	*/
+	double fragmentation() const;
+};
+
+/**
+   Report the current usage of the secure memory pool
+
+   All values are zero if %QCA is not initialized.
+
+   This function was introduced in %QCA 2.2.
+*/
+QCA_EXPORT SecureMemoryStats secureMemoryStats();
+
+/**
+   Set the policy for growing the secure memory pool
+
+   This may be called before or after %QCA is initialized.  If it is
+   set to SecureMemoryFailFast before initialization, initialization
+   aborts when memory locking is not available at all.
+
+   This function was introduced in %QCA 2.2.
+
+   \param policy what to do once memory can no longer be locked
+   \param growSize the size in bytes of each region added to the pool,
+   rounded up to a multiple of 16 KiB.  If it is 0, the preallocation
+   size passed to init() is used.
+*/
+QCA_EXPORT void setSecureMemoryPolicy(SecureMemoryPolicy policy, int growSize = 0);
+
+/**
+   The current policy for growing the secure memory pool
+
+   This function was introduced in %QCA 2.2.
+
+   \sa setSecureMemoryPolicy()
+*/
+QCA_EXPORT SecureMemoryPolicy secureMemoryPolicy();
+
 /**
    Test if secure random is available
 
@@ -370,6 +481,74 @@ QCA_EXPORT Provider *findProvider(const QString &name);
 */
 QCA_EXPORT Provider *defaultProvider();
 
+/**
+   Return the number of provider lookups that were answered from the
+   provider resolution cache
+
+   Each time an algorithm object is created, %QCA has to find the provider
+   that supports the requested type.  The result of that search is cached
+   per thread until the list of providers changes (for example through
+   scanForPlugins(), insertProvider(), unloadProvider() or
+   setProviderPriority()).
+
+   This function was introduced in %QCA 2.2.
+
+   \sa providerCacheMisses
+   \sa resetProviderCacheStatistics
+*/
+QCA_EXPORT int providerCacheHits();
+
+/**
+   Return the number of provider lookups that could not be answered from
+   the provider resolution cache, and so required a search of the
+   provider list
+
+   This function was introduced in %QCA 2.2.
+
+   \sa providerCacheHits
+*/
+QCA_EXPORT int providerCacheMisses();
+
+/**
+   Reset the provider resolution cache hit and miss counters to zero
+
+   This function was introduced in %QCA 2.2.
+*/
+QCA_EXPORT void resetProviderCacheStatistics();
+
+/**
+   Enable pooling of algorithm contexts
+
+   Normally every Hash object creates a new provider context, which is
+   destroyed along with the object.  When pooling is enabled, released hash
+   contexts are reset and kept in a per-thread pool, keyed by provider and
+   type, and handed out again to the next object of the same type.  This
+   avoids the cost of setting up the context for applications that create
+   many short-lived hash objects.
+
+   MessageAuthenticationCode and Cipher contexts are never pooled, so that
+   no key material is kept in memory after the object is destroyed.
+
+   \param size the maximum number of idle contexts kept for each provider and
+   type in each thread.  Pass 0 (the default) to disable pooling, which also
+   destroys all pooled contexts.
+
+   This function was introduced in %QCA 2.2.
+
+   \sa contextPoolSize
+*/
+QCA_EXPORT void setContextPoolSize(int size);
+
+/**
+   Return the maximum number of idle contexts kept per provider and type in
+   each thread, or 0 if context pooling is disabled
+
+   This function was introduced in %QCA 2.2.
+
+   \sa setContextPoolSize
+*/
+QCA_EXPORT int contextPoolSize();
+
 /**
    Retrieve plugin paths. It consists of:
    1. QCA_PLUGIN_PATH environment if set.
@@ -477,13 +656,15 @@ QCA_EXPORT void setGlobalRandomProvider(const QString &provider);
    and error recording.
 
    The system Logger is automatically created for you on start. 
+   Once it exists, this function does not take a lock.
 */
 QCA_EXPORT Logger *logger();
 
 /**
    Log a text message. This is an efficient function
    to avoid overhead of argument executions when log level
-   blocks the message.
+   blocks the message.  Neither fetching the logger nor
+   checking the level takes a lock.
 
    \param message the text to log
    \param severity the type of information to log
@@ -502,7 +683,8 @@ QCA_EXPORT Logger *logger();
 /**
    Log a binary message. This is an efficient function
    to avoid overhead of argument executions when log level
-   blocks the message.
+   blocks the message.  Neither fetching the logger nor
+   checking the level takes a lock.
 
    \param blob the blob to log
    \param severity the type of information to log
@@ -1051,6 +1233,25 @@ public:
 	*/
 	virtual void update(const MemoryRegion &a) = 0;
 
+	/**
+	   \overload
+
+	   Update the internal state with memory that is not
+	   owned by a MemoryRegion, without copying it first
+	   where the implementation allows.
+
+	   This copies the data and calls update(const MemoryRegion &).
+	   Hash and MessageAuthenticationCode have overloads of their
+	   own that avoid the copy.  It is not virtual, to keep the
+	   class binary compatible.
+
+	   \param a the data that is to be used to update the
+	   internal state.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void update(const MemoryRegionView &a);
+
 	/**
 	   Complete the algorithm and return the internal state
 	*/
@@ -1107,6 +1308,23 @@ public:
 	*/
 	virtual MemoryRegion update(const MemoryRegion &a) = 0;
 
+	/**
+	   \overload
+
+	   Process memory that is not owned by a MemoryRegion,
+	   without copying it first where the implementation
+	   allows.
+
+	   This copies the data and calls update(const MemoryRegion &).
+	   Cipher has an overload of its own that avoids the copy.  It
+	   is not virtual, to keep the class binary compatible.
+
+	   \param a the data to process
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	MemoryRegion update(const MemoryRegionView &a);
+
 	/**
 	   Complete the algorithm, returning any 
 	   additional results.
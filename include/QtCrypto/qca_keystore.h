@@ -486,6 +486,11 @@ public:
 	/**
 	   A list of the KeyStoreEntry objects in this store
 
+	   The entries are fetched from the provider the first time any
+	   KeyStore object for the store asks for them, and are then kept up
+	   to date as the store changes, so later calls only return a shared
+	   copy.
+
 	   \note This synchronous operation may require event handling, and so
 	   it must not be called from the same thread as an EventHandler
 	   (this is not a concern if asynchronous mode is enabled).
@@ -570,6 +575,21 @@ Q_SIGNALS:
 	*/
 	void updated();
 
+	/**
+	   Emitted just before updated(), with what changed since the
+	   entries this object last saw.  It is only emitted once the
+	   entries have been read with entryList() or in asynchronous mode,
+	   and if the changes go back too far to be known, only updated() is
+	   emitted.
+
+	   \param added the entries that are new
+	   \param changed the entries that were replaced, by their new version
+	   \param removed the ids of the entries that are gone
+
+	   This signal was introduced in %QCA 2.2.
+	*/
+	void entriesChanged(const QList<QCA::KeyStoreEntry> &added, const QList<QCA::KeyStoreEntry> &changed, const QStringList &removed);
+
 	/**
 	   Emitted when the KeyStore becomes unavailable
 	*/
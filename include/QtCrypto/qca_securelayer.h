@@ -262,6 +262,133 @@ public:
 	bool isNull() const;
 };
 
+/**
+   \class TLSSessionCache qca_securelayer.h QtCrypto
+
+   Client side cache of %TLS sessions, keyed by host name
+
+   Clients that connect to the same servers repeatedly can avoid most of
+   the cost of the handshake by resuming an earlier session.  Give the
+   same TLSSessionCache to each TLS object with TLS::setSessionCache(),
+   and each connection will offer the session of the last successful
+   connection to the same host, and store its own session afterwards.
+
+   Whether a session is actually resumed is up to the server.  Both
+   session IDs and session tickets are used, if the provider supports
+   them.
+
+   A cache may be shared between threads.
+
+   \code
+QCA::TLSSessionCache cache(1000, 600);
+...
+tls->setSessionCache(&cache);
+tls->startClient("www.example.com");
+   \endcode
+
+   \ingroup UserAPI
+
+   This class was introduced in %QCA 2.2.
+*/
+class QCA_EXPORT TLSSessionCache
+{
+public:
+	/**
+	   Create an empty cache
+
+	   \param maxEntries the maximum number of hosts to keep a session
+	   for.  When full, the least recently stored session is dropped.
+	   \param timeout the number of seconds a session is kept for
+	*/
+	TLSSessionCache(int maxEntries = 256, int timeout = 300);
+
+	~TLSSessionCache();
+
+	/**
+	   The maximum number of hosts a session is kept for
+	*/
+	int maxEntries() const;
+
+	/**
+	   Set the maximum number of hosts a session is kept for
+
+	   \param maxEntries the new limit
+	*/
+	void setMaxEntries(int maxEntries);
+
+	/**
+	   The number of seconds a session is kept for
+	*/
+	int timeout() const;
+
+	/**
+	   Set the number of seconds a session is kept for
+
+	   \param timeout the new timeout
+	*/
+	void setTimeout(int timeout);
+
+	/**
+	   Returns the session stored for the given host, or a null session
+	   if there is none or it has expired
+
+	   \param host the host name the session was stored under
+	*/
+	TLSSession session(const QString &host) const;
+
+	/**
+	   Store a session for the given host, replacing any earlier one
+
+	   \param host the host name to store the session under
+	   \param session the session to store
+	*/
+	void insert(const QString &host, const TLSSession &session);
+
+	/**
+	   Remove the session stored for the given host
+
+	   \param host the host name the session was stored under
+	*/
+	void remove(const QString &host);
+
+	/**
+	   Remove all sessions
+	*/
+	void clear();
+
+	/**
+	   The number of sessions stored, including expired ones that have
+	   not been dropped yet
+	*/
+	int count() const;
+
+	/**
+	   The number of times a session was found for a new connection
+	*/
+	int hits() const;
+
+	/**
+	   The number of times no session was found for a new connection
+	*/
+	int misses() const;
+
+	/**
+	   The number of connections that offered a session from this cache
+	   and resumed it.  The difference between hits() and resumed()
+	   is the number of sessions the servers turned down.
+	*/
+	int resumed() const;
+
+private:
+	Q_DISABLE_COPY(TLSSessionCache)
+
+	friend class TLS;
+	void handshakeDone(bool offered, bool resumed);
+
+	class Private;
+	Private *d;
+};
+
 /**
    \class TLS qca_securelayer.h QtCrypto
 
@@ -323,6 +450,18 @@ public:
 		ErrorCrypt            ///< problem at anytime after
 	};
 
+	/**
+	   Result of processing data in direct mode
+
+	   \sa setDirectMode()
+	*/
+	enum DirectResult
+	{
+		DirectOk,     ///< the data was processed and the session continues
+		DirectClosed, ///< the session has been closed
+		DirectError   ///< the session failed, see errorCode()
+	};
+
 	/**
 	   Type of identity
 	*/
@@ -497,6 +636,24 @@ foreach(const CertificateInfoOrdered &info, tls->issuerList())
 	*/
 	void setSession(const TLSSession &session);
 
+	/**
+	   Use the given cache to resume sessions.  For use with clients
+	   only.
+
+	   When starting a client with a host name and no session set with
+	   setSession(), the session stored in the cache for that host is
+	   offered to the server.  After a successful handshake, the new
+	   session is stored in the cache.
+
+	   The cache is not owned by this object, and must stay valid until
+	   the cache is unset or this object is destroyed.
+
+	   \param cache the cache to use, or 0 to not use one
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void setSessionCache(TLSSessionCache *cache);
+
 	/**
 	   Test if the link can use compression
 
@@ -572,6 +729,84 @@ foreach(const CertificateInfoOrdered &info, tls->issuerList())
 	*/
 	void continueAfterStep();
 
+	/**
+	   Enable or disable direct processing
+
+	   Normally the provider is driven from the event loop: results
+	   are picked up when the provider signals them, and readyRead(),
+	   readyReadOutgoing() and the other signals are emitted one event
+	   loop iteration later.
+
+	   In direct mode every call that feeds the session (startClient(),
+	   startServer(), write(), writeIncoming(), close(), and
+	   processIncoming() and processOutgoing()) runs the provider
+	   inline and has handled all of its results by the time it
+	   returns.  The output can then be collected right away with
+	   read() and readOutgoing().  No timers are used and no signals
+	   are emitted, so the object can be driven from a thread without
+	   an event loop, such as one built around epoll.
+
+	   Since there are no signals, the handshake does not stop for
+	   hostNameReceived(), certificateRequested(),
+	   peerCertificateAvailable() or handshaken().  Use isHandshaken(),
+	   peerCertificateChain() and peerIdentityResult() to check on the
+	   session instead.
+
+	   This must be set before the session is started, and stays in
+	   effect until reset().  It is only available in stream mode;
+	   enabling it in datagram mode logs a warning and leaves direct
+	   mode off.
+
+	   \param enabled whether to process directly
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void setDirectMode(bool enabled);
+
+	/**
+	   Test if direct processing is enabled
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	bool isDirectMode() const;
+
+	/**
+	   Processes network data in direct mode
+
+	   This feeds \a fromNet to the session, and returns the plain
+	   data and the network data it produced, all in one call.
+
+	   Returns DirectError without processing anything if direct mode
+	   is not enabled.
+
+	   \param fromNet the data received from the network
+	   \param toApp set to the decrypted data, if not null
+	   \param toNet set to the data to send to the network, if not
+	   null.  This may hold handshake records even when no
+	   application data was written.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	DirectResult processIncoming(const QByteArray &fromNet, QByteArray *toApp, QByteArray *toNet);
+
+	/**
+	   Processes application data in direct mode
+
+	   This encrypts \a fromApp and returns the records to send, all
+	   in one call.  Data written before the handshake completes is
+	   sent once it does.
+
+	   Returns DirectError without processing anything if direct mode
+	   is not enabled.
+
+	   \param fromApp the plain data to send
+	   \param toNet set to the data to send to the network, if not
+	   null
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	DirectResult processOutgoing(const QByteArray &fromApp, QByteArray *toNet);
+
 	/**
 	   test if the handshake is complete
 
@@ -626,6 +861,16 @@ foreach(const CertificateInfoOrdered &info, tls->issuerList())
 	*/
 	TLSSession session() const;
 
+	/**
+	   Test if the handshake resumed an earlier session, rather than
+	   performing a full handshake
+
+	   This function was introduced in %QCA 2.2.
+
+	   \sa setSession, setSessionCache
+	*/
+	bool isSessionReused() const;
+
 	/**
 	   This method returns the type of error that has
 	   occurred. You should only need to check this if the
@@ -692,6 +937,59 @@ foreach(const CertificateInfoOrdered &info, tls->issuerList())
 	virtual QByteArray readUnprocessed();
 	virtual int convertBytesWritten(qint64 encryptedBytes);
 
+	/**
+	   Reads decrypted data into a buffer supplied by the caller
+
+	   This is the same as read(), except that the data is copied
+	   straight from the chunks it was decoded into, and only as much
+	   as fits is consumed.  It returns the number of bytes copied.
+
+	   \param data where to copy the data to
+	   \param size the most bytes to copy
+
+	   \note this is only used with TLS stream mode, and returns 0
+	   for DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int readInto(char *data, int size);
+
+	/**
+	   Accepts network-side data made of several chunks
+
+	   This is the same as writeIncoming(const QByteArray &), but takes
+	   a whole ChunkBuffer.  The chunks are shared rather than copied,
+	   and in stream mode they are handed to the provider as they are,
+	   so a provider that supports it reads them in place.
+
+	   \param data the network-side data
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void writeIncoming(const ChunkBuffer &data);
+
+	/**
+	   Reads encoded data into a buffer supplied by the caller
+
+	   This is the same as readOutgoing(), except that the data is
+	   copied straight from the chunks the provider produced, and only
+	   as much as fits is consumed.  It returns the number of bytes
+	   copied, so a socket buffer can be filled without an
+	   intermediate QByteArray.
+
+	   \param data where to copy the data to
+	   \param size the most bytes to copy
+	   \param plainBytes the number of plain bytes the copied data
+	   accounts for.  These are only credited once all the pending
+	   data has been read.
+
+	   \note this is only used with TLS stream mode, and returns 0
+	   for DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int readOutgoingInto(char *data, int size, int *plainBytes = 0);
+
 	/**
 	   Determine the number of packets available to be
 	   read on the application side.
@@ -724,6 +1022,95 @@ foreach(const CertificateInfoOrdered &info, tls->issuerList())
 	*/
 	void setPacketMTU(int size) const;
 
+	/**
+	   Return the address of the peer set with setPeerAddress()
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	QByteArray peerAddress() const;
+
+	/**
+	   Set the network address of the peer
+
+	   A DTLS server that knows the address answers the first
+	   ClientHello with a cookie bound to it, and only goes on with
+	   the handshake once the client sends the cookie back.  This
+	   keeps spoofed addresses from making the server do work or
+	   send replies to a victim.  Without an address, there is no
+	   cookie exchange.
+
+	   Call this before startServer().  The address can be any bytes
+	   that identify where the packets came from, such as the IP
+	   address and port.
+
+	   \param address the peer's address
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void setPeerAddress(const QByteArray &address);
+
+	/**
+	   Queues several packets to be encrypted and sent
+
+	   This is the same as calling write() for each packet, but the
+	   packets are handed to the provider in batches, so that a whole
+	   burst is encoded in one operation.
+
+	   Packets larger than packetMTU() are dropped, rather than
+	   failing the whole batch.
+
+	   \param packets the packets to send
+
+	   \return the number of packets queued
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int writePackets(const QList<QByteArray> &packets);
+
+	/**
+	   Reads the decrypted packets that are available
+
+	   \param max the most packets to read, or -1 for all of them
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	QList<QByteArray> readPackets(int max = -1);
+
+	/**
+	   Accepts several packets from the network
+
+	   This is the same as calling writeIncoming() for each packet,
+	   but the packets are handed to the provider in batches.
+
+	   \param packets the packets received
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void writeIncomingPackets(const QList<QByteArray> &packets);
+
+	/**
+	   Reads the encrypted packets that are ready to be sent
+
+	   \param max the most packets to read, or -1 for all of them
+	   \param plainBytes the number of plain bytes the packets account
+	   for
+
+	   \note this is only used with DTLS.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	QList<QByteArray> readOutgoingPackets(int max = -1, int *plainBytes = 0);
+
 Q_SIGNALS:
 	/**
 	   Emitted if a host name is set by the client.  At
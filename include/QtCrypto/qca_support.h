@@ -45,6 +45,7 @@
 #include <QList>
 #include <QMetaObject>
 #include <QThread>
+#include <QAtomicInt>
 #include "qca_export.h"
 #include "qca_tools.h"
 
@@ -974,12 +975,58 @@ public:
 		Debug = 8        ///< Debug: debug-level messages
 	};
 
+	/**
+	   A message held by the asynchronous logger
+
+	   Records are built on the thread that logged the message and
+	   handed to AbstractLogDevice::logRecords() in batches.
+
+	   This class was introduced in %QCA 2.2.
+	*/
+	class Record
+	{
+	public:
+		/**
+		   The severity the message was logged with
+		*/
+		Severity severity;
+
+		/**
+		   True if this is a binary message, in which case blob
+		   holds the data, otherwise message holds the text
+		*/
+		bool binary;
+
+		/**
+		   The text of the message
+		*/
+		QString message;
+
+		/**
+		   The data of a binary message
+		*/
+		QByteArray blob;
+
+		/**
+		   The time the message was logged, in milliseconds since
+		   the epoch
+		*/
+		qint64 time;
+	};
+
 	/**
 	   Get the current logging level
 
+	   The level is read without locking, so this is cheap enough to
+	   call before building every message.
+
 	   \return Current level
 	*/
-	inline Severity level() const { return m_logLevel; }
+#if QT_VERSION >= 0x050000
+	inline Severity level() const { return (Severity)m_logLevel.load(); }
+#else
+	inline Severity level() const { return (Severity)(int)m_logLevel; }
+#endif
 
 	/**
 	   Set the current logging level
@@ -1029,6 +1076,60 @@ public:
 	*/
 	QStringList currentLogDevices() const;
 
+	/**
+	   Enable or disable asynchronous logging
+
+	   In asynchronous mode, logTextMessage() and logBinaryMessage()
+	   only place the message in a fixed size queue and return.  A
+	   dedicated thread takes the messages off the queue and passes
+	   them to the log devices in batches, using
+	   AbstractLogDevice::logRecords(), so the devices are called from
+	   that thread rather than the one that logged the message.
+
+	   Adding a message to the queue does not take a lock.  If the
+	   queue is full the message is dropped and counted, see
+	   droppedMessages(), so memory use is bounded by \a capacity
+	   messages no matter how fast they are logged.
+
+	   Disabling asynchronous mode delivers all queued messages before
+	   returning.
+
+	   \param enabled whether messages should be queued
+	   \param capacity the number of messages the queue holds.  This
+	   is rounded up to a power of two.
+
+	   \note Changing the capacity while other threads are logging is
+	   not safe.  Enable asynchronous mode once, early on.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void setAsynchronous(bool enabled, int capacity = 4096);
+
+	/**
+	   Test if asynchronous logging is enabled
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	bool isAsynchronous() const;
+
+	/**
+	   The number of messages dropped because the queue was full,
+	   since asynchronous mode was last enabled
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	int droppedMessages() const;
+
+	/**
+	   Wait until every message queued so far has been passed to the
+	   log devices
+
+	   This does nothing if asynchronous logging is disabled.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	void flush();
+
 private:
 	Q_DISABLE_COPY(Logger)
 
@@ -1043,7 +1144,14 @@ private:
 
 	QStringList m_loggerNames;
 	QList<AbstractLogDevice*> m_loggers;
-	Severity m_logLevel;
+
+	// level() is inline, so this keeps the offset and size the old
+	//   Severity member had
+	QAtomicInt m_logLevel;
+
+	class Private;
+	friend class Private;
+	Private *d;
 };
 
 /**
@@ -1097,6 +1205,21 @@ protected:
 
 	virtual ~AbstractLogDevice() = 0;
 
+public:
+	/**
+	   Log a batch of messages
+
+	   This is called from the logging thread when the Logger is in
+	   asynchronous mode.  The default implementation passes each
+	   record to logTextMessage() or logBinaryMessage().  Devices that
+	   do I/O can override it to write the whole batch at once.
+
+	   \param records the messages to log, oldest first
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	virtual void logRecords(const QList<Logger::Record> &records);
+
 private:
 	Q_DISABLE_COPY(AbstractLogDevice)
 
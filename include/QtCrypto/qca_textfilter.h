@@ -197,6 +197,9 @@ public:
 	*/
 	virtual MemoryRegion update(const MemoryRegion &a);
 
+	// keep the overload taking a MemoryRegionView visible
+	using TextFilter::update;
+
 	/**
 	   Complete the algorithm
 
@@ -258,6 +261,13 @@ public:
 	   If disabled, linebreaks in encoded input will cause
 	   a failure to decode.  The default is disabled.
 
+	   When decoding with line breaks enabled, any whitespace
+	   (spaces, tabs, carriage returns and line feeds) in the
+	   input is skipped, wherever it appears.  The input is
+	   decoded as it arrives, so update() can be fed data of
+	   any size, in pieces of any size, without the decoder
+	   holding on to more than a few characters between calls.
+
 	   \param b whether to enable line breaks (true) or disable line breaks (false)
 	*/
 	void setLineBreaksEnabled(bool b);
@@ -292,6 +302,9 @@ public:
 	*/
 	virtual MemoryRegion update(const MemoryRegion &a);
 
+	// keep the overload taking a MemoryRegionView visible
+	using TextFilter::update;
+
 	/**
 	   Complete the algorithm
 
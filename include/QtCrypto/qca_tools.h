@@ -36,6 +36,8 @@
 #ifndef QCA_TOOLS_H
 #define QCA_TOOLS_H
 
+#include <QByteArray>
+#include <QList>
 #include <QSharedData>
 #include <QSharedDataPointer>
 #include <QMetaType>
@@ -551,6 +553,252 @@ protected:
 */
 QCA_EXPORT const SecureArray operator+(const SecureArray &a, const SecureArray &b);
 
+/**
+   \class MemoryRegionView qca_tools.h QtCrypto
+
+   Read-only view of bytes owned by someone else
+
+   A %MemoryRegionView refers to a range of memory without copying or
+   owning it.  It can be passed to the update() functions of Hash,
+   MessageAuthenticationCode and Cipher in place of a MemoryRegion, to
+   process part of a larger buffer (for example a memory mapped file or a
+   network buffer) without an intermediate copy.
+
+   \code
+QByteArray packet = socket->readAll();
+// hash everything after the 4 byte header
+QCA::Hash hash("sha1");
+hash.update(QCA::MemoryRegionView(packet).mid(4));
+   \endcode
+
+   The memory must stay valid and unchanged while the view is in use.
+   Views are cheap to copy and should be passed by value or const
+   reference.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT MemoryRegionView
+{
+public:
+	/**
+	   Constructs an empty view
+	*/
+	MemoryRegionView() : _data(""), _size(0), _secure(false) {}
+
+	/**
+	   Constructs a view of a range of memory
+
+	   \param data pointer to the first byte
+	   \param size the number of bytes
+	   \param secure whether the memory holds sensitive data.  This is
+	   only a hint for providers that copy the data.
+	*/
+	MemoryRegionView(const char *data, int size, bool secure = false)
+		: _data(data), _size(size), _secure(secure) {}
+
+	/**
+	   Constructs a view of the contents of a byte array
+
+	   \param from the byte array to refer to
+	*/
+	explicit MemoryRegionView(const QByteArray &from);
+
+	/**
+	   Constructs a view of the contents of a memory region.  The view
+	   is secure if the region is.
+
+	   \param from the memory region to refer to
+	*/
+	explicit MemoryRegionView(const MemoryRegion &from);
+
+	/**
+	   Returns a pointer to the first byte of the view.  Unlike
+	   MemoryRegion, the data is not followed by a null terminator.
+	*/
+	const char *data() const { return _data; }
+
+	/**
+	   Same as data()
+	*/
+	const char *constData() const { return _data; }
+
+	/**
+	   Returns the number of bytes in the view
+	*/
+	int size() const { return _size; }
+
+	/**
+	   Returns true if the view has no bytes
+	*/
+	bool isEmpty() const { return _size == 0; }
+
+	/**
+	   Returns true if the view refers to sensitive data
+	*/
+	bool isSecure() const { return _secure; }
+
+	/**
+	   Returns a view of part of this view.  No data is copied.
+
+	   \param pos the offset of the first byte
+	   \param len the number of bytes, or -1 for everything after pos
+
+	   The range is clipped to this view.
+	*/
+	MemoryRegionView mid(int pos, int len = -1) const;
+
+	/**
+	   Returns a copy of the bytes in the view
+
+	   \note For secure data, this will make it insecure
+	*/
+	QByteArray toByteArray() const;
+
+private:
+	const char *_data;
+	int _size;
+	bool _secure;
+};
+
+/**
+   \class ChunkBuffer qca_tools.h QtCrypto
+
+   A queue of bytes held as a list of shared chunks
+
+   ChunkBuffer is used for stream I/O where data is appended at one end
+   and consumed from the other.  Appending a QByteArray keeps a reference
+   to it rather than copying it, and consuming the front of the queue
+   only moves an offset, so bytes are copied at most once: when they are
+   read out into the caller's memory.
+
+   \code
+QCA::ChunkBuffer buf;
+buf.append(socket->read(4096));
+buf.append(socket->read(4096));
+
+char block[1024];
+int n = buf.read(block, sizeof(block));
+   \endcode
+
+   The chunks can also be visited in place with chunk(), for example to
+   hand them to a writev() style call.
+
+   This class was introduced in %QCA 2.2.
+
+   \ingroup UserAPI
+*/
+class QCA_EXPORT ChunkBuffer
+{
+public:
+	/**
+	   Constructs an empty buffer
+	*/
+	ChunkBuffer() : _offset(0), _size(0) {}
+
+	/**
+	   Constructs a buffer holding a single chunk
+
+	   \param from the bytes to hold.  They are shared, not copied.
+	*/
+	explicit ChunkBuffer(const QByteArray &from);
+
+	/**
+	   Returns the number of bytes in the buffer
+	*/
+	int size() const { return _size; }
+
+	/**
+	   Returns true if the buffer holds no bytes
+	*/
+	bool isEmpty() const { return _size == 0; }
+
+	/**
+	   Removes all the bytes from the buffer
+	*/
+	void clear();
+
+	/**
+	   Appends bytes to the end of the buffer.  The byte array is
+	   shared, not copied, so changing it afterwards does not affect
+	   the buffer.
+
+	   \param a the bytes to append
+	*/
+	void append(const QByteArray &a);
+
+	/**
+	   Appends the contents of another buffer.  The chunks are shared,
+	   except for the unread part of a partly consumed first chunk,
+	   which is copied.
+
+	   \param b the buffer to append
+	*/
+	void append(const ChunkBuffer &b);
+
+	/**
+	   Returns the number of chunks in the buffer
+	*/
+	int chunkCount() const { return _chunks.count(); }
+
+	/**
+	   Returns a view of one chunk, in order from the front of the
+	   buffer.  The view stays valid until the chunk is consumed or
+	   the buffer is cleared.
+
+	   \param index the chunk to return, from 0 to chunkCount() - 1
+	*/
+	MemoryRegionView chunk(int index) const;
+
+	/**
+	   Copies bytes from the front of the buffer without consuming
+	   them, and returns the number of bytes copied
+
+	   \param data where to copy the bytes to
+	   \param size the most bytes to copy
+	*/
+	int peek(char *data, int size) const;
+
+	/**
+	   Copies bytes from the front of the buffer and consumes them,
+	   and returns the number of bytes copied
+
+	   \param data where to copy the bytes to
+	   \param size the most bytes to copy
+	*/
+	int read(char *data, int size);
+
+	/**
+	   Consumes bytes from the front of the buffer and returns them
+
+	   If the bytes are exactly one whole chunk, that chunk is returned
+	   without copying.
+
+	   \param size the most bytes to take, or -1 for all of them
+	*/
+	QByteArray take(int size = -1);
+
+	/**
+	   Consumes bytes from the front of the buffer without copying
+	   them
+
+	   \param size the number of bytes to drop
+	*/
+	void skip(int size);
+
+	/**
+	   Returns a copy of all the bytes in the buffer.  A buffer that
+	   holds a single whole chunk returns it without copying.
+	*/
+	QByteArray toByteArray() const;
+
+private:
+	QList<QByteArray> _chunks;
+	int _offset; // into the first chunk
+	int _size;
+};
+
 /**
    \class BigInteger qca_tools.h QtCrypto
 
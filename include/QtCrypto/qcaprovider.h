@@ -201,6 +201,34 @@ public:
 	   Return the computed hash
 	*/
 	virtual MemoryRegion final() = 0;
+
+	/**
+	   Compute the hash of each of a number of independent messages
+
+	   The default implementation resets the context and hashes each
+	   message in turn, using clear(), update() and final().  Providers can
+	   reimplement this to avoid per-message overhead, or to hash several
+	   messages at once.  The context is left in the reset state.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param regions pointer to the first message
+	   \param count the number of messages
+	*/
+	virtual QList<MemoryRegion> hashMany(const MemoryRegion *regions, int count);
+
+	/**
+	   Process a chunk of data that is not owned by a MemoryRegion
+
+	   The default implementation copies the data and calls
+	   update(const MemoryRegion &).  Providers should reimplement
+	   this to read the data in place.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param a the input data to process
+	*/
+	virtual void update(const MemoryRegionView &a);
 };
 
 /**
@@ -267,6 +295,55 @@ public:
 	   \param out pointer to an array that should store the result
 	*/
 	virtual bool final(SecureArray *out) = 0;
+
+	/**
+	   Process a chunk of data that is not owned by a SecureArray.
+	   Returns true if successful.
+
+	   The default implementation copies the data and calls
+	   update(const SecureArray &, SecureArray *).  Providers should
+	   reimplement this to read the data in place.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param in the input data to process
+	   \param out pointer to an array that should store the result
+	*/
+	virtual bool update(const MemoryRegionView &in, SecureArray *out);
+
+	/**
+	   Process a chunk of data into memory supplied by the caller.
+	   Returns the number of bytes written, or -1 on failure.
+
+	   The caller provides at least in.size() + blockSize() bytes,
+	   and out may be the same as in.data() for in-place operation.
+	   The default implementation calls
+	   update(const MemoryRegionView &, SecureArray *) and copies the
+	   result.  Providers should reimplement this to write the output
+	   directly.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param in the input data to process
+	   \param out where to write the result
+	   \param outSize the number of bytes available at out
+	*/
+	virtual int update(const MemoryRegionView &in, char *out, int outSize);
+
+	/**
+	   Finish the cipher processing into memory supplied by the
+	   caller.  Returns the number of bytes written, or -1 on failure.
+
+	   The caller provides at least blockSize() bytes.  The default
+	   implementation calls final(SecureArray *) and copies the
+	   result.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param out where to write the result
+	   \param outSize the number of bytes available at out
+	*/
+	virtual int final(char *out, int outSize);
 };
 
 /**
@@ -317,6 +394,19 @@ public:
 	*/
 	virtual void final(MemoryRegion *out) = 0;
 
+	/**
+	   Process a chunk of data that is not owned by a MemoryRegion
+
+	   The default implementation copies the data and calls
+	   update(const MemoryRegion &).  Providers should reimplement
+	   this to read the data in place.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param in the input data to process
+	*/
+	virtual void update(const MemoryRegionView &in);
+
 protected:
 	/**
 	   Returns a KeyLength that supports any length
@@ -377,6 +467,79 @@ public:
 								 unsigned int keyLength,
 								 int msecInterval,
 								 unsigned int *iterationCount) = 0;
+
+	/**
+	   Returns the size of the independent blocks that a derived key
+	   is made of, or 0 if the key can only be computed as a whole
+
+	   Keys longer than one block can be computed a part at a time,
+	   with makeKeyPart(), so that the parts can be derived in
+	   parallel.  The default implementation returns 0.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	virtual int blockSize() const;
+
+	/**
+	   Create part of a key and return it
+
+	   The result is the \a length bytes starting at \a offset of
+	   the key that makeKey() would return for a \a keyLength
+	   byte key.  \a offset is always a multiple of blockSize().
+
+	   The default implementation calls makeKey() for the whole key
+	   and returns the requested part.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param secret the secret part (typically password)
+	   \param salt the salt / initialization vector
+	   \param keyLength the length of the whole key
+	   \param iterationCount the number of iterations of the derivation algorithm
+	   \param offset the position of the part in the key
+	   \param length the length of the part
+	*/
+	virtual SymmetricKey makeKeyPart(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount, unsigned int offset, unsigned int length);
+
+	/**
+	   Returns the memory cost, in KiB, for memory-hard functions
+
+	   The default implementation returns 0.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	virtual unsigned int memoryCost() const;
+
+	/**
+	   Sets the memory cost, in KiB, for memory-hard functions
+
+	   The default implementation does nothing.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param kib the memory cost
+	*/
+	virtual void setMemoryCost(unsigned int kib);
+
+	/**
+	   Returns the number of lanes that can be computed in parallel
+
+	   The default implementation returns 1.
+
+	   This function was introduced in %QCA 2.2.
+	*/
+	virtual int parallelism() const;
+
+	/**
+	   Sets the number of lanes that can be computed in parallel
+
+	   The default implementation does nothing.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param lanes the number of lanes
+	*/
+	virtual void setParallelism(int lanes);
 };
 
 /**
@@ -2121,6 +2284,11 @@ public:
 	class SessionInfo
 	{
 	public:
+		/**
+		   Standard constructor, describing no session
+		*/
+		SessionInfo() : isCompressed(false), version(TLS::TLS_v1), cipherBits(0), cipherMaxBits(0), id(0), isResumed(false) {}
+
 		/**
 		   True if the TLS connection is compressed, otherwise false
 		*/
@@ -2154,6 +2322,13 @@ public:
 		   resuming
 		*/
 		TLSSessionContext *id;
+
+		/**
+		   True if the handshake resumed an earlier session
+
+		   This member was introduced in %QCA 2.2.
+		*/
+		bool isResumed;
 	};
 
 	/**
@@ -2441,6 +2616,78 @@ public:
 	*/
 	virtual QByteArray unprocessed() = 0;
 
+	/**
+	   Same as update(), but the network data is given as a list of
+	   chunks, which the provider may read in place instead of copying
+	   them into its own buffer first.  TLS uses this in stream mode.
+
+	   The default implementation joins the chunks and calls update().
+
+	   \param from_net the data from the "other side" of the connection
+	   \param from_app the data from the application of the protocol
+	*/
+	virtual void updateChunks(const ChunkBuffer &from_net, const QByteArray &from_app);
+
+	/**
+	   Same as to_net(), but returns the data in the chunks it was
+	   produced in, for example one per TLS record, so that it does not
+	   need to be joined.  TLS uses this in stream mode.
+
+	   The default implementation returns to_net() as a single chunk.
+	*/
+	virtual ChunkBuffer to_netChunks();
+
+	/**
+	   Returns the most packets of each kind that updatePackets() takes
+	   at once.  TLS uses this in datagram mode.
+
+	   The default implementation returns 1.
+	*/
+	virtual int packetBatchSize() const;
+
+	/**
+	   Same as update(), but for DTLS, with any number of packets up to
+	   packetBatchSize() in each direction.  Every application packet
+	   given is encoded before the results are ready, and the results are
+	   read with to_netPackets() and to_appPackets().  TLS uses this in
+	   datagram mode.
+
+	   The default implementation calls update() with the first packet
+	   of each list.
+
+	   \param from_net the packets from the "other side" of the connection
+	   \param from_app the packets from the application of the protocol
+	*/
+	virtual void updatePackets(const QList<QByteArray> &from_net, const QList<QByteArray> &from_app);
+
+	/**
+	   Same as to_net(), but for DTLS, with one entry per packet.
+
+	   The default implementation returns to_net() as a single packet.
+	*/
+	virtual QList<QByteArray> to_netPackets();
+
+	/**
+	   Same as to_app(), but for DTLS, with one entry per packet.
+
+	   The default implementation returns to_app() as a single packet.
+	*/
+	virtual QList<QByteArray> to_appPackets();
+
+	/**
+	   Set the network address of the peer, for DTLS servers.  When it
+	   is known, a server should only go on with a handshake once the
+	   client has proven it can receive at this address, with a cookie
+	   exchange.
+
+	   The default implementation does nothing.
+
+	   This function was introduced in %QCA 2.2.
+
+	   \param address the peer's address, or empty if unknown
+	*/
+	virtual void setPeerAddress(const QByteArray &address);
+
 Q_SIGNALS:
 	/**
 	   Emit this when a start() or update() operation has completed.
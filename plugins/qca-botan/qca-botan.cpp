@@ -33,6 +33,7 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 //-----------------------------------------------------------
@@ -104,6 +105,20 @@ public:
 	return a;
     }
 
+    QList<QCA::MemoryRegion> hashMany(const QCA::MemoryRegion *regions, int count)
+    {
+	// final() already resets the hash object, so no clear() is needed
+	//   between messages
+	QList<QCA::MemoryRegion> out;
+	m_hashObj->clear();
+	for(int n = 0; n < count; ++n)
+	{
+	    m_hashObj->update( (const Botan::byte*)regions[n].data(), regions[n].size() );
+	    out += final();
+	}
+	return out;
+    }
+
 private:
     Botan::HashFunction *m_hashObj;
 };
@@ -181,6 +196,7 @@ class BotanPBKDFContext: public QCA::KDFContext
 public:
     BotanPBKDFContext( const QString &kdfName, QCA::Provider *p, const QString &type) : QCA::KDFContext(p, type)
     {
+	m_kdfName = kdfName;
 	m_s2k = Botan::get_s2k(kdfName.toStdString());
     }
 
@@ -191,7 +207,8 @@ public:
 
     Context *clone() const
     {
-	return new BotanPBKDFContext( *this );
+	// each context needs its own S2K object
+	return new BotanPBKDFContext( m_kdfName, provider(), type() );
     }
 
     QCA::SymmetricKey makeKey(const QCA::SecureArray &secret, const QCA::InitializationVector &salt,
@@ -244,7 +261,86 @@ public:
 		return makeKey(secret, salt, keyLength, *iterationCount);
 	}
 
+    int blockSize() const
+    {
+	// only PBKDF2 keys are made of independent blocks
+	if (!m_kdfName.startsWith("PBKDF2("))
+	    return 0;
+	Botan::HMAC hmac(makeHash());
+#if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(1,9,0)
+	return hmac.OUTPUT_LENGTH;
+#else
+	return hmac.output_length();
+#endif
+    }
+
+    QCA::SymmetricKey makeKeyPart(const QCA::SecureArray &secret, const QCA::InitializationVector &salt,
+				  unsigned int keyLength, unsigned int iterationCount,
+				  unsigned int offset, unsigned int length)
+    {
+	if (!m_kdfName.startsWith("PBKDF2("))
+	    return QCA::KDFContext::makeKeyPart(secret, salt, keyLength, iterationCount, offset, length);
+
+	Botan::HMAC hmac(makeHash());
+#if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(1,9,0)
+	unsigned int hlen = hmac.OUTPUT_LENGTH;
+#else
+	unsigned int hlen = hmac.output_length();
+#endif
+	hmac.set_key( (const Botan::byte *)secret.data(), secret.size() );
+
+	QCA::SecureArray out(length);
+	QCA::SecureArray u(hlen), t(hlen);
+	Botan::byte *up = (Botan::byte *)u.data();
+	Botan::byte *tp = (Botan::byte *)t.data();
+	unsigned int at = 0;
+	for (unsigned int block = offset / hlen + 1; at < length; ++block) {
+	    Botan::byte index[4];
+	    index[0] = (block >> 24) & 0xff;
+	    index[1] = (block >> 16) & 0xff;
+	    index[2] = (block >> 8) & 0xff;
+	    index[3] = block & 0xff;
+
+	    // final() leaves the key in place for the next message
+	    hmac.update( (const Botan::byte *)salt.data(), salt.size() );
+	    hmac.update( index, 4 );
+	    hmac.final( up );
+	    memcpy( tp, up, hlen );
+	    for (unsigned int n = 1; n < iterationCount; ++n) {
+		hmac.update( up, hlen );
+		hmac.final( up );
+		for (unsigned int k = 0; k < hlen; ++k)
+		    tp[k] ^= up[k];
+	    }
+
+	    unsigned int take = qMin(length - at, hlen);
+	    memcpy( out.data() + at, tp, take );
+	    at += take;
+	}
+	return out;
+    }
+
 protected:
+    // the hash named inside "PBKDF2(...)"
+#if BOTAN_VERSION_CODE < BOTAN_VERSION_CODE_FOR(1,8,0)
+    std::string makeHash() const
+    {
+	return hashName().toStdString();
+    }
+#else
+    Botan::HashFunction *makeHash() const
+    {
+	return Botan::global_state().algorithm_factory().make_hash_function(hashName().toStdString());
+    }
+#endif
+
+    QString hashName() const
+    {
+	int start = m_kdfName.indexOf('(') + 1;
+	return m_kdfName.mid(start, m_kdfName.lastIndexOf(')') - start);
+    }
+
+    QString m_kdfName;
     Botan::S2K* m_s2k;
 };
 
@@ -324,6 +420,16 @@ public:
         return true;
     }
 
+    int update(const QCA::MemoryRegionView &in, char *out, int outSize)
+    {
+	if (outSize < in.size() + blockSize())
+	    return -1;
+	m_crypter->write((const Botan::byte*)in.data(), in.size());
+	if (m_crypter->remaining() > (size_t)outSize)
+	    return -1;
+	return (int)m_crypter->read((Botan::byte*)out, m_crypter->remaining());
+    }
+
     bool final(QCA::SecureArray *out)
     {
 	m_crypter->end_msg();
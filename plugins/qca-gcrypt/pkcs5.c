@@ -45,9 +45,16 @@
  *  Output:         DK         derived key, a dkLen-octet string
  */
 
+/*
+ * gcry_pbkdf2_part computes dkLen octets of the derived key, starting
+ * with block T_(first + 1), so that the blocks of one key can be
+ * computed separately.
+ */
+
 gcry_error_t
-gcry_pbkdf2 (int PRF, const char *P, size_t Plen, const char *S,
-	     size_t Slen, unsigned int c, unsigned int dkLen, char *DK)
+gcry_pbkdf2_part (int PRF, const char *P, size_t Plen, const char *S,
+		  size_t Slen, unsigned int c, unsigned int first,
+		  unsigned int dkLen, char *DK)
 {
   gcry_md_hd_t prf;
   gcry_error_t rc;
@@ -166,10 +173,10 @@ gcry_pbkdf2 (int PRF, const char *P, size_t Plen, const char *S,
            {
              char tmp[4];
              gcry_md_write (prf, S, Slen);
-             tmp[0] = (i & 0xff000000) >> 24;
-             tmp[1] = (i & 0x00ff0000) >> 16;
-             tmp[2] = (i & 0x0000ff00) >> 8;
-             tmp[3] = (i & 0x000000ff) >> 0;
+             tmp[0] = ((first + i) & 0xff000000) >> 24;
+             tmp[1] = ((first + i) & 0x00ff0000) >> 16;
+             tmp[2] = ((first + i) & 0x0000ff00) >> 8;
+             tmp[3] = ((first + i) & 0x000000ff) >> 0;
              gcry_md_write (prf, tmp, 4);
            }
          else
@@ -195,3 +202,9 @@ gcry_pbkdf2 (int PRF, const char *P, size_t Plen, const char *S,
   return rc;
 }
 
+gcry_error_t
+gcry_pbkdf2 (int PRF, const char *P, size_t Plen, const char *S,
+	     size_t Slen, unsigned int c, unsigned int dkLen, char *DK)
+{
+  return gcry_pbkdf2_part (PRF, P, Plen, S, Slen, c, 0, dkLen, DK);
+}
@@ -85,6 +85,22 @@ public:
 	return a;
     }
 
+    QList<QCA::MemoryRegion> hashMany(const QCA::MemoryRegion *regions, int count)
+    {
+	QList<QCA::MemoryRegion> out;
+	int size = gcry_md_get_algo_dlen( m_hashAlgorithm );
+	for(int n = 0; n < count; ++n)
+	{
+	    QCA::SecureArray a( size );
+	    gcry_md_reset( context );
+	    gcry_md_write( context, regions[n].data(), regions[n].size() );
+	    memcpy( a.data(), gcry_md_read( context, m_hashAlgorithm ), size );
+	    out += a;
+	}
+	gcry_md_reset( context );
+	return out;
+    }
+
 protected:
     gcry_md_hd_t context;
     gcry_error_t err;
@@ -217,6 +233,19 @@ public:
 	return true;
     }
 
+    int update(const QCA::MemoryRegionView &in, char *out, int outSize)
+    {
+	if ( outSize < in.size() )
+	    return -1;
+	if (QCA::Encode == m_direction) {
+	    err = gcry_cipher_encrypt( context, (unsigned char*)out, outSize, (const unsigned char*)in.data(), in.size() );
+	} else {
+	    err = gcry_cipher_decrypt( context, (unsigned char*)out, outSize, (const unsigned char*)in.data(), in.size() );
+	}
+	check_error( "update cipher encrypt/decrypt", err );
+	return in.size();
+    }
+
     bool final(QCA::SecureArray *out)
     {
         QCA::SecureArray result;
@@ -469,6 +498,26 @@ public:
 		return makeKey(secret, salt, keyLength, *iterationCount);
 	}
 
+    int blockSize() const
+    {
+	return gcry_md_get_algo_dlen(m_algorithm);
+    }
+
+    QCA::SymmetricKey makeKeyPart(const QCA::SecureArray &secret, const QCA::InitializationVector &salt,
+				  unsigned int keyLength, unsigned int iterationCount,
+				  unsigned int offset, unsigned int length)
+    {
+	Q_UNUSED(keyLength);
+	QCA::SymmetricKey result(length);
+	gcry_error_t retval = gcry_pbkdf2_part(m_algorithm, secret.data(), secret.size(),
+					       salt.data(), salt.size(), iterationCount,
+					       offset / blockSize(), length, result.data());
+	if (retval == GPG_ERR_NO_ERROR)
+	    return result;
+	else
+	    return QCA::SymmetricKey();
+    }
+
 protected:
     int m_algorithm;
 };
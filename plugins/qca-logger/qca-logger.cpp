@@ -39,6 +39,7 @@ public:
 
 	~StreamLogger()
 	{
+		QCA::logger()->flush ();
 		QCA::logger()->unregisterLogDevice (name ());
 	}
 
@@ -53,6 +54,23 @@ public:
 		_stream << now () << " " << severityName (severity) << " " << "Binary blob not implemented yet" << endl;
 	}
 
+	// in asynchronous mode the file is written once per batch rather
+	//   than once per message
+	void logRecords( const QList<QCA::Logger::Record> &records )
+	{
+		for (int i = 0; i < records.size (); ++i) {
+			const QCA::Logger::Record &r = records[i];
+			_stream << QDateTime::fromMSecsSinceEpoch (r.time).toString (s_format) << " " << severityName (r.severity) << " ";
+			if (r.binary) {
+				_stream << "Binary blob not implemented yet" << '\n';
+			}
+			else {
+				_stream << r.message << '\n';
+			}
+		}
+		_stream.flush ();
+	}
+
 private:
 	inline const char *severityName( enum QCA::Logger::Severity severity )
 	{
@@ -65,12 +83,12 @@ private:
 	}
 
 	inline QString now() {
-		static QString format = "yyyy-MM-dd hh:mm:ss";
-		return QDateTime::currentDateTime ().toString (format);
+		return QDateTime::currentDateTime ().toString (s_format);
 	}
 
 private:
 	static const char *s_severityNames[];
+	static const QString s_format;
 	QTextStream &_stream;
 };
 
@@ -87,6 +105,8 @@ const char *StreamLogger::s_severityNames[] = {
 	"U"
 };
 
+const QString StreamLogger::s_format = "yyyy-MM-dd hh:mm:ss";
+
 }
 
 using namespace loggerQCAPlugin;
@@ -106,13 +126,15 @@ public:
 
 		QByteArray level = qgetenv ("QCALOGGER_LEVEL");
 		QByteArray file = qgetenv ("QCALOGGER_FILE");
+		QByteArray async = qgetenv ("QCALOGGER_ASYNC");
 
 		if (!level.isEmpty ()) {
 			printf ("XXXX %s %s\n", level.data (), file.data ());
 			_externalConfig = true;
 			createLogger (
 				atoi (level),
-				file.isEmpty () ? QString() : QString::fromUtf8 (file)
+				file.isEmpty () ? QString() : QString::fromUtf8 (file),
+				atoi (async) != 0
 			);
 		}
 	}
@@ -165,6 +187,7 @@ public:
 		mytemplate["enabled"] = false;
 		mytemplate["file"] = "";
 		mytemplate["level"] = (int)Logger::Quiet;
+		mytemplate["async"] = false;
 
 		return mytemplate;
 	}
@@ -179,7 +202,8 @@ public:
 			if (config["enabled"].toBool ()) {
 				createLogger (
 					config["level"].toInt (),
-					config["file"].toString ()
+					config["file"].toString (),
+					config["async"].toBool ()
 				);
 			}
 		}
@@ -189,7 +213,8 @@ private:
 	void
 	createLogger (
 		const int level,
-		const QString &file
+		const QString &file,
+		const bool async
 	) {
 		bool success = false;
 		if (file.isEmpty ()) {
@@ -204,6 +229,9 @@ private:
 			_logStream.setDevice (&_logFile);
 			logger ()->setLevel ((Logger::Severity)level);
 			_streamLogger = new StreamLogger (_logStream);
+			if (async && !logger ()->isAsynchronous ()) {
+				logger ()->setAsynchronous (true);
+			}
 		}
 	}
 };
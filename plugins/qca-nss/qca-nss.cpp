@@ -386,6 +386,20 @@ public:
 	    return true;
 	}
 
+    int update( const QCA::MemoryRegionView &in, char *out, int outSize )
+	{
+	    if (outSize < in.size()+blockSize())
+		return -1;
+
+	    int resultLength;
+	    if (SECSuccess != PK11_CipherOp(m_context, (unsigned char*)out,
+					   &resultLength, outSize,
+					   (unsigned char*)in.data(), in.size()))
+		return -1;
+
+	    return resultLength;
+	}
+
     bool final( QCA::SecureArray *out )
 	{
 	    out->resize(blockSize());
@@ -22,7 +22,14 @@
 #include <QtCrypto>
 #include <qcaprovider.h>
 #include <QDebug>
+#include <QHash>
+#include <QMutex>
+#include <QRunnable>
+#include <QThread>
+#include <QThreadPool>
 #include <QTime>
+#include <QTimer>
+#include <QWaitCondition>
 #include <QtPlugin>
 
 #include <openssl/evp.h>
@@ -30,6 +37,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <iostream>
 
 #include <openssl/rand.h>
@@ -1024,6 +1032,11 @@ public:
 		EVP_DigestUpdate( &m_context, (unsigned char*)a.data(), a.size() );
 	}
 
+	void update(const MemoryRegionView &a)
+	{
+		EVP_DigestUpdate( &m_context, (const unsigned char*)a.data(), a.size() );
+	}
+
 	MemoryRegion final()
 	{
 		SecureArray a( EVP_MD_size( m_algorithm ) );
@@ -1031,6 +1044,24 @@ public:
 		return a;
 	}
 
+	QList<MemoryRegion> hashMany(const MemoryRegion *regions, int count)
+	{
+		// reinitialize the same context for each message, instead of
+		//   cleaning it up and setting it up again
+		QList<MemoryRegion> out;
+		int size = EVP_MD_size( m_algorithm );
+		for(int n = 0; n < count; ++n)
+		{
+			SecureArray a( size );
+			EVP_DigestInit_ex( &m_context, m_algorithm, 0 );
+			EVP_DigestUpdate( &m_context, (unsigned char*)regions[n].data(), regions[n].size() );
+			EVP_DigestFinal_ex( &m_context, (unsigned char*)a.data(), 0 );
+			out += a;
+		}
+		EVP_DigestInit_ex( &m_context, m_algorithm, 0 );
+		return out;
+	}
+
 	Provider::Context *clone() const
 	{
 		return new opensslHashContext(*this);
@@ -1167,6 +1198,55 @@ protected:
 	EVP_MD_CTX m_context;
 };
 
+// compute the PBKDF2 blocks covering length bytes of the derived key,
+//   starting at offset, which must be a multiple of the digest size
+static void pbkdf2_hmac_part(const EVP_MD *md, const SecureArray &secret, const InitializationVector &salt,
+							 unsigned int iterationCount, unsigned int offset, unsigned int length, unsigned char *out)
+{
+	unsigned int hlen = EVP_MD_size(md);
+	unsigned char u[EVP_MAX_MD_SIZE];
+	unsigned char t[EVP_MAX_MD_SIZE];
+	HMAC_CTX hctx;
+
+	// the key is only processed once.  after that, HMAC_Init_ex() with no
+	//   key just restores the keyed state.
+	HMAC_CTX_init(&hctx);
+	HMAC_Init_ex(&hctx, secret.data(), secret.size(), md, 0);
+
+	for(unsigned int block = offset / hlen + 1; length > 0; ++block)
+	{
+		unsigned char index[4];
+		index[0] = (block >> 24) & 0xff;
+		index[1] = (block >> 16) & 0xff;
+		index[2] = (block >> 8) & 0xff;
+		index[3] = block & 0xff;
+
+		HMAC_Init_ex(&hctx, 0, 0, 0, 0);
+		HMAC_Update(&hctx, (const unsigned char *)salt.data(), salt.size());
+		HMAC_Update(&hctx, index, 4);
+		HMAC_Final(&hctx, u, 0);
+		memcpy(t, u, hlen);
+
+		for(unsigned int n = 1; n < iterationCount; ++n)
+		{
+			HMAC_Init_ex(&hctx, 0, 0, 0, 0);
+			HMAC_Update(&hctx, u, hlen);
+			HMAC_Final(&hctx, u, 0);
+			for(unsigned int k = 0; k < hlen; ++k)
+				t[k] ^= u[k];
+		}
+
+		unsigned int take = qMin(length, hlen);
+		memcpy(out, t, take);
+		out += take;
+		length -= take;
+	}
+
+	HMAC_CTX_cleanup(&hctx);
+	OPENSSL_cleanse(u, sizeof(u));
+	OPENSSL_cleanse(t, sizeof(t));
+}
+
 class opensslPbkdf2Context : public KDFContext
 {
 public:
@@ -1223,6 +1303,21 @@ public:
 		return out;
 	}
 
+	int blockSize() const
+	{
+		return EVP_MD_size(EVP_sha1());
+	}
+
+	SymmetricKey makeKeyPart(const SecureArray &secret, const InitializationVector &salt,
+							 unsigned int keyLength, unsigned int iterationCount,
+							 unsigned int offset, unsigned int length)
+	{
+		Q_UNUSED(keyLength);
+		SecureArray out(length);
+		pbkdf2_hmac_part(EVP_sha1(), secret, salt, iterationCount, offset, length, (unsigned char*)out.data());
+		return out;
+	}
+
 protected:
 };
 
@@ -1250,6 +1345,11 @@ public:
 		HMAC_Update( &m_context, (unsigned char *)a.data(), a.size() );
 	}
 
+	void update(const MemoryRegionView &a)
+	{
+		HMAC_Update( &m_context, (const unsigned char *)a.data(), a.size() );
+	}
+
 	void final(MemoryRegion *out)
 	{
 		SecureArray sa( EVP_MD_size( m_algorithm ), 0 );
@@ -5304,204 +5404,1014 @@ static QString cipherIDtoString( const TLS::Version &version, const unsigned lon
 
 // TODO: test to ensure there is no cert-test lag
 static bool ssl_init = false;
-class MyTLSContext : public TLSContext
+
+//----------------------------------------------------------------------------
+// SSL_CTX cache
+//----------------------------------------------------------------------------
+// building the X509_STORE of an SSL_CTX from a large trusted collection
+//   costs much more than the rest of setting up a connection, so contexts
+//   are shared between sessions that use the same method and trusted
+//   certificates.  the certificate and key to send are set on each SSL
+//   rather than on the SSL_CTX.  however, a server context also holds the
+//   session cache and ticket keys, so when servers cache sessions the
+//   local identity is part of the key.  otherwise a client could resume a
+//   session made with one identity against another, skipping the full
+//   handshake and its client certificate check.
+//
+// without locking callbacks, openssl must not use an SSL_CTX from more
+//   than one thread, so in that case each thread gets its own contexts.
+class SslCtxCache
 {
 public:
-	enum { Good, TryAgain, Bad };
-	enum { Idle, Connect, Accept, Handshake, Active, Closing };
-
-	bool serv; // true if we are acting as a server
-	int mode;
-	QByteArray sendQueue;
-	QByteArray recvQueue;
-
-	CertificateCollection trusted;
-	Certificate cert, peercert; // TODO: support cert chains
-	PrivateKey key;
-	QString targetHostName;
+	class Item
+	{
+	public:
+		SSL_CTX *context;
+		int refs;
+		quint64 lastUsed;
 
-	Result result_result;
-	QByteArray result_to_net;
-	int result_encoded;
-	QByteArray result_plain;
+		// made with settings that have changed since
+		bool stale;
 
-	SSL *ssl;
-#if OPENSSL_VERSION_NUMBER >= 0x00909000L
-	const SSL_METHOD *method;
-#else
-	SSL_METHOD *method;
-#endif
-	SSL_CTX *context;
-	BIO *rbio, *wbio;
-	Validity vr;
-	bool v_eof;
+		// these keep the certificates alive, so that their X509
+		//   pointers in the key can't be reused by other certificates
+		QList<Certificate> certs;
+		QList<CRL> crls;
+	};
 
-	MyTLSContext(Provider *p) : TLSContext(p, "tls")
-	{
-		if(!ssl_init)
-		{
-			SSL_library_init();
-			SSL_load_error_strings();
-			ssl_init = true;
-		}
+	enum { MaxUnused = 8 };
 
-		ssl = 0;
-		context = 0;
-		reset();
-	}
+	QMutex m;
+	bool enabled;
+	int sessionCacheSize;
+	int sessionTimeout;
+	quint64 useCounter;
+	QHash<QByteArray, Item*> items;
+	QHash<SSL_CTX*, QByteArray> keys;
 
-	~MyTLSContext()
+	SslCtxCache() : enabled(true), sessionCacheSize(1024), sessionTimeout(300), useCounter(0)
 	{
-		reset();
 	}
 
-	virtual Provider::Context *clone() const
+	~SslCtxCache()
 	{
-		return 0;
+		foreach(Item *i, items)
+		{
+			SSL_CTX_free(i->context);
+			delete i;
+		}
 	}
 
-	virtual void reset()
+	// drop unused contexts, keeping at most max of them
+	void trim(int max)
 	{
-		if(ssl)
+		QList<Item*> unused;
+		foreach(Item *i, items)
 		{
-			SSL_free(ssl);
-			ssl = 0;
+			if(i->refs == 0)
+				unused += i;
 		}
-		if(context)
+
+		while(unused.count() > max)
 		{
-			SSL_CTX_free(context);
-			context = 0;
+			int oldest = 0;
+			for(int n = 1; n < unused.count(); ++n)
+			{
+				if(unused[n]->lastUsed < unused[oldest]->lastUsed)
+					oldest = n;
+			}
+
+			Item *i = unused.takeAt(oldest);
+			items.remove(keys.take(i->context));
+			SSL_CTX_free(i->context);
+			delete i;
 		}
+	}
+};
 
-		cert = Certificate();
-		key = PrivateKey();
+Q_GLOBAL_STATIC(SslCtxCache, g_sslCtxCache)
 
-		sendQueue.resize(0);
-		recvQueue.resize(0);
-		mode = Idle;
-		peercert = Certificate();
-		vr = ErrorValidityUnknown;
-		v_eof = false;
-	}
+static void append_pointer(QByteArray *out, const void *p)
+{
+	out->append((const char *)&p, sizeof(p));
+}
 
-	// dummy verification function for SSL_set_verify()
-	static int ssl_verify_callback(int preverify_ok, X509_STORE_CTX *x509_ctx)
-	{
-		Q_UNUSED(preverify_ok);
-		Q_UNUSED(x509_ctx);
+#if OPENSSL_VERSION_NUMBER >= 0x00909000L
+static bool ssl_method_is_server(const SSL_METHOD *method)
+#else
+static bool ssl_method_is_server(SSL_METHOD *method)
+#endif
+{
+	return (method == SSLv23_server_method() || method == DTLSv1_server_method());
+}
 
-		// don't terminate handshake in case of verification failure
-		return 1;
-	}
+// identifies the certificate a server presents.  the digest is no longer
+//   than SSL_MAX_SID_CTX_LENGTH, so it can be the session id context too.
+static QByteArray ssl_local_identity(const Certificate &cert)
+{
+	if(cert.isNull())
+		return QByteArray();
 
-	virtual QStringList supportedCipherSuites(const TLS::Version &version) const
+	QByteArray der = cert.toDER();
+	unsigned char md[EVP_MAX_MD_SIZE];
+	unsigned int len = 0;
+	if(!EVP_Digest((unsigned char *)der.data(), der.size(), md, &len, EVP_sha256(), NULL))
+		return QByteArray();
+	return QByteArray((const char *)md, qMin((int)len, SSL_MAX_SID_CTX_LENGTH));
+}
+
+// DTLS servers that are told the peer's address answer a first
+//   ClientHello with a HelloVerifyRequest, and only go on with a client
+//   that returns the cookie, proving that it can receive at that address.
+//   the cookie is an HMAC over the address and the client random, which a
+//   client must repeat, keyed with a secret made once per process.  the
+//   SSL's app data points to the address.
+class DtlsCookieSecret
+{
+public:
+	unsigned char key[32];
+	bool ok;
+
+	DtlsCookieSecret()
 	{
-		OpenSSL_add_ssl_algorithms();
-		SSL_CTX *ctx = 0;
-		switch (version) {
-#ifndef OPENSSL_NO_SSL2
-		case TLS::SSL_v2:
-			ctx = SSL_CTX_new(SSLv2_client_method());
-			break;
-#endif
-#ifndef OPENSSL_NO_SSL3_METHOD
-		case TLS::SSL_v3:
-			ctx = SSL_CTX_new(SSLv3_client_method());
-			break;
+		ok = (RAND_bytes(key, sizeof(key)) == 1);
+	}
+};
+
+Q_GLOBAL_STATIC(DtlsCookieSecret, g_dtlsCookieSecret)
+
+static bool dtls_make_cookie(SSL *ssl, unsigned char *cookie, unsigned int *len)
+{
+	DtlsCookieSecret *secret = g_dtlsCookieSecret();
+	const QByteArray *peer = (const QByteArray *)SSL_get_app_data(ssl);
+	if(!secret || !secret->ok || !peer || peer->isEmpty())
+		return false;
+
+	unsigned char random[SSL3_RANDOM_SIZE];
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	SSL_get_client_random(ssl, random, sizeof(random));
+#else
+	memcpy(random, ssl->s3->client_random, sizeof(random));
 #endif
-		case TLS::TLS_v1:
-			ctx = SSL_CTX_new(TLSv1_client_method());
-			break;
-		case TLS::DTLS_v1:
-		default:
-			/* should not happen - should be in a "dtls" provider*/
-			qWarning("Unexpected enum in cipherSuites");
-			ctx = 0;
-		}
-		if (NULL == ctx)
-			return QStringList();
 
-		SSL *ssl = SSL_new(ctx);
-		if (NULL == ssl) {
-			SSL_CTX_free(ctx);
-			return QStringList();
-		}
+	// the address comes last, since it varies in length
+	QByteArray input((const char *)random, sizeof(random));
+	input += *peer;
 
-		STACK_OF(SSL_CIPHER) *sk = SSL_get_ciphers(ssl);
-		QStringList cipherList;
-		for(int i = 0; i < sk_SSL_CIPHER_num(sk); ++i) {
-			SSL_CIPHER *thisCipher = sk_SSL_CIPHER_value(sk, i);
-			cipherList += cipherIDtoString(version, thisCipher->id);
-		}
+	// a sha256 is exactly as long as the largest cookie DTLS 1.0 allows
+	return HMAC(EVP_sha256(), secret->key, sizeof(secret->key), (const unsigned char *)input.constData(), input.size(), cookie, len) != 0;
+}
 
-		SSL_free(ssl);
-		SSL_CTX_free(ctx);
+static int dtls_generate_cookie_callback(SSL *ssl, unsigned char *cookie, unsigned int *len)
+{
+	return dtls_make_cookie(ssl, cookie, len) ? 1 : 0;
+}
 
-		return cipherList;
-	}
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static int dtls_verify_cookie_callback(SSL *ssl, const unsigned char *cookie, unsigned int len)
+#else
+static int dtls_verify_cookie_callback(SSL *ssl, unsigned char *cookie, unsigned int len)
+#endif
+{
+	unsigned char expected[EVP_MAX_MD_SIZE];
+	unsigned int expectedLen = 0;
+	if(!dtls_make_cookie(ssl, expected, &expectedLen) || len != expectedLen)
+		return 0;
 
-	virtual bool canCompress() const
+	// compare in constant time
+	unsigned char diff = 0;
+	for(unsigned int n = 0; n < len; ++n)
+		diff |= cookie[n] ^ expected[n];
+	return diff == 0 ? 1 : 0;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x00909000L
+static QByteArray ssl_ctx_key(const SSL_METHOD *method, const QList<Certificate> &certs, const QList<CRL> &crls, const QByteArray &identity, int sessionCacheSize, int sessionTimeout)
+#else
+static QByteArray ssl_ctx_key(SSL_METHOD *method, const QList<Certificate> &certs, const QList<CRL> &crls, const QByteArray &identity, int sessionCacheSize, int sessionTimeout)
+#endif
+{
+	QByteArray key;
+	append_pointer(&key, method);
+
+	// contexts made with other session cache settings never match, so
+	//   that new sessions pick up a change even while the old contexts
+	//   are still in use
+	key.append((const char *)&sessionCacheSize, sizeof(sessionCacheSize));
+	key.append((const char *)&sessionTimeout, sizeof(sessionTimeout));
+	append_pointer(&key, CRYPTO_get_locking_callback() ? 0 : QThread::currentThread());
+	append_pointer(&key, 0);
+	foreach(const Certificate &cert, certs)
+		append_pointer(&key, cert.context());
+	append_pointer(&key, 0);
+	foreach(const CRL &crl, crls)
+		append_pointer(&key, crl.context());
+	append_pointer(&key, 0);
+	key += identity;
+	return key;
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x00909000L
+static SSL_CTX *ssl_ctx_create(const SSL_METHOD *method, const QList<Certificate> &cert_list, const QList<CRL> &crl_list, const QByteArray &identity, int sessionCacheSize, int sessionTimeout)
+#else
+static SSL_CTX *ssl_ctx_create(SSL_METHOD *method, const QList<Certificate> &cert_list, const QList<CRL> &crl_list, const QByteArray &identity, int sessionCacheSize, int sessionTimeout)
+#endif
+{
+	SSL_CTX *context = SSL_CTX_new(method);
+	if(!context)
+		return 0;
+
+	// the cookie exchange itself is turned on per SSL, when the peer's
+	//   address is known
+	if(method == DTLSv1_server_method())
 	{
-		// TODO
-		return false;
+		SSL_CTX_set_cookie_generate_cb(context, dtls_generate_cookie_callback);
+		SSL_CTX_set_cookie_verify_cb(context, dtls_verify_cookie_callback);
 	}
 
-	virtual bool canSetHostName() const
+	bool server = ssl_method_is_server(method);
+	if(server && sessionCacheSize > 0)
 	{
-		// TODO
-		return false;
+		// servers resume sessions of earlier connections that used the
+		//   same context, by session id or by ticket.  sessions are bound
+		//   to the identity they were made with.
+		SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+		SSL_CTX_sess_set_cache_size(context, sessionCacheSize);
+		SSL_CTX_set_timeout(context, sessionTimeout);
+		if(!identity.isEmpty())
+			SSL_CTX_set_session_id_context(context, (const unsigned char *)identity.data(), identity.size());
+		else
+			SSL_CTX_set_session_id_context(context, (const unsigned char *)"qca-ossl", 8);
 	}
-
-	virtual int maxSSF() const
+	else
 	{
-		// TODO
-		return 256;
+		// clients only resume the sessions given to them with
+		//   setSessionId()
+		SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_OFF);
+#ifdef SSL_OP_NO_TICKET
+		if(server)
+			SSL_CTX_set_options(context, SSL_OP_NO_TICKET);
+#endif
 	}
 
-	virtual void setConstraints(int minSSF, int maxSSF)
+	// setup the cert store
+	X509_STORE *store = SSL_CTX_get_cert_store(context);
+	int n;
+	for(n = 0; n < cert_list.count(); ++n)
 	{
-		// TODO
-		Q_UNUSED(minSSF);
-		Q_UNUSED(maxSSF);
+		const MyCertContext *cc = static_cast<const MyCertContext *>(cert_list[n].context());
+		X509 *x = cc->item.cert;
+		//CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509);
+		X509_STORE_add_cert(store, x);
 	}
-
-	virtual void setConstraints(const QStringList &cipherSuiteList)
+	for(n = 0; n < crl_list.count(); ++n)
 	{
-		// TODO
-		Q_UNUSED(cipherSuiteList);
+		const MyCRLContext *cc = static_cast<const MyCRLContext *>(crl_list[n].context());
+		X509_CRL *x = cc->item.crl;
+		//CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509_CRL);
+		X509_STORE_add_crl(store, x);
 	}
 
-	virtual void setup(bool serverMode, const QString &hostName, bool compress)
+	return context;
+}
+
+// returns a context for the given method and trusted collection, which
+//   must be given back with ssl_ctx_release().  servers also pass the
+//   certificate they present, which is null for clients.
+#if OPENSSL_VERSION_NUMBER >= 0x00909000L
+static SSL_CTX *ssl_ctx_acquire(const SSL_METHOD *method, const CertificateCollection &trusted, const Certificate &local)
+#else
+static SSL_CTX *ssl_ctx_acquire(SSL_METHOD *method, const CertificateCollection &trusted, const Certificate &local)
+#endif
+{
+	QList<Certificate> cert_list = trusted.certificates();
+	QList<CRL> crl_list = trusted.crls();
+
+	QByteArray identity;
+	if(ssl_method_is_server(method))
+		identity = ssl_local_identity(local);
+
+	SslCtxCache *cache = g_sslCtxCache();
+	QByteArray key;
+	int sessionCacheSize, sessionTimeout;
 	{
-		serv = serverMode;
-		if ( false == serverMode ) {
-			// client
-			targetHostName = hostName;
+		QMutexLocker locker(&cache->m);
+		sessionCacheSize = cache->sessionCacheSize;
+		sessionTimeout = cache->sessionTimeout;
+		if(!cache->enabled)
+			return ssl_ctx_create(method, cert_list, crl_list, identity, sessionCacheSize, sessionTimeout);
+
+		// without a session cache, server contexts carry nothing that
+		//   depends on the identity and may be shared
+		key = ssl_ctx_key(method, cert_list, crl_list, sessionCacheSize > 0 ? identity : QByteArray(), sessionCacheSize, sessionTimeout);
+
+		SslCtxCache::Item *i = cache->items.value(key);
+		if(i)
+		{
+			++i->refs;
+			i->lastUsed = ++cache->useCounter;
+			return i->context;
 		}
-		Q_UNUSED(compress); // TODO
 	}
 
-	virtual void setTrustedCertificates(const CertificateCollection &_trusted)
+	// the store is built without holding the lock.  if another thread
+	//   got there first, use its context instead.
+	SSL_CTX *context = ssl_ctx_create(method, cert_list, crl_list, identity, sessionCacheSize, sessionTimeout);
+	if(!context)
+		return 0;
+
+	QMutexLocker locker(&cache->m);
+	SslCtxCache::Item *i = cache->items.value(key);
+	if(i)
 	{
-		trusted = _trusted;
+		SSL_CTX_free(context);
 	}
+	else
+	{
+		i = new SslCtxCache::Item;
+		i->context = context;
+		i->refs = 0;
+		i->stale = false;
+		i->certs = cert_list;
+		i->crls = crl_list;
+		cache->items.insert(key, i);
+		cache->keys.insert(context, key);
+	}
+	++i->refs;
+	i->lastUsed = ++cache->useCounter;
+	return i->context;
+}
 
-	virtual void setIssuerList(const QList<CertificateInfoOrdered> &issuerList)
+static void ssl_ctx_release(SSL_CTX *context)
+{
+	SslCtxCache *cache = g_sslCtxCache();
+	QMutexLocker locker(&cache->m);
+	if(cache->keys.contains(context))
 	{
-		Q_UNUSED(issuerList); // TODO
+		SslCtxCache::Item *i = cache->items.value(cache->keys.value(context));
+		--i->refs;
+		if(i->refs == 0 && i->stale)
+		{
+			cache->items.remove(cache->keys.take(context));
+			SSL_CTX_free(context);
+			delete i;
+		}
+		cache->trim(SslCtxCache::MaxUnused);
 	}
-
-	virtual void setCertificate(const CertificateChain &_cert, const PrivateKey &_key)
+	else
 	{
-		if(!_cert.isEmpty())
-			cert = _cert.primary(); // TODO: take the whole chain
-		key = _key;
+		// created while the cache was disabled
+		SSL_CTX_free(context);
 	}
+}
 
-	virtual void setSessionId(const TLSSessionContext &id)
+static void ssl_ctx_configure(bool enabled, int sessionCacheSize, int sessionTimeout)
+{
+	SslCtxCache *cache = g_sslCtxCache();
+	QMutexLocker locker(&cache->m);
+	cache->enabled = enabled;
+	cache->sessionCacheSize = sessionCacheSize;
+	cache->sessionTimeout = sessionTimeout;
+
+	// contexts made with the old settings no longer match any key.  the
+	//   unused ones are dropped now, the others as they are released.
+	foreach(SslCtxCache::Item *i, cache->items)
+		i->stale = true;
+	cache->trim(0);
+}
+
+//----------------------------------------------------------------------------
+// TLS handshake offload
+//----------------------------------------------------------------------------
+// handshake steps do the public key operations, which are slow enough to
+//   stall a thread serving many sessions.  when enabled, they run on a
+//   shared pool instead, and the result is signalled back to the thread
+//   that owns the session as usual.  bulk data is still processed inline.
+class TLSOffload
+{
+public:
+	QAtomicInt enabled;
+	QThreadPool pool;
+};
+
+Q_GLOBAL_STATIC(TLSOffload, g_tlsOffload)
+
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+// OpenSSL before 1.1 is only safe to use from several threads once these
+//   are set.  they are installed when the provider is initialized, before
+//   any SSL_CTX exists, and never change afterwards.
+static QMutex *g_sslLocks = 0;
+
+static void ssl_locking_callback(int mode, int n, const char *file, int line)
+{
+	Q_UNUSED(file);
+	Q_UNUSED(line);
+
+	if(mode & CRYPTO_LOCK)
+		g_sslLocks[n].lock();
+	else
+		g_sslLocks[n].unlock();
+}
+
+static void ssl_threadid_callback(CRYPTO_THREADID *id)
+{
+	CRYPTO_THREADID_set_pointer(id, QThread::currentThreadId());
+}
+#endif
+
+static void ssl_enable_threads()
+{
+#if OPENSSL_VERSION_NUMBER < 0x10100000L
+	// leave callbacks set by the application alone
+	if(g_sslLocks || CRYPTO_get_locking_callback())
+		return;
+
+	g_sslLocks = new QMutex[CRYPTO_num_locks()];
+	CRYPTO_THREADID_set_callback(ssl_threadid_callback);
+	CRYPTO_set_locking_callback(ssl_locking_callback);
+#endif
+}
+
+static void tls_offload_configure(bool enabled, int threads)
+{
+	TLSOffload *offload = g_tlsOffload();
+	offload->pool.setMaxThreadCount(threads > 0 ? threads : QThread::idealThreadCount());
+	offload->enabled.fetchAndStoreRelease(enabled ? 1 : 0);
+}
+
+static bool tls_offload_enabled()
+{
+#if QT_VERSION >= 0x050000
+	return g_tlsOffload()->enabled.loadAcquire() != 0;
+#else
+	return g_tlsOffload()->enabled != 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// Chunk BIO
+//----------------------------------------------------------------------------
+// a source/sink BIO over a ChunkBuffer.  network input is read straight
+//   from the chunks TLS hands in, and each record OpenSSL writes becomes a
+//   chunk of its own, so neither direction goes through the extra copy a
+//   memory BIO makes.  the buffer is owned by the TLS context.
+static int chunk_bio_write(BIO *b, const char *data, int size)
+{
+	BIO_clear_retry_flags(b);
+	if(size <= 0)
+		return 0;
+	static_cast<ChunkBuffer*>(b->ptr)->append(QByteArray(data, size));
+	return size;
+}
+
+static int chunk_bio_read(BIO *b, char *data, int size)
+{
+	ChunkBuffer *buf = static_cast<ChunkBuffer*>(b->ptr);
+	BIO_clear_retry_flags(b);
+	if(buf->isEmpty())
+	{
+		// like a memory BIO, ask to be called again when there is data
+		BIO_set_retry_read(b);
+		return -1;
+	}
+	return buf->read(data, size);
+}
+
+static int chunk_bio_puts(BIO *b, const char *str)
+{
+	return chunk_bio_write(b, str, strlen(str));
+}
+
+static long chunk_bio_ctrl(BIO *b, int cmd, long num, void *ptr)
+{
+	Q_UNUSED(num);
+	Q_UNUSED(ptr);
+
+	ChunkBuffer *buf = static_cast<ChunkBuffer*>(b->ptr);
+	switch(cmd)
+	{
+		case BIO_CTRL_RESET:
+			buf->clear();
+			return 1;
+		case BIO_CTRL_EOF:
+			return buf->isEmpty() ? 1 : 0;
+		case BIO_CTRL_PENDING:
+			return buf->size();
+		case BIO_CTRL_WPENDING:
+			return 0;
+		case BIO_CTRL_FLUSH:
+		case BIO_CTRL_DUP:
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+static int chunk_bio_create(BIO *b)
+{
+	b->init = 1;
+	b->num = 0;
+	b->ptr = 0;
+	b->flags = 0;
+	return 1;
+}
+
+static int chunk_bio_destroy(BIO *b)
+{
+	b->ptr = 0;
+	return 1;
+}
+
+static BIO_METHOD chunk_bio_method =
+{
+	BIO_TYPE_SOURCE_SINK | 0x60,
+	"qca chunk buffer",
+	chunk_bio_write,
+	chunk_bio_read,
+	chunk_bio_puts,
+	0,
+	chunk_bio_ctrl,
+	chunk_bio_create,
+	chunk_bio_destroy,
+	0
+};
+
+static BIO *chunk_bio_new(ChunkBuffer *buf)
+{
+	BIO *b = BIO_new(&chunk_bio_method);
+	if(b)
+		b->ptr = buf;
+	return b;
+}
+
+//----------------------------------------------------------------------------
+// PacketPool
+//----------------------------------------------------------------------------
+// recycles packet buffers.  a buffer handed out stays shared with the pool,
+//   and once whoever got it lets go of it the pool is its only user again
+//   and can fill it anew, so a steady flow of packets stops allocating.
+class PacketPool
+{
+public:
+	enum { MaxBuffers = 256, MaxScan = 8 };
+
+	PacketPool() : next(0)
+	{
+	}
+
+	QByteArray get(const char *data, int size)
+	{
+		// look at a few buffers from where the last search stopped
+		for(int n = 0; n < buffers.count() && n < MaxScan; ++n)
+		{
+			QByteArray &b = buffers[next];
+			next = (next + 1) % buffers.count();
+			if(b.isDetached())
+			{
+				b.resize(size);
+				memcpy(b.data(), data, size);
+				return b;
+			}
+		}
+
+		QByteArray b(data, size);
+		if(buffers.count() < MaxBuffers)
+			buffers += b;
+		return b;
+	}
+
+	void clear()
+	{
+		buffers.clear();
+		next = 0;
+	}
+
+private:
+	QList<QByteArray> buffers;
+	int next;
+};
+
+//----------------------------------------------------------------------------
+// Packet BIO
+//----------------------------------------------------------------------------
+// the datagram flavour of the chunk BIO.  each chunk is one packet: a read
+//   returns at most one of them, and drops what doesn't fit like a datagram
+//   socket would, and each write, which OpenSSL makes once per datagram,
+//   becomes a chunk taken from the pool.
+struct PacketBio
+{
+	ChunkBuffer *buf;
+	PacketPool *pool;
+};
+
+static int packet_bio_write(BIO *b, const char *data, int size)
+{
+	PacketBio *p = static_cast<PacketBio*>(b->ptr);
+	BIO_clear_retry_flags(b);
+	if(size <= 0)
+		return 0;
+	if(p->pool)
+		p->buf->append(p->pool->get(data, size));
+	else
+		p->buf->append(QByteArray(data, size));
+	return size;
+}
+
+static int packet_bio_read(BIO *b, char *data, int size)
+{
+	ChunkBuffer *buf = static_cast<PacketBio*>(b->ptr)->buf;
+	BIO_clear_retry_flags(b);
+	if(buf->isEmpty())
+	{
+		BIO_set_retry_read(b);
+		return -1;
+	}
+	int len = buf->chunk(0).size();
+	int ret = buf->read(data, qMin(size, len));
+	if(ret < len)
+		buf->skip(len - ret);
+	return ret;
+}
+
+static int packet_bio_puts(BIO *b, const char *str)
+{
+	return packet_bio_write(b, str, strlen(str));
+}
+
+static long packet_bio_ctrl(BIO *b, int cmd, long num, void *ptr)
+{
+	Q_UNUSED(num);
+	Q_UNUSED(ptr);
+
+	ChunkBuffer *buf = static_cast<PacketBio*>(b->ptr)->buf;
+	switch(cmd)
+	{
+		case BIO_CTRL_RESET:
+			buf->clear();
+			return 1;
+		case BIO_CTRL_EOF:
+			return buf->isEmpty() ? 1 : 0;
+		case BIO_CTRL_PENDING:
+			return buf->isEmpty() ? 0 : buf->chunk(0).size();
+		case BIO_CTRL_WPENDING:
+			return 0;
+		case BIO_CTRL_FLUSH:
+		case BIO_CTRL_DUP:
+			return 1;
+		default:
+			// the datagram controls (peer, mtu, timeouts) are left
+			//   to OpenSSL's defaults
+			return 0;
+	}
+}
+
+static int packet_bio_create(BIO *b)
+{
+	b->init = 1;
+	b->num = 0;
+	b->ptr = 0;
+	b->flags = 0;
+	return 1;
+}
+
+static int packet_bio_destroy(BIO *b)
+{
+	delete static_cast<PacketBio*>(b->ptr);
+	b->ptr = 0;
+	return 1;
+}
+
+static BIO_METHOD packet_bio_method =
+{
+	BIO_TYPE_SOURCE_SINK | 0x61,
+	"qca packet buffer",
+	packet_bio_write,
+	packet_bio_read,
+	packet_bio_puts,
+	0,
+	packet_bio_ctrl,
+	packet_bio_create,
+	packet_bio_destroy,
+	0
+};
+
+// pool may be 0, for a BIO that is only read from
+static BIO *packet_bio_new(ChunkBuffer *buf, PacketPool *pool)
+{
+	BIO *b = BIO_new(&packet_bio_method);
+	if(b)
+	{
+		PacketBio *p = new PacketBio;
+		p->buf = buf;
+		p->pool = pool;
+		b->ptr = p;
+	}
+	return b;
+}
+
+//----------------------------------------------------------------------------
+// MyTLSSessionContext
+//----------------------------------------------------------------------------
+class MyTLSSessionContext : public TLSSessionContext
+{
+public:
+	SSL_SESSION *session;
+
+	// takes ownership of a reference to the session
+	MyTLSSessionContext(Provider *p, SSL_SESSION *_session) : TLSSessionContext(p), session(_session)
+	{
+	}
+
+	MyTLSSessionContext(const MyTLSSessionContext &from) : TLSSessionContext(from), session(from.session)
+	{
+		CRYPTO_add(&session->references, 1, CRYPTO_LOCK_SSL_SESSION);
+	}
+
+	~MyTLSSessionContext()
+	{
+		SSL_SESSION_free(session);
+	}
+
+	virtual Provider::Context *clone() const
+	{
+		return new MyTLSSessionContext(*this);
+	}
+};
+
+class MyTLSContext;
+
+class TLSHandshakeJob : public QRunnable
+{
+public:
+	MyTLSContext *c;
+
+	TLSHandshakeJob(MyTLSContext *_c) : c(_c)
+	{
+	}
+
+	virtual void run();
+};
+
+class MyTLSContext : public TLSContext
+{
+public:
+	enum { Good, TryAgain, Bad };
+	enum { Idle, Connect, Accept, Handshake, Active, Closing };
+
+	bool serv; // true if we are acting as a server
+	bool datagram; // DTLS rather than TLS
+	int mode;
+	QByteArray sendQueue;
+	QByteArray recvQueue;
+	ChunkBuffer netIn, netOut; // read and written through rbio and wbio
+
+	CertificateCollection trusted;
+	Certificate cert, peercert; // TODO: support cert chains
+	PrivateKey key;
+	QString targetHostName;
+
+	Result result_result;
+	ChunkBuffer result_to_net;
+	int result_encoded;
+	QByteArray result_plain;
+	QList<QByteArray> result_packets;
+
+	// datagram mode
+	int mtu;
+	QByteArray peerAddress;
+	QByteArray scratch; // SSL_read target, copied out to the pool
+	PacketPool pool;
+	QTimer *dtlsTimer;
+
+	SSL *ssl;
+#if OPENSSL_VERSION_NUMBER >= 0x00909000L
+	const SSL_METHOD *method;
+#else
+	SSL_METHOD *method;
+#endif
+	SSL_CTX *context;
+	BIO *rbio, *wbio;
+	Validity vr;
+	bool v_eof;
+	SSL_SESSION *resumeSession;
+	mutable MyTLSSessionContext *sessionId;
+
+	// a handshake step running on the offload pool
+	QMutex jobMutex;
+	QWaitCondition jobDone;
+	bool jobPending;
+	Qt::HANDLE jobThread;
+
+	MyTLSContext(Provider *p, bool _datagram = false) : TLSContext(p, _datagram ? "dtls" : "tls"), datagram(_datagram)
+	{
+		if(!ssl_init)
+		{
+			SSL_library_init();
+			SSL_load_error_strings();
+			ssl_init = true;
+		}
+
+		ssl = 0;
+		context = 0;
+		resumeSession = 0;
+		sessionId = 0;
+		jobPending = false;
+		jobThread = 0;
+		mtu = -1;
+
+		// OpenSSL asks to be called again when a retransmission is due
+		dtlsTimer = new QTimer(this);
+		dtlsTimer->setSingleShot(true);
+		connect(dtlsTimer, SIGNAL(timeout()), SIGNAL(dtlsTimeout()));
+
+		reset();
+	}
+
+	~MyTLSContext()
+	{
+		reset();
+	}
+
+	virtual Provider::Context *clone() const
+	{
+		return 0;
+	}
+
+	virtual void reset()
+	{
+		waitForJob();
+
+		if(ssl)
+		{
+			SSL_free(ssl);
+			ssl = 0;
+		}
+		if(context)
+		{
+			ssl_ctx_release(context);
+			context = 0;
+		}
+		if(resumeSession)
+		{
+			SSL_SESSION_free(resumeSession);
+			resumeSession = 0;
+		}
+		delete sessionId;
+		sessionId = 0;
+
+		cert = Certificate();
+		key = PrivateKey();
+
+		sendQueue.resize(0);
+		recvQueue.resize(0);
+		netIn.clear();
+		netOut.clear();
+		result_packets.clear();
+		if(datagram)
+			dtlsTimer->stop();
+		mode = Idle;
+		peercert = Certificate();
+		vr = ErrorValidityUnknown;
+		v_eof = false;
+	}
+
+	// dummy verification function for SSL_set_verify()
+	static int ssl_verify_callback(int preverify_ok, X509_STORE_CTX *x509_ctx)
+	{
+		Q_UNUSED(preverify_ok);
+		Q_UNUSED(x509_ctx);
+
+		// don't terminate handshake in case of verification failure
+		return 1;
+	}
+
+	virtual QStringList supportedCipherSuites(const TLS::Version &version) const
+	{
+		OpenSSL_add_ssl_algorithms();
+		SSL_CTX *ctx = 0;
+		switch (version) {
+#ifndef OPENSSL_NO_SSL2
+		case TLS::SSL_v2:
+			ctx = SSL_CTX_new(SSLv2_client_method());
+			break;
+#endif
+#ifndef OPENSSL_NO_SSL3_METHOD
+		case TLS::SSL_v3:
+			ctx = SSL_CTX_new(SSLv3_client_method());
+			break;
+#endif
+		case TLS::TLS_v1:
+			ctx = SSL_CTX_new(TLSv1_client_method());
+			break;
+		case TLS::DTLS_v1:
+			ctx = SSL_CTX_new(DTLSv1_client_method());
+			break;
+		default:
+			qWarning("Unexpected enum in cipherSuites");
+			ctx = 0;
+		}
+		if (NULL == ctx)
+			return QStringList();
+
+		SSL *ssl = SSL_new(ctx);
+		if (NULL == ssl) {
+			SSL_CTX_free(ctx);
+			return QStringList();
+		}
+
+		STACK_OF(SSL_CIPHER) *sk = SSL_get_ciphers(ssl);
+		QStringList cipherList;
+		for(int i = 0; i < sk_SSL_CIPHER_num(sk); ++i) {
+			SSL_CIPHER *thisCipher = sk_SSL_CIPHER_value(sk, i);
+			// DTLS uses the TLS suites
+			cipherList += cipherIDtoString(version == TLS::DTLS_v1 ? TLS::TLS_v1 : version, thisCipher->id);
+		}
+
+		SSL_free(ssl);
+		SSL_CTX_free(ctx);
+
+		return cipherList;
+	}
+
+	virtual bool canCompress() const
+	{
+		// TODO
+		return false;
+	}
+
+	virtual bool canSetHostName() const
+	{
+		// TODO
+		return false;
+	}
+
+	virtual int maxSSF() const
 	{
 		// TODO
-		Q_UNUSED(id);
+		return 256;
+	}
+
+	virtual void setConstraints(int minSSF, int maxSSF)
+	{
+		// TODO
+		Q_UNUSED(minSSF);
+		Q_UNUSED(maxSSF);
+	}
+
+	virtual void setConstraints(const QStringList &cipherSuiteList)
+	{
+		// TODO
+		Q_UNUSED(cipherSuiteList);
+	}
+
+	virtual void setup(bool serverMode, const QString &hostName, bool compress)
+	{
+		serv = serverMode;
+		if ( false == serverMode ) {
+			// client
+			targetHostName = hostName;
+		}
+		Q_UNUSED(compress); // TODO
+	}
+
+	virtual void setTrustedCertificates(const CertificateCollection &_trusted)
+	{
+		trusted = _trusted;
+	}
+
+	virtual void setIssuerList(const QList<CertificateInfoOrdered> &issuerList)
+	{
+		Q_UNUSED(issuerList); // TODO
+	}
+
+	virtual void setCertificate(const CertificateChain &_cert, const PrivateKey &_key)
+	{
+		if(!_cert.isEmpty())
+			cert = _cert.primary(); // TODO: take the whole chain
+		key = _key;
+	}
+
+	virtual void setSessionId(const TLSSessionContext &id)
+	{
+		if(!id.sameProvider(this))
+			return;
+		const MyTLSSessionContext *sc = static_cast<const MyTLSSessionContext *>(&id);
+		if(resumeSession)
+			SSL_SESSION_free(resumeSession);
+		resumeSession = sc->session;
+		CRYPTO_add(&resumeSession->references, 1, CRYPTO_LOCK_SSL_SESSION);
+	}
+
+	virtual void setMTU(int size)
+	{
+		mtu = size;
+		if(datagram && ssl)
+			SSL_set_mtu(ssl, mtu > 0 ? mtu : 1200);
+	}
+
+	virtual void setPeerAddress(const QByteArray &address)
+	{
+		peerAddress = address;
 	}
 
 	virtual void shutdown()
@@ -5523,19 +6433,85 @@ public:
 
 	virtual void update(const QByteArray &from_net, const QByteArray &from_app)
 	{
+		if(datagram)
+		{
+			QList<QByteArray> net, app;
+			if(!from_net.isEmpty())
+				net += from_net;
+			if(!from_app.isEmpty())
+				app += from_app;
+			updatePackets(net, app);
+			return;
+		}
+
+		updateChunks(ChunkBuffer(from_net), from_app);
+	}
+
+	virtual int packetBatchSize() const
+	{
+		return datagram ? 64 : 1;
+	}
+
+	virtual void updatePackets(const QList<QByteArray> &from_net, const QList<QByteArray> &from_app)
+	{
+		if(!datagram)
+		{
+			TLSContext::updatePackets(from_net, from_app);
+			return;
+		}
+
+		// each packet stays a chunk of its own, which rbio reads one
+		//   at a time
+		for(int n = 0; n < from_net.count(); ++n)
+			netIn.append(from_net[n]);
+
+		if(mode == Active)
+		{
+			bool ok = true;
+			result_encoded = 0;
+			for(int n = 0; ok && n < from_app.count(); ++n)
+				ok = priv_encodePacket(from_app[n]);
+			if(ok)
+				ok = priv_decodePackets();
+			result_to_net.append(readOutgoing());
+			result_result = ok ? Success : Error;
+		}
+		else if(mode == Closing)
+			result_result = priv_shutdown(&result_to_net);
+		else
+			result_result = priv_handshake(&result_to_net);
+
+		dtlsTimerUpdate();
+		doResultsReady();
+	}
+
+	virtual void updateChunks(const ChunkBuffer &from_net, const QByteArray &from_app)
+	{
+		// rbio reads from these chunks in place
+		netIn.append(from_net);
+
 		if(mode == Active)
 		{
 			bool ok = true;
 			if(!from_app.isEmpty())
 				ok = priv_encode(from_app, &result_to_net, &result_encoded);
 			if(ok)
-				ok = priv_decode(from_net, &result_plain, &result_to_net);
+				ok = priv_decode(&result_plain, &result_to_net);
 			result_result = ok ? Success : Error;
 		}
 		else if(mode == Closing)
-			result_result = priv_shutdown(from_net, &result_to_net);
+			result_result = priv_shutdown(&result_to_net);
+		else if(tls_offload_enabled() && !signalsBlocked())
+		{
+			// blocked signals mean the caller waits for the result
+			//   anyway, so there is nothing to gain from another thread
+			QMutexLocker locker(&jobMutex);
+			jobPending = true;
+			g_tlsOffload()->pool.start(new TLSHandshakeJob(this));
+			return;
+		}
 		else
-			result_result = priv_handshake(from_net, &result_to_net);
+			result_result = priv_handshake(&result_to_net);
 
 		//printf("update (from_net=%d, to_net=%d, from_app=%d, to_app=%d)\n", from_net.size(), result_to_net.size(), from_app.size(), result_plain.size());
 
@@ -5545,7 +6521,7 @@ public:
 	bool priv_startClient()
 	{
 		//serv = false;
-		method = SSLv23_client_method();
+		method = datagram ? DTLSv1_client_method() : SSLv23_client_method();
 		if(!init())
 			return false;
 		mode = Connect;
@@ -5555,17 +6531,18 @@ public:
 	bool priv_startServer()
 	{
 		//serv = true;
-		method = SSLv23_server_method();
+		method = datagram ? DTLSv1_server_method() : SSLv23_server_method();
 		if(!init())
 			return false;
 		mode = Accept;
 		return true;
 	}
 
-	Result priv_handshake(const QByteArray &from_net, QByteArray *to_net)
+	Result priv_handshake(ChunkBuffer *to_net)
 	{
-		if(!from_net.isEmpty())
-			BIO_write(rbio, from_net.data(), from_net.size());
+		// retransmits the last flight if its timer has run out
+		if(datagram)
+			DTLSv1_handle_timeout(ssl);
 
 		if(mode == Connect)
 		{
@@ -5620,11 +6597,8 @@ public:
 			return Continue;
 	}
 
-	Result priv_shutdown(const QByteArray &from_net, QByteArray *to_net)
+	Result priv_shutdown(ChunkBuffer *to_net)
 	{
-		if(!from_net.isEmpty())
-			BIO_write(rbio, from_net.data(), from_net.size());
-
 		int ret = doShutdown();
 		if(ret == Bad)
 		{
@@ -5646,7 +6620,7 @@ public:
 		}
 	}
 
-	bool priv_encode(const QByteArray &plain, QByteArray *to_net, int *enc)
+	bool priv_encode(const QByteArray &plain, ChunkBuffer *to_net, int *enc)
 	{
 		if(mode != Active)
 			return false;
@@ -5692,32 +6666,29 @@ public:
 			}
 		}
 
-		*to_net += readOutgoing();
+		to_net->append(readOutgoing());
 		*enc = encoded;
 		return true;
 	}
 
-	bool priv_decode(const QByteArray &from_net, QByteArray *plain, QByteArray *to_net)
+	bool priv_decode(QByteArray *plain, ChunkBuffer *to_net)
 	{
 		if(mode != Active)
 			return false;
-		if(!from_net.isEmpty())
-			BIO_write(rbio, from_net.data(), from_net.size());
 
-		QByteArray a;
 		while(!v_eof) {
-			a.resize(8192);
-			int ret = SSL_read(ssl, a.data(), a.size());
+			// decrypt straight onto the end of the queue
+			int at = recvQueue.size();
+			recvQueue.resize(at + 8192);
+			int ret = SSL_read(ssl, recvQueue.data() + at, 8192);
 			//printf("SSL_read = %d\n", ret);
 			if(ret > 0)
 			{
-				if(ret != (int)a.size())
-					a.resize(ret);
-				//printf("SSL_read chunk: [%s]\n", qPrintable(arrayToHex(a)));
-				recvQueue.append(a);
+				recvQueue.resize(at + ret);
 			}
 			else if(ret <= 0)
 			{
+				recvQueue.resize(at);
 				ERR_print_errors_fp(stdout);
 				int x = SSL_get_error(ssl, ret);
 				//printf("SSL_read error = %d\n", x);
@@ -5731,20 +6702,117 @@ public:
 		}
 
 		*plain = recvQueue;
-		recvQueue.resize(0);
+		recvQueue.clear();
 
 		// could be outgoing data also
-		*to_net += readOutgoing();
+		to_net->append(readOutgoing());
 		return true;
 	}
 
-	virtual bool waitForResultsReady(int msecs)
+	// each packet is a record of its own
+	bool priv_encodePacket(const QByteArray &plain)
 	{
-		// TODO: for now, all operations block anyway
-		Q_UNUSED(msecs);
+		if(mode != Active)
+			return false;
+
+		int ret = SSL_write(ssl, plain.data(), plain.size());
+		if(ret <= 0)
+		{
+			if(SSL_get_error(ssl, ret) == SSL_ERROR_ZERO_RETURN)
+				v_eof = true;
+			return false;
+		}
+		result_encoded += ret;
+		return true;
+	}
+
+	// each record read is a packet of its own
+	bool priv_decodePackets()
+	{
+		if(mode != Active)
+			return false;
+
+		if(scratch.isEmpty())
+			scratch.resize(16384);
+
+		while(!v_eof)
+		{
+			int ret = SSL_read(ssl, scratch.data(), scratch.size());
+			if(ret > 0)
+			{
+				result_packets += pool.get(scratch.constData(), ret);
+				continue;
+			}
+
+			int x = SSL_get_error(ssl, ret);
+			if(x == SSL_ERROR_WANT_READ || x == SSL_ERROR_WANT_WRITE)
+				break;
+			else if(x == SSL_ERROR_ZERO_RETURN)
+				v_eof = true;
+			else
+				return false;
+		}
 		return true;
 	}
 
+	void dtlsTimerUpdate()
+	{
+		struct timeval tv;
+		if(ssl && DTLSv1_get_timeout(ssl, &tv))
+			dtlsTimer->start(tv.tv_sec * 1000 + tv.tv_usec / 1000);
+		else
+			dtlsTimer->stop();
+	}
+
+	// called on the offload pool
+	void runHandshakeJob()
+	{
+		{
+			QMutexLocker locker(&jobMutex);
+			jobThread = QThread::currentThreadId();
+		}
+
+		result_result = priv_handshake(&result_to_net);
+
+		// signal before letting go, since the owner may delete us as
+		//   soon as the job is no longer pending
+		QMutexLocker locker(&jobMutex);
+		doResultsReady();
+		jobPending = false;
+		jobThread = 0;
+		jobDone.wakeAll();
+	}
+
+	void waitForJob()
+	{
+		QMutexLocker locker(&jobMutex);
+
+		// priv_handshake() resets on failure, from the job itself
+		if(jobThread == QThread::currentThreadId())
+			return;
+
+		while(jobPending)
+			jobDone.wait(&jobMutex);
+	}
+
+	virtual bool waitForResultsReady(int msecs)
+	{
+		// only handshake steps on the offload pool run in the
+		//   background, everything else has finished already
+		QMutexLocker locker(&jobMutex);
+		if(jobPending)
+		{
+			if(msecs < 0)
+			{
+				while(jobPending)
+					jobDone.wait(&jobMutex);
+			}
+			else
+				jobDone.wait(&jobMutex, msecs);
+		}
+		return !jobPending;
+	}
+
 	virtual Result result() const
 	{
 		return result_result;
@@ -5752,11 +6820,24 @@ public:
 
 	virtual QByteArray to_net()
 	{
-		QByteArray a = result_to_net;
+		return result_to_net.take();
+	}
+
+	virtual ChunkBuffer to_netChunks()
+	{
+		ChunkBuffer a = result_to_net;
 		result_to_net.clear();
 		return a;
 	}
 
+	virtual QList<QByteArray> to_netPackets()
+	{
+		QList<QByteArray> list;
+		while(!result_to_net.isEmpty())
+			list += result_to_net.take(result_to_net.chunk(0).size());
+		return list;
+	}
+
 	virtual int encoded() const
 	{
 		return result_encoded;
@@ -5764,11 +6845,30 @@ public:
 
 	virtual QByteArray to_app()
 	{
+		if(datagram)
+		{
+			QByteArray a;
+			for(int n = 0; n < result_packets.count(); ++n)
+				a += result_packets[n];
+			result_packets.clear();
+			return a;
+		}
+
 		QByteArray a = result_plain;
 		result_plain.clear();
 		return a;
 	}
 
+	virtual QList<QByteArray> to_appPackets()
+	{
+		if(!datagram)
+			return TLSContext::to_appPackets();
+
+		QList<QByteArray> list = result_packets;
+		result_packets.clear();
+		return list;
+	}
+
 	virtual bool eof() const
 	{
 		return v_eof;
@@ -5816,38 +6916,33 @@ public:
 			sessInfo.version = TLS::SSL_v3;
 		else if (ssl->version == SSL2_VERSION)
 			sessInfo.version = TLS::SSL_v2;
+		else if (ssl->version == DTLS1_VERSION)
+			sessInfo.version = TLS::DTLS_v1;
 		else {
 			qDebug("unexpected version response");
 			sessInfo.version = TLS::TLS_v1;
 		}
 
-		sessInfo.cipherSuite = cipherIDtoString( sessInfo.version,
+		sessInfo.cipherSuite = cipherIDtoString( sessInfo.version == TLS::DTLS_v1 ? TLS::TLS_v1 : sessInfo.version,
 												 SSL_get_current_cipher(ssl)->id);
 
 		sessInfo.cipherMaxBits = SSL_get_cipher_bits(ssl, &(sessInfo.cipherBits));
 
-		sessInfo.id = 0; // TODO: session resuming
+		SSL_SESSION *session = SSL_get1_session(ssl);
+		if(session)
+		{
+			delete sessionId;
+			sessionId = new MyTLSSessionContext(provider(), session);
+		}
+		sessInfo.id = sessionId;
+		sessInfo.isResumed = SSL_session_reused(ssl) != 0;
 
 		return sessInfo;
 	}
 
 	virtual QByteArray unprocessed()
 	{
-		QByteArray a;
-		int size = BIO_pending(rbio);
-		if(size <= 0)
-			return a;
-		a.resize(size);
-
-		int r = BIO_read(rbio, a.data(), size);
-		if(r <= 0)
-		{
-			a.resize(0);
-			return a;
-		}
-		if(r != size)
-			a.resize(r);
-		return a;
+		return netIn.take();
 	}
 
 	virtual Validity peerCertificateValidity() const
@@ -5865,46 +6960,33 @@ public:
 
 	void doResultsReady()
 	{
-		QMetaObject::invokeMethod(this, "resultsReady", Qt::QueuedConnection);
+		// when the signal is blocked the results are collected with
+		//   waitForResultsReady() instead, so don't post an event that
+		//   a thread without an event loop would never deliver
+		if(!signalsBlocked())
+			QMetaObject::invokeMethod(this, "resultsReady", Qt::QueuedConnection);
 	}
 
 	bool init()
 	{
-		context = SSL_CTX_new(method);
+		context = ssl_ctx_acquire(method, trusted, serv ? cert : Certificate());
 		if(!context)
 			return false;
 
-		// setup the cert store
-		{
-			X509_STORE *store = SSL_CTX_get_cert_store(context);
-			QList<Certificate> cert_list = trusted.certificates();
-			QList<CRL> crl_list = trusted.crls();
-			int n;
-			for(n = 0; n < cert_list.count(); ++n)
-			{
-				const MyCertContext *cc = static_cast<const MyCertContext *>(cert_list[n].context());
-				X509 *x = cc->item.cert;
-				//CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509);
-				X509_STORE_add_cert(store, x);
-			}
-			for(n = 0; n < crl_list.count(); ++n)
-			{
-				const MyCRLContext *cc = static_cast<const MyCRLContext *>(crl_list[n].context());
-				X509_CRL *x = cc->item.crl;
-				//CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509_CRL);
-				X509_STORE_add_crl(store, x);
-			}
-		}
-
 		ssl = SSL_new(context);
 		if(!ssl)
 		{
-			SSL_CTX_free(context);
+			ssl_ctx_release(context);
 			context = 0;
 			return false;
 		}
 		SSL_set_ssl_method(ssl, method); // can this return error?
 
+		// offer the session to resume.  if the server doesn't accept it,
+		//   a full handshake is done instead.
+		if(!serv && resumeSession)
+			SSL_set_session(ssl, resumeSession);
+
 #ifdef SSL_CTRL_SET_TLSEXT_HOSTNAME
 		if ( targetHostName.isEmpty() == false ) {
 			// we have a target
@@ -5914,9 +6996,27 @@ public:
 		}
 #endif
 
-		// setup the memory bio
-		rbio = BIO_new(BIO_s_mem());
-		wbio = BIO_new(BIO_s_mem());
+		// setup the chunk bios
+		if(datagram)
+		{
+			rbio = packet_bio_new(&netIn, 0);
+			wbio = packet_bio_new(&netOut, &pool);
+
+			// there is no socket to ask
+			SSL_set_options(ssl, SSL_OP_NO_QUERY_MTU);
+			SSL_set_mtu(ssl, mtu > 0 ? mtu : 1200);
+
+			if(serv && !peerAddress.isEmpty())
+			{
+				SSL_set_app_data(ssl, &peerAddress);
+				SSL_set_options(ssl, SSL_OP_COOKIE_EXCHANGE);
+			}
+		}
+		else
+		{
+			rbio = chunk_bio_new(&netIn);
+			wbio = chunk_bio_new(&netOut);
+		}
 
 		// this passes control of the bios to ssl.  we don't need to free them.
 		SSL_set_bio(ssl, rbio, wbio);
@@ -5951,13 +7051,17 @@ public:
 			if(SSL_use_certificate(ssl, cc->item.cert) != 1)
 			{
 				SSL_free(ssl);
-				SSL_CTX_free(context);
+				ssl = 0;
+				ssl_ctx_release(context);
+				context = 0;
 				return false;
 			}
 			if(SSL_use_PrivateKey(ssl, kc->get_pkey()) != 1)
 			{
 				SSL_free(ssl);
-				SSL_CTX_free(context);
+				ssl = 0;
+				ssl_ctx_release(context);
+				context = 0;
 				return false;
 			}
 		}
@@ -6086,26 +7190,19 @@ public:
 		}
 	}
 
-	QByteArray readOutgoing()
+	ChunkBuffer readOutgoing()
 	{
-		QByteArray a;
-		int size = BIO_pending(wbio);
-		if(size <= 0)
-			return a;
-		a.resize(size);
-
-		int r = BIO_read(wbio, a.data(), size);
-		if(r <= 0)
-		{
-			a.resize(0);
-			return a;
-		}
-		if(r != size)
-			a.resize(r);
+		ChunkBuffer a = netOut;
+		netOut.clear();
 		return a;
 	}
 };
 
+void TLSHandshakeJob::run()
+{
+	c->runHandshakeJob();
+}
+
 class CMSContext : public SMSContext
 {
 public:
@@ -6812,66 +7909,94 @@ public:
     }
 
 	bool update(const SecureArray &in, SecureArray *out)
+	{
+		return update(MemoryRegionView(in), out);
+	}
+
+	bool update(const MemoryRegionView &in, SecureArray *out)
+	{
+		out->resize(in.size()+blockSize());
+		int resultLength = update(in, out->data(), out->size());
+		if (resultLength < 0)
+			return false;
+		out->resize(resultLength);
+		return true;
+	}
+
+	int update(const MemoryRegionView &in, char *out, int outSize)
 	{
 		// This works around a problem in OpenSSL, where it asserts if
 		// there is nothing to encrypt.
 		if ( 0 == in.size() )
-			return true;
+			return 0;
+
+		// OpenSSL can hold back up to a block, and write it out later
+		if ( outSize < in.size()+blockSize() )
+			return -1;
 
-		out->resize(in.size()+blockSize());
 		int resultLength;
 		if (Encode == m_direction) {
 			if (0 == EVP_EncryptUpdate(&m_context,
-									   (unsigned char*)out->data(),
+									   (unsigned char*)out,
 									   &resultLength,
-									   (unsigned char*)in.data(),
+									   (const unsigned char*)in.data(),
 									   in.size())) {
-				return false;
+				return -1;
 			}
 		} else {
 			if (0 == EVP_DecryptUpdate(&m_context,
-									   (unsigned char*)out->data(),
+									   (unsigned char*)out,
 									   &resultLength,
-									   (unsigned char*)in.data(),
+									   (const unsigned char*)in.data(),
 									   in.size())) {
-				return false;
+				return -1;
 			}
 		}
-		out->resize(resultLength);
-		return true;
+		return resultLength;
 	}
 
 	bool final(SecureArray *out)
 	{
 		out->resize(blockSize());
+		int resultLength = final(out->data(), out->size());
+		if (resultLength < 0)
+			return false;
+		out->resize(resultLength);
+		return true;
+	}
+
+	int final(char *out, int outSize)
+	{
+		if (outSize < blockSize())
+			return -1;
+
 		int resultLength;
 		if (Encode == m_direction) {
 			if (0 == EVP_EncryptFinal_ex(&m_context,
-										 (unsigned char*)out->data(),
+										 (unsigned char*)out,
 										 &resultLength)) {
-				return false;
+				return -1;
 			}
 			if (m_tag.size() && (m_type.endsWith("gcm") || m_type.endsWith("ccm"))) {
 				int parameter = m_type.endsWith("gcm") ? EVP_CTRL_GCM_GET_TAG : EVP_CTRL_CCM_GET_TAG;
 				if (0 == EVP_CIPHER_CTX_ctrl(&m_context, parameter, m_tag.size(), (unsigned char*)m_tag.data())) {
-					return false;
+					return -1;
 				}
 			}
 		} else {
 			if (m_tag.size() && (m_type.endsWith("gcm") || m_type.endsWith("ccm"))) {
 				int parameter = m_type.endsWith("gcm") ? EVP_CTRL_GCM_SET_TAG : EVP_CTRL_CCM_SET_TAG;
 				if (0 == EVP_CIPHER_CTX_ctrl(&m_context, parameter, m_tag.size(), m_tag.data())) {
-					return false;
+					return -1;
 				}
 			}
 			if (0 == EVP_DecryptFinal_ex(&m_context,
-										 (unsigned char*)out->data(),
+										 (unsigned char*)out,
 										 &resultLength)) {
-				return false;
+				return -1;
 			}
 		}
-		out->resize(resultLength);
-		return true;
+		return resultLength;
 	}
 
 	// Change cipher names
@@ -7100,6 +8225,7 @@ public:
 
 	void init()
 	{
+		ssl_enable_threads();
 		OpenSSL_add_all_algorithms();
 		ERR_load_crypto_strings();
 
@@ -7169,6 +8295,7 @@ public:
 		list += "certcollection";
 		list += "pkcs12";
 		list += "tls";
+		list += "dtls";
 		list += "cms";
 		list += "ca";
 
@@ -7374,12 +8501,35 @@ public:
 			return new MyPKCS12Context( this );
 		else if ( type == "tls" )
 			return new MyTLSContext( this );
+		else if ( type == "dtls" )
+			return new MyTLSContext( this, true );
 		else if ( type == "cms" )
 			return new CMSContext( this );
 		else if ( type == "ca" )
 			return new MyCAContext( this );
 		return 0;
 	}
+
+	QVariantMap defaultConfig() const
+	{
+		QVariantMap config;
+		config["formtype"] = "http://affinix.com/qca/forms/qca-ossl#1.0";
+		config["ssl_ctx_cache"] = true;
+		config["session_cache_size"] = 1024;
+		config["session_timeout"] = 300;
+		config["tls_offload_handshake"] = false;
+		config["tls_offload_threads"] = 0;
+		return config;
+	}
+
+	void configChanged(const QVariantMap &config)
+	{
+		ssl_ctx_configure(config.value("ssl_ctx_cache", true).toBool(),
+			qMax(config.value("session_cache_size", 1024).toInt(), 0),
+			qMax(config.value("session_timeout", 300).toInt(), 1));
+		tls_offload_configure(config.value("tls_offload_handshake", false).toBool(),
+			config.value("tls_offload_threads", 0).toInt());
+	}
 };
 
 class opensslPlugin : public QObject, public QCAPlugin
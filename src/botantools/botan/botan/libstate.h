@@ -37,6 +37,9 @@ namespace QCA { // WRAPNS_LINE
 } // WRAPNS_LINE
 #include <botan/allocate.h>
 namespace QCA { // WRAPNS_LINE
+} // WRAPNS_LINE
+#include <QAtomicPointer>
+namespace QCA { // WRAPNS_LINE
 #else
 } // WRAPNS_LINE
 #include <botan/base.h>
@@ -154,6 +157,7 @@ class Library_State
       mutable Allocator* cached_default_allocator;
 #ifdef BOTAN_TOOLS_ONLY
       std::string default_allocator_type;
+      mutable QAtomicPointer<Allocator> fast_default_allocator;
 #endif
 
 #ifndef BOTAN_TOOLS_ONLY
@@ -140,6 +140,17 @@ Mutex* Library_State::get_named_mutex(const std::string& name)
 *************************************************/
 Allocator* Library_State::get_allocator(const std::string& type) const
    {
+#ifdef BOTAN_TOOLS_ONLY
+   // the default allocator is looked up for every secure buffer, so
+   // once it is known it is returned without taking the lock
+   if(type == "")
+      {
+      Allocator* fast = fast_default_allocator.fetchAndAddAcquire(0);
+      if(fast)
+         return fast;
+      }
+#endif
+
    Named_Mutex_Holder lock("allocator");
 
    if(type != "")
@@ -157,6 +168,9 @@ Allocator* Library_State::get_allocator(const std::string& type) const
 
       cached_default_allocator =
          search_map<std::string, Allocator*>(alloc_factory, chosen, 0);
+#ifdef BOTAN_TOOLS_ONLY
+      fast_default_allocator.fetchAndStoreRelease(cached_default_allocator);
+#endif
       }
 
    return cached_default_allocator;
@@ -191,6 +205,7 @@ void Library_State::set_default_allocator(const std::string& type) const
 
 #ifdef BOTAN_TOOLS_ONLY
    default_allocator_type = type;
+   fast_default_allocator.fetchAndStoreRelease(0);
 #else
    config().set("conf", "base/default_allocator", type);
 #endif
@@ -471,6 +486,9 @@ Library_State::~Library_State()
 #endif
 
    cached_default_allocator = 0;
+#ifdef BOTAN_TOOLS_ONLY
+   fast_default_allocator.fetchAndStoreRelease(0);
+#endif
 
    for(u32bit j = 0; j != allocators.size(); j++)
       {
@@ -22,15 +22,32 @@
 #include "qca_basic.h"
 
 #include "qcaprovider.h"
+#include "qca_plugin.h"
 
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QHash>
 #include <QMutexLocker>
+#include <QRunnable>
+#include <QSettings>
+#include <QThread>
+#include <QThreadPool>
+#include <QThreadStorage>
+#include <QVector>
+#include <QWaitCondition>
 #include <QtGlobal>
 
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+# include <unistd.h>
+#endif
+
 namespace QCA {
 
 // from qca_core.cpp
-QMutex *global_random_mutex();
-Random *global_random();
 Provider::Context *getContext(const QString &type, Provider *p);
 
 // from qca_publickey.cpp
@@ -145,16 +162,152 @@ SecureArray Random::nextBytes(int size)
 	return static_cast<RandomContext *>(context())->nextBytes(size);
 }
 
+// each thread gets its own generator for the static functions, so that
+//   they don't all serialize on the global one.  the lock in ThreadRandom is
+//   only ever contended while the generators are being flushed.
+class ThreadRandom;
+
+class ThreadRandomList
+{
+public:
+	QMutex m;
+	QList<ThreadRandom*> list;
+};
+
+Q_GLOBAL_STATIC(ThreadRandomList, g_threadRandoms)
+Q_GLOBAL_STATIC(QThreadStorage<ThreadRandom*>, g_threadRandom)
+static QAtomicInt g_randomBufferSize;
+
+class ThreadRandom
+{
+public:
+	QMutex m;
+	Random *rng;
+	SecureArray buf;
+	int pos;
+	qint64 pid;
+
+	ThreadRandom() : rng(0), pos(0), pid(0)
+	{
+		ThreadRandomList *randoms = g_threadRandoms();
+		QMutexLocker locker(&randoms->m);
+		randoms->list += this;
+	}
+
+	~ThreadRandom()
+	{
+		// the list is gone if we are destroyed during application exit
+		ThreadRandomList *randoms = g_threadRandoms();
+		if(randoms)
+		{
+			QMutexLocker locker(&randoms->m);
+			randoms->list.removeAll(this);
+		}
+		delete rng;
+	}
+
+	SecureArray nextBytes(int size)
+	{
+		QMutexLocker locker(&m);
+		if(!rng)
+		{
+			// the generator is created without holding the lock, since
+			//   that may load the providers, which flushes the generators.
+			//   only this thread ever sets it.
+			locker.unlock();
+			Random *r = new Random(globalRandomProvider());
+			locker.relock();
+			rng = r;
+		}
+
+		// big requests, and everything when unbuffered, go straight to
+		//   the provider
+		int max = atomicLoadAcquire(g_randomBufferSize);
+		if(size > max)
+			return rng->nextBytes(size);
+
+		// a forked child must not hand out what is left of the
+		//   parent's buffer
+		qint64 current = QCoreApplication::applicationPid();
+		if(pid != current)
+		{
+			buf.clear();
+			pos = 0;
+			pid = current;
+		}
+
+		if(buf.size() - pos < size)
+		{
+			buf = rng->nextBytes(max);
+			pos = 0;
+
+			// the provider gave less than asked for
+			if(buf.size() < size)
+			{
+				buf.clear();
+				return rng->nextBytes(size);
+			}
+		}
+
+		// bytes are wiped from the buffer as they are handed out
+		SecureArray out(size);
+		memcpy(out.data(), buf.data() + pos, size);
+		memset(buf.data() + pos, 0, size);
+		pos += size;
+		return out;
+	}
+
+	// take out the generator if it belongs to the given provider, or
+	//   regardless if p is null
+	Random *take(Provider *p)
+	{
+		QMutexLocker locker(&m);
+		if(!rng || (p && rng->provider() != p))
+			return 0;
+		Random *out = rng;
+		rng = 0;
+		buf.clear();
+		pos = 0;
+		return out;
+	}
+};
+
+static ThreadRandom *local_thread_random()
+{
+	QThreadStorage<ThreadRandom*> *storage = g_threadRandom();
+	if(!storage->hasLocalData())
+		storage->setLocalData(new ThreadRandom);
+	return storage->localData();
+}
+
+void flush_thread_randoms(Provider *p)
+{
+	ThreadRandomList *randoms = g_threadRandoms();
+	if(!randoms)
+		return;
+
+	// generators are deleted outside of the locks, since that may release
+	//   contexts into the context pools
+	QList<Random*> dead;
+	randoms->m.lock();
+	foreach(ThreadRandom *r, randoms->list)
+	{
+		Random *rng = r->take(p);
+		if(rng)
+			dead += rng;
+	}
+	randoms->m.unlock();
+	qDeleteAll(dead);
+}
+
 uchar Random::randomChar()
 {
-	QMutexLocker locker(global_random_mutex());
-	return global_random()->nextByte();
+	return (uchar)local_thread_random()->nextBytes(1)[0];
 }
 
 int Random::randomInt()
 {
-	QMutexLocker locker(global_random_mutex());
-	SecureArray a = global_random()->nextBytes(sizeof(int));
+	SecureArray a = local_thread_random()->nextBytes(sizeof(int));
 	int x;
 	memcpy(&x, a.data(), a.size());
 	return x;
@@ -162,8 +315,19 @@ int Random::randomInt()
 
 SecureArray Random::randomArray(int size)
 {
-	QMutexLocker locker(global_random_mutex());
-	return global_random()->nextBytes(size);
+	return local_thread_random()->nextBytes(size);
+}
+
+void Random::setBufferSize(int size)
+{
+	if(size < 0)
+		size = 0;
+	g_randomBufferSize.fetchAndStoreRelease(size);
+}
+
+int Random::bufferSize()
+{
+	return atomicLoadAcquire(g_randomBufferSize);
 }
 
 //----------------------------------------------------------------------------
@@ -212,9 +376,16 @@ void Hash::update(const MemoryRegion &a)
 
 void Hash::update(const QByteArray &a)
 {
+	// shares the array, and providers without a view override would
+	//   have to copy a view
 	update(MemoryRegion(a));
 }
 
+void Hash::update(const MemoryRegionView &a)
+{
+	static_cast<HashContext *>(context())->update(a);
+}
+
 void Hash::update(const char *data, int len)
 {
 	if(len < 0)
@@ -225,14 +396,220 @@ void Hash::update(const char *data, int len)
 	update(MemoryRegion(QByteArray::fromRawData(data, len)));
 }
 
-// Reworked from KMD5, from KDE's kdelibs
+// reading starts with MinReadChunk sized reads, doubling up to MaxReadChunk
+//   while the device keeps filling them.  large files are mapped a window
+//   at a time, so that they don't need contiguous address space.
+enum
+{
+	MinReadChunk = 256 * 1024,
+	MaxReadChunk = 4 * 1024 * 1024,
+	MapWindow    = 64 * 1024 * 1024,
+	MaxReadAhead = 3
+};
+
+static int first_chunk_size(QIODevice *file)
+{
+	int chunk = MinReadChunk;
+
+	// don't allocate a big buffer for a small file.  ask for one more byte
+	//   than is left, so that the end is seen without another read.
+	if(!file->isSequential())
+	{
+		qint64 left = file->size() - file->pos();
+		if(left >= 0 && left < chunk)
+			chunk = qMax((int)left + 1, 1024);
+	}
+	return chunk;
+}
+
 void Hash::update(QIODevice *file)
 {
-	char buffer[1024];
-	int len;
+	int chunk = first_chunk_size(file);
+	QByteArray buffer;
+	buffer.resize(chunk);
+	qint64 len;
+
+	while((len = file->read(buffer.data(), chunk)) > 0)
+	{
+		update(buffer.constData(), (int)len);
+		if(len == chunk && chunk < MaxReadChunk)
+		{
+			chunk = qMin(chunk * 2, (int)MaxReadChunk);
+			buffer.resize(chunk);
+		}
+	}
+}
+
+enum MapResult
+{
+	MapUnsupported, // nothing has been passed to the hash
+	MapDone,
+	MapFailed       // part of the file has been passed to the hash
+};
+
+static MapResult update_mapped(Hash *hash, QFile *file)
+{
+	if(file->isSequential())
+		return MapUnsupported;
+
+	// some special files report a size of zero, so read those instead
+	qint64 size = file->size();
+	if(size <= 0)
+		return MapUnsupported;
 
-	while ((len=file->read(reinterpret_cast<char*>(buffer), sizeof(buffer))) > 0)
-		update(buffer, len);
+	for(qint64 at = 0; at < size; at += MapWindow)
+	{
+		qint64 len = qMin((qint64)MapWindow, size - at);
+		uchar *p = file->map(at, len);
+		if(!p)
+		{
+			file->unsetError();
+			if(at == 0)
+				return MapUnsupported;
+
+			// mapping worked before, so read the rest
+			if(!file->seek(at))
+				return MapFailed;
+			hash->update(file);
+			return MapDone;
+		}
+		hash->update((const char *)p, (int)len);
+		file->unmap(p);
+	}
+	return MapDone;
+}
+
+class FileReadAhead : public QThread
+{
+public:
+	class Chunk
+	{
+	public:
+		QByteArray buf;
+		int len;
+	};
+
+	QString fileName;
+	QMutex m;
+	QWaitCondition w;
+	QList<Chunk> filled;
+	QList<QByteArray> spare;
+	bool done, failed;
+
+	FileReadAhead(const QString &_fileName) : fileName(_fileName), done(false), failed(false)
+	{
+	}
+
+	// called from the hashing thread.  returns false at the end of the file
+	bool next(Chunk *c)
+	{
+		QMutexLocker locker(&m);
+		while(filled.isEmpty() && !done)
+			w.wait(&m);
+		if(filled.isEmpty())
+			return false;
+		*c = filled.takeFirst();
+		w.wakeAll();
+		return true;
+	}
+
+	// hand a chunk back for reuse once it has been hashed
+	void recycle(Chunk *c)
+	{
+		QMutexLocker locker(&m);
+		spare += c->buf;
+		c->buf.clear();
+	}
+
+protected:
+	virtual void run()
+	{
+		QFile f(fileName);
+		bool ok = f.open(QIODevice::ReadOnly);
+		int chunk = ok ? first_chunk_size(&f) : 0;
+		while(ok)
+		{
+			Chunk c;
+			{
+				QMutexLocker locker(&m);
+				while(filled.count() >= MaxReadAhead)
+					w.wait(&m);
+				if(!spare.isEmpty())
+					c.buf = spare.takeFirst();
+			}
+
+			if(c.buf.size() < chunk)
+				c.buf.resize(chunk);
+			qint64 len = f.read(c.buf.data(), chunk);
+			if(len < 0)
+				ok = false;
+			if(len <= 0)
+				break;
+			c.len = (int)len;
+
+			{
+				QMutexLocker locker(&m);
+				filled += c;
+				w.wakeAll();
+			}
+
+			if(len == chunk && chunk < MaxReadChunk)
+				chunk = qMin(chunk * 2, (int)MaxReadChunk);
+		}
+
+		QMutexLocker locker(&m);
+		failed = !ok;
+		done = true;
+		w.wakeAll();
+	}
+};
+
+MemoryRegion Hash::hashFile(const QString &fileName, bool readAhead)
+{
+	clear();
+
+	QFile file(fileName);
+	if(!file.open(QIODevice::ReadOnly))
+		return MemoryRegion();
+
+	if(readAhead)
+	{
+		file.close();
+
+		FileReadAhead reader(fileName);
+		reader.start();
+		FileReadAhead::Chunk c;
+		while(reader.next(&c))
+		{
+			update(c.buf.constData(), c.len);
+			reader.recycle(&c);
+		}
+		reader.wait();
+
+		if(reader.failed)
+		{
+			clear();
+			return MemoryRegion();
+		}
+	}
+	else
+	{
+		MapResult r = update_mapped(this, &file);
+		if(r == MapUnsupported)
+			update(&file);
+		else if(r == MapFailed)
+		{
+			clear();
+			return MemoryRegion();
+		}
+	}
+
+	if(file.error() != QFile::NoError)
+	{
+		clear();
+		return MemoryRegion();
+	}
+	return final();
 }
 
 MemoryRegion Hash::final()
@@ -250,6 +627,259 @@ QString Hash::hashToString(const MemoryRegion &a)
 	return arrayToHex(hash(a).toByteArray());
 }
 
+QList<MemoryRegion> Hash::hashMany(const QList<MemoryRegion> &regions)
+{
+	QVector<MemoryRegion> v = regions.toVector();
+	return hashMany(v.constData(), v.count());
+}
+
+QList<MemoryRegion> Hash::hashMany(const MemoryRegion *regions, int count)
+{
+	if(count <= 0)
+	{
+		clear();
+		return QList<MemoryRegion>();
+	}
+	return static_cast<HashContext *>(context())->hashMany(regions, count);
+}
+
+//----------------------------------------------------------------------------
+// TreeHash
+//----------------------------------------------------------------------------
+// leaves and nodes get different prefixes, so that one can't be passed off
+//   as the other
+static const char tree_leaf_prefix = 0x00;
+static const char tree_node_prefix = 0x01;
+
+static MemoryRegion tree_hash_leaf(Hash *hash, const MemoryRegion &leaf)
+{
+	hash->clear();
+	hash->update(&tree_leaf_prefix, 1);
+	hash->update(leaf);
+	return hash->final();
+}
+
+class TreeHashJob : public QRunnable
+{
+public:
+	QString type, provider;
+	QList<QByteArray> leaves;
+	QList<MemoryRegion> digests;
+	QMutex *m;
+	QWaitCondition *w;
+	bool done;
+
+	TreeHashJob() : done(false)
+	{
+		setAutoDelete(false);
+	}
+
+	virtual void run()
+	{
+		Hash hash(type, provider);
+		for(int n = 0; n < leaves.count(); ++n)
+			digests += tree_hash_leaf(&hash, leaves[n]);
+		leaves.clear();
+
+		QMutexLocker locker(m);
+		done = true;
+		w->wakeAll();
+	}
+};
+
+class TreeHash::Private
+{
+public:
+	QString type, provider;
+	int leafSize;
+	int leavesPerJob;
+	int maxJobs;
+	bool threaded;
+	Hash hash;
+	QByteArray leaf;
+	QList<QByteArray> pending;
+	QList<TreeHashJob*> jobs;
+	QList<MemoryRegion> leafDigests;
+	bool haveLeaves;
+	QMutex m;
+	QWaitCondition w;
+
+	Private(const QString &_type, int _leafSize, const QString &_provider) :
+		type(_type), provider(_provider), leafSize(qMax(_leafSize, 1)), hash(_type, _provider), haveLeaves(false)
+	{
+		// jobs should be big enough for the threading to pay off, and there
+		//   should be enough of them in flight to keep the pool busy without
+		//   buffering too much of the message
+		leavesPerJob = qMax(1, (256 * 1024) / leafSize);
+		int threads = QThreadPool::globalInstance()->maxThreadCount();
+		maxJobs = 2 * qMax(threads, 1);
+		threaded = (threads > 1);
+	}
+
+	~Private()
+	{
+		collect(true);
+	}
+
+	void submit()
+	{
+		TreeHashJob *job = new TreeHashJob;
+		job->type = type;
+		job->provider = provider;
+		job->leaves = pending;
+		job->m = &m;
+		job->w = &w;
+		pending.clear();
+		haveLeaves = true;
+
+		// a job is only handed to the pool if a thread can take it right
+		//   away.  a queued job could wait behind the thread we are
+		//   running on, when that is a pool thread itself, and waiting
+		//   for it would then never end.
+		jobs += job;
+		if(!threaded || !QThreadPool::globalInstance()->tryStart(job))
+			job->run();
+
+		collect(false);
+	}
+
+	// take the results of finished jobs, in order.  unless all is set,
+	//   only wait if there are too many jobs in flight.
+	void collect(bool all)
+	{
+		while(!jobs.isEmpty())
+		{
+			TreeHashJob *job = jobs.first();
+			{
+				QMutexLocker locker(&m);
+				if(!job->done)
+				{
+					if(!all && jobs.count() < maxJobs)
+						break;
+					while(!job->done)
+						w.wait(&m);
+				}
+			}
+
+			leafDigests += job->digests;
+			jobs.removeFirst();
+			delete job;
+		}
+	}
+
+	void reset()
+	{
+		collect(true);
+		leaf.clear();
+		pending.clear();
+		leafDigests.clear();
+		haveLeaves = false;
+	}
+};
+
+TreeHash::TreeHash(const QString &type, int leafSize, const QString &provider)
+{
+	d = new Private(type, leafSize, provider);
+}
+
+TreeHash::~TreeHash()
+{
+	delete d;
+}
+
+QString TreeHash::type() const
+{
+	return d->type;
+}
+
+int TreeHash::leafSize() const
+{
+	return d->leafSize;
+}
+
+void TreeHash::clear()
+{
+	d->reset();
+}
+
+void TreeHash::update(const MemoryRegion &a)
+{
+	update(MemoryRegionView(a));
+}
+
+void TreeHash::update(const MemoryRegionView &a)
+{
+	const char *p = a.data();
+	int len = a.size();
+	while(len > 0)
+	{
+		if(d->leaf.isEmpty())
+			d->leaf.reserve(d->leafSize);
+
+		int take = qMin(len, d->leafSize - d->leaf.size());
+		d->leaf.append(p, take);
+		p += take;
+		len -= take;
+
+		if(d->leaf.size() == d->leafSize)
+		{
+			d->pending += d->leaf;
+			d->leaf = QByteArray();
+			if(d->pending.count() >= d->leavesPerJob)
+				d->submit();
+		}
+	}
+}
+
+MemoryRegion TreeHash::final()
+{
+	// the last leaf may be short.  an empty message is one empty leaf.
+	if(!d->leaf.isEmpty() || (!d->haveLeaves && d->pending.isEmpty()))
+	{
+		d->pending += d->leaf;
+		d->leaf = QByteArray();
+	}
+	if(!d->pending.isEmpty())
+		d->submit();
+	d->collect(true);
+
+	return rootFromLeaves(d->leafDigests);
+}
+
+QList<MemoryRegion> TreeHash::leafDigests() const
+{
+	return d->leafDigests;
+}
+
+MemoryRegion TreeHash::hashLeaf(const MemoryRegion &leaf)
+{
+	return tree_hash_leaf(&d->hash, leaf);
+}
+
+MemoryRegion TreeHash::rootFromLeaves(const QList<MemoryRegion> &leaves)
+{
+	if(leaves.isEmpty())
+		return MemoryRegion();
+
+	QList<MemoryRegion> level = leaves;
+	while(level.count() > 1)
+	{
+		QList<MemoryRegion> next;
+		for(int n = 0; n + 1 < level.count(); n += 2)
+		{
+			d->hash.clear();
+			d->hash.update(&tree_node_prefix, 1);
+			d->hash.update(level[n]);
+			d->hash.update(level[n + 1]);
+			next += d->hash.final();
+		}
+		if(level.count() % 2)
+			next += level.last();
+		level = next;
+	}
+	return level.first();
+}
+
 //----------------------------------------------------------------------------
 // Cipher
 //----------------------------------------------------------------------------
@@ -373,6 +1003,34 @@ MemoryRegion Cipher::update(const MemoryRegion &a)
 	return out;
 }
 
+MemoryRegion Cipher::update(const MemoryRegionView &a)
+{
+	SecureArray out;
+	if(d->done)
+		return out;
+	d->ok = static_cast<CipherContext *>(context())->update(a, &out);
+	return out;
+}
+
+int Cipher::update(const MemoryRegionView &in, char *out, int outSize)
+{
+	if(d->done)
+		return 0;
+	int len = static_cast<CipherContext *>(context())->update(in, out, outSize);
+	d->ok = (len >= 0);
+	return len;
+}
+
+int Cipher::final(char *out, int outSize)
+{
+	if(d->done)
+		return 0;
+	d->done = true;
+	int len = static_cast<CipherContext *>(context())->final(out, outSize);
+	d->ok = (len >= 0);
+	return len;
+}
+
 MemoryRegion Cipher::final()
 {
 	SecureArray out;
@@ -529,6 +1187,13 @@ void MessageAuthenticationCode::update(const MemoryRegion &a)
 	static_cast<MACContext *>(context())->update(a);
 }
 
+void MessageAuthenticationCode::update(const MemoryRegionView &a)
+{
+	if(d->done)
+		return;
+	static_cast<MACContext *>(context())->update(a);
+}
+
 MemoryRegion MessageAuthenticationCode::final()
 {
 	if(!d->done)
@@ -548,6 +1213,169 @@ void MessageAuthenticationCode::setup(const SymmetricKey &key)
 //----------------------------------------------------------------------------
 // Key Derivation Function
 //----------------------------------------------------------------------------
+// one piece of work in a KDF batch: part of the key for one secret and salt
+struct KDFUnit
+{
+	int item;
+	unsigned int offset, length;
+};
+
+class KDFBatch
+{
+public:
+	QVector<SecureArray> secrets;
+	QVector<InitializationVector> salts;
+	unsigned int keyLength, iterationCount;
+	QVector<KDFUnit> units;
+	QVector<SymmetricKey> parts;
+	QAtomicInt next;
+	QMutex m;
+	QWaitCondition w;
+	int running;
+
+	KDFBatch() : next(0), running(0)
+	{
+	}
+
+	// take units until there are none left.  units and parts are sized
+	//   before any worker starts, and each unit writes only its own part.
+	void work(KDFContext *c)
+	{
+		const KDFUnit *u = units.constData();
+		SymmetricKey *out = parts.data();
+		int count = units.count();
+		while(true)
+		{
+			int n = next.fetchAndAddRelaxed(1);
+			if(n >= count)
+				break;
+			const SecureArray &secret = secrets.at(u[n].item);
+			const InitializationVector &salt = salts.at(u[n].item);
+			if(u[n].offset == 0 && u[n].length == keyLength)
+				out[n] = c->makeKey(secret, salt, keyLength, iterationCount);
+			else
+				out[n] = c->makeKeyPart(secret, salt, keyLength, iterationCount, u[n].offset, u[n].length);
+		}
+	}
+};
+
+class KDFWorker : public QRunnable
+{
+public:
+	KDFBatch *batch;
+	KDFContext *c;
+
+	KDFWorker(KDFBatch *_batch, KDFContext *_c) : batch(_batch), c(_c)
+	{
+	}
+
+	~KDFWorker()
+	{
+		delete c;
+	}
+
+	virtual void run()
+	{
+		batch->work(c);
+
+		QMutexLocker locker(&batch->m);
+		--batch->running;
+		batch->w.wakeAll();
+	}
+};
+
+// derive one key per secret and salt pair.  the keys are split into parts
+//   of whole blocks when that is needed to give every pool thread some
+//   work, and the calling thread computes parts too, so nothing is lost
+//   when the pool is busy.
+static QList<SymmetricKey> kdf_make_keys(KDFContext *c, const QVector<SecureArray> &secrets, const QVector<InitializationVector> &salts, unsigned int keyLength, unsigned int iterationCount)
+{
+	KDFBatch batch;
+	batch.secrets = secrets;
+	batch.salts = salts;
+	batch.keyLength = keyLength;
+	batch.iterationCount = iterationCount;
+
+	int items = secrets.count();
+	int threads = qMax(QThreadPool::globalInstance()->maxThreadCount(), 1);
+	unsigned int step = keyLength;
+	unsigned int bs = (unsigned int)qMax(c->blockSize(), 0);
+	if(bs > 0 && keyLength > bs && items < threads)
+	{
+		unsigned int blocks = (keyLength + bs - 1) / bs;
+		unsigned int want = (threads + items - 1) / items;
+		step = (blocks + want - 1) / want * bs;
+	}
+
+	for(int n = 0; n < items; ++n)
+	{
+		unsigned int offset = 0;
+		do
+		{
+			KDFUnit u;
+			u.item = n;
+			u.offset = offset;
+			u.length = qMin(step, keyLength - offset);
+			batch.units += u;
+			offset += step;
+		} while(offset < keyLength);
+	}
+	batch.parts.resize(batch.units.count());
+
+	// use whatever pool threads are free right now, rather than queueing
+	//   behind other work
+	int helpers = qMin(threads, batch.units.count()) - 1;
+	for(int n = 0; n < helpers; ++n)
+	{
+		KDFWorker *worker = new KDFWorker(&batch, static_cast<KDFContext *>(c->clone()));
+		{
+			QMutexLocker locker(&batch.m);
+			++batch.running;
+		}
+		if(!QThreadPool::globalInstance()->tryStart(worker))
+		{
+			delete worker;
+			QMutexLocker locker(&batch.m);
+			--batch.running;
+			break;
+		}
+	}
+
+	batch.work(c);
+	{
+		QMutexLocker locker(&batch.m);
+		while(batch.running > 0)
+			batch.w.wait(&batch.m);
+	}
+
+	QList<SymmetricKey> out;
+	int at = 0;
+	for(int n = 0; n < items; ++n)
+	{
+		if(batch.units[at].length == keyLength)
+		{
+			out += batch.parts[at++];
+			continue;
+		}
+
+		// a provider signals failure with an empty key, so a short part
+		//   spoils the whole key
+		SecureArray key(keyLength);
+		bool ok = true;
+		while(at < batch.units.count() && batch.units[at].item == n)
+		{
+			const KDFUnit &u = batch.units[at];
+			if((unsigned int)batch.parts[at].size() == u.length)
+				memcpy(key.data() + u.offset, batch.parts[at].constData(), u.length);
+			else
+				ok = false;
+			++at;
+		}
+		out += ok ? SymmetricKey(key) : SymmetricKey();
+	}
+	return out;
+}
+
 KeyDerivationFunction::KeyDerivationFunction(const QString &type, const QString &provider)
 :Algorithm(type, provider)
 {
@@ -570,7 +1398,127 @@ KeyDerivationFunction & KeyDerivationFunction::operator=(const KeyDerivationFunc
 
 SymmetricKey KeyDerivationFunction::makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount)
 {
-	return static_cast<KDFContext *>(context())->makeKey(secret, salt, keyLength, iterationCount);
+	KDFContext *c = static_cast<KDFContext *>(context());
+	int bs = c->blockSize();
+	if(bs <= 0 || keyLength <= (unsigned int)bs)
+		return c->makeKey(secret, salt, keyLength, iterationCount);
+
+	QVector<SecureArray> secrets(1, secret);
+	QVector<InitializationVector> salts(1, salt);
+	return kdf_make_keys(c, secrets, salts, keyLength, iterationCount).first();
+}
+
+QList<SymmetricKey> KeyDerivationFunction::makeKeys(const QList<SecureArray> &secrets, const QList<InitializationVector> &salts, unsigned int keyLength, unsigned int iterationCount)
+{
+	// a single secret or salt goes with every entry of the other list
+	int count = qMax(secrets.count(), salts.count());
+	if(secrets.isEmpty() || salts.isEmpty()
+		|| (secrets.count() != count && secrets.count() != 1)
+		|| (salts.count() != count && salts.count() != 1))
+		return QList<SymmetricKey>();
+
+	QVector<SecureArray> s = secrets.toVector();
+	if(s.count() != count)
+		s.fill(secrets.first(), count);
+	QVector<InitializationVector> v = salts.toVector();
+	if(v.count() != count)
+		v.fill(salts.first(), count);
+	return kdf_make_keys(static_cast<KDFContext *>(context()), s, v, keyLength, iterationCount);
+}
+
+// the measured speed of iteration based KDFs, in iterations per
+//   millisecond for one block, for each provider and type.  measurements
+//   are shared by the whole process, and optionally kept in a profile on
+//   disk for the next run.
+//
+// a stored speed only ever lowers the work done when it is too low, so it
+//   is not trusted blindly: every derivation takes a quick measurement as
+//   well, and measures again properly if the stored speed is far below
+//   it.  profile entries are kept per format version and machine, and no
+//   key gets fewer than KDFMinIterations iterations.
+enum
+{
+	KDFMinIterations = 1000,
+	KDFMeasureNsecs  = 20000000,
+	KDFCheckNsecs    = 2000000
+};
+
+class KDFCalibration
+{
+public:
+	QMutex m;
+	QHash<QString, double> rates;
+	QString profile;
+};
+
+Q_GLOBAL_STATIC(KDFCalibration, g_kdfCalibration)
+
+static QString kdf_calibration_key(const KDFContext *c)
+{
+	return c->provider()->name() + '/' + c->type();
+}
+
+// the group of the profile that holds the measurements of this machine
+static QString kdf_profile_group()
+{
+	QByteArray host;
+#if defined(Q_OS_UNIX)
+	char name[256];
+	if(gethostname(name, sizeof(name)) == 0)
+	{
+		name[sizeof(name) - 1] = 0;
+		host = name;
+	}
+#elif defined(Q_OS_WIN)
+	host = qgetenv("COMPUTERNAME");
+#endif
+	host += '/' + QByteArray::number(QThread::idealThreadCount());
+	host += '/' + QByteArray::number(QT_POINTER_SIZE);
+
+	QByteArray id = QCryptographicHash::hash(host, QCryptographicHash::Sha1).toHex().left(16);
+	return QString("kdf/v1-") + QString::fromLatin1(id);
+}
+
+static double kdf_calibrated_rate(const QString &key)
+{
+	KDFCalibration *cal = g_kdfCalibration();
+	QMutexLocker locker(&cal->m);
+	return cal->rates.value(key, 0);
+}
+
+static void kdf_store_rate(const QString &key, double rate)
+{
+	KDFCalibration *cal = g_kdfCalibration();
+	QMutexLocker locker(&cal->m);
+	cal->rates.insert(key, rate);
+	if(!cal->profile.isEmpty())
+	{
+		QSettings settings(cal->profile, QSettings::IniFormat);
+		settings.beginGroup(kdf_profile_group());
+		settings.setValue(key, rate);
+		settings.endGroup();
+		settings.sync();
+	}
+}
+
+// time the derivation of a single block, doubling the iteration count until
+//   the measurement takes at least nsecs.  this costs about twice that,
+//   whatever interval the caller asked for.
+static double kdf_measure_rate(KDFContext *c, unsigned int blockLength, qint64 minNsecs)
+{
+	SecureArray secret("calibration");
+	InitializationVector salt(SecureArray("calibration salt"));
+	unsigned int iterations = 256;
+	QElapsedTimer timer;
+	while(true)
+	{
+		timer.start();
+		c->makeKey(secret, salt, blockLength, iterations);
+		qint64 nsecs = timer.nsecsElapsed();
+		if(nsecs >= minNsecs || iterations >= 0x40000000)
+			return iterations / (qMax(nsecs, (qint64)1) / 1000000.0);
+		iterations *= 2;
+	}
 }
 
 SymmetricKey KeyDerivationFunction::makeKey(const SecureArray &secret,
@@ -579,11 +1527,94 @@ SymmetricKey KeyDerivationFunction::makeKey(const SecureArray &secret,
 											int msecInterval,
 											unsigned int *iterationCount)
 {
-	return static_cast<KDFContext *>(context())->makeKey(secret,
-														 salt,
-														 keyLength,
-														 msecInterval,
-														 iterationCount);
+	KDFContext *c = static_cast<KDFContext *>(context());
+
+	// only the iteration count based functions can be calibrated from a
+	//   stored speed.  the memory-hard ones calibrate themselves.
+	if(!type().startsWith("pbkdf"))
+		return c->makeKey(secret, salt, keyLength, msecInterval, iterationCount);
+
+	Q_ASSERT(iterationCount != NULL);
+	QString key = kdf_calibration_key(c);
+	int bs = c->blockSize();
+	unsigned int blockLength = bs > 0 ? qMin(keyLength, (unsigned int)bs) : keyLength;
+	blockLength = qMax(blockLength, 1u);
+	double rate = kdf_calibrated_rate(key);
+	if(rate > 0 && rate < kdf_measure_rate(c, blockLength, KDFCheckNsecs) / 2)
+		rate = 0;
+	if(rate <= 0)
+	{
+		rate = kdf_measure_rate(c, blockLength, KDFMeasureNsecs);
+		kdf_store_rate(key, rate);
+	}
+
+	// the time is the work of one thread doing every block in turn, as
+	//   the providers have always measured it, even though the blocks may
+	//   then be computed in parallel
+	unsigned int blocks = bs > 0 ? qMax((keyLength + bs - 1) / bs, 1u) : 1;
+	double count = rate * msecInterval / blocks;
+	*iterationCount = (unsigned int)qBound((double)KDFMinIterations, count, (double)0x7fffffff);
+	return makeKey(secret, salt, keyLength, *iterationCount);
+}
+
+void KeyDerivationFunction::setCalibrationProfile(const QString &fileName)
+{
+	KDFCalibration *cal = g_kdfCalibration();
+	QMutexLocker locker(&cal->m);
+	cal->profile = fileName;
+	if(fileName.isEmpty())
+		return;
+
+	// measurements already made in this process take precedence
+	QSettings settings(fileName, QSettings::IniFormat);
+	settings.beginGroup(kdf_profile_group());
+	foreach(const QString &key, settings.allKeys())
+	{
+		double rate = settings.value(key).toDouble();
+		if(rate > 0 && !cal->rates.contains(key))
+			cal->rates.insert(key, rate);
+	}
+	settings.endGroup();
+}
+
+QString KeyDerivationFunction::calibrationProfile()
+{
+	KDFCalibration *cal = g_kdfCalibration();
+	QMutexLocker locker(&cal->m);
+	return cal->profile;
+}
+
+void KeyDerivationFunction::clearCalibration()
+{
+	KDFCalibration *cal = g_kdfCalibration();
+	QMutexLocker locker(&cal->m);
+	cal->rates.clear();
+	if(!cal->profile.isEmpty())
+	{
+		QSettings settings(cal->profile, QSettings::IniFormat);
+		settings.remove("kdf");
+		settings.sync();
+	}
+}
+
+unsigned int KeyDerivationFunction::memoryCost() const
+{
+	return static_cast<const KDFContext *>(context())->memoryCost();
+}
+
+void KeyDerivationFunction::setMemoryCost(unsigned int kib)
+{
+	static_cast<KDFContext *>(context())->setMemoryCost(kib);
+}
+
+int KeyDerivationFunction::parallelism() const
+{
+	return static_cast<const KDFContext *>(context())->parallelism();
+}
+
+void KeyDerivationFunction::setParallelism(int lanes)
+{
+	static_cast<KDFContext *>(context())->setParallelism(lanes);
 }
 
 QString KeyDerivationFunction::withAlgorithm(const QString &kdfType, const QString &algType)
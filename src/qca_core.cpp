@@ -31,12 +31,18 @@
 // for qAddPostRoutine
 #include <QCoreApplication>
 
+#include <QAtomicPointer>
+#include <QHash>
 #include <QMutex>
+#include <QPair>
 #include <QSettings>
+#include <QThreadStorage>
 #include <QVariantMap>
 #include <QWaitCondition>
 #include <QDir>
 
+#include <string.h>
+
 #ifdef Q_OS_UNIX
 # include <unistd.h>
 #endif
@@ -75,6 +81,12 @@ void botan_deinit();
 // from qca_default
 Provider *create_default_provider();
 
+// from qca_basic.cpp
+void flush_thread_randoms(Provider *p);
+
+// below
+void flush_context_pools(Provider *p);
+
 //----------------------------------------------------------------------------
 // Global
 //----------------------------------------------------------------------------
@@ -83,15 +95,15 @@ class Global
 public:
 	int refs;
 	bool secmem;
-	bool loaded;
-	bool first_scan;
+	QAtomicInt loaded;
+	QAtomicInt first_scan;
 	QString app_name;
 	QMutex name_mutex;
 	ProviderManager *manager;
 	QMutex scan_mutex;
 	Random *rng;
 	QMutex rng_mutex;
-	Logger *logger;
+	QAtomicPointer<Logger> logger;
 	QVariantMap properties;
 	QMutex prop_mutex;
 	QMap<QString,QVariantMap> config;
@@ -102,10 +114,7 @@ public:
 	{
 		refs = 0;
 		secmem = false;
-		loaded = false;
-		first_scan = false;
 		rng = 0;
-		logger = 0;
 		manager = new ProviderManager;
 	}
 
@@ -114,30 +123,40 @@ public:
 		KeyStoreManager::shutdown();
 		delete rng;
 		rng = 0;
+		flush_thread_randoms(0);
+		flush_context_pools(0);
 		delete manager;
 		manager = 0;
-		delete logger;
-		logger = 0;
+		delete logger.fetchAndStoreOrdered(0);
 	}
 
+	// the flags are checked without locking first, since these are
+	//   called for every context creation and are almost always set
+
 	void ensure_loaded()
 	{
+		if(atomicLoadAcquire(loaded))
+			return;
+
 		// probably we shouldn't overload scan mutex, or else rename it
 		QMutexLocker locker(&scan_mutex);
-		if(!loaded)
+		if(!atomicLoadAcquire(loaded))
 		{
-			loaded = true;
 			manager->setDefault(create_default_provider()); // manager owns it
+			loaded.fetchAndStoreRelease(1);
 		}
 	}
 
 	bool ensure_first_scan()
 	{
+		if(atomicLoadAcquire(first_scan))
+			return false;
+
 		scan_mutex.lock();
-		if(!first_scan)
+		if(!atomicLoadAcquire(first_scan))
 		{
-			first_scan = true;
 			manager->scan();
+			first_scan.fetchAndStoreRelease(1);
 			scan_mutex.unlock();
 			return true;
 		}
@@ -148,8 +167,8 @@ public:
 	void scan()
 	{
 		scan_mutex.lock();
-		first_scan = true;
 		manager->scan();
+		first_scan.fetchAndStoreRelease(1);
 		scan_mutex.unlock();
 	}
 
@@ -158,18 +177,34 @@ public:
 		KeyStoreManager::scan();
 	}
 
+	// this is called by every QCA_logTextMessage, so once the logger
+	//   exists it is returned without locking
 	Logger *get_logger()
 	{
+#if QT_VERSION >= 0x050000
+		Logger *l = logger.loadAcquire();
+#else
+		Logger *l = logger;
+#endif
+		if(l)
+			return l;
+
 		QMutexLocker locker(&logger_mutex);
-		if(!logger)
+#if QT_VERSION >= 0x050000
+		l = logger.loadAcquire();
+#else
+		l = logger;
+#endif
+		if(!l)
 		{
-			logger = new Logger;
+			l = new Logger;
 
 			// needed so deinit may delete the logger regardless
 			//   of what thread the logger was created from
-			logger->moveToThread(0);
+			l->moveToThread(0);
+			logger.fetchAndStoreRelease(l);
 		}
-		return logger;
+		return l;
 	}
 
 	void unloadAllPlugins()
@@ -454,6 +489,30 @@ Provider *defaultProvider()
 	return global->manager->find("default");
 }
 
+int providerCacheHits()
+{
+	if(!global_check())
+		return 0;
+
+	return global->manager->cacheHits();
+}
+
+int providerCacheMisses()
+{
+	if(!global_check())
+		return 0;
+
+	return global->manager->cacheMisses();
+}
+
+void resetProviderCacheStatistics()
+{
+	if(!global_check())
+		return;
+
+	global->manager->resetCacheStatistics();
+}
+
 QStringList pluginPaths()
 {
 	QStringList paths;
@@ -725,9 +784,14 @@ QString globalRandomProvider()
 
 void setGlobalRandomProvider(const QString &provider)
 {
-	QMutexLocker locker(global_random_mutex());
-	delete global->rng;
-	global->rng = new Random(provider);
+	{
+		QMutexLocker locker(global_random_mutex());
+		delete global->rng;
+		global->rng = new Random(provider);
+	}
+
+	// the per-thread generators pick up the new provider when next used
+	flush_thread_randoms(0);
 }
 
 Logger *logger()
@@ -866,8 +930,165 @@ static Provider *getProviderForType(const QString &type, const QString &provider
 	return p;
 }
 
+//----------------------------------------------------------------------------
+// Context pool
+//----------------------------------------------------------------------------
+// Each thread that creates algorithm objects gets its own pool of idle
+//   contexts, keyed by (provider, type).  The pools are also kept in a global
+//   list so that contexts can be flushed when their provider goes away, and
+//   each pool has its own mutex for that reason.  The mutex is only ever
+//   contended during a flush.
+class ContextPool;
+
+class ContextPoolList
+{
+public:
+	QMutex m;
+	QList<ContextPool*> list;
+};
+
+Q_GLOBAL_STATIC(ContextPoolList, g_contextPools)
+Q_GLOBAL_STATIC(QThreadStorage<ContextPool*>, g_contextPool)
+static QAtomicInt g_contextPoolSize;
+
+class ContextPool
+{
+public:
+	typedef QPair<Provider*,QString> Key;
+
+	QMutex m;
+	QHash<Key, QList<Provider::Context*> > contexts;
+
+	ContextPool()
+	{
+		ContextPoolList *pools = g_contextPools();
+		QMutexLocker locker(&pools->m);
+		pools->list += this;
+	}
+
+	~ContextPool()
+	{
+		// the list is gone if we are destroyed during application exit
+		ContextPoolList *pools = g_contextPools();
+		if(pools)
+		{
+			QMutexLocker locker(&pools->m);
+			pools->list.removeAll(this);
+		}
+		qDeleteAll(takeAll(0));
+	}
+
+	Provider::Context *take(Provider *p, const QString &type)
+	{
+		QMutexLocker locker(&m);
+		QHash<Key, QList<Provider::Context*> >::Iterator it = contexts.find(Key(p, type));
+		if(it == contexts.end() || it->isEmpty())
+			return 0;
+		return it->takeLast();
+	}
+
+	bool put(Provider::Context *c, int max)
+	{
+		QMutexLocker locker(&m);
+		QList<Provider::Context*> &list = contexts[Key(c->provider(), c->type())];
+		if(list.count() >= max)
+			return false;
+		list += c;
+		return true;
+	}
+
+	// take out contexts of the given provider, or all of them if p is null
+	QList<Provider::Context*> takeAll(Provider *p)
+	{
+		QList<Provider::Context*> out;
+		QMutexLocker locker(&m);
+		QHash<Key, QList<Provider::Context*> >::Iterator it = contexts.begin();
+		while(it != contexts.end())
+		{
+			if(!p || it.key().first == p)
+			{
+				out += it.value();
+				it = contexts.erase(it);
+			}
+			else
+				++it;
+		}
+		return out;
+	}
+};
+
+static ContextPool *local_context_pool()
+{
+	QThreadStorage<ContextPool*> *storage = g_contextPool();
+	if(!storage->hasLocalData())
+		storage->setLocalData(new ContextPool);
+	return storage->localData();
+}
+
+// only hash contexts are pooled, since they hold no secrets once reset.
+//   MAC and cipher contexts would keep the previous key schedule in memory
+//   while idle, and providers cannot be relied upon to accept an empty key
+//   to wipe it.
+static bool poolable_context(Provider::Context *c)
+{
+	return qobject_cast<HashContext*>(c) != 0;
+}
+
+void flush_context_pools(Provider *p)
+{
+	ContextPoolList *pools = g_contextPools();
+	if(!pools)
+		return;
+
+	// contexts are deleted outside of the locks, in case their destructors
+	//   release further contexts
+	QList<Provider::Context*> dead;
+	pools->m.lock();
+	foreach(ContextPool *pool, pools->list)
+		dead += pool->takeAll(p);
+	pools->m.unlock();
+	qDeleteAll(dead);
+}
+
+static void release_context(Provider::Context *c)
+{
+	if(!c)
+		return;
+
+	int max = atomicLoadAcquire(g_contextPoolSize);
+	if(max > 0 && poolable_context(c))
+	{
+		static_cast<HashContext*>(c)->clear();
+		if(local_context_pool()->put(c, max))
+			return;
+	}
+
+	delete c;
+}
+
+void setContextPoolSize(int size)
+{
+	if(size < 0)
+		size = 0;
+	g_contextPoolSize.fetchAndStoreRelease(size);
+	if(size == 0)
+		flush_context_pools(0);
+}
+
+int contextPoolSize()
+{
+	return atomicLoadAcquire(g_contextPoolSize);
+}
+
 static inline Provider::Context *doCreateContext(Provider *p, const QString &type)
 {
+	if(atomicLoadAcquire(g_contextPoolSize) > 0)
+	{
+		Provider::Context *c = local_context_pool()->take(p, type);
+		if(c)
+			return c;
+	}
+
 	return p->createContext(type);
 }
 
@@ -1018,6 +1239,120 @@ QStringList InfoContext::supportedMACTypes() const
 	return QStringList();
 }
 
+// copy views for the implementations that only take owned memory
+static SecureArray view_to_array(const MemoryRegionView &a)
+{
+	SecureArray buf(a.size());
+	memcpy(buf.data(), a.data(), a.size());
+	return buf;
+}
+
+static MemoryRegion view_to_region(const MemoryRegionView &a)
+{
+	if(a.isSecure())
+		return view_to_array(a);
+	return a.toByteArray();
+}
+
+//----------------------------------------------------------------------------
+// HashContext
+//----------------------------------------------------------------------------
+void HashContext::update(const MemoryRegionView &a)
+{
+	update(view_to_region(a));
+}
+
+QList<MemoryRegion> HashContext::hashMany(const MemoryRegion *regions, int count)
+{
+	QList<MemoryRegion> out;
+	for(int n = 0; n < count; ++n)
+	{
+		clear();
+		update(regions[n]);
+		out += final();
+	}
+	clear();
+	return out;
+}
+
+//----------------------------------------------------------------------------
+// CipherContext
+//----------------------------------------------------------------------------
+bool CipherContext::update(const MemoryRegionView &in, SecureArray *out)
+{
+	return update(view_to_array(in), out);
+}
+
+int CipherContext::update(const MemoryRegionView &in, char *out, int outSize)
+{
+	SecureArray buf;
+	if(!update(in, &buf) || buf.size() > outSize)
+		return -1;
+	memcpy(out, buf.data(), buf.size());
+	return buf.size();
+}
+
+int CipherContext::final(char *out, int outSize)
+{
+	SecureArray buf;
+	if(!final(&buf) || buf.size() > outSize)
+		return -1;
+	memcpy(out, buf.data(), buf.size());
+	return buf.size();
+}
+
+//----------------------------------------------------------------------------
+// MACContext
+//----------------------------------------------------------------------------
+void MACContext::update(const MemoryRegionView &in)
+{
+	update(view_to_region(in));
+}
+
+//----------------------------------------------------------------------------
+// KDFContext
+//----------------------------------------------------------------------------
+int KDFContext::blockSize() const
+{
+	return 0;
+}
+
+SymmetricKey KDFContext::makeKeyPart(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount, unsigned int offset, unsigned int length)
+{
+	SymmetricKey key = makeKey(secret, salt, keyLength, iterationCount);
+	if(offset == 0 && length == (unsigned int)key.size())
+		return key;
+
+	// makeKey() gives an empty key on failure.  written so that
+	//   offset + length can't overflow.
+	unsigned int size = (unsigned int)key.size();
+	if(offset > size || length > size - offset)
+		return SymmetricKey();
+	SecureArray part(length);
+	memcpy(part.data(), key.constData() + offset, length);
+	return part;
+}
+
+unsigned int KDFContext::memoryCost() const
+{
+	return 0;
+}
+
+void KDFContext::setMemoryCost(unsigned int kib)
+{
+	Q_UNUSED(kib);
+}
+
+int KDFContext::parallelism() const
+{
+	return 1;
+}
+
+void KDFContext::setParallelism(int lanes)
+{
+	Q_UNUSED(lanes);
+}
+
 //----------------------------------------------------------------------------
 // PKeyBase
 //----------------------------------------------------------------------------
@@ -1220,6 +1555,48 @@ void TLSContext::setMTU(int)
 {
 }
 
+void TLSContext::updateChunks(const ChunkBuffer &from_net, const QByteArray &from_app)
+{
+	update(from_net.toByteArray(), from_app);
+}
+
+ChunkBuffer TLSContext::to_netChunks()
+{
+	return ChunkBuffer(to_net());
+}
+
+int TLSContext::packetBatchSize() const
+{
+	return 1;
+}
+
+void TLSContext::updatePackets(const QList<QByteArray> &from_net, const QList<QByteArray> &from_app)
+{
+	update(from_net.value(0), from_app.value(0));
+}
+
+QList<QByteArray> TLSContext::to_netPackets()
+{
+	QList<QByteArray> list;
+	QByteArray a = to_net();
+	if(!a.isEmpty())
+		list += a;
+	return list;
+}
+
+QList<QByteArray> TLSContext::to_appPackets()
+{
+	QList<QByteArray> list;
+	QByteArray a = to_app();
+	if(!a.isEmpty())
+		list += a;
+	return list;
+}
+
+void TLSContext::setPeerAddress(const QByteArray &)
+{
+}
+
 //----------------------------------------------------------------------------
 // MessageContext
 //----------------------------------------------------------------------------
@@ -1250,6 +1627,11 @@ BufferedComputation::~BufferedComputation()
 {
 }
 
+void BufferedComputation::update(const MemoryRegionView &a)
+{
+	update(view_to_region(a));
+}
+
 MemoryRegion BufferedComputation::process(const MemoryRegion &a)
 {
 	clear();
@@ -1264,6 +1646,11 @@ Filter::~Filter()
 {
 }
 
+MemoryRegion Filter::update(const MemoryRegionView &a)
+{
+	return update(view_to_region(a));
+}
+
 MemoryRegion Filter::process(const MemoryRegion &a)
 {
 	clear();
@@ -1302,7 +1689,7 @@ public:
 	~Private()
 	{
 		//printf("** [%p] Algorithm Destroyed\n", c);
-		delete c;
+		release_context(c);
 	}
 };
 
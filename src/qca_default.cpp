@@ -21,10 +21,29 @@
 
 #include "qca_core.h"
 
+#include <QAtomicInt>
 #include <QMutex>
+#include <QVector>
+#include <QtEndian>
 #include "qca_textfilter.h"
 #include "qca_cert.h"
 #include "qcaprovider.h"
+#include "qca_simd.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#if defined(Q_OS_WIN)
+# include <windows.h>
+# include <wincrypt.h>
+#elif defined(Q_OS_UNIX)
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# if defined(Q_OS_LINUX)
+#  include <sys/syscall.h>
+# endif
+#endif
 
 #ifndef QCA_NO_SYSTEMSTORE
 # include "qca_systemstore.h"
@@ -34,6 +53,9 @@
 
 namespace QCA {
 
+// from qca_kdf.cpp
+KDFContext *create_default_kdf(Provider *p, const QString &type);
+
 class DefaultShared
 {
 private:
@@ -85,21 +107,180 @@ public:
 //----------------------------------------------------------------------------
 // DefaultRandomContext
 //----------------------------------------------------------------------------
+
+// fill out with bytes from the operating system's generator
+static bool system_entropy(quint8 *out, int size)
+{
+#if defined(Q_OS_WIN)
+	HCRYPTPROV prov;
+	if(!CryptAcquireContextW(&prov, 0, 0, PROV_RSA_FULL, CRYPT_VERIFYCONTEXT | CRYPT_SILENT))
+		return false;
+	bool ok = CryptGenRandom(prov, size, out) != 0;
+	CryptReleaseContext(prov, 0);
+	return ok;
+#elif defined(Q_OS_UNIX)
+# if defined(Q_OS_LINUX) && defined(SYS_getrandom)
+	// getrandom() doesn't need a file descriptor, so it works in chroots
+	//   and when out of descriptors.  fall back to the device if the
+	//   kernel is too old.
+	int at = 0;
+	while(at < size)
+	{
+		long ret = syscall(SYS_getrandom, out + at, size - at, 0);
+		if(ret < 0)
+		{
+			if(errno == EINTR)
+				continue;
+			break;
+		}
+		at += (int)ret;
+	}
+	if(at == size)
+		return true;
+# endif
+	int fd = open("/dev/urandom", O_RDONLY);
+	if(fd == -1)
+		return false;
+	int got = 0;
+	while(got < size)
+	{
+		ssize_t ret = read(fd, out + got, size - got);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		if(ret <= 0)
+			break;
+		got += (int)ret;
+	}
+	close(fd);
+	return got == size;
+#else
+	Q_UNUSED(out);
+	Q_UNUSED(size);
+	return false;
+#endif
+}
+
+static qint64 current_pid()
+{
+#if defined(Q_OS_UNIX)
+	return getpid();
+#else
+	return 0;
+#endif
+}
+
+// chacha20 keystream generator.  the key is replaced after every request
+//   with keystream that is never handed out, so earlier output can't be
+//   recovered from the state.  fresh system entropy is mixed into the key
+//   periodically, and whenever the process has forked, so that parent and
+//   child don't produce the same bytes.
+//
+// if the system generator can't be read, the output is predictable.  a
+//   warning is printed once, and the generator stays unseeded, trying the
+//   system again on every request until it succeeds.
+static QAtomicInt g_unseededWarned;
+
 class DefaultRandomContext : public RandomContext
 {
+private:
+	enum { ReseedInterval = 64 * 1024 * 1024 };
+
+	quint32 input[16];
+	qint64 pid;
+	qint64 sinceReseed;
+	bool seeded;
+
+	void reseed()
+	{
+		quint8 seed[32];
+		seeded = system_entropy(seed, sizeof(seed));
+		if(!seeded)
+		{
+			if(g_unseededWarned.testAndSetRelaxed(0, 1))
+				fprintf(stderr, "QCA: Unable to read the system random generator, random numbers are not secure\n");
+
+			// better than nothing, but not by much
+			quint32 mix = (quint32)QDateTime::currentDateTime().toTime_t() ^ (quint32)(quintptr)this;
+			for(int n = 0; n < (int)sizeof(seed); ++n)
+				seed[n] = (quint8)(qrand() ^ (mix >> (8 * (n & 3))));
+		}
+
+		// the new entropy is mixed into the old key, rather than
+		//   replacing it
+		for(int n = 0; n < 8; ++n)
+			input[4 + n] ^= qFromLittleEndian<quint32>(seed + 4 * n);
+		memset(seed, 0, sizeof(seed));
+
+		pid = current_pid();
+		sinceReseed = 0;
+	}
+
+	void rekey(const quint8 *block)
+	{
+		for(int n = 0; n < 8; ++n)
+			input[4 + n] = qFromLittleEndian<quint32>(block + 4 * n);
+		input[12] = 0;
+		input[13] = 0;
+	}
+
 public:
-	DefaultRandomContext(Provider *p) : RandomContext(p) {}
+	DefaultRandomContext(Provider *p) : RandomContext(p)
+	{
+		// "expand 32-byte k"
+		input[0] = 0x61707865;
+		input[1] = 0x3320646e;
+		input[2] = 0x79622d32;
+		input[3] = 0x6b206574;
+		for(int n = 4; n < 16; ++n)
+			input[n] = 0;
+		reseed();
+	}
+
+	~DefaultRandomContext()
+	{
+		memset(input, 0, sizeof(input));
+	}
 
 	virtual Provider::Context *clone() const
 	{
+		// a clone must not repeat our output, so it gets its own seed
 		return new DefaultRandomContext(provider());
 	}
 
 	virtual SecureArray nextBytes(int size)
 	{
 		SecureArray buf(size);
-		for(int n = 0; n < (int)buf.size(); ++n)
-			buf[n] = (char)qrand();
+		if(size <= 0)
+			return buf;
+
+		if(!seeded || pid != current_pid() || sinceReseed >= ReseedInterval)
+			reseed();
+		sinceReseed += size;
+
+		quint8 *out = (quint8 *)buf.data();
+		quint8 block[64];
+
+		// small requests come out of the same block as the next key
+		if(size <= 32)
+		{
+			chacha20_blocks(input, block, 1);
+			memcpy(out, block + 32, size);
+			rekey(block);
+			memset(block, 0, sizeof(block));
+			return buf;
+		}
+
+		int whole = size / 64;
+		int rest = size % 64;
+		chacha20_blocks(input, out, whole);
+		if(rest > 0)
+		{
+			chacha20_blocks(input, block, 1);
+			memcpy(out + whole * 64, block, rest);
+		}
+		chacha20_blocks(input, block, 1);
+		rekey(block);
+		memset(block, 0, sizeof(block));
 		return buf;
 	}
 };
@@ -510,6 +691,45 @@ md5_finish(md5_state_t *pms, md5_byte_t digest[16])
 	digest[i] = (md5_byte_t)(pms->abcd[i >> 2] >> ((i & 3) << 3));
 }
 
+// hash many messages with the multi-buffer kernels.  this is only worth it
+//   if at least half of the lanes can be kept busy.
+typedef void (*HashManyFunc)(const quint8 * const *data, const int *len, int count, quint8 *out);
+
+static bool use_hash_many(int count)
+{
+	int lanes = hash_lanes();
+	return (lanes > 0 && count >= 2 && count >= lanes / 2);
+}
+
+static QList<MemoryRegion> hash_many(HashManyFunc func, int size, const MemoryRegion *regions, int count)
+{
+	QVector<const quint8 *> data(count);
+	QVector<int> len(count);
+	for(int n = 0; n < count; ++n)
+	{
+		data[n] = (const quint8 *)regions[n].data();
+		len[n] = regions[n].size();
+	}
+
+	SecureArray buf(count * size);
+	func(data.data(), len.data(), count, (quint8 *)buf.data());
+
+	QList<MemoryRegion> out;
+	for(int n = 0; n < count; ++n)
+	{
+		const char *digest = buf.data() + n * size;
+		if(regions[n].isSecure())
+		{
+			SecureArray b(size);
+			memcpy(b.data(), digest, size);
+			out += b;
+		}
+		else
+			out += QByteArray(digest, size);
+	}
+	return out;
+}
+
 class DefaultMD5Context : public HashContext
 {
 public:
@@ -536,6 +756,13 @@ public:
 		md5_append(&md5, (const md5_byte_t *)in.data(), in.size());
 	}
 
+	virtual void update(const MemoryRegionView &in)
+	{
+		if(!in.isSecure())
+			secure = false;
+		md5_append(&md5, (const md5_byte_t *)in.data(), in.size());
+	}
+
 	virtual MemoryRegion final()
 	{
 		if(secure)
@@ -552,6 +779,15 @@ public:
 		}
 	}
 
+	virtual QList<MemoryRegion> hashMany(const MemoryRegion *regions, int count)
+	{
+		if(!use_hash_many(count))
+			return HashContext::hashMany(regions, count);
+
+		clear();
+		return hash_many(md5_many, 16, regions, count);
+	}
+
 	bool secure;
 	md5_state_t md5;
 };
@@ -564,11 +800,7 @@ public:
 
 #define rol(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
 
-#ifdef Q_PROCESSOR_ARM
 #define blk(i) (block.l[i&15] = rol(block.l[(i+13)&15]^block.l[(i+8)&15]^block.l[(i+2)&15]^block.l[i&15],1))
-#else
-#define blk(i) (block->l[i&15] = rol(block->l[(i+13)&15]^block->l[(i+8)&15]^block->l[(i+2)&15]^block->l[i&15],1))
-#endif
 
 /* (R0+R1), R2, R3, R4 are the different operations used in SHA1 */
 #define R0(v,w,x,y,z,i) z+=((w&(x^y))^y)+blk0(i)+0x5A827999+rol(v,5);w=rol(w,30);
@@ -611,11 +843,7 @@ class DefaultSHA1Context : public HashContext
 {
 public:
 	SHA1_CONTEXT _context;
-#ifdef Q_PROCESSOR_ARM
 	CHAR64LONG16 block;
-#else
-	CHAR64LONG16 *block;
-#endif
 	bool secure;
 
 	DefaultSHA1Context(Provider *p) : HashContext(p, "sha1")
@@ -641,6 +869,13 @@ public:
 		sha1_update(&_context, (unsigned char *)in.data(), (unsigned int)in.size());
 	}
 
+	virtual void update(const MemoryRegionView &in)
+	{
+		if(!in.isSecure())
+			secure = false;
+		sha1_update(&_context, (unsigned char *)in.data(), (unsigned int)in.size());
+	}
+
 	virtual MemoryRegion final()
 	{
 		if(secure)
@@ -657,20 +892,21 @@ public:
 		}
 	}
 
+	virtual QList<MemoryRegion> hashMany(const MemoryRegion *regions, int count)
+	{
+		if(!use_hash_many(count))
+			return HashContext::hashMany(regions, count);
+
+		clear();
+		return hash_many(sha1_many, 20, regions, count);
+	}
+
 	inline unsigned long blk0(quint32 i)
 	{
 		if(QSysInfo::ByteOrder == QSysInfo::BigEndian)
-#ifdef Q_PROCESSOR_ARM
 			return block.l[i];
-#else
-			return block->l[i];
-#endif
 		else
-#ifdef Q_PROCESSOR_ARM
 			return (block.l[i] = (rol(block.l[i],24)&0xFF00FF00) | (rol(block.l[i],8)&0x00FF00FF));
-#else
-			return (block->l[i] = (rol(block->l[i],24)&0xFF00FF00) | (rol(block->l[i],8)&0x00FF00FF));
-#endif
 	}
 
 	// Hash a single 512-bit block. This is the core of the algorithm.
@@ -678,11 +914,7 @@ public:
 	{
 		quint32 a, b, c, d, e;
 
-#ifdef Q_PROCESSOR_ARM
 		memcpy(&block, buffer, sizeof(block));
-#else
-		block = reinterpret_cast<CHAR64LONG16*>(buffer);
-#endif
 		// Copy context->state[] to working vars
 		a = state[0];
 		b = state[1];
@@ -749,8 +981,14 @@ public:
 		if((j + len) > 63) {
 			memcpy(&context->buffer[j], data, (i = 64-j));
 			transform(context->state, context->buffer);
-			for ( ; i + 63 < len; i += 64) {
-				transform(context->state, &data[i]);
+			quint32 blocks = (len - i) >> 6;
+			if(blocks > 0 && sha1_blocks_accel(context->state, &data[i], blocks)) {
+				i += blocks << 6;
+			}
+			else {
+				for ( ; i + 63 < len; i += 64) {
+					transform(context->state, &data[i]);
+				}
 			}
 			j = 0;
 		}
@@ -1237,6 +1475,8 @@ public:
 		list += "random";
 		list += "md5";
 		list += "sha1";
+		list += "scrypt";
+		list += "argon2id";
 		list += "keystorelist";
 		return list;
 	}
@@ -1249,6 +1489,8 @@ public:
 			return new DefaultMD5Context(this);
 		else if(type == "sha1")
 			return new DefaultSHA1Context(this);
+		else if(type == "scrypt" || type == "argon2id")
+			return create_default_kdf(this, type);
 		else if(type == "keystorelist")
 			return new DefaultKeyStoreList(this, &shared);
 		else
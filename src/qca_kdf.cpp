@@ -0,0 +1,1048 @@
+/*
+ * qca_kdf.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// memory-hard password hashing for the default provider: scrypt (RFC 7914)
+//   and Argon2id (RFC 9106).  these are straightforward reference
+//   implementations, with the SHA-256 and BLAKE2b they need kept local to
+//   this file.  the lanes of both are independent enough to be computed
+//   on the global thread pool.
+//
+// the large work areas are not taken from secure memory: they can be
+//   gigabytes in size and would exhaust the locked pool.  they are wiped
+//   before being released instead.
+
+#include "qca_core.h"
+#include "qcaprovider.h"
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QWaitCondition>
+#include <QtEndian>
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace QCA {
+
+// memset() on memory that is about to be freed may be optimized away
+static void wipe(void *p, size_t size)
+{
+	volatile quint8 *v = (volatile quint8 *)p;
+	while(size--)
+		*(v++) = 0;
+}
+
+//----------------------------------------------------------------------------
+// Lanes
+//----------------------------------------------------------------------------
+typedef void (*LaneFunc)(void *arg, int lane);
+
+class LaneJob
+{
+public:
+	LaneFunc func;
+	void *arg;
+	int count;
+	QAtomicInt next;
+	QMutex m;
+	QWaitCondition w;
+	int running;
+
+	LaneJob() : next(0), running(0)
+	{
+	}
+
+	void work()
+	{
+		while(true)
+		{
+			int n = next.fetchAndAddRelaxed(1);
+			if(n >= count)
+				break;
+			func(arg, n);
+		}
+	}
+};
+
+class LaneWorker : public QRunnable
+{
+public:
+	LaneJob *job;
+
+	LaneWorker(LaneJob *_job) : job(_job)
+	{
+	}
+
+	virtual void run()
+	{
+		job->work();
+
+		QMutexLocker locker(&job->m);
+		--job->running;
+		job->w.wakeAll();
+	}
+};
+
+// call func for lanes 0 to count - 1, and return when all are done.  the
+//   calling thread takes lanes too, and only idle pool threads help, so
+//   this can't stall behind other work on the pool.
+static void run_lanes(int count, LaneFunc func, void *arg)
+{
+	LaneJob job;
+	job.func = func;
+	job.arg = arg;
+	job.count = count;
+
+	int helpers = qMin(QThreadPool::globalInstance()->maxThreadCount(), count) - 1;
+	for(int n = 0; n < helpers; ++n)
+	{
+		LaneWorker *worker = new LaneWorker(&job);
+		{
+			QMutexLocker locker(&job.m);
+			++job.running;
+		}
+		if(!QThreadPool::globalInstance()->tryStart(worker))
+		{
+			delete worker;
+			QMutexLocker locker(&job.m);
+			--job.running;
+			break;
+		}
+	}
+
+	job.work();
+
+	QMutexLocker locker(&job.m);
+	while(job.running > 0)
+		job.w.wait(&job.m);
+}
+
+//----------------------------------------------------------------------------
+// SHA-256
+//----------------------------------------------------------------------------
+struct Sha256
+{
+	quint32 h[8];
+	quint64 length;
+	quint8 buf[64];
+	int used;
+};
+
+static const quint32 sha256_k[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline quint32 ror32(quint32 x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_block(quint32 *h, const quint8 *p)
+{
+	quint32 w[64];
+	for(int i = 0; i < 16; ++i)
+		w[i] = qFromBigEndian<quint32>(p + 4 * i);
+	for(int i = 16; i < 64; ++i)
+	{
+		quint32 s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+		quint32 s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+		w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+	}
+
+	quint32 a = h[0], b = h[1], c = h[2], d = h[3];
+	quint32 e = h[4], f = h[5], g = h[6], k = h[7];
+	for(int i = 0; i < 64; ++i)
+	{
+		quint32 t1 = k + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		quint32 t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+static void sha256_init(Sha256 *s)
+{
+	static const quint32 iv[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	memcpy(s->h, iv, sizeof(iv));
+	s->length = 0;
+	s->used = 0;
+}
+
+static void sha256_update(Sha256 *s, const quint8 *p, size_t size)
+{
+	s->length += size;
+	while(size > 0)
+	{
+		if(s->used == 0 && size >= 64)
+		{
+			sha256_block(s->h, p);
+			p += 64;
+			size -= 64;
+			continue;
+		}
+		size_t take = qMin(size, (size_t)(64 - s->used));
+		memcpy(s->buf + s->used, p, take);
+		s->used += (int)take;
+		p += take;
+		size -= take;
+		if(s->used == 64)
+		{
+			sha256_block(s->h, s->buf);
+			s->used = 0;
+		}
+	}
+}
+
+static void sha256_final(Sha256 *s, quint8 *out)
+{
+	quint64 bits = s->length * 8;
+	quint8 pad[72];
+	int padSize = (s->used < 56 ? 56 : 120) - s->used;
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	qToBigEndian<quint64>(bits, pad + padSize);
+	sha256_update(s, pad, padSize + 8);
+	for(int i = 0; i < 8; ++i)
+		qToBigEndian<quint32>(s->h[i], out + 4 * i);
+}
+
+// HMAC-SHA256 with the key already absorbed into the two states
+struct HmacSha256
+{
+	Sha256 inner, outer;
+};
+
+static void hmac_sha256_init(HmacSha256 *h, const quint8 *key, size_t size)
+{
+	quint8 k[64];
+	memset(k, 0, sizeof(k));
+	if(size > 64)
+	{
+		Sha256 s;
+		sha256_init(&s);
+		sha256_update(&s, key, size);
+		sha256_final(&s, k);
+	}
+	else
+		memcpy(k, key, size);
+
+	quint8 pad[64];
+	for(int i = 0; i < 64; ++i)
+		pad[i] = k[i] ^ 0x36;
+	sha256_init(&h->inner);
+	sha256_update(&h->inner, pad, 64);
+	for(int i = 0; i < 64; ++i)
+		pad[i] = k[i] ^ 0x5c;
+	sha256_init(&h->outer);
+	sha256_update(&h->outer, pad, 64);
+	wipe(k, sizeof(k));
+	wipe(pad, sizeof(pad));
+}
+
+// PBKDF2-HMAC-SHA256 with an iteration count of 1, as scrypt uses it
+static void pbkdf2_sha256_once(const quint8 *secret, size_t secretSize, const quint8 *salt, size_t saltSize, quint8 *out, size_t size)
+{
+	HmacSha256 hmac;
+	hmac_sha256_init(&hmac, secret, secretSize);
+	for(quint32 block = 1; size > 0; ++block)
+	{
+		quint8 index[4];
+		quint8 t[32];
+		qToBigEndian<quint32>(block, index);
+
+		Sha256 s = hmac.inner;
+		sha256_update(&s, salt, saltSize);
+		sha256_update(&s, index, 4);
+		sha256_final(&s, t);
+		s = hmac.outer;
+		sha256_update(&s, t, 32);
+		sha256_final(&s, t);
+
+		size_t take = qMin(size, (size_t)32);
+		memcpy(out, t, take);
+		out += take;
+		size -= take;
+		wipe(t, sizeof(t));
+	}
+	wipe(&hmac, sizeof(hmac));
+}
+
+//----------------------------------------------------------------------------
+// scrypt
+//----------------------------------------------------------------------------
+static void salsa20_8(quint32 *b)
+{
+	quint32 x[16];
+	memcpy(x, b, sizeof(x));
+	for(int i = 0; i < 8; i += 2)
+	{
+#define R(a, n) (((a) << (n)) | ((a) >> (32 - (n))))
+		// columns
+		x[ 4] ^= R(x[ 0] + x[12],  7); x[ 8] ^= R(x[ 4] + x[ 0],  9);
+		x[12] ^= R(x[ 8] + x[ 4], 13); x[ 0] ^= R(x[12] + x[ 8], 18);
+		x[ 9] ^= R(x[ 5] + x[ 1],  7); x[13] ^= R(x[ 9] + x[ 5],  9);
+		x[ 1] ^= R(x[13] + x[ 9], 13); x[ 5] ^= R(x[ 1] + x[13], 18);
+		x[14] ^= R(x[10] + x[ 6],  7); x[ 2] ^= R(x[14] + x[10],  9);
+		x[ 6] ^= R(x[ 2] + x[14], 13); x[10] ^= R(x[ 6] + x[ 2], 18);
+		x[ 3] ^= R(x[15] + x[11],  7); x[ 7] ^= R(x[ 3] + x[15],  9);
+		x[11] ^= R(x[ 7] + x[ 3], 13); x[15] ^= R(x[11] + x[ 7], 18);
+
+		// rows
+		x[ 1] ^= R(x[ 0] + x[ 3],  7); x[ 2] ^= R(x[ 1] + x[ 0],  9);
+		x[ 3] ^= R(x[ 2] + x[ 1], 13); x[ 0] ^= R(x[ 3] + x[ 2], 18);
+		x[ 6] ^= R(x[ 5] + x[ 4],  7); x[ 7] ^= R(x[ 6] + x[ 5],  9);
+		x[ 4] ^= R(x[ 7] + x[ 6], 13); x[ 5] ^= R(x[ 4] + x[ 7], 18);
+		x[11] ^= R(x[10] + x[ 9],  7); x[ 8] ^= R(x[11] + x[10],  9);
+		x[ 9] ^= R(x[ 8] + x[11], 13); x[10] ^= R(x[ 9] + x[ 8], 18);
+		x[12] ^= R(x[15] + x[14],  7); x[13] ^= R(x[12] + x[15],  9);
+		x[14] ^= R(x[13] + x[12], 13); x[15] ^= R(x[14] + x[13], 18);
+#undef R
+	}
+	for(int i = 0; i < 16; ++i)
+		b[i] += x[i];
+}
+
+// the even numbered outputs go in the first half of y, the odd ones in the
+//   second half
+static void scrypt_blockmix(const quint32 *b, quint32 *y, int r)
+{
+	quint32 x[16];
+	memcpy(x, b + (2 * r - 1) * 16, 64);
+	for(int i = 0; i < 2 * r; ++i)
+	{
+		for(int k = 0; k < 16; ++k)
+			x[k] ^= b[i * 16 + k];
+		salsa20_8(x);
+		memcpy(y + (i / 2 + (i & 1) * r) * 16, x, 64);
+	}
+}
+
+struct ScryptState
+{
+	quint8 *b;
+	quint32 n;
+	int r;
+	bool failed;
+};
+
+static void scrypt_romix(void *arg, int lane)
+{
+	ScryptState *st = (ScryptState *)arg;
+	int words = 32 * st->r;
+	size_t vsize = (size_t)st->n * words * 4;
+	quint32 *v = (quint32 *)malloc(vsize);
+	quint32 *xy = (quint32 *)malloc(words * 8);
+	if(!v || !xy)
+	{
+		free(v);
+		free(xy);
+		st->failed = true;
+		return;
+	}
+	quint32 *x = xy;
+	quint32 *y = xy + words;
+
+	quint8 *b = st->b + (size_t)lane * words * 4;
+	for(int k = 0; k < words; ++k)
+		x[k] = qFromLittleEndian<quint32>(b + 4 * k);
+
+	for(quint32 i = 0; i < st->n; ++i)
+	{
+		memcpy(v + (size_t)i * words, x, words * 4);
+		scrypt_blockmix(x, y, st->r);
+		qSwap(x, y);
+	}
+	for(quint32 i = 0; i < st->n; ++i)
+	{
+		quint32 j = x[(2 * st->r - 1) * 16] & (st->n - 1);
+		const quint32 *vj = v + (size_t)j * words;
+		for(int k = 0; k < words; ++k)
+			x[k] ^= vj[k];
+		scrypt_blockmix(x, y, st->r);
+		qSwap(x, y);
+	}
+
+	for(int k = 0; k < words; ++k)
+		qToLittleEndian<quint32>(x[k], b + 4 * k);
+
+	wipe(v, vsize);
+	wipe(xy, words * 8);
+	free(v);
+	free(xy);
+}
+
+static bool scrypt(const SecureArray &secret, const InitializationVector &salt, quint32 n, int r, int p, quint8 *out, size_t size)
+{
+	if(n < 2 || (n & (n - 1)) != 0 || r < 1 || p < 1 || (quint64)r * p >= (1 << 30))
+		return false;
+	if((quint64)n * r * 128 > (quint64)(size_t)-1)
+		return false;
+
+	SecureArray b(128 * r * p);
+	pbkdf2_sha256_once((const quint8 *)secret.data(), secret.size(), (const quint8 *)salt.data(), salt.size(), (quint8 *)b.data(), b.size());
+
+	ScryptState st;
+	st.b = (quint8 *)b.data();
+	st.n = n;
+	st.r = r;
+	st.failed = false;
+	run_lanes(p, scrypt_romix, &st);
+	if(st.failed)
+		return false;
+
+	pbkdf2_sha256_once((const quint8 *)secret.data(), secret.size(), (const quint8 *)b.data(), b.size(), out, size);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// BLAKE2b
+//----------------------------------------------------------------------------
+struct Blake2b
+{
+	quint64 h[8];
+	quint64 t;
+	quint8 buf[128];
+	int used;
+	int outSize;
+};
+
+static const quint64 blake2b_iv[8] =
+{
+	Q_UINT64_C(0x6a09e667f3bcc908), Q_UINT64_C(0xbb67ae8584caa73b),
+	Q_UINT64_C(0x3c6ef372fe94f82b), Q_UINT64_C(0xa54ff53a5f1d36f1),
+	Q_UINT64_C(0x510e527fade682d1), Q_UINT64_C(0x9b05688c2b3e6c1f),
+	Q_UINT64_C(0x1f83d9abfb41bd6b), Q_UINT64_C(0x5be0cd19137e2179)
+};
+
+static const quint8 blake2b_sigma[12][16] =
+{
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 },
+	{ 11,  8, 12,  0,  5,  2, 15, 13, 10, 14,  3,  6,  7,  1,  9,  4 },
+	{  7,  9,  3,  1, 13, 12, 11, 14,  2,  6,  5, 10,  4,  0, 15,  8 },
+	{  9,  0,  5,  7,  2,  4, 10, 15, 14,  1, 11, 12,  6,  8,  3, 13 },
+	{  2, 12,  6, 10,  0, 11,  8,  3,  4, 13,  7,  5, 15, 14,  1,  9 },
+	{ 12,  5,  1, 15, 14, 13,  4, 10,  0,  7,  6,  3,  9,  2,  8, 11 },
+	{ 13, 11,  7, 14, 12,  1,  3,  9,  5,  0, 15,  4,  8,  6,  2, 10 },
+	{  6, 15, 14,  9, 11,  3,  0,  8, 12,  2, 13,  7,  1,  4, 10,  5 },
+	{ 10,  2,  8,  4,  7,  6,  1,  5, 15, 11,  9, 14,  3, 12, 13,  0 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15 },
+	{ 14, 10,  4,  8,  9, 15, 13,  6,  1, 12,  0,  2, 11,  7,  5,  3 }
+};
+
+static inline quint64 ror64(quint64 x, int n)
+{
+	return (x >> n) | (x << (64 - n));
+}
+
+static void blake2b_compress(Blake2b *s, const quint8 *block, bool last)
+{
+	quint64 m[16], v[16];
+	for(int i = 0; i < 16; ++i)
+		m[i] = qFromLittleEndian<quint64>(block + 8 * i);
+	for(int i = 0; i < 8; ++i)
+	{
+		v[i] = s->h[i];
+		v[i + 8] = blake2b_iv[i];
+	}
+	v[12] ^= s->t;
+	if(last)
+		v[14] = ~v[14];
+
+#define G(r, i, a, b, c, d) \
+	a = a + b + m[blake2b_sigma[r][2 * i]]; \
+	d = ror64(d ^ a, 32); \
+	c = c + d; \
+	b = ror64(b ^ c, 24); \
+	a = a + b + m[blake2b_sigma[r][2 * i + 1]]; \
+	d = ror64(d ^ a, 16); \
+	c = c + d; \
+	b = ror64(b ^ c, 63);
+
+	for(int r = 0; r < 12; ++r)
+	{
+		G(r, 0, v[0], v[4], v[ 8], v[12]);
+		G(r, 1, v[1], v[5], v[ 9], v[13]);
+		G(r, 2, v[2], v[6], v[10], v[14]);
+		G(r, 3, v[3], v[7], v[11], v[15]);
+		G(r, 4, v[0], v[5], v[10], v[15]);
+		G(r, 5, v[1], v[6], v[11], v[12]);
+		G(r, 6, v[2], v[7], v[ 8], v[13]);
+		G(r, 7, v[3], v[4], v[ 9], v[14]);
+	}
+#undef G
+
+	for(int i = 0; i < 8; ++i)
+		s->h[i] ^= v[i] ^ v[i + 8];
+}
+
+// unkeyed, with a digest of 1 to 64 bytes
+static void blake2b_init(Blake2b *s, int outSize)
+{
+	memcpy(s->h, blake2b_iv, sizeof(s->h));
+	s->h[0] ^= Q_UINT64_C(0x01010000) ^ (quint64)outSize;
+	s->t = 0;
+	s->used = 0;
+	s->outSize = outSize;
+}
+
+static void blake2b_update(Blake2b *s, const quint8 *p, size_t size)
+{
+	while(size > 0)
+	{
+		// the last block is compressed by final(), so only compress a
+		//   full buffer once there is more data after it
+		if(s->used == 128)
+		{
+			s->t += 128;
+			blake2b_compress(s, s->buf, false);
+			s->used = 0;
+		}
+		size_t take = qMin(size, (size_t)(128 - s->used));
+		memcpy(s->buf + s->used, p, take);
+		s->used += (int)take;
+		p += take;
+		size -= take;
+	}
+}
+
+static void blake2b_final(Blake2b *s, quint8 *out)
+{
+	s->t += s->used;
+	memset(s->buf + s->used, 0, 128 - s->used);
+	blake2b_compress(s, s->buf, true);
+
+	quint8 digest[64];
+	for(int i = 0; i < 8; ++i)
+		qToLittleEndian<quint64>(s->h[i], digest + 8 * i);
+	memcpy(out, digest, s->outSize);
+	wipe(digest, sizeof(digest));
+}
+
+static void blake2b(const quint8 *in, size_t size, quint8 *out, int outSize)
+{
+	Blake2b s;
+	blake2b_init(&s, outSize);
+	blake2b_update(&s, in, size);
+	blake2b_final(&s, out);
+}
+
+//----------------------------------------------------------------------------
+// Argon2id
+//----------------------------------------------------------------------------
+static const int argon2_block_words = 128;
+static const int argon2_sync_points = 4;
+
+struct Argon2Block
+{
+	quint64 v[argon2_block_words];
+};
+
+// H' from the specification, for digests of any length
+static void argon2_hash(const quint8 *in, size_t size, quint8 *out, quint32 outSize)
+{
+	quint8 len[4];
+	qToLittleEndian<quint32>(outSize, len);
+
+	Blake2b s;
+	if(outSize <= 64)
+	{
+		blake2b_init(&s, outSize);
+		blake2b_update(&s, len, 4);
+		blake2b_update(&s, in, size);
+		blake2b_final(&s, out);
+		return;
+	}
+
+	// whole 64 byte digests, of which the first half of each is used,
+	//   and then a final one of whatever size is left
+	quint8 v[64];
+	blake2b_init(&s, 64);
+	blake2b_update(&s, len, 4);
+	blake2b_update(&s, in, size);
+	blake2b_final(&s, v);
+	memcpy(out, v, 32);
+	out += 32;
+	outSize -= 32;
+	while(outSize > 64)
+	{
+		blake2b(v, 64, v, 64);
+		memcpy(out, v, 32);
+		out += 32;
+		outSize -= 32;
+	}
+	blake2b(v, 64, out, outSize);
+	wipe(v, sizeof(v));
+}
+
+static inline quint64 blamka(quint64 x, quint64 y)
+{
+	return x + y + 2 * (x & Q_UINT64_C(0xffffffff)) * (y & Q_UINT64_C(0xffffffff));
+}
+
+static inline void argon2_g(quint64 &a, quint64 &b, quint64 &c, quint64 &d)
+{
+	a = blamka(a, b);
+	d = ror64(d ^ a, 32);
+	c = blamka(c, d);
+	b = ror64(b ^ c, 24);
+	a = blamka(a, b);
+	d = ror64(d ^ a, 16);
+	c = blamka(c, d);
+	b = ror64(b ^ c, 63);
+}
+
+static inline void argon2_round(quint64 *v, int i0, int i1, int i2, int i3, int i4, int i5, int i6, int i7,
+	int i8, int i9, int i10, int i11, int i12, int i13, int i14, int i15)
+{
+	argon2_g(v[i0], v[i4], v[i8], v[i12]);
+	argon2_g(v[i1], v[i5], v[i9], v[i13]);
+	argon2_g(v[i2], v[i6], v[i10], v[i14]);
+	argon2_g(v[i3], v[i7], v[i11], v[i15]);
+	argon2_g(v[i0], v[i5], v[i10], v[i15]);
+	argon2_g(v[i1], v[i6], v[i11], v[i12]);
+	argon2_g(v[i2], v[i7], v[i8], v[i13]);
+	argon2_g(v[i3], v[i4], v[i9], v[i14]);
+}
+
+// the compression function G.  with xorInto set, the result is xored into
+//   next rather than replacing it, as passes after the first require.
+static void argon2_fill_block(const Argon2Block *prev, const Argon2Block *ref, Argon2Block *next, bool xorInto)
+{
+	Argon2Block r, z;
+	for(int i = 0; i < argon2_block_words; ++i)
+		r.v[i] = prev->v[i] ^ ref->v[i];
+	z = r;
+
+	// the rows, then the columns, of the 8x8 matrix of 16 byte registers
+	for(int i = 0; i < 8; ++i)
+	{
+		int b = 16 * i;
+		argon2_round(z.v, b, b + 1, b + 2, b + 3, b + 4, b + 5, b + 6, b + 7,
+			b + 8, b + 9, b + 10, b + 11, b + 12, b + 13, b + 14, b + 15);
+	}
+	for(int i = 0; i < 8; ++i)
+	{
+		int b = 2 * i;
+		argon2_round(z.v, b, b + 1, b + 16, b + 17, b + 32, b + 33, b + 48, b + 49,
+			b + 64, b + 65, b + 80, b + 81, b + 96, b + 97, b + 112, b + 113);
+	}
+
+	if(xorInto)
+	{
+		for(int i = 0; i < argon2_block_words; ++i)
+			next->v[i] ^= z.v[i] ^ r.v[i];
+	}
+	else
+	{
+		for(int i = 0; i < argon2_block_words; ++i)
+			next->v[i] = z.v[i] ^ r.v[i];
+	}
+}
+
+struct Argon2State
+{
+	Argon2Block *memory;
+	quint32 lanes;
+	quint32 laneLength;
+	quint32 segmentLength;
+	quint32 passes;
+	quint32 pass;
+	quint32 slice;
+};
+
+// the block in the reference area picked by the low 32 bits of rand
+static quint32 argon2_index(const Argon2State *st, quint32 index, quint32 rand, bool sameLane)
+{
+	quint32 areaSize;
+	if(st->pass == 0)
+	{
+		if(st->slice == 0)
+			areaSize = index - 1;
+		else if(sameLane)
+			areaSize = st->slice * st->segmentLength + index - 1;
+		else
+			areaSize = st->slice * st->segmentLength - (index == 0 ? 1 : 0);
+	}
+	else
+	{
+		if(sameLane)
+			areaSize = st->laneLength - st->segmentLength + index - 1;
+		else
+			areaSize = st->laneLength - st->segmentLength - (index == 0 ? 1 : 0);
+	}
+
+	quint64 pos = rand;
+	pos = (pos * pos) >> 32;
+	pos = areaSize - 1 - ((areaSize * pos) >> 32);
+
+	quint32 start = 0;
+	if(st->pass != 0 && st->slice != argon2_sync_points - 1)
+		start = (st->slice + 1) * st->segmentLength;
+	return (quint32)((start + pos) % st->laneLength);
+}
+
+static void argon2_next_addresses(Argon2Block *address, Argon2Block *input)
+{
+	Argon2Block zero;
+	memset(&zero, 0, sizeof(zero));
+	++input->v[6];
+	argon2_fill_block(&zero, input, address, false);
+	argon2_fill_block(&zero, address, address, false);
+}
+
+static void argon2_fill_segment(void *arg, int laneIndex)
+{
+	const Argon2State *st = (const Argon2State *)arg;
+	quint32 lane = laneIndex;
+
+	// Argon2id takes its references independently of the data for the
+	//   first half of the first pass, and from the data after that
+	bool independent = (st->pass == 0 && st->slice < argon2_sync_points / 2);
+	Argon2Block address, input;
+	if(independent)
+	{
+		memset(&input, 0, sizeof(input));
+		input.v[0] = st->pass;
+		input.v[1] = lane;
+		input.v[2] = st->slice;
+		input.v[3] = (quint64)st->lanes * st->laneLength;
+		input.v[4] = st->passes;
+		input.v[5] = 2; // Argon2id
+	}
+
+	quint32 start = 0;
+	if(st->pass == 0 && st->slice == 0)
+	{
+		// the first two blocks of each lane are already filled
+		start = 2;
+		if(independent)
+			argon2_next_addresses(&address, &input);
+	}
+
+	quint32 offset = lane * st->laneLength + st->slice * st->segmentLength + start;
+	quint32 prev = (offset % st->laneLength == 0) ? offset + st->laneLength - 1 : offset - 1;
+	for(quint32 i = start; i < st->segmentLength; ++i, ++offset, ++prev)
+	{
+		if(offset % st->laneLength == 1)
+			prev = offset - 1;
+
+		quint64 rand;
+		if(independent)
+		{
+			if(i % argon2_block_words == 0)
+				argon2_next_addresses(&address, &input);
+			rand = address.v[i % argon2_block_words];
+		}
+		else
+			rand = st->memory[prev].v[0];
+
+		quint32 refLane = (quint32)((rand >> 32) % st->lanes);
+		if(st->pass == 0 && st->slice == 0)
+			refLane = lane;
+		quint32 refIndex = argon2_index(st, i, (quint32)rand, refLane == lane);
+
+		argon2_fill_block(&st->memory[prev], &st->memory[(size_t)refLane * st->laneLength + refIndex], &st->memory[offset], st->pass != 0);
+	}
+
+	if(independent)
+	{
+		wipe(&address, sizeof(address));
+		wipe(&input, sizeof(input));
+	}
+}
+
+// the secret, salt, key and associated data, in that order
+struct Argon2Inputs
+{
+	const char *data[4];
+	int size[4];
+};
+
+// memoryCost is in KiB, which is also the size of a block
+static bool argon2id(const Argon2Inputs &in, quint32 passes, quint32 memoryCost, quint32 lanes, quint8 *out, quint32 size)
+{
+	if(passes < 1 || lanes < 1 || lanes > 0xffffff || memoryCost < 8 * lanes || size < 4 || in.size[1] < 8)
+		return false;
+
+	// the number of blocks is rounded down to a multiple of 4 per lane
+	quint32 segmentLength = memoryCost / (lanes * argon2_sync_points);
+	quint32 laneLength = segmentLength * argon2_sync_points;
+	quint64 blocks = (quint64)laneLength * lanes;
+	if(blocks * sizeof(Argon2Block) > (quint64)(size_t)-1)
+		return false;
+
+	Argon2Block *memory = (Argon2Block *)malloc((size_t)blocks * sizeof(Argon2Block));
+	if(!memory)
+		return false;
+
+	// H0 covers all of the parameters and inputs
+	quint8 h0[72];
+	{
+		Blake2b s;
+		quint8 word[4];
+		blake2b_init(&s, 64);
+		quint32 params[6] = { lanes, size, memoryCost, passes, 0x13, 2 };
+		for(int i = 0; i < 6; ++i)
+		{
+			qToLittleEndian<quint32>(params[i], word);
+			blake2b_update(&s, word, 4);
+		}
+		for(int i = 0; i < 4; ++i)
+		{
+			qToLittleEndian<quint32>((quint32)in.size[i], word);
+			blake2b_update(&s, word, 4);
+			blake2b_update(&s, (const quint8 *)in.data[i], in.size[i]);
+		}
+		blake2b_final(&s, h0);
+	}
+
+	quint8 block[1024];
+	for(quint32 lane = 0; lane < lanes; ++lane)
+	{
+		for(quint32 i = 0; i < 2; ++i)
+		{
+			qToLittleEndian<quint32>(i, h0 + 64);
+			qToLittleEndian<quint32>(lane, h0 + 68);
+			argon2_hash(h0, sizeof(h0), block, sizeof(block));
+			Argon2Block *b = &memory[(size_t)lane * laneLength + i];
+			for(int k = 0; k < argon2_block_words; ++k)
+				b->v[k] = qFromLittleEndian<quint64>(block + 8 * k);
+		}
+	}
+
+	// the lanes of a slice are independent of each other, but every
+	//   slice depends on the ones before it
+	Argon2State st;
+	st.memory = memory;
+	st.lanes = lanes;
+	st.laneLength = laneLength;
+	st.segmentLength = segmentLength;
+	st.passes = passes;
+	for(st.pass = 0; st.pass < passes; ++st.pass)
+	{
+		for(st.slice = 0; st.slice < (quint32)argon2_sync_points; ++st.slice)
+			run_lanes(lanes, argon2_fill_segment, &st);
+	}
+
+	Argon2Block last = memory[laneLength - 1];
+	for(quint32 lane = 1; lane < lanes; ++lane)
+	{
+		const Argon2Block *b = &memory[(size_t)lane * laneLength + laneLength - 1];
+		for(int k = 0; k < argon2_block_words; ++k)
+			last.v[k] ^= b->v[k];
+	}
+	for(int k = 0; k < argon2_block_words; ++k)
+		qToLittleEndian<quint64>(last.v[k], block + 8 * k);
+	argon2_hash(block, sizeof(block), out, size);
+
+	wipe(h0, sizeof(h0));
+	wipe(block, sizeof(block));
+	wipe(&last, sizeof(last));
+	wipe(memory, (size_t)blocks * sizeof(Argon2Block));
+	free(memory);
+	return true;
+}
+
+//----------------------------------------------------------------------------
+// DefaultScryptContext
+//----------------------------------------------------------------------------
+class DefaultScryptContext : public KDFContext
+{
+public:
+	unsigned int _memoryCost;
+	int _parallelism;
+
+	// r is fixed at the usual 8, so that a lane needs N KiB
+	enum { BlockSize = 8 };
+
+	DefaultScryptContext(Provider *p) : KDFContext(p, "scrypt"), _memoryCost(65536), _parallelism(1)
+	{
+	}
+
+	virtual Provider::Context *clone() const
+	{
+		return new DefaultScryptContext(*this);
+	}
+
+	virtual SymmetricKey makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount)
+	{
+		SecureArray out(keyLength);
+		if(!scrypt(secret, salt, iterationCount, BlockSize, _parallelism, (quint8 *)out.data(), out.size()))
+			return SymmetricKey();
+		return out;
+	}
+
+	virtual SymmetricKey makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, int msecInterval, unsigned int *iterationCount)
+	{
+		Q_ASSERT(iterationCount != NULL);
+
+		// N doubles until the next doubling would take too long, or would
+		//   need more than memoryCost() per lane
+		unsigned int n = 1024;
+		while(n > 2 && n > _memoryCost)
+			n /= 2;
+
+		SymmetricKey key;
+		QElapsedTimer timer;
+		while(true)
+		{
+			timer.start();
+			key = makeKey(secret, salt, keyLength, n);
+			qint64 elapsed = timer.elapsed();
+			if(key.isEmpty() || elapsed * 2 > msecInterval || n * 2 > _memoryCost || n >= 0x40000000)
+				break;
+			n *= 2;
+		}
+
+		*iterationCount = n;
+		return key;
+	}
+
+	virtual unsigned int memoryCost() const
+	{
+		return _memoryCost;
+	}
+
+	virtual void setMemoryCost(unsigned int kib)
+	{
+		_memoryCost = kib;
+	}
+
+	virtual int parallelism() const
+	{
+		return _parallelism;
+	}
+
+	virtual void setParallelism(int lanes)
+	{
+		_parallelism = lanes;
+	}
+};
+
+//----------------------------------------------------------------------------
+// DefaultArgon2Context
+//----------------------------------------------------------------------------
+class DefaultArgon2Context : public KDFContext
+{
+public:
+	unsigned int _memoryCost;
+	int _parallelism;
+
+	DefaultArgon2Context(Provider *p) : KDFContext(p, "argon2id"), _memoryCost(65536), _parallelism(4)
+	{
+	}
+
+	virtual Provider::Context *clone() const
+	{
+		return new DefaultArgon2Context(*this);
+	}
+
+	virtual SymmetricKey makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, unsigned int iterationCount)
+	{
+		Argon2Inputs in;
+		in.data[0] = secret.data();
+		in.size[0] = secret.size();
+		in.data[1] = salt.data();
+		in.size[1] = salt.size();
+		in.data[2] = in.data[3] = 0;
+		in.size[2] = in.size[3] = 0;
+
+		SecureArray out(keyLength);
+		if(_parallelism < 1 || !argon2id(in, iterationCount, _memoryCost, _parallelism, (quint8 *)out.data(), out.size()))
+			return SymmetricKey();
+		return out;
+	}
+
+	virtual SymmetricKey makeKey(const SecureArray &secret, const InitializationVector &salt, unsigned int keyLength, int msecInterval, unsigned int *iterationCount)
+	{
+		Q_ASSERT(iterationCount != NULL);
+
+		// the memory cost is fixed, and each pass takes about as long as
+		//   the first one
+		QElapsedTimer timer;
+		timer.start();
+		SymmetricKey key = makeKey(secret, salt, keyLength, 1);
+		qint64 elapsed = qMax(timer.elapsed(), (qint64)1);
+
+		*iterationCount = 1;
+		if(key.isEmpty() || elapsed >= msecInterval)
+			return key;
+
+		*iterationCount = (unsigned int)qMin((qint64)msecInterval / elapsed, (qint64)0x7fffffff);
+		if(*iterationCount == 1)
+			return key;
+		return makeKey(secret, salt, keyLength, *iterationCount);
+	}
+
+	virtual unsigned int memoryCost() const
+	{
+		return _memoryCost;
+	}
+
+	virtual void setMemoryCost(unsigned int kib)
+	{
+		_memoryCost = kib;
+	}
+
+	virtual int parallelism() const
+	{
+		return _parallelism;
+	}
+
+	virtual void setParallelism(int lanes)
+	{
+		_parallelism = lanes;
+	}
+};
+
+KDFContext *create_default_kdf(Provider *p, const QString &type)
+{
+	if(type == "scrypt")
+		return new DefaultScryptContext(p);
+	else if(type == "argon2id")
+		return new DefaultArgon2Context(p);
+	else
+		return 0;
+}
+
+}
@@ -23,6 +23,7 @@
 
 #include <QCoreApplication>
 #include <QAbstractEventDispatcher>
+#include <QHash>
 #include <QPointer>
 #include <QSet>
 #include <QMutex>
@@ -119,10 +120,56 @@ public:
 		}
 	};
 
+	// what changed in a store from one version of its index to the next
+	class EntryDelta
+	{
+	public:
+		int version;
+		QList<KeyStoreEntry> added, changed;
+		QStringList removed;
+
+		bool isEmpty() const
+		{
+			return added.isEmpty() && changed.isEmpty() && removed.isEmpty();
+		}
+	};
+
+	// the entries of a store, fetched from the provider once and then
+	//   kept up to date as the store changes.  version goes up with each
+	//   change, and the most recent changes are kept so that they can be
+	//   handed out instead of the whole list.
+	class EntryIndex
+	{
+	public:
+		int version;
+		QList<KeyStoreEntry> entries;
+		QList<EntryDelta> history;
+
+		EntryIndex() : version(0)
+		{
+		}
+	};
+
+	// the entries of a store, and how they differ from an earlier
+	//   version.  complete is false if the changes go back further than
+	//   the index remembers.
+	class EntryChanges
+	{
+	public:
+		int version;
+		QList<KeyStoreEntry> entries;
+		QList<KeyStoreEntry> added, changed;
+		QStringList removed;
+		bool complete;
+	};
+
+	enum { MaxHistory = 32 };
+
 	QMutex m;
 	QSet<KeyStoreListContext*> sources;
 	QSet<KeyStoreListContext*> busySources;
 	QList<Item> items;
+	QHash<int, EntryIndex> indexes; // by tracker id, written in the tracker thread
 	QString dtext;
 	bool startedAll;
 	bool busy;
@@ -172,6 +219,87 @@ public:
 		return items;
 	}
 
+	// thread-safe.  returns false if the store hasn't been indexed yet
+	bool cachedEntryList(int trackerId, QList<KeyStoreEntry> *entries, int *version)
+	{
+		QMutexLocker locker(&m);
+		QHash<int, EntryIndex>::const_iterator it = indexes.constFind(trackerId);
+		if(it == indexes.constEnd())
+			return false;
+		*entries = it->entries;
+		*version = it->version;
+		return true;
+	}
+
+	// thread-safe.  returns false if the store hasn't been indexed yet
+	bool entryChanges(int trackerId, int since, EntryChanges *out)
+	{
+		QMutexLocker locker(&m);
+		QHash<int, EntryIndex>::const_iterator it = indexes.constFind(trackerId);
+		if(it == indexes.constEnd())
+			return false;
+
+		const EntryIndex &index = *it;
+		out->version = index.version;
+		out->entries = index.entries;
+		out->added.clear();
+		out->changed.clear();
+		out->removed.clear();
+		out->complete = (since == index.version);
+		if(out->complete || since <= 0 || index.history.isEmpty() || index.history.first().version > since + 1)
+			return true;
+
+		// fold the deltas after since into one
+		QList<KeyStoreEntry> added, changed;
+		QStringList removed;
+		foreach(const EntryDelta &d, index.history)
+		{
+			if(d.version <= since)
+				continue;
+
+			foreach(const KeyStoreEntry &e, d.added)
+			{
+				// removed and back again is a change
+				if(removed.removeAll(e.id()) > 0)
+					changed += e;
+				else
+					added += e;
+			}
+			foreach(const KeyStoreEntry &e, d.changed)
+			{
+				int at = findEntry(added, e.id());
+				if(at != -1)
+					added[at] = e;
+				else
+				{
+					at = findEntry(changed, e.id());
+					if(at != -1)
+						changed[at] = e;
+					else
+						changed += e;
+				}
+			}
+			foreach(const QString &id, d.removed)
+			{
+				int at = findEntry(added, id);
+				if(at != -1)
+				{
+					added.removeAt(at);
+					continue;
+				}
+				at = findEntry(changed, id);
+				if(at != -1)
+					changed.removeAt(at);
+				removed += id;
+			}
+		}
+		out->added = added;
+		out->changed = changed;
+		out->removed = removed;
+		out->complete = true;
+		return true;
+	}
+
 	// thread-safe
 	QString getDText()
 	{
@@ -250,19 +378,14 @@ public slots:
 
 	QList<QCA::KeyStoreEntry> entryList(int trackerId)
 	{
-		QList<KeyStoreEntry> out;
 		int at = findItem(trackerId);
 		if(at == -1)
-			return out;
-		Item &i = items[at];
-		QList<KeyStoreEntryContext*> list = i.owner->entryList(i.storeContextId);
-		for(int n = 0; n < list.count(); ++n)
-		{
-			KeyStoreEntry entry;
-			entry.change(list[n]);
-			out.append(entry);
-		}
-		return out;
+			return QList<KeyStoreEntry>();
+
+		// the index is kept up to date once it exists
+		if(!indexes.contains(trackerId))
+			updateIndex(items[at]);
+		return indexes.value(trackerId).entries;
 	}
 
 	QList<QCA::KeyStoreEntry::Type> entryTypes(int trackerId)
@@ -315,25 +438,24 @@ public slots:
 		int at = findItem(trackerId);
 		if(at == -1)
 			return QString();
-		Item &i = items[at];
 #if QT_VERSION >= 0x050000
 		if(v.canConvert<KeyBundle>())
-			return i.owner->writeEntry(i.storeContextId, v.value<KeyBundle>());
+			return writeEntry(trackerId, v.value<KeyBundle>());
 		else if(v.canConvert<Certificate>())
-			return i.owner->writeEntry(i.storeContextId, v.value<Certificate>());
+			return writeEntry(trackerId, v.value<Certificate>());
 		else if(v.canConvert<CRL>())
-			return i.owner->writeEntry(i.storeContextId, v.value<CRL>());
+			return writeEntry(trackerId, v.value<CRL>());
 		else if(v.canConvert<PGPKey>())
-			return i.owner->writeEntry(i.storeContextId, v.value<PGPKey>());
+			return writeEntry(trackerId, v.value<PGPKey>());
 #else
 		if(qVariantCanConvert<KeyBundle>(v))
-			return i.owner->writeEntry(i.storeContextId, qVariantValue<KeyBundle>(v));
+			return writeEntry(trackerId, qVariantValue<KeyBundle>(v));
 		else if(qVariantCanConvert<Certificate>(v))
-			return i.owner->writeEntry(i.storeContextId, qVariantValue<Certificate>(v));
+			return writeEntry(trackerId, qVariantValue<Certificate>(v));
 		else if(qVariantCanConvert<CRL>(v))
-			return i.owner->writeEntry(i.storeContextId, qVariantValue<CRL>(v));
+			return writeEntry(trackerId, qVariantValue<CRL>(v));
 		else if(qVariantCanConvert<PGPKey>(v))
-			return i.owner->writeEntry(i.storeContextId, qVariantValue<PGPKey>(v));
+			return writeEntry(trackerId, qVariantValue<PGPKey>(v));
 #endif
 		else
 			return QString();
@@ -346,7 +468,9 @@ public slots:
 			return QString();
 		Item &i = items[at];
 
-		return i.owner->writeEntry(i.storeContextId, v);
+		QString entryId = i.owner->writeEntry(i.storeContextId, v);
+		refreshIndex(i);
+		return entryId;
 	}
 
 	QString writeEntry(int trackerId, const QCA::Certificate &v)
@@ -356,7 +480,9 @@ public slots:
 			return QString();
 		Item &i = items[at];
 
-		return i.owner->writeEntry(i.storeContextId, v);
+		QString entryId = i.owner->writeEntry(i.storeContextId, v);
+		refreshIndex(i);
+		return entryId;
 	}
 
 	QString writeEntry(int trackerId, const QCA::CRL &v)
@@ -366,7 +492,9 @@ public slots:
 			return QString();
 		Item &i = items[at];
 
-		return i.owner->writeEntry(i.storeContextId, v);
+		QString entryId = i.owner->writeEntry(i.storeContextId, v);
+		refreshIndex(i);
+		return entryId;
 	}
 
 	QString writeEntry(int trackerId, const QCA::PGPKey &v)
@@ -376,7 +504,9 @@ public slots:
 			return QString();
 		Item &i = items[at];
 
-		return i.owner->writeEntry(i.storeContextId, v);
+		QString entryId = i.owner->writeEntry(i.storeContextId, v);
+		refreshIndex(i);
+		return entryId;
 	}
 
 	bool removeEntry(int trackerId, const QString &entryId)
@@ -385,7 +515,9 @@ public slots:
 		if(at == -1)
 			return false;
 		Item &i = items[at];
-		return i.owner->removeEntry(i.storeContextId, entryId);
+		bool ok = i.owner->removeEntry(i.storeContextId, entryId);
+		refreshIndex(i);
+		return ok;
 	}
 
 signals:
@@ -421,6 +553,98 @@ private:
 		return -1;
 	}
 
+	static int findEntry(const QList<KeyStoreEntry> &list, const QString &id)
+	{
+		for(int n = 0; n < list.count(); ++n)
+		{
+			if(list[n].id() == id)
+				return n;
+		}
+		return -1;
+	}
+
+	static bool sameEntry(const KeyStoreEntry &e, const KeyStoreEntryContext *c)
+	{
+		return e.type() == c->type()
+			&& e.name() == c->name()
+			&& e.isAvailable() == c->isAvailable()
+			&& e.toString() == c->serialize();
+	}
+
+	// fetches the entries of a store from the provider, and records how
+	//   they differ from the indexed ones.  entries that haven't changed
+	//   are kept as they are, rather than made anew.
+	void updateIndex(const Item &i)
+	{
+		QList<KeyStoreEntryContext*> list = i.owner->entryList(i.storeContextId);
+
+		// only this thread writes the index, so it can be read unlocked
+		QHash<int, EntryIndex>::const_iterator it = indexes.constFind(i.trackerId);
+		bool existed = (it != indexes.constEnd());
+		QList<KeyStoreEntry> old;
+		if(existed)
+			old = it->entries;
+
+		QHash<QString, int> oldPositions;
+		for(int n = 0; n < old.count(); ++n)
+			oldPositions.insert(old[n].id(), n);
+
+		QList<KeyStoreEntry> entries;
+		EntryDelta delta;
+		QSet<QString> seen;
+		for(int n = 0; n < list.count(); ++n)
+		{
+			KeyStoreEntryContext *c = list[n];
+			QString id = c->id();
+			seen += id;
+
+			int at = oldPositions.value(id, -1);
+			if(at != -1 && sameEntry(old[at], c))
+			{
+				entries += old[at];
+				delete c;
+				continue;
+			}
+
+			KeyStoreEntry entry;
+			entry.change(c);
+			entries += entry;
+			if(at != -1)
+				delta.changed += entry;
+			else
+				delta.added += entry;
+		}
+		for(int n = 0; n < old.count(); ++n)
+		{
+			if(!seen.contains(old[n].id()))
+				delta.removed += old[n].id();
+		}
+
+		if(existed && delta.isEmpty())
+			return;
+
+		QMutexLocker locker(&m);
+		EntryIndex &index = indexes[i.trackerId];
+		index.entries = entries;
+		++index.version;
+		if(existed)
+		{
+			delta.version = index.version;
+			index.history += delta;
+			if(index.history.count() > MaxHistory)
+				index.history.removeFirst();
+		}
+
+		QCA_logTextMessage(QString("keystore: %1 index version %2, %3 entries").arg(i.name, QString::number(index.version), QString::number(entries.count())), Logger::Information);
+	}
+
+	// only stores that have been asked for are indexed
+	void refreshIndex(const Item &i)
+	{
+		if(indexes.contains(i.trackerId))
+			updateIndex(i);
+	}
+
 	void startProvider(Provider *p)
 	{
 		KeyStoreListContext *c = static_cast<KeyStoreListContext *>(getContext("keystorelist", p));
@@ -455,6 +679,7 @@ private:
 			{
 				QCA_logTextMessage(QString("keystore: updateStores remove %1").arg(items[n].storeContextId), Logger::Information);
 
+				indexes.remove(items[n].trackerId);
 				items.removeAt(n);
 				--n; // adjust position
 
@@ -581,21 +806,27 @@ private slots:
 
 		QCA_logTextMessage(QString("keystore: ksl_storeUpdated %1 %2").arg(c->provider()->name(), QString::number(id)), Logger::Information);
 
-		QMutexLocker locker(&m);
+		m.lock();
 		for(int n = 0; n < items.count(); ++n)
 		{
 			Item &i = items[n];
 			if(i.owner == c && i.storeContextId == id)
 			{
 				++i.updateCount;
+				Item copy = i;
+				m.unlock();
+
+				QCA_logTextMessage(QString("keystore: %1 updateCount = %2").arg(copy.name, QString::number(copy.updateCount)), Logger::Information);
 
-				QCA_logTextMessage(QString("keystore: %1 updateCount = %2").arg(i.name, QString::number(i.updateCount)), Logger::Information);
+				// have the changes ready before anyone is told
+				refreshIndex(copy);
 
 				QCA_logTextMessage(QString("keystore: emitting updated"), Logger::Information);
 				emit updated_p();
 				return;
 			}
 		}
+		m.unlock();
 	}
 };
 
@@ -1056,9 +1287,10 @@ public:
 	bool async;
 	bool need_update;
 	QList<KeyStoreEntry> latestEntryList;
+	int entryVersion; // of the tracker's index, as last seen here
 	QList<KeyStoreOperation*> ops;
 
-	KeyStorePrivate(KeyStore *_q) : QObject(_q), q(_q), async(false)
+	KeyStorePrivate(KeyStore *_q) : QObject(_q), q(_q), async(false), entryVersion(0)
 	{
 	}
 
@@ -1089,8 +1321,46 @@ public:
 		return false;
 	}
 
+	// picks up the changes to the tracker's index since they were last
+	//   seen here, and emits them.  returns false if the store isn't
+	//   indexed, or if this object was deleted by a slot.
+	bool takeChanges()
+	{
+		KeyStoreTracker::EntryChanges c;
+		if(!KeyStoreTracker::instance()->entryChanges(trackerId, entryVersion, &c))
+			return false;
+
+		bool delta = (entryVersion > 0 && c.complete && c.version != entryVersion);
+		entryVersion = c.version;
+		if(async)
+			latestEntryList = c.entries;
+
+		if(delta)
+		{
+			QPointer<QObject> self(this);
+			emit q->entriesChanged(c.added, c.changed, c.removed);
+			if(!self)
+				return false;
+		}
+		return true;
+	}
+
 	void handle_updated()
 	{
+		// an indexed store has its changes ready, so the entries don't
+		//   need to be fetched again
+		if(!(async && have_entryList_op()) && trackerId != -1)
+		{
+			QPointer<QObject> self(this);
+			if(takeChanges())
+			{
+				emit q->updated();
+				return;
+			}
+			if(!self)
+				return;
+		}
+
 		if(async)
 		{
 			if(!have_entryList_op())
@@ -1144,7 +1414,10 @@ private slots:
 
 		if(op->type == KeyStoreOperation::EntryList)
 		{
-			latestEntryList = op->entryList;
+			// take the list together with its version, if the store is
+			//   still there
+			if(!KeyStoreTracker::instance()->cachedEntryList(trackerId, &latestEntryList, &entryVersion))
+				latestEntryList = op->entryList;
 			ops.removeAll(op);
 			delete op;
 
@@ -1243,11 +1516,30 @@ QList<KeyStoreEntry> KeyStore::entryList() const
 
 	if(d->trackerId == -1)
 		return QList<KeyStoreEntry>();
+
+	// once the store is indexed this is a shared copy, with no call
+	//   into the tracker thread
+	QList<KeyStoreEntry> list;
+	int version;
+	if(KeyStoreTracker::instance()->cachedEntryList(d->trackerId, &list, &version))
+	{
+		if(d->entryVersion == 0)
+			d->entryVersion = version;
+		return list;
+	}
+
 #if QT_VERSION >= 0x050000
-	return trackercall("entryList", QVariantList() << d->trackerId).value< QList<KeyStoreEntry> >();
+	list = trackercall("entryList", QVariantList() << d->trackerId).value< QList<KeyStoreEntry> >();
 #else
-	return qVariantValue< QList<KeyStoreEntry> >(trackercall("entryList", QVariantList() << d->trackerId));
+	list = qVariantValue< QList<KeyStoreEntry> >(trackercall("entryList", QVariantList() << d->trackerId));
 #endif
+	if(d->entryVersion == 0)
+	{
+		QList<KeyStoreEntry> indexed;
+		if(KeyStoreTracker::instance()->cachedEntryList(d->trackerId, &indexed, &version))
+			d->entryVersion = version;
+	}
+	return list;
 }
 
 bool KeyStore::holdsTrustedCertificates() const
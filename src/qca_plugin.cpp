@@ -32,8 +32,11 @@
 #include <QCoreApplication>
 #include <QDir>
 #include <QFileInfo>
+#include <QHash>
 #include <QLibrary>
+#include <QPair>
 #include <QPluginLoader>
+#include <QThreadStorage>
 
 #define PLUGIN_SUBDIR "crypto"
 
@@ -41,6 +44,10 @@ namespace QCA {
 
 // from qca_core.cpp
 QVariantMap getProviderConfig_internal(Provider *p);
+void flush_context_pools(Provider *p);
+
+// from qca_basic.cpp
+void flush_thread_randoms(Provider *p);
 
 // from qca_default.cpp
 QStringList skip_plugins(Provider *defaultProvider);
@@ -77,6 +84,68 @@ QString truncate_log(const QString &in, int size)
 
 static ProviderManager *g_pluginman = 0;
 
+// Provider resolution cache.  Each thread keeps its own map of
+//   (provider name, type) -> Provider*, stamped with the generation of the
+//   provider list it was built against.  Any change to the provider list
+//   bumps the global generation, causing the per-thread maps to be thrown
+//   out the next time they are consulted.  This keeps the lookup free of
+//   locks for the common case of repeatedly creating the same algorithm.
+//   The hit and miss counts are kept per thread as well, and only summed
+//   up when they are asked for.
+class ProviderCache
+{
+public:
+	int generation;
+	QHash<QPair<QString,QString>, Provider*> map;
+
+	// only written by the thread owning the cache
+	QAtomicInt hits, misses;
+
+	ProviderCache();
+	~ProviderCache();
+};
+
+class ProviderCacheList
+{
+public:
+	QMutex m;
+	QList<ProviderCache*> list;
+
+	// counts of the threads that have finished
+	int retiredHits, retiredMisses;
+
+	ProviderCacheList() : retiredHits(0), retiredMisses(0) {}
+};
+
+Q_GLOBAL_STATIC(ProviderCacheList, g_providerCaches)
+Q_GLOBAL_STATIC(QThreadStorage<ProviderCache*>, g_providerCache)
+
+ProviderCache::ProviderCache() : generation(-1)
+{
+	ProviderCacheList *caches = g_providerCaches();
+	QMutexLocker locker(&caches->m);
+	caches->list += this;
+}
+
+ProviderCache::~ProviderCache()
+{
+	// the list is gone if we are destroyed during application exit
+	ProviderCacheList *caches = g_providerCaches();
+	if(!caches)
+		return;
+
+	QMutexLocker locker(&caches->m);
+	caches->list.removeAll(this);
+	caches->retiredHits += atomicLoadAcquire(hits);
+	caches->retiredMisses += atomicLoadAcquire(misses);
+}
+static QAtomicInt g_providerGeneration;
+
+static void invalidateProviderCache()
+{
+	g_providerGeneration.ref();
+}
+
 static void logDebug(const QString &str)
 {
 	if(g_pluginman)
@@ -306,10 +375,13 @@ ProviderManager::ProviderManager()
 
 ProviderManager::~ProviderManager()
 {
+	flush_thread_randoms(0);
+	flush_context_pools(0);
 	if(def)
 		def->deinit();
 	unloadAll();
 	delete def;
+	invalidateProviderCache();
 	g_pluginman = 0;
 }
 
@@ -494,12 +566,15 @@ bool ProviderManager::unload(const QString &name)
 		ProviderItem *i = providerItemList[n];
 		if(i->p && i->p->name() == name)
 		{
+			flush_thread_randoms(i->p);
+			flush_context_pools(i->p);
 			if(i->initted())
 				i->p->deinit();
 
 			delete i;
 			providerItemList.removeAt(n);
 			providerList.removeAt(n);
+			invalidateProviderCache();
 
 			logDebug(QString("Unloaded: %1").arg(name));
 			return true;
@@ -513,6 +588,8 @@ void ProviderManager::unloadAll()
 {
 	foreach(ProviderItem *i, providerItemList)
 	{
+		flush_thread_randoms(i->p);
+		flush_context_pools(i->p);
 		if(i->initted())
 			i->p->deinit();
 	}
@@ -524,6 +601,7 @@ void ProviderManager::unloadAll()
 		delete i;
 		providerItemList.removeFirst();
 		providerList.removeFirst();
+		invalidateProviderCache();
 
 		logDebug(QString("Unloaded: %1").arg(name));
 	}
@@ -534,8 +612,13 @@ void ProviderManager::setDefault(Provider *p)
 	QMutexLocker locker(&providerMutex);
 
 	if(def)
+	{
+		flush_thread_randoms(def);
+		flush_context_pools(def);
 		delete def;
+	}
 	def = p;
+	invalidateProviderCache();
 	if(def)
 	{
 		def->init();
@@ -606,6 +689,40 @@ Provider *ProviderManager::find(const QString &name) const
 }
 
 Provider *ProviderManager::findFor(const QString &name, const QString &type) const
+{
+	QThreadStorage<ProviderCache*> *storage = g_providerCache();
+	if(!storage->hasLocalData())
+		storage->setLocalData(new ProviderCache);
+	ProviderCache *cache = storage->localData();
+
+	// read the generation before doing any lookup, so that a change
+	//   happening in the middle of it won't be cached as current
+	int generation = atomicLoadAcquire(g_providerGeneration);
+	if(cache->generation != generation)
+	{
+		cache->map.clear();
+		cache->generation = generation;
+	}
+
+	QPair<QString,QString> key(name, type);
+	Provider *p = cache->map.value(key);
+	if(p)
+	{
+		cache->hits.fetchAndAddRelaxed(1);
+		return p;
+	}
+
+	cache->misses.fetchAndAddRelaxed(1);
+	p = findForUncached(name, type);
+
+	// only remember successful lookups, so that a rescan can still find
+	//   providers that were missing before
+	if(p)
+		cache->map.insert(key, p);
+	return p;
+}
+
+Provider *ProviderManager::findForUncached(const QString &name, const QString &type) const
 {
 	if(name.isEmpty())
 	{
@@ -714,6 +831,39 @@ ProviderList ProviderManager::providers() const
 	return providerList;
 }
 
+int ProviderManager::cacheHits() const
+{
+	ProviderCacheList *caches = g_providerCaches();
+	QMutexLocker locker(&caches->m);
+	int total = caches->retiredHits;
+	foreach(ProviderCache *cache, caches->list)
+		total += atomicLoadAcquire(cache->hits);
+	return total;
+}
+
+int ProviderManager::cacheMisses() const
+{
+	ProviderCacheList *caches = g_providerCaches();
+	QMutexLocker locker(&caches->m);
+	int total = caches->retiredMisses;
+	foreach(ProviderCache *cache, caches->list)
+		total += atomicLoadAcquire(cache->misses);
+	return total;
+}
+
+void ProviderManager::resetCacheStatistics()
+{
+	ProviderCacheList *caches = g_providerCaches();
+	QMutexLocker locker(&caches->m);
+	caches->retiredHits = 0;
+	caches->retiredMisses = 0;
+	foreach(ProviderCache *cache, caches->list)
+	{
+		cache->hits.fetchAndStoreRelaxed(0);
+		cache->misses.fetchAndStoreRelaxed(0);
+	}
+}
+
 QString ProviderManager::diagnosticText() const
 {
 	QMutexLocker locker(&logMutex);
@@ -738,6 +888,8 @@ void ProviderManager::clearDiagnosticText()
 
 void ProviderManager::addItem(ProviderItem *item, int priority)
 {
+	invalidateProviderCache();
+
 	if(priority < 0)
 	{
 		// for -1, make the priority the same as the last item
@@ -26,6 +26,7 @@
 // NOTE: this API is private to QCA
 
 #include "qca_core.h"
+#include <QAtomicInt>
 #include <QMutex>
 
 namespace QCA {
@@ -51,6 +52,10 @@ public:
 	QStringList allFeatures() const;
 	ProviderList providers() const;
 
+	int cacheHits() const;
+	int cacheMisses() const;
+	void resetCacheStatistics();
+
 	static void mergeFeatures(QStringList *a, const QStringList &b);
 
 	QString diagnosticText() const;
@@ -64,11 +69,23 @@ private:
 	ProviderList providerList;
 	Provider *def;
 	bool scanned_static;
+	Provider *findForUncached(const QString &name, const QString &type) const;
 	void addItem(ProviderItem *i, int priority);
 	bool haveAlready(const QString &name) const;
 	int get_default_priority(const QString &name) const;
 };
 
+// Qt 4 has no explicit load operations, but reading the value directly has
+//   the same effect there
+inline int atomicLoadAcquire(const QAtomicInt &a)
+{
+#if QT_VERSION >= 0x050000
+	return a.loadAcquire();
+#else
+	return a;
+#endif
+}
+
 }
 
 #endif
@@ -0,0 +1,662 @@
+/*
+ * qca_securealloc.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// secure memory allocator with per-thread caches.
+//
+// small allocations are rounded up to one of a few size classes, and
+//   each thread keeps a list of free chunks for every class, so that most
+//   allocations and frees don't take any lock at all.  threads exchange
+//   chunks in batches through a shared depot, which takes a lock per size
+//   class, and the depot gets new chunks by carving up slabs.  slabs are
+//   only given back when the allocator is destroyed.
+//
+// when memory locking works, slabs are cut from an arena of large regions
+//   that we map and lock ourselves, so that we can tell when the lock limit
+//   has been reached.  otherwise slabs are taken from the underlying (mmap
+//   or malloc) pool.  only allocations too big for any size class get a
+//   region of their own, since mapping and locking one is expensive.
+//
+// free chunks are always zero, except for the link to the next chunk
+//   stored at their start, which is cleared again when handed out.
+
+#include "qca_core.h"
+#include "botantools/botantools.h"
+
+#include <QAtomicInt>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QThreadStorage>
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef Q_OS_UNIX
+# include <sys/mman.h>
+# include <unistd.h>
+#endif
+#ifdef Q_OS_WIN
+# include <windows.h>
+#endif
+
+#ifdef MLOCK_NOT_VOID_PTR
+# define MLOCK_TYPE_CAST (char *)
+#else
+# define MLOCK_TYPE_CAST
+#endif
+
+namespace QCA {
+
+enum
+{
+	MinChunkShift = 6,           // 64 bytes
+	SizeClasses   = 9,           // 64 .. 16384 bytes
+	SlabSize      = 16 * 1024,   // smallest slab, and unit of the arena
+	CacheBytes    = 16 * 1024    // per size class and thread
+};
+
+static QAtomicInt g_policy(SecureMemoryGrow);
+static QAtomicInt g_growSize(0);
+
+static inline int chunk_size(int c)
+{
+	return 1 << (MinChunkShift + c);
+}
+
+// size class for an allocation, or -1 if it is too big for one
+static inline int size_class(Botan::u32bit n)
+{
+	if(n > (Botan::u32bit)chunk_size(SizeClasses - 1))
+		return -1;
+	int c = 0;
+	while((Botan::u32bit)chunk_size(c) < n)
+		++c;
+	return c;
+}
+
+// slabs of the larger classes hold a few chunks each
+static inline int slab_size(int c)
+{
+	return qMax((int)SlabSize, 4 * chunk_size(c));
+}
+
+// the most chunks a thread keeps of a class.  half of them move to or
+//   from the depot at a time.
+static inline int cache_limit(int c)
+{
+	return qMax(CacheBytes / chunk_size(c), 2);
+}
+
+static inline int round_up(int n, int align)
+{
+	return (n + align - 1) / align * align;
+}
+
+static int page_size()
+{
+#if defined(Q_OS_UNIX)
+	return (int)sysconf(_SC_PAGESIZE);
+#elif defined(Q_OS_WIN)
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return (int)info.dwPageSize;
+#else
+	return 4096;
+#endif
+}
+
+// map a zeroed, page aligned region and try to lock it into memory.
+//   returns 0 if no memory could be mapped at all.
+static void *region_alloc(int size, bool *locked)
+{
+	*locked = false;
+#if defined(Q_OS_UNIX)
+	void *p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+	if(p == MAP_FAILED)
+		return 0;
+# ifdef MADV_DONTDUMP
+	madvise(p, size, MADV_DONTDUMP);
+# endif
+	*locked = (mlock(MLOCK_TYPE_CAST p, size) == 0);
+	return p;
+#elif defined(Q_OS_WIN)
+	void *p = VirtualAlloc(0, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+	if(!p)
+		return 0;
+	*locked = (VirtualLock(p, size) != 0);
+	return p;
+#else
+	void *p = malloc(size);
+	if(p)
+		memset(p, 0, size);
+	return p;
+#endif
+}
+
+static void region_free(void *p, int size, bool locked)
+{
+	memset(p, 0, size);
+#if defined(Q_OS_UNIX)
+	if(locked)
+		munlock(MLOCK_TYPE_CAST p, size);
+	munmap(p, size);
+#elif defined(Q_OS_WIN)
+	if(locked)
+		VirtualUnlock(p, size);
+	VirtualFree(p, 0, MEM_RELEASE);
+#else
+	Q_UNUSED(locked);
+	free(p);
+#endif
+}
+
+struct FreeChunk
+{
+	FreeChunk *next;
+};
+
+class ChunkList
+{
+public:
+	FreeChunk *head;
+	int count;
+
+	ChunkList() : head(0), count(0) {}
+
+	void push(void *p)
+	{
+		FreeChunk *f = static_cast<FreeChunk *>(p);
+		f->next = head;
+		head = f;
+		++count;
+	}
+
+	void *pop()
+	{
+		FreeChunk *f = head;
+		head = f->next;
+		f->next = 0;
+		--count;
+		return f;
+	}
+
+	// move up to n chunks from the front of this list to another
+	void moveTo(ChunkList *other, int n)
+	{
+		while(n-- > 0 && head)
+		{
+			FreeChunk *f = head;
+			head = f->next;
+			--count;
+			f->next = other->head;
+			other->head = f;
+			++other->count;
+		}
+	}
+};
+
+struct Region
+{
+	char *p;
+	int size;
+	bool locked;
+};
+
+class Thread_Caching_Allocator;
+
+class ThreadCache
+{
+public:
+	Thread_Caching_Allocator *owner;
+	ChunkList lists[SizeClasses];
+
+	// bytes handed out by this thread, minus those it gave back.  only
+	//   written by the thread itself.
+	QAtomicInt inUse;
+
+	ThreadCache();
+	~ThreadCache();
+};
+
+class ThreadCacheList
+{
+public:
+	QMutex m;
+	QList<ThreadCache*> list;
+	Thread_Caching_Allocator *current;
+
+	ThreadCacheList() : current(0) {}
+};
+
+Q_GLOBAL_STATIC(ThreadCacheList, g_threadCaches)
+Q_GLOBAL_STATIC(QThreadStorage<ThreadCache*>, g_threadCache)
+
+class Thread_Caching_Allocator : public Botan::Allocator
+{
+public:
+	Botan::Allocator *backing;
+	int prealloc;
+	QMutex depotMutex[SizeClasses];
+	ChunkList depot[SizeClasses];
+
+	// bytes in use that are not counted by any thread cache
+	QAtomicInt sharedInUse;
+
+	// everything below is protected by arenaMutex
+	QMutex arenaMutex;
+	QList<Region> regions;
+	QList<char*> spareSlabs;
+	QHash<void*, Region> large;
+	char *arenaAt;
+	int arenaLeft;
+	qint64 bytesLocked;
+	qint64 bytesUnlocked;
+	qint64 peak;
+	int fallbackEvents;
+
+	// if backing is 0, memory is mapped and locked by us
+	Thread_Caching_Allocator(Botan::Allocator *_backing, int _prealloc) :
+		backing(_backing),
+		prealloc(_prealloc),
+		arenaAt(0),
+		arenaLeft(0),
+		bytesLocked(0),
+		bytesUnlocked(0),
+		peak(0),
+		fallbackEvents(0)
+	{
+		// not being able to lock anything is the first fallback
+		if(backing)
+			fallbackEvents = 1;
+	}
+
+	virtual std::string type() const
+	{
+		return "qca_threaded";
+	}
+
+	// returns 0 if the calling thread has no cache, and one is not wanted
+	ThreadCache *localCache(bool create)
+	{
+		QThreadStorage<ThreadCache*> *storage = g_threadCache();
+		if(!storage)
+			return 0;
+		if(!storage->hasLocalData())
+		{
+			if(!create)
+				return 0;
+			storage->setLocalData(new ThreadCache);
+		}
+
+		// a cache left over from a previous allocator was emptied when
+		//   that allocator was destroyed, so it can simply be taken over
+		ThreadCache *tc = storage->localData();
+		tc->owner = this;
+		return tc;
+	}
+
+	// the size of the next arena region
+	int growSize() const
+	{
+		int size = g_growSize.fetchAndAddRelaxed(0);
+		if(size <= 0)
+			size = prealloc;
+		return qMax(round_up(size, SlabSize), (int)SlabSize);
+	}
+
+	void account(const Region &r, int sign)
+	{
+		if(r.locked)
+			bytesLocked += sign * r.size;
+		else
+			bytesUnlocked += sign * r.size;
+		peak = qMax(peak, bytesLocked + bytesUnlocked);
+	}
+
+	// call with arenaMutex held
+	Region newRegion(int size)
+	{
+		Region r;
+		r.size = size;
+		if(backing)
+		{
+			r.p = static_cast<char *>(backing->allocate(size));
+			r.locked = false;
+		}
+		else
+		{
+			r.size = round_up(size, page_size());
+			r.p = static_cast<char *>(region_alloc(r.size, &r.locked));
+			if(!r.p)
+				throw std::bad_alloc();
+
+			if(!r.locked)
+			{
+				// secure allocations have no way to report failure, so
+				//   failing fast means stopping here
+				if(g_policy.fetchAndAddRelaxed(0) == SecureMemoryFailFast)
+				{
+					fprintf(stderr, "QCA: Unable to lock secure memory\n");
+					abort();
+				}
+				if(fallbackEvents == 0)
+					fprintf(stderr, "QCA: Unable to lock secure memory, continuing with unlocked memory\n");
+				++fallbackEvents;
+			}
+		}
+		account(r, 1);
+		return r;
+	}
+
+	// call with arenaMutex held
+	void freeRegion(const Region &r)
+	{
+		account(r, -1);
+		if(backing)
+			backing->deallocate(r.p, r.size);
+		else
+			region_free(r.p, r.size, r.locked);
+	}
+
+	// size is a multiple of SlabSize
+	char *takeSlab(int size)
+	{
+		QMutexLocker locker(&arenaMutex);
+		if(size == SlabSize && !spareSlabs.isEmpty())
+			return spareSlabs.takeLast();
+
+		if(arenaLeft < size)
+		{
+			// what is left of the current region is kept for smaller slabs
+			while(arenaLeft >= SlabSize)
+			{
+				spareSlabs += arenaAt;
+				arenaAt += SlabSize;
+				arenaLeft -= SlabSize;
+			}
+
+			Region r = newRegion(backing ? size : qMax(growSize(), size));
+			regions += r;
+			arenaAt = r.p;
+			arenaLeft = r.size;
+		}
+		char *slab = arenaAt;
+		arenaAt += size;
+		arenaLeft -= size;
+		return slab;
+	}
+
+	// fill a thread list with chunks from the depot, or a new slab
+	void refill(int c, ChunkList *list)
+	{
+		int batch = cache_limit(c) / 2;
+		{
+			QMutexLocker locker(&depotMutex[c]);
+			depot[c].moveTo(list, batch);
+		}
+		if(list->count > 0)
+			return;
+
+		char *slab = takeSlab(slab_size(c));
+
+		int size = chunk_size(c);
+		ChunkList fresh;
+		for(int at = slab_size(c) - size; at >= 0; at -= size)
+			fresh.push(slab + at);
+		fresh.moveTo(list, batch);
+
+		if(fresh.count > 0)
+		{
+			QMutexLocker locker(&depotMutex[c]);
+			fresh.moveTo(&depot[c], fresh.count);
+		}
+	}
+
+	virtual void *allocate(Botan::u32bit n)
+	{
+		int c = size_class(n);
+		if(c == -1)
+		{
+			QMutexLocker locker(&arenaMutex);
+			Region r = newRegion((int)n);
+			large.insert(r.p, r);
+			sharedInUse.fetchAndAddRelaxed(r.size);
+			return r.p;
+		}
+
+		ThreadCache *tc = localCache(true);
+		if(!tc)
+		{
+			sharedInUse.fetchAndAddRelaxed(chunk_size(c));
+			QMutexLocker locker(&depotMutex[c]);
+			if(depot[c].count == 0)
+			{
+				locker.unlock();
+				ChunkList list;
+				refill(c, &list);
+				locker.relock();
+				list.moveTo(&depot[c], list.count);
+			}
+			return depot[c].pop();
+		}
+
+		tc->inUse.fetchAndAddRelaxed(chunk_size(c));
+		ChunkList *list = &tc->lists[c];
+		if(list->count == 0)
+			refill(c, list);
+		return list->pop();
+	}
+
+	virtual void deallocate(void *p, Botan::u32bit n)
+	{
+		if(!p || n == 0)
+			return;
+
+		int c = size_class(n);
+		if(c == -1)
+		{
+			QMutexLocker locker(&arenaMutex);
+			QHash<void*, Region>::iterator it = large.find(p);
+			Q_ASSERT(it != large.end());
+			if(it == large.end())
+				return;
+			Region r = it.value();
+			large.erase(it);
+			sharedInUse.fetchAndAddRelaxed(-r.size);
+			freeRegion(r);
+			return;
+		}
+
+		memset(p, 0, chunk_size(c));
+
+		// threads that are exiting, or never allocated anything, give
+		//   the chunk straight back to the depot
+		ThreadCache *tc = localCache(false);
+		if(!tc)
+		{
+			sharedInUse.fetchAndAddRelaxed(-chunk_size(c));
+			QMutexLocker locker(&depotMutex[c]);
+			depot[c].push(p);
+			return;
+		}
+
+		tc->inUse.fetchAndAddRelaxed(-chunk_size(c));
+		ChunkList *list = &tc->lists[c];
+		list->push(p);
+		if(list->count > cache_limit(c))
+		{
+			QMutexLocker locker(&depotMutex[c]);
+			list->moveTo(&depot[c], cache_limit(c) / 2);
+		}
+	}
+
+	// give everything back.  no other thread may be using the allocator
+	//   at this point.
+	virtual void destroy()
+	{
+		ThreadCacheList *caches = g_threadCaches();
+		if(caches)
+		{
+			QMutexLocker locker(&caches->m);
+			foreach(ThreadCache *tc, caches->list)
+			{
+				if(tc->owner != this)
+					continue;
+				for(int c = 0; c < SizeClasses; ++c)
+					tc->lists[c] = ChunkList();
+				tc->inUse.fetchAndStoreRelaxed(0);
+				tc->owner = 0;
+			}
+			if(caches->current == this)
+				caches->current = 0;
+		}
+
+		for(int c = 0; c < SizeClasses; ++c)
+			depot[c] = ChunkList();
+		sharedInUse.fetchAndStoreRelaxed(0);
+
+		// chunks still in use by the application are lost along with
+		//   their slabs, as with the other pools
+		QMutexLocker locker(&arenaMutex);
+		foreach(const Region &r, regions)
+			freeRegion(r);
+		regions.clear();
+		spareSlabs.clear();
+		foreach(const Region &r, large)
+			freeRegion(r);
+		large.clear();
+		arenaAt = 0;
+		arenaLeft = 0;
+	}
+};
+
+ThreadCache::ThreadCache() : owner(0)
+{
+	ThreadCacheList *caches = g_threadCaches();
+	QMutexLocker locker(&caches->m);
+	caches->list += this;
+}
+
+ThreadCache::~ThreadCache()
+{
+	// the list is gone if we are destroyed during application exit
+	ThreadCacheList *caches = g_threadCaches();
+	if(!caches)
+		return;
+
+	QMutexLocker locker(&caches->m);
+	caches->list.removeAll(this);
+
+	if(owner)
+	{
+		owner->sharedInUse.fetchAndAddRelaxed(inUse.fetchAndAddRelaxed(0));
+		for(int c = 0; c < SizeClasses; ++c)
+		{
+			QMutexLocker depotLocker(&owner->depotMutex[c]);
+			lists[c].moveTo(&owner->depot[c], lists[c].count);
+		}
+	}
+}
+
+Botan::Allocator *create_thread_allocator(Botan::Allocator *backing, int prealloc)
+{
+	Thread_Caching_Allocator *a = new Thread_Caching_Allocator(backing, prealloc);
+
+	// honor the preallocation size up front
+	if(!backing)
+	{
+		QMutexLocker locker(&a->arenaMutex);
+		Region r = a->newRegion(a->growSize());
+		a->regions += r;
+		a->arenaAt = r.p;
+		a->arenaLeft = r.size;
+	}
+
+	ThreadCacheList *caches = g_threadCaches();
+	QMutexLocker locker(&caches->m);
+	caches->current = a;
+	return a;
+}
+
+// the number of bytes usable in an allocation of the given size
+int thread_allocator_capacity(int bytes)
+{
+	int c = size_class((Botan::u32bit)bytes);
+	return c == -1 ? bytes : chunk_size(c);
+}
+
+//----------------------------------------------------------------------------
+// SecureMemoryStats
+//----------------------------------------------------------------------------
+SecureMemoryStats::SecureMemoryStats()
+:bytesLocked(0), bytesUnlocked(0), bytesInPool(0), bytesInUse(0), peakBytesInPool(0), fallbackEvents(0)
+{
+}
+
+double SecureMemoryStats::fragmentation() const
+{
+	if(bytesInPool == 0)
+		return 0;
+	return 1.0 - (double)bytesInUse / (double)bytesInPool;
+}
+
+SecureMemoryStats secureMemoryStats()
+{
+	SecureMemoryStats stats;
+	ThreadCacheList *caches = g_threadCaches();
+	if(!caches)
+		return stats;
+
+	QMutexLocker locker(&caches->m);
+	Thread_Caching_Allocator *a = caches->current;
+	if(!a)
+		return stats;
+
+	qint64 inUse = a->sharedInUse.fetchAndAddRelaxed(0);
+	foreach(ThreadCache *tc, caches->list)
+	{
+		if(tc->owner == a)
+			inUse += tc->inUse.fetchAndAddRelaxed(0);
+	}
+
+	QMutexLocker arenaLocker(&a->arenaMutex);
+	stats.bytesLocked = a->bytesLocked;
+	stats.bytesUnlocked = a->bytesUnlocked;
+	stats.bytesInPool = a->bytesLocked + a->bytesUnlocked;
+	stats.bytesInUse = inUse;
+	stats.peakBytesInPool = a->peak;
+	stats.fallbackEvents = a->fallbackEvents;
+	return stats;
+}
+
+void setSecureMemoryPolicy(SecureMemoryPolicy policy, int growSize)
+{
+	g_policy.fetchAndStoreRelaxed(policy);
+	g_growSize.fetchAndStoreRelaxed(growSize);
+}
+
+SecureMemoryPolicy secureMemoryPolicy()
+{
+	return (SecureMemoryPolicy)g_policy.fetchAndAddRelaxed(0);
+}
+
+}
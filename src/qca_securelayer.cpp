@@ -25,6 +25,9 @@
 #include "qca_safeobj.h"
 #include "qca_safetimer.h"
 
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
 #include <QPointer>
 #if QT_VERSION >= 0x050000
 #include <QMetaMethod>
@@ -156,6 +159,176 @@ bool TLSSession::isNull() const
 	return (!context() ? true : false);
 }
 
+//----------------------------------------------------------------------------
+// TLSSessionCache
+//----------------------------------------------------------------------------
+class TLSSessionCache::Private
+{
+public:
+	class Entry
+	{
+	public:
+		TLSSession session;
+		qint64 stored; // msecs on clock
+		quint64 order;
+	};
+
+	mutable QMutex m;
+	int maxEntries;
+	int timeout;
+	QHash<QString, Entry> entries;
+	QElapsedTimer clock;
+	quint64 counter;
+	mutable int hits, misses;
+	int resumed;
+
+	bool isExpired(const Entry &e) const
+	{
+		return clock.elapsed() - e.stored >= (qint64)timeout * 1000;
+	}
+
+	// drop expired sessions, then the oldest ones, until there is room
+	//   for the given number of entries
+	void makeRoom(int max)
+	{
+		QMutableHashIterator<QString, Entry> it(entries);
+		while(it.hasNext())
+		{
+			it.next();
+			if(isExpired(it.value()))
+				it.remove();
+		}
+
+		while(entries.count() > max)
+		{
+			QHash<QString, Entry>::iterator oldest = entries.begin();
+			for(QHash<QString, Entry>::iterator i = entries.begin(); i != entries.end(); ++i)
+			{
+				if(i.value().order < oldest.value().order)
+					oldest = i;
+			}
+			entries.erase(oldest);
+		}
+	}
+};
+
+TLSSessionCache::TLSSessionCache(int maxEntries, int timeout)
+{
+	d = new Private;
+	d->maxEntries = qMax(maxEntries, 0);
+	d->timeout = qMax(timeout, 0);
+	d->clock.start();
+	d->counter = 0;
+	d->hits = 0;
+	d->misses = 0;
+	d->resumed = 0;
+}
+
+TLSSessionCache::~TLSSessionCache()
+{
+	delete d;
+}
+
+int TLSSessionCache::maxEntries() const
+{
+	QMutexLocker locker(&d->m);
+	return d->maxEntries;
+}
+
+void TLSSessionCache::setMaxEntries(int maxEntries)
+{
+	QMutexLocker locker(&d->m);
+	d->maxEntries = qMax(maxEntries, 0);
+	d->makeRoom(d->maxEntries);
+}
+
+int TLSSessionCache::timeout() const
+{
+	QMutexLocker locker(&d->m);
+	return d->timeout;
+}
+
+void TLSSessionCache::setTimeout(int timeout)
+{
+	QMutexLocker locker(&d->m);
+	d->timeout = qMax(timeout, 0);
+}
+
+TLSSession TLSSessionCache::session(const QString &host) const
+{
+	QMutexLocker locker(&d->m);
+	QHash<QString, Private::Entry>::const_iterator it = d->entries.constFind(host);
+	if(it == d->entries.constEnd() || d->isExpired(it.value()))
+	{
+		++d->misses;
+		return TLSSession();
+	}
+	++d->hits;
+	return it.value().session;
+}
+
+void TLSSessionCache::insert(const QString &host, const TLSSession &session)
+{
+	if(session.isNull())
+		return;
+
+	QMutexLocker locker(&d->m);
+	if(d->maxEntries == 0)
+		return;
+
+	d->entries.remove(host);
+	d->makeRoom(d->maxEntries - 1);
+
+	Private::Entry e;
+	e.session = session;
+	e.stored = d->clock.elapsed();
+	e.order = ++d->counter;
+	d->entries.insert(host, e);
+}
+
+void TLSSessionCache::remove(const QString &host)
+{
+	QMutexLocker locker(&d->m);
+	d->entries.remove(host);
+}
+
+void TLSSessionCache::clear()
+{
+	QMutexLocker locker(&d->m);
+	d->entries.clear();
+}
+
+int TLSSessionCache::count() const
+{
+	QMutexLocker locker(&d->m);
+	return d->entries.count();
+}
+
+int TLSSessionCache::hits() const
+{
+	QMutexLocker locker(&d->m);
+	return d->hits;
+}
+
+int TLSSessionCache::misses() const
+{
+	QMutexLocker locker(&d->m);
+	return d->misses;
+}
+
+int TLSSessionCache::resumed() const
+{
+	QMutexLocker locker(&d->m);
+	return d->resumed;
+}
+
+void TLSSessionCache::handshakeDone(bool offered, bool resumed)
+{
+	QMutexLocker locker(&d->m);
+	if(offered && resumed)
+		++d->resumed;
+}
+
 //----------------------------------------------------------------------------
 // TLS
 //----------------------------------------------------------------------------
@@ -218,8 +391,12 @@ public:
 	QStringList con_cipherSuites;
 	bool tryCompress;
 	int packet_mtu;
+	QByteArray peer_address;
 	QList<CertificateInfoOrdered> issuerList;
 	TLSSession session;
+	TLSSessionCache *sessionCache;
+	bool sessionFromCache;
+	bool direct;
 
 	// session
 	State state;
@@ -235,6 +412,7 @@ public:
 	bool emitted_hostNameReceived;
 	bool emitted_certificateRequested;
 	bool emitted_peerCertificateAvailable;
+	bool direct_closed, direct_failed;
 
 	// data (survives ResetSession)
 	CertificateChain peerCert;
@@ -242,19 +420,22 @@ public:
 	bool hostMismatch;
 	Error errorCode;
 
-	// stream i/o
-	QByteArray in, out;
-	QByteArray to_net, from_net;
+	// stream i/o.  network data and decoded data are kept in the chunks
+	//   they arrived in, and are only copied when read out
+	QByteArray out;
+	ChunkBuffer in;
+	ChunkBuffer to_net, from_net;
 	QByteArray unprocessed;
 	int out_pending;
 	int to_net_encoded;
 	LayerTracker layer;
 
-	// datagram i/o
+	// datagram i/o.  packets go to the provider in batches
 	QList<QByteArray> packet_in, packet_out;
 	QList<QByteArray> packet_to_net, packet_from_net;
 	int packet_out_pending; // packet count
 	QList<int> packet_to_net_encoded;
+	QList<int> packet_batch; // plain sizes in the operation in progress
 
 	Private(TLS *_q, TLS::Mode _mode) : QObject(_q), q(_q), mode(_mode), actionTrigger(this)
 	{
@@ -301,6 +482,7 @@ public:
 		server = false;
 		host = QString();
 		sessionInfo = TLSContext::SessionInfo();
+		sessionFromCache = false;
 		actionTrigger.stop();
 		op = -1;
 		actionQueue.clear();
@@ -309,11 +491,14 @@ public:
 		emitted_hostNameReceived = false;
 		emitted_certificateRequested = false;
 		emitted_peerCertificateAvailable = false;
+		direct_closed = false;
+		direct_failed = false;
 
 		out.clear();
 		out_pending = 0;
 		packet_out.clear();
 		packet_out_pending = 0;
+		packet_batch.clear();
 
 		if(mode >= ResetSessionAndData)
 		{
@@ -346,8 +531,11 @@ public:
 			con_cipherSuites = QStringList();
 			tryCompress = false;
 			packet_mtu = -1;
+			peer_address.clear();
 			issuerList.clear();
 			session = TLSSession();
+			sessionCache = 0;
+			direct = false;
 		}
 	}
 
@@ -367,16 +555,54 @@ public:
 		c->setTrustedCertificates(trusted);
 		if(serverMode)
 			c->setIssuerList(issuerList);
+
+		// offer the cached session for this host, unless the
+		//   application gave one
+		sessionFromCache = false;
+		if(!serverMode && sessionCache && session.isNull() && !host.isEmpty())
+		{
+			TLSSession cached = sessionCache->session(host);
+			if(!cached.isNull() && cached.provider() == q->provider())
+			{
+				session = cached;
+				sessionFromCache = true;
+			}
+		}
+
 		if(!session.isNull())
 		{
 			TLSSessionContext *sc = static_cast<TLSSessionContext*>(session.context());
 			c->setSessionId(*sc);
 		}
 		c->setMTU(packet_mtu);
+		c->setPeerAddress(peer_address);
+
+		// in direct mode results are collected inline, so the context
+		//   must not signal them as well
+		c->blockSignals(direct);
 
 		QCA_logTextMessage(QString("tls[%1]: c->start()").arg(q->objectName()), Logger::Information);
 		op = OpStart;
 		c->start();
+		finishInline();
+	}
+
+	// in direct mode, wait for the operation just started and handle
+	//   its results before returning to the caller
+	void finishInline()
+	{
+		if(!direct)
+			return;
+
+		c->waitForResultsReady(-1);
+		tls_resultsReady();
+	}
+
+	void fail()
+	{
+		direct_failed = true;
+		if(!direct)
+			emit q->error();
 	}
 
 	void close()
@@ -413,6 +639,16 @@ public:
 			return;
 		}
 
+		// direct mode runs all the actions now, without signals
+		if(direct)
+		{
+			while(!actionQueue.isEmpty())
+				doAction(actionQueue.takeFirst());
+			if(need_update)
+				update();
+			return;
+		}
+
 		Action a = actionQueue.takeFirst();
 
 		// set up for the next one, if necessary
@@ -422,13 +658,20 @@ public:
 				actionTrigger.start();
 		}
 
+		doAction(a);
+	}
+
+	void doAction(const Action &a)
+	{
 		if(a.type == Action::ReadyRead)
 		{
-			emit q->readyRead();
+			if(!direct)
+				emit q->readyRead();
 		}
 		else if(a.type == Action::ReadyReadOutgoing)
 		{
-			emit q->readyReadOutgoing();
+			if(!direct)
+				emit q->readyReadOutgoing();
 		}
 		else if(a.type == Action::Handshaken)
 		{
@@ -438,13 +681,13 @@ public:
 			if(!out.isEmpty())
 			{
 				need_update = true;
-				if(!actionTrigger.isActive())
+				if(!direct && !actionTrigger.isActive())
 					actionTrigger.start();
 			}
 
 			QCA_logTextMessage(QString("tls[%1]: handshaken").arg(q->objectName()), Logger::Information);
 
-			if(connect_handshaken)
+			if(connect_handshaken && !direct)
 			{
 				blocked = true;
 				emit q->handshaken();
@@ -454,7 +697,9 @@ public:
 		{
 			unprocessed = c->unprocessed();
 			reset(ResetSession);
-			emit q->closed();
+			direct_closed = true;
+			if(!direct)
+				emit q->closed();
 		}
 		else if(a.type == Action::CheckPeerCertificate)
 		{
@@ -466,7 +711,7 @@ public:
 					hostMismatch = true;
 			}
 
-			if(connect_peerCertificateAvailable)
+			if(connect_peerCertificateAvailable && !direct)
 			{
 				blocked = true;
 				emitted_peerCertificateAvailable = true;
@@ -476,7 +721,7 @@ public:
 		else if(a.type == Action::CertificateRequested)
 		{
 			issuerList = c->issuerList();
-			if(connect_certificateRequested)
+			if(connect_certificateRequested && !direct)
 			{
 				blocked = true;
 				emitted_certificateRequested = true;
@@ -485,7 +730,7 @@ public:
 		}
 		else if(a.type == Action::HostNameReceived)
 		{
-			if(connect_hostNameReceived)
+			if(connect_hostNameReceived && !direct)
 			{
 				blocked = true;
 				emitted_hostNameReceived = true;
@@ -521,7 +766,10 @@ public:
 
 		need_update = false;
 
-		QByteArray arg_from_net, arg_from_app;
+		ChunkBuffer arg_from_net;
+		QByteArray arg_from_app;
+		QList<QByteArray> arg_net_packets, arg_app_packets;
+		int batch = (mode == TLS::Datagram) ? qMax(c->packetBatchSize(), 1) : 0;
 
 		if(state == Handshaking)
 		{
@@ -535,8 +783,8 @@ public:
 			else
 			{
 				// note: there may not be a packet
-				if(!packet_from_net.isEmpty())
-					arg_from_net = packet_from_net.takeFirst();
+				while(!packet_from_net.isEmpty() && arg_net_packets.count() < batch)
+					arg_net_packets += packet_from_net.takeFirst();
 			}
 		}
 		else
@@ -558,18 +806,19 @@ public:
 			}
 			else
 			{
-				if(!packet_from_net.isEmpty())
-					arg_from_net = packet_from_net.takeFirst();
+				while(!packet_from_net.isEmpty() && arg_net_packets.count() < batch)
+					arg_net_packets += packet_from_net.takeFirst();
 
-				if(!packet_out.isEmpty())
+				while(!packet_out.isEmpty() && arg_app_packets.count() < batch)
 				{
-					arg_from_app = packet_out.takeFirst();
+					arg_app_packets += packet_out.takeFirst();
+					packet_batch += arg_app_packets.last().size();
 					++packet_out_pending;
 				}
 			}
 		}
 
-		if(arg_from_net.isEmpty() && arg_from_app.isEmpty() && !maybe_input)
+		if(arg_from_net.isEmpty() && arg_from_app.isEmpty() && arg_net_packets.isEmpty() && arg_app_packets.isEmpty() && !maybe_input)
 		{
 			QCA_logTextMessage(QString("tls[%1]: ignoring update: no output and no expected input").arg(q->objectName()), Logger::Information);
 			return;
@@ -580,7 +829,11 @@ public:
 
 		QCA_logTextMessage(QString("tls[%1]: c->update").arg(q->objectName()), Logger::Information);
 		op = OpUpdate;
-		c->update(arg_from_net, arg_from_app);
+		if(mode == TLS::Stream)
+			c->updateChunks(arg_from_net, arg_from_app);
+		else
+			c->updatePackets(arg_net_packets, arg_app_packets);
+		finishInline();
 	}
 
 	void start_finished()
@@ -590,7 +843,7 @@ public:
 		{
 			reset(ResetSession);
 			errorCode = TLS::ErrorInit;
-			emit q->error();
+			fail();
 			return;
 		}
 
@@ -617,11 +870,28 @@ public:
 				errorCode = ErrorCrypt;
 			}
 
-			emit q->error();
+			fail();
 			return;
 		}
 
-		QByteArray c_to_net = c->to_net();
+		// the plain sizes of the packets that went in with this update
+		QList<int> c_batch = packet_batch;
+		packet_batch.clear();
+
+		// a batch may have left packets behind
+		if(mode == TLS::Datagram && !packet_from_net.isEmpty())
+			need_update = true;
+
+		ChunkBuffer c_to_net;
+		QList<QByteArray> c_to_net_packets;
+		if(mode == TLS::Stream)
+			c_to_net = c->to_netChunks();
+		else
+		{
+			c_to_net_packets = c->to_netPackets();
+			for(int n = 0; n < c_to_net_packets.count(); ++n)
+				c_to_net.append(c_to_net_packets[n]);
+		}
 		if(!c_to_net.isEmpty())
 		{
 			QCA_logTextMessage(QString("tls[%1]: to_net %2").arg(q->objectName(), QString::number(c_to_net.size())), Logger::Information);
@@ -630,9 +900,9 @@ public:
 		if(state == Closing)
 		{
 			if(mode == TLS::Stream)
-				to_net += c_to_net;
+				to_net.append(c_to_net);
 			else
-				packet_to_net += c_to_net;
+				addOutgoingPackets(c_to_net_packets, QList<int>());
 
 			if(!c_to_net.isEmpty())
 				actionQueue += Action(Action::ReadyReadOutgoing);
@@ -646,9 +916,9 @@ public:
 		else if(state == Handshaking)
 		{
 			if(mode == TLS::Stream)
-				to_net += c_to_net;
+				to_net.append(c_to_net);
 			else
-				packet_to_net += c_to_net;
+				addOutgoingPackets(c_to_net_packets, QList<int>());
 
 			if(!c_to_net.isEmpty())
 				actionQueue += Action(Action::ReadyReadOutgoing);
@@ -685,6 +955,13 @@ public:
 					session.change(sc);
 				}
 
+				if(!server && sessionCache && !host.isEmpty())
+				{
+					sessionCache->handshakeDone(sessionFromCache, sessionInfo.isResumed);
+					if(sessionInfo.id)
+						sessionCache->insert(host, session);
+				}
+
 				actionQueue += Action(Action::Handshaken);
 			}
 
@@ -693,10 +970,23 @@ public:
 		}
 		else // Connected
 		{
-			QByteArray c_to_app = c->to_app();
-			if(!c_to_app.isEmpty())
+			QByteArray c_to_app;
+			QList<QByteArray> c_to_app_packets;
+			int c_to_app_size = 0;
+			if(mode == TLS::Stream)
 			{
-				QCA_logTextMessage(QString("tls[%1]: to_app %2").arg(q->objectName(), QString::number(c_to_app.size())), Logger::Information);
+				c_to_app = c->to_app();
+				c_to_app_size = c_to_app.size();
+			}
+			else
+			{
+				c_to_app_packets = c->to_appPackets();
+				for(int n = 0; n < c_to_app_packets.count(); ++n)
+					c_to_app_size += c_to_app_packets[n].size();
+			}
+			if(c_to_app_size > 0)
+			{
+				QCA_logTextMessage(QString("tls[%1]: to_app %2").arg(q->objectName(), QString::number(c_to_app_size)), Logger::Information);
 			}
 
 			bool eof = c->eof();
@@ -722,7 +1012,7 @@ public:
 			else
 			{
 				if(!c_to_net.isEmpty())
-					--packet_out_pending;
+					packet_out_pending -= c_batch.count();
 
 				if(packet_out_pending > 0)
 				{
@@ -736,20 +1026,20 @@ public:
 
 			if(mode == TLS::Stream)
 			{
-				to_net += c_to_net;
-				in += c_to_app;
+				to_net.append(c_to_net);
+				in.append(c_to_app);
 				to_net_encoded += enc;
 			}
 			else
 			{
-				packet_to_net += c_to_net;
-				packet_in += c_to_app;
+				addOutgoingPackets(c_to_net_packets, c_batch);
+				packet_in += c_to_app_packets;
 			}
 
 			if(!c_to_net.isEmpty())
 				actionQueue += Action(Action::ReadyReadOutgoing);
 
-			if(!c_to_app.isEmpty())
+			if(c_to_app_size > 0)
 				actionQueue += Action(Action::ReadyRead);
 
 			if(eof)
@@ -769,6 +1059,17 @@ public:
 		}
 	}
 
+	// the first packets carry the application packets of the update, in
+	//   order, and the rest (handshake, alerts) carry none
+	void addOutgoingPackets(const QList<QByteArray> &packets, const QList<int> &plain)
+	{
+		for(int n = 0; n < packets.count(); ++n)
+		{
+			packet_to_net += packets[n];
+			packet_to_net_encoded += (n < plain.count()) ? plain[n] : 0;
+		}
+	}
+
 private slots:
 	void tls_resultsReady()
 	{
@@ -920,6 +1221,11 @@ void TLS::setSession(const TLSSession &session)
 	d->session = session;
 }
 
+void TLS::setSessionCache(TLSSessionCache *cache)
+{
+	d->sessionCache = cache;
+}
+
 bool TLS::canCompress() const
 {
 	return d->c->canCompress();
@@ -963,6 +1269,70 @@ void TLS::continueAfterStep()
 	d->continueAfterStep();
 }
 
+void TLS::setDirectMode(bool enabled)
+{
+	if(enabled && d->mode != Stream)
+	{
+		QCA_logTextMessage(QString("tls[%1]: setDirectMode: only available in stream mode").arg(objectName()), Logger::Warning);
+		d->direct = false;
+		return;
+	}
+	d->direct = enabled;
+}
+
+bool TLS::isDirectMode() const
+{
+	return d->direct;
+}
+
+TLS::DirectResult TLS::processIncoming(const QByteArray &fromNet, QByteArray *toApp, QByteArray *toNet)
+{
+	if(!d->direct)
+	{
+		QCA_logTextMessage(QString("tls[%1]: processIncoming: direct mode is not enabled").arg(objectName()), Logger::Warning);
+		return DirectError;
+	}
+
+	d->direct_closed = false;
+	d->direct_failed = false;
+
+	if(!fromNet.isEmpty())
+		writeIncoming(fromNet);
+	if(toApp)
+		*toApp = d->in.take();
+	if(toNet)
+		*toNet = readOutgoing();
+
+	if(d->direct_failed)
+		return DirectError;
+	if(d->direct_closed)
+		return DirectClosed;
+	return DirectOk;
+}
+
+TLS::DirectResult TLS::processOutgoing(const QByteArray &fromApp, QByteArray *toNet)
+{
+	if(!d->direct)
+	{
+		QCA_logTextMessage(QString("tls[%1]: processOutgoing: direct mode is not enabled").arg(objectName()), Logger::Warning);
+		return DirectError;
+	}
+
+	d->direct_closed = false;
+	d->direct_failed = false;
+
+	if(!fromApp.isEmpty())
+		write(fromApp);
+	if(toNet)
+		*toNet = readOutgoing();
+
+	if(d->direct_failed)
+		return DirectError;
+	if(d->direct_closed)
+		return DirectClosed;
+	return DirectOk;
+}
+
 bool TLS::isHandshaken() const
 {
 	if(d->state == TLS::Private::Connected || d->state == TLS::Private::Closing)
@@ -1001,6 +1371,11 @@ TLSSession TLS::session() const
 	return d->session;
 }
 
+bool TLS::isSessionReused() const
+{
+	return d->sessionInfo.isResumed;
+}
+
 TLS::Error TLS::errorCode() const
 {
 	return d->errorCode;
@@ -1075,7 +1450,15 @@ void TLS::write(const QByteArray &a)
 		d->layer.addPlain(a.size());
 	}
 	else
+	{
+		// a packet that can't be sent whole is never sent
+		if(d->packet_mtu > 0 && a.size() > d->packet_mtu)
+		{
+			QCA_logTextMessage(QString("tls[%1]: write: dropping packet of %2 bytes, larger than the MTU").arg(objectName(), QString::number(a.size())), Logger::Warning);
+			return;
+		}
 		d->packet_out.append(a);
+	}
 	QCA_logTextMessage(QString("tls[%1]: write").arg(objectName()), Logger::Information);
 	d->update();
 }
@@ -1084,9 +1467,7 @@ QByteArray TLS::read()
 {
 	if(d->mode == Stream)
 	{
-		QByteArray a = d->in;
-		d->in.clear();
-		return a;
+		return d->in.take();
 	}
 	else
 	{
@@ -1097,6 +1478,14 @@ QByteArray TLS::read()
 	}
 }
 
+int TLS::readInto(char *data, int size)
+{
+	if(d->mode == Stream)
+		return d->in.read(data, size);
+	else
+		return 0;
+}
+
 void TLS::writeIncoming(const QByteArray &a)
 {
 	if(d->mode == Stream)
@@ -1107,12 +1496,21 @@ void TLS::writeIncoming(const QByteArray &a)
 	d->update();
 }
 
+void TLS::writeIncoming(const ChunkBuffer &data)
+{
+	if(d->mode == Stream)
+		d->from_net.append(data);
+	else
+		d->packet_from_net.append(data.toByteArray());
+	QCA_logTextMessage(QString("tls[%1]: writeIncoming %2").arg(objectName(), QString::number(data.size())), Logger::Information);
+	d->update();
+}
+
 QByteArray TLS::readOutgoing(int *plainBytes)
 {
 	if(d->mode == Stream)
 	{
-		QByteArray a = d->to_net;
-		d->to_net.clear();
+		QByteArray a = d->to_net.take();
 		if(plainBytes)
 			*plainBytes = d->to_net_encoded;
 		d->layer.specifyEncoded(a.size(), d->to_net_encoded);
@@ -1138,6 +1536,32 @@ QByteArray TLS::readOutgoing(int *plainBytes)
 	}
 }
 
+int TLS::readOutgoingInto(char *data, int size, int *plainBytes)
+{
+	if(d->mode != Stream)
+	{
+		if(plainBytes)
+			*plainBytes = 0;
+		return 0;
+	}
+
+	int len = d->to_net.read(data, size);
+
+	// the plain bytes are credited when the last of the pending
+	//   network data is read
+	int plain = 0;
+	if(d->to_net.isEmpty())
+	{
+		plain = d->to_net_encoded;
+		d->to_net_encoded = 0;
+	}
+	if(plainBytes)
+		*plainBytes = plain;
+	if(len > 0)
+		d->layer.specifyEncoded(len, plain);
+	return len;
+}
+
 QByteArray TLS::readUnprocessed()
 {
 	if(d->mode == Stream)
@@ -1177,6 +1601,96 @@ void TLS::setPacketMTU(int size) const
 		d->c->setMTU(size);
 }
 
+QByteArray TLS::peerAddress() const
+{
+	return d->peer_address;
+}
+
+void TLS::setPeerAddress(const QByteArray &address)
+{
+	d->peer_address = address;
+}
+
+int TLS::writePackets(const QList<QByteArray> &packets)
+{
+	if(d->mode != Datagram)
+		return 0;
+
+	int accepted = 0;
+	for(int n = 0; n < packets.count(); ++n)
+	{
+		if(d->packet_mtu > 0 && packets[n].size() > d->packet_mtu)
+			continue;
+		d->packet_out += packets[n];
+		++accepted;
+	}
+
+	if(accepted < packets.count())
+		QCA_logTextMessage(QString("tls[%1]: writePackets: dropping %2 packets larger than the MTU").arg(objectName(), QString::number(packets.count() - accepted)), Logger::Warning);
+	if(accepted == 0)
+		return 0;
+
+	QCA_logTextMessage(QString("tls[%1]: writePackets %2").arg(objectName(), QString::number(accepted)), Logger::Information);
+	d->update();
+	return accepted;
+}
+
+QList<QByteArray> TLS::readPackets(int max)
+{
+	if(d->mode != Datagram)
+		return QList<QByteArray>();
+
+	if(max < 0 || max >= d->packet_in.count())
+	{
+		QList<QByteArray> list = d->packet_in;
+		d->packet_in.clear();
+		return list;
+	}
+
+	QList<QByteArray> list = d->packet_in.mid(0, max);
+	d->packet_in.erase(d->packet_in.begin(), d->packet_in.begin() + max);
+	return list;
+}
+
+void TLS::writeIncomingPackets(const QList<QByteArray> &packets)
+{
+	if(d->mode != Datagram || packets.isEmpty())
+		return;
+	d->packet_from_net += packets;
+	QCA_logTextMessage(QString("tls[%1]: writeIncomingPackets %2").arg(objectName(), QString::number(packets.count())), Logger::Information);
+	d->update();
+}
+
+QList<QByteArray> TLS::readOutgoingPackets(int max, int *plainBytes)
+{
+	int plain = 0;
+	QList<QByteArray> list;
+	if(d->mode == Datagram)
+	{
+		int count = d->packet_to_net.count();
+		if(max >= 0 && max < count)
+			count = max;
+		for(int n = 0; n < count; ++n)
+			plain += d->packet_to_net_encoded[n];
+
+		if(count == d->packet_to_net.count())
+		{
+			list = d->packet_to_net;
+			d->packet_to_net.clear();
+			d->packet_to_net_encoded.clear();
+		}
+		else
+		{
+			list = d->packet_to_net.mid(0, count);
+			d->packet_to_net.erase(d->packet_to_net.begin(), d->packet_to_net.begin() + count);
+			d->packet_to_net_encoded.erase(d->packet_to_net_encoded.begin(), d->packet_to_net_encoded.begin() + count);
+		}
+	}
+	if(plainBytes)
+		*plainBytes = plain;
+	return list;
+}
+
 #if QT_VERSION >= 0x050000
 void TLS::connectNotify(const QMetaMethod &signal)
 {
@@ -0,0 +1,468 @@
+/*
+ * qca_simd.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+#include "qca_simd.h"
+
+#include <QtEndian>
+#include <string.h>
+
+#ifdef QCA_SIMD_X86
+# include <cpuid.h>
+#endif
+
+namespace QCA {
+
+//----------------------------------------------------------------------------
+// cpu detection
+//----------------------------------------------------------------------------
+#ifdef QCA_SIMD_X86
+static int detect_features()
+{
+	unsigned int eax, ebx, ecx, edx;
+	int out = 0;
+
+	if(!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return 0;
+	if(edx & (1 << 26))
+		out |= SimdSSE2;
+	if(ecx & (1 << 9))
+		out |= SimdSSSE3;
+	if(ecx & (1 << 19))
+		out |= SimdSSE41;
+
+	// avx2 also needs the os to save the ymm registers
+	bool osxsave = (ecx & (1 << 27)) != 0;
+	unsigned int xcr0 = 0;
+	if(osxsave)
+	{
+		unsigned int xcr0_hi;
+		__asm__ __volatile__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+	}
+
+	if(__get_cpuid_max(0, 0) >= 7)
+	{
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+#ifdef QCA_SIMD_AVX2
+		if((ebx & (1 << 5)) && (xcr0 & 6) == 6)
+			out |= SimdAVX2;
+#endif
+#ifdef QCA_SIMD_SHANI
+		if((ebx & (1 << 29)) && (out & SimdSSE41))
+			out |= SimdSHA;
+#endif
+	}
+
+	return out;
+}
+#endif
+
+int simd_features()
+{
+#ifdef QCA_SIMD_X86
+	// computing this more than once in a race is harmless
+	static int features = -1;
+	if(features == -1)
+		features = detect_features();
+	return features;
+#else
+	return 0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// multi-buffer hashing
+//----------------------------------------------------------------------------
+typedef void (*MultiBlockFunc)(quint32 *state, const quint8 * const *blocks);
+
+enum { MaxLanes = 8 };
+
+// a message being hashed in one lane.  whole blocks are read directly from
+//   the message, while the last one or two blocks (holding the padding and
+//   length) are built in tail.
+struct LaneJob
+{
+	int msg;
+	const quint8 *p;
+	int fullBlocks;
+	int tailBlocks;
+	int tailAt;
+	quint8 tail[128];
+};
+
+static void lane_start(LaneJob *job, int msg, const quint8 *data, int len, bool bigEndian)
+{
+	job->msg = msg;
+	job->p = data;
+	job->fullBlocks = len / 64;
+	job->tailAt = 0;
+
+	int rem = len % 64;
+	job->tailBlocks = (rem + 9 <= 64) ? 1 : 2;
+	memset(job->tail, 0, sizeof(job->tail));
+	if(rem > 0)
+		memcpy(job->tail, data + job->fullBlocks * 64, rem);
+	job->tail[rem] = 0x80;
+
+	quint64 bits = (quint64)len << 3;
+	quint8 *lp = job->tail + job->tailBlocks * 64 - 8;
+	for(int n = 0; n < 8; ++n)
+	{
+		int shift = bigEndian ? (56 - 8 * n) : (8 * n);
+		lp[n] = (quint8)(bits >> shift);
+	}
+}
+
+static const quint8 *lane_next_block(LaneJob *job)
+{
+	if(job->fullBlocks > 0)
+	{
+		const quint8 *b = job->p;
+		job->p += 64;
+		--job->fullBlocks;
+		return b;
+	}
+	return job->tail + 64 * (job->tailAt++);
+}
+
+static bool lane_done(const LaneJob *job)
+{
+	return job->fullBlocks == 0 && job->tailAt == job->tailBlocks;
+}
+
+static void hash_many(MultiBlockFunc func, int lanes, int words, const quint32 *iv, bool bigEndian,
+	const quint8 * const *data, const int *len, int count, quint8 *out)
+{
+	static const quint8 idle[64] = { 0 };
+
+	LaneJob jobs[MaxLanes];
+	bool active[MaxLanes];
+	quint32 state[5 * MaxLanes];
+	const quint8 *blocks[MaxLanes];
+	int next = 0;
+
+	for(int l = 0; l < lanes; ++l)
+		active[l] = false;
+
+	while(true)
+	{
+		// give idle lanes a new message
+		int busy = 0;
+		for(int l = 0; l < lanes; ++l)
+		{
+			if(!active[l] && next < count)
+			{
+				lane_start(&jobs[l], next, data[next], len[next], bigEndian);
+				for(int w = 0; w < words; ++w)
+					state[w * lanes + l] = iv[w];
+				active[l] = true;
+				++next;
+			}
+			if(active[l])
+				++busy;
+		}
+		if(busy == 0)
+			break;
+
+		for(int l = 0; l < lanes; ++l)
+			blocks[l] = active[l] ? lane_next_block(&jobs[l]) : idle;
+
+		func(state, blocks);
+
+		for(int l = 0; l < lanes; ++l)
+		{
+			if(!active[l] || !lane_done(&jobs[l]))
+				continue;
+
+			quint8 *digest = out + jobs[l].msg * words * 4;
+			for(int w = 0; w < words; ++w)
+			{
+				quint32 v = state[w * lanes + l];
+				for(int n = 0; n < 4; ++n)
+				{
+					int shift = bigEndian ? (24 - 8 * n) : (8 * n);
+					digest[w * 4 + n] = (quint8)(v >> shift);
+				}
+			}
+			active[l] = false;
+		}
+	}
+
+	memset(state, 0, sizeof(state));
+	for(int l = 0; l < lanes; ++l)
+		memset(jobs[l].tail, 0, sizeof(jobs[l].tail));
+}
+
+static const quint32 md5_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+static const quint32 sha1_iv[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+int hash_lanes()
+{
+	int features = simd_features();
+#ifdef QCA_SIMD_AVX2
+	if(features & SimdAVX2)
+		return 8;
+#endif
+#ifdef QCA_SIMD_X86
+	if(features & SimdSSE2)
+		return 4;
+#endif
+	Q_UNUSED(features);
+	return 0;
+}
+
+void md5_many(const quint8 * const *data, const int *len, int count, quint8 *out)
+{
+	int lanes = hash_lanes();
+#ifdef QCA_SIMD_AVX2
+	if(lanes == 8)
+	{
+		hash_many(md5_block_x8_avx2, 8, 4, md5_iv, false, data, len, count, out);
+		return;
+	}
+#endif
+#ifdef QCA_SIMD_X86
+	if(lanes == 4)
+	{
+		hash_many(md5_block_x4_sse2, 4, 4, md5_iv, false, data, len, count, out);
+		return;
+	}
+#endif
+	Q_UNUSED(lanes);
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+	Q_UNUSED(count);
+	Q_UNUSED(out);
+	Q_ASSERT(0);
+}
+
+void sha1_many(const quint8 * const *data, const int *len, int count, quint8 *out)
+{
+	int lanes = hash_lanes();
+#ifdef QCA_SIMD_AVX2
+	if(lanes == 8)
+	{
+		hash_many(sha1_block_x8_avx2, 8, 5, sha1_iv, true, data, len, count, out);
+		return;
+	}
+#endif
+#ifdef QCA_SIMD_X86
+	if(lanes == 4)
+	{
+		hash_many(sha1_block_x4_sse2, 4, 5, sha1_iv, true, data, len, count, out);
+		return;
+	}
+#endif
+	Q_UNUSED(lanes);
+	Q_UNUSED(data);
+	Q_UNUSED(len);
+	Q_UNUSED(count);
+	Q_UNUSED(out);
+	Q_ASSERT(0);
+}
+
+bool sha1_blocks_accel(quint32 state[5], const quint8 *data, int nblocks)
+{
+#ifdef QCA_SIMD_SHANI
+	if(simd_features() & SimdSHA)
+	{
+		sha1_blocks_shani(state, data, nblocks);
+		return true;
+	}
+#endif
+	Q_UNUSED(state);
+	Q_UNUSED(data);
+	Q_UNUSED(nblocks);
+	return false;
+}
+
+//----------------------------------------------------------------------------
+// chacha20
+//----------------------------------------------------------------------------
+typedef void (*ChaChaFunc)(const quint32 *input, quint32 *out);
+
+static inline quint32 rotl32(quint32 x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+static inline void chacha_qr(quint32 &a, quint32 &b, quint32 &c, quint32 &d)
+{
+	a += b; d = rotl32(d ^ a, 16);
+	c += d; b = rotl32(b ^ c, 12);
+	a += b; d = rotl32(d ^ a, 8);
+	c += d; b = rotl32(b ^ c, 7);
+}
+
+static void chacha_block(const quint32 *input, quint8 *out)
+{
+	quint32 x[16];
+	for(int i = 0; i < 16; ++i)
+		x[i] = input[i];
+
+	for(int i = 0; i < 10; ++i)
+	{
+		chacha_qr(x[0], x[4], x[8], x[12]);
+		chacha_qr(x[1], x[5], x[9], x[13]);
+		chacha_qr(x[2], x[6], x[10], x[14]);
+		chacha_qr(x[3], x[7], x[11], x[15]);
+		chacha_qr(x[0], x[5], x[10], x[15]);
+		chacha_qr(x[1], x[6], x[11], x[12]);
+		chacha_qr(x[2], x[7], x[8], x[13]);
+		chacha_qr(x[3], x[4], x[9], x[14]);
+	}
+
+	for(int i = 0; i < 16; ++i)
+		qToLittleEndian<quint32>(x[i] + input[i], out + 4 * i);
+	memset(x, 0, sizeof(x));
+}
+
+static void chacha_advance(quint32 *input, int nblocks)
+{
+	quint64 counter = (((quint64)input[13] << 32) | input[12]) + nblocks;
+	input[12] = (quint32)counter;
+	input[13] = (quint32)(counter >> 32);
+}
+
+void chacha20_blocks(quint32 *input, quint8 *out, int nblocks)
+{
+	// the vector kernels have the same widths as the multi-buffer hashes
+	int lanes = hash_lanes();
+	ChaChaFunc func = 0;
+#ifdef QCA_SIMD_AVX2
+	if(lanes == 8)
+		func = chacha_blocks_x8_avx2;
+#endif
+#ifdef QCA_SIMD_X86
+	if(lanes == 4)
+		func = chacha_blocks_x4_sse2;
+#endif
+
+	if(func)
+	{
+		quint32 words[16 * MaxLanes];
+		while(nblocks >= lanes)
+		{
+			func(input, words);
+			for(int l = 0; l < lanes; ++l)
+			{
+				for(int w = 0; w < 16; ++w)
+					qToLittleEndian<quint32>(words[w * lanes + l], out + 4 * w);
+				out += 64;
+			}
+			chacha_advance(input, lanes);
+			nblocks -= lanes;
+		}
+		memset(words, 0, sizeof(words));
+	}
+
+	for(; nblocks > 0; --nblocks)
+	{
+		chacha_block(input, out);
+		chacha_advance(input, 1);
+		out += 64;
+	}
+}
+
+//----------------------------------------------------------------------------
+// hex and base64
+//----------------------------------------------------------------------------
+int hex_encode_accel(const quint8 *in, int len, char *out)
+{
+	int features = simd_features();
+#ifdef QCA_SIMD_AVX2
+	if(features & SimdAVX2)
+		return hex_encode_avx2(in, len, out);
+#endif
+#ifdef QCA_SIMD_X86
+	if(features & SimdSSE2)
+		return hex_encode_sse2(in, len, out);
+#endif
+	Q_UNUSED(features);
+	Q_UNUSED(in);
+	Q_UNUSED(len);
+	Q_UNUSED(out);
+	return 0;
+}
+
+int hex_decode_accel(const char *in, int len, quint8 *out)
+{
+	int features = simd_features();
+#ifdef QCA_SIMD_AVX2
+	if(features & SimdAVX2)
+	{
+		// finish with the narrower kernel
+		int at = hex_decode_avx2(in, len, out);
+		return at + hex_decode_sse2(in + at, len - at, out + at / 2);
+	}
+#endif
+#ifdef QCA_SIMD_X86
+	if(features & SimdSSE2)
+		return hex_decode_sse2(in, len, out);
+#endif
+	Q_UNUSED(features);
+	Q_UNUSED(in);
+	Q_UNUSED(len);
+	Q_UNUSED(out);
+	return 0;
+}
+
+int base64_encode_accel(const quint8 *in, int len, char *out)
+{
+	int features = simd_features();
+#ifdef QCA_SIMD_AVX2
+	if(features & SimdAVX2)
+	{
+		int at = base64_encode_avx2(in, len, out);
+		return at + base64_encode_ssse3(in + at, len - at, out + at / 3 * 4);
+	}
+#endif
+#ifdef QCA_SIMD_X86
+	if(features & SimdSSSE3)
+		return base64_encode_ssse3(in, len, out);
+#endif
+	Q_UNUSED(features);
+	Q_UNUSED(in);
+	Q_UNUSED(len);
+	Q_UNUSED(out);
+	return 0;
+}
+
+int base64_decode_accel(const char *in, int len, quint8 *out)
+{
+	int features = simd_features();
+#ifdef QCA_SIMD_AVX2
+	if(features & SimdAVX2)
+	{
+		int at = base64_decode_avx2(in, len, out);
+		return at + base64_decode_ssse3(in + at, len - at, out + at / 4 * 3);
+	}
+#endif
+#ifdef QCA_SIMD_X86
+	if(features & SimdSSSE3)
+		return base64_decode_ssse3(in, len, out);
+#endif
+	Q_UNUSED(features);
+	Q_UNUSED(in);
+	Q_UNUSED(len);
+	Q_UNUSED(out);
+	return 0;
+}
+
+}
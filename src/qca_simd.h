@@ -0,0 +1,98 @@
+/*
+ * qca_simd.h - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+#ifndef QCA_SIMD_H
+#define QCA_SIMD_H
+
+// NOTE: this API is private to QCA
+
+#include <QtGlobal>
+
+namespace QCA {
+
+// cpu features usable by the accelerated code paths.  these are only
+//   reported if the library was also built with the matching kernels.
+enum SimdFeature
+{
+	SimdSSE2  = 0x01,
+	SimdSSE41 = 0x02,
+	SimdAVX2  = 0x04,
+	SimdSHA   = 0x08,
+	SimdSSSE3 = 0x10
+};
+
+int simd_features();
+
+// multi-buffer hashing.  hash_lanes() returns the number of messages that
+//   md5_many() and sha1_many() process side by side, or 0 if there is no
+//   multi-buffer implementation for this cpu (in which case the *_many()
+//   functions must not be called).  digests are written consecutively to
+//   out, 16 bytes per message for md5 and 20 bytes per message for sha1.
+int hash_lanes();
+void md5_many(const quint8 * const *data, const int *len, int count, quint8 *out);
+void sha1_many(const quint8 * const *data, const int *len, int count, quint8 *out);
+
+// single-stream sha1 over whole 64-byte blocks.  returns false without
+//   touching the state if there is no accelerated implementation.
+bool sha1_blocks_accel(quint32 state[5], const quint8 *data, int nblocks);
+
+// chacha20 keystream.  input is the 16-word chacha20 state, and nblocks
+//   whole 64-byte blocks are written to out.  the 64-bit block counter in
+//   input[12] and input[13] is advanced past the blocks written.
+void chacha20_blocks(quint32 *input, quint8 *out, int nblocks);
+
+// hex and base64 conversion.  these convert as much of the input as the
+//   vector kernels can handle in whole blocks, and return the number of
+//   input bytes consumed, leaving the rest to the caller.  the decoders
+//   also stop early at a block containing anything other than plain
+//   digits, such as padding or invalid characters.  out must have room
+//   for all of the input converted.
+int hex_encode_accel(const quint8 *in, int len, char *out);
+int hex_decode_accel(const char *in, int len, quint8 *out);
+int base64_encode_accel(const quint8 *in, int len, char *out);
+int base64_decode_accel(const char *in, int len, quint8 *out);
+
+// kernels, implemented in the per-instruction-set source files.  state is
+//   laid out word by word, with one entry per lane for each word.
+#ifdef QCA_SIMD_X86
+void md5_block_x4_sse2(quint32 *state, const quint8 * const *blocks);
+void sha1_block_x4_sse2(quint32 *state, const quint8 * const *blocks);
+void chacha_blocks_x4_sse2(const quint32 *input, quint32 *out);
+int hex_encode_sse2(const quint8 *in, int len, char *out);
+int hex_decode_sse2(const char *in, int len, quint8 *out);
+int base64_encode_ssse3(const quint8 *in, int len, char *out);
+int base64_decode_ssse3(const char *in, int len, quint8 *out);
+#endif
+#ifdef QCA_SIMD_AVX2
+void md5_block_x8_avx2(quint32 *state, const quint8 * const *blocks);
+void sha1_block_x8_avx2(quint32 *state, const quint8 * const *blocks);
+void chacha_blocks_x8_avx2(const quint32 *input, quint32 *out);
+int hex_encode_avx2(const quint8 *in, int len, char *out);
+int hex_decode_avx2(const char *in, int len, quint8 *out);
+int base64_encode_avx2(const quint8 *in, int len, char *out);
+int base64_decode_avx2(const char *in, int len, quint8 *out);
+#endif
+#ifdef QCA_SIMD_SHANI
+void sha1_blocks_shani(quint32 state[5], const quint8 *data, int nblocks);
+#endif
+
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ * qca_simd_avx2.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// 8-lane MD5, SHA1 and ChaCha20 kernels, and hex and base64 conversion.  this
+//   file is compiled with AVX2 enabled, and must only be called after checking
+//   for AVX2 at runtime.
+
+#include "qca_simd.h"
+
+#include <QtEndian>
+#include <immintrin.h>
+
+namespace QCA {
+
+struct V8
+{
+	__m256i v;
+};
+
+static inline V8 mk(__m256i v)
+{
+	V8 r;
+	r.v = v;
+	return r;
+}
+
+template <typename V> static inline V v_load(const quint32 *p);
+template <typename V> static inline V v_set1(quint32 x);
+template <typename V> static inline V v_gather_le(const quint8 * const *p, int i);
+template <typename V> static inline V v_gather_be(const quint8 * const *p, int i);
+
+template <> inline V8 v_load<V8>(const quint32 *p)
+{
+	return mk(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+static inline void v_store(quint32 *p, V8 a)
+{
+	_mm256_storeu_si256(reinterpret_cast<__m256i*>(p), a.v);
+}
+
+template <> inline V8 v_set1<V8>(quint32 x)
+{
+	return mk(_mm256_set1_epi32((int)x));
+}
+
+static inline V8 v_add(V8 a, V8 b)    { return mk(_mm256_add_epi32(a.v, b.v)); }
+static inline V8 v_xor(V8 a, V8 b)    { return mk(_mm256_xor_si256(a.v, b.v)); }
+static inline V8 v_and(V8 a, V8 b)    { return mk(_mm256_and_si256(a.v, b.v)); }
+static inline V8 v_or(V8 a, V8 b)     { return mk(_mm256_or_si256(a.v, b.v)); }
+static inline V8 v_andnot(V8 a, V8 b) { return mk(_mm256_andnot_si256(a.v, b.v)); }
+
+static inline V8 v_rotl(V8 a, int n)
+{
+	// whole-byte rotations are a single shuffle.  n is always a constant
+	//   here, so only one of these paths survives inlining.
+	if(n == 16)
+		return mk(_mm256_shuffle_epi8(a.v, _mm256_setr_epi8(
+			2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13,
+			2, 3, 0, 1, 6, 7, 4, 5, 10, 11, 8, 9, 14, 15, 12, 13)));
+	if(n == 8)
+		return mk(_mm256_shuffle_epi8(a.v, _mm256_setr_epi8(
+			3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14,
+			3, 0, 1, 2, 7, 4, 5, 6, 11, 8, 9, 10, 15, 12, 13, 14)));
+	return mk(_mm256_or_si256(_mm256_sll_epi32(a.v, _mm_cvtsi32_si128(n)), _mm256_srl_epi32(a.v, _mm_cvtsi32_si128(32 - n))));
+}
+
+template <> inline V8 v_gather_le<V8>(const quint8 * const *p, int i)
+{
+	return mk(_mm256_setr_epi32(
+		(int)qFromLittleEndian<quint32>(p[0] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[1] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[2] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[3] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[4] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[5] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[6] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[7] + 4 * i)));
+}
+
+template <> inline V8 v_gather_be<V8>(const quint8 * const *p, int i)
+{
+	return mk(_mm256_setr_epi32(
+		(int)qFromBigEndian<quint32>(p[0] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[1] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[2] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[3] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[4] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[5] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[6] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[7] + 4 * i)));
+}
+
+}
+
+#include "qca_simd_kernels.h"
+
+namespace QCA {
+
+void md5_block_x8_avx2(quint32 *state, const quint8 * const *blocks)
+{
+	simd_md5_block<V8, 8>(state, blocks);
+}
+
+void sha1_block_x8_avx2(quint32 *state, const quint8 * const *blocks)
+{
+	simd_sha1_block<V8, 8>(state, blocks);
+}
+
+void chacha_blocks_x8_avx2(const quint32 *input, quint32 *out)
+{
+	simd_chacha_blocks<V8, 8>(input, out);
+}
+
+//----------------------------------------------------------------------------
+// hex and base64.  these are the kernels of qca_simd_sse2.cpp and
+//   qca_simd_ssse3.cpp, working on both 128-bit halves at once.
+//----------------------------------------------------------------------------
+static inline __m256i dup128(__m128i v)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(v), v, 1);
+}
+
+static inline __m256i hex_digits(__m256i n)
+{
+	__m256i letters = _mm256_and_si256(_mm256_cmpgt_epi8(n, _mm256_set1_epi8(9)), _mm256_set1_epi8('a' - '0' - 10));
+	return _mm256_add_epi8(_mm256_add_epi8(n, _mm256_set1_epi8('0')), letters);
+}
+
+int hex_encode_avx2(const quint8 *in, int len, char *out)
+{
+	const __m256i low = _mm256_set1_epi8(0x0f);
+	int at = 0;
+	for(; at + 32 <= len; at += 32)
+	{
+		__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + at));
+		__m256i hi = hex_digits(_mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+		__m256i lo = hex_digits(_mm256_and_si256(v, low));
+
+		// unpacking works within each half, so put the halves back in order
+		__m256i a = _mm256_unpacklo_epi8(hi, lo);
+		__m256i b = _mm256_unpackhi_epi8(hi, lo);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * at), _mm256_permute2x128_si256(a, b, 0x20));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * at + 32), _mm256_permute2x128_si256(a, b, 0x31));
+	}
+	return at;
+}
+
+static inline __m256i hex_values(__m256i c, __m256i *valid)
+{
+	__m256i digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+	__m256i lower = _mm256_or_si256(c, _mm256_set1_epi8(0x20));
+	__m256i alpha = _mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a' - 1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('f' + 1), lower));
+	*valid = _mm256_or_si256(digit, alpha);
+	return _mm256_or_si256(
+		_mm256_and_si256(digit, _mm256_sub_epi8(c, _mm256_set1_epi8('0'))),
+		_mm256_and_si256(alpha, _mm256_sub_epi8(lower, _mm256_set1_epi8('a' - 10))));
+}
+
+static inline __m256i hex_pairs(__m256i n)
+{
+	return _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(n, _mm256_set1_epi16(0xff)), 4), _mm256_srli_epi16(n, 8));
+}
+
+int hex_decode_avx2(const char *in, int len, quint8 *out)
+{
+	int at = 0;
+	for(; at + 64 <= len; at += 64)
+	{
+		__m256i va, vb;
+		__m256i a = hex_values(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + at)), &va);
+		__m256i b = hex_values(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + at + 32)), &vb);
+		if(_mm256_movemask_epi8(_mm256_and_si256(va, vb)) != -1)
+			break;
+		__m256i packed = _mm256_packus_epi16(hex_pairs(a), hex_pairs(b));
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + at / 2), _mm256_permute4x64_epi64(packed, 0xd8));
+	}
+	return at;
+}
+
+static inline __m256i b64_split(__m256i in)
+{
+	in = _mm256_shuffle_epi8(in, dup128(_mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1)));
+	__m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+	__m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+	__m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+	__m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+	return _mm256_or_si256(t1, t3);
+}
+
+static inline __m256i b64_chars(__m256i n)
+{
+	const __m256i offsets = dup128(_mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0));
+
+	__m256i index = _mm256_subs_epu8(n, _mm256_set1_epi8(51));
+	__m256i upper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), n);
+	index = _mm256_or_si256(index, _mm256_and_si256(upper, _mm256_set1_epi8(13)));
+	return _mm256_add_epi8(n, _mm256_shuffle_epi8(offsets, index));
+}
+
+static inline bool b64_values(__m256i c, __m256i *out)
+{
+	const __m256i lutLo = dup128(_mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a));
+	const __m256i lutHi = dup128(_mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10));
+	const __m256i lutRoll = dup128(_mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0));
+	const __m256i low = _mm256_set1_epi8(0x0f);
+
+	__m256i hiNibbles = _mm256_and_si256(_mm256_srli_epi32(c, 4), low);
+	__m256i loNibbles = _mm256_and_si256(c, low);
+	__m256i lo = _mm256_shuffle_epi8(lutLo, loNibbles);
+	__m256i hi = _mm256_shuffle_epi8(lutHi, hiNibbles);
+	if(!_mm256_testz_si256(lo, hi))
+		return false;
+
+	__m256i slash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('/'));
+	__m256i roll = _mm256_shuffle_epi8(lutRoll, _mm256_add_epi8(slash, hiNibbles));
+	*out = _mm256_add_epi8(c, roll);
+	return true;
+}
+
+static inline __m256i b64_join(__m256i n)
+{
+	__m256i pairs = _mm256_maddubs_epi16(n, _mm256_set1_epi32(0x01400140));
+	__m256i words = _mm256_madd_epi16(pairs, _mm256_set1_epi32(0x00011000));
+	return _mm256_shuffle_epi8(words, dup128(_mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1)));
+}
+
+int base64_encode_avx2(const quint8 *in, int len, char *out)
+{
+	// each half takes 12 bytes, loaded separately.  the second load
+	//   reads 16 bytes starting 12 bytes in.
+	int at = 0;
+	for(; at + 28 <= len; at += 24)
+	{
+		__m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at));
+		__m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at + 12));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(a), b, 1);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(out + at / 3 * 4), b64_chars(b64_split(v)));
+	}
+	return at;
+}
+
+int base64_decode_avx2(const char *in, int len, quint8 *out)
+{
+	// each half gives 12 bytes, stored separately.  the second store
+	//   writes 16 bytes starting 12 bytes in, so keep room for it.
+	int at = 0;
+	for(; at + 40 <= len; at += 32)
+	{
+		__m256i n;
+		if(!b64_values(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + at)), &n))
+			break;
+		__m256i bytes = b64_join(n);
+		quint8 *p = out + at / 4 * 3;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p), _mm256_castsi256_si128(bytes));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(p + 12), _mm256_extracti128_si256(bytes, 1));
+	}
+	return at;
+}
+
+}
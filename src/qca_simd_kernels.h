@@ -0,0 +1,231 @@
+/*
+ * qca_simd_kernels.h - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+#ifndef QCA_SIMD_KERNELS_H
+#define QCA_SIMD_KERNELS_H
+
+// NOTE: this file is private to QCA.  it is included by each of the
+//   qca_simd_*.cpp files, after they have defined a vector type V and the
+//   following operations on it, all of which work on 32-bit lanes:
+//
+//     V v_load(const quint32 *p)            load one word of every lane
+//     void v_store(quint32 *p, V a)
+//     V v_set1(quint32 x)
+//     V v_add(V a, V b), v_xor, v_and, v_or
+//     V v_andnot(V a, V b)                  (~a & b)
+//     V v_rotl(V a, int n)
+//     V v_gather_le(const quint8 * const *p, int i)   word i of each block
+//     V v_gather_be(const quint8 * const *p, int i)
+//
+//   everything here is a static template so that the copies compiled with
+//   different instruction sets don't clash.
+
+namespace QCA {
+
+static const quint32 simd_md5_T[64] =
+{
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
+};
+
+static const int simd_md5_S[16] =
+{
+	7, 12, 17, 22,
+	5,  9, 14, 20,
+	4, 11, 16, 23,
+	6, 10, 15, 21
+};
+
+template <typename V>
+static inline void simd_md5_step(V &a, const V &b, const V &f, const V &x, int t)
+{
+	a = v_add(v_rotl(v_add(v_add(a, f), v_add(x, v_set1<V>(simd_md5_T[t]))), simd_md5_S[((t >> 4) << 2) + (t & 3)]), b);
+}
+
+template <typename V, int Lanes>
+static inline void simd_md5_block(quint32 *state, const quint8 * const *blocks)
+{
+	V x[16];
+	for(int i = 0; i < 16; ++i)
+		x[i] = v_gather_le<V>(blocks, i);
+
+	V a = v_load<V>(state + 0 * Lanes);
+	V b = v_load<V>(state + 1 * Lanes);
+	V c = v_load<V>(state + 2 * Lanes);
+	V d = v_load<V>(state + 3 * Lanes);
+	V aa = a, bb = b, cc = c, dd = d;
+	V t;
+
+	// round 1: F(b,c,d) = (b & c) | (~b & d)
+	for(int i = 0; i < 16; ++i)
+	{
+		simd_md5_step(a, b, v_or(v_and(b, c), v_andnot(b, d)), x[i], i);
+		t = d; d = c; c = b; b = a; a = t;
+	}
+
+	// round 2: G(b,c,d) = (b & d) | (c & ~d)
+	for(int i = 16; i < 32; ++i)
+	{
+		simd_md5_step(a, b, v_or(v_and(b, d), v_andnot(d, c)), x[(5 * i + 1) & 15], i);
+		t = d; d = c; c = b; b = a; a = t;
+	}
+
+	// round 3: H(b,c,d) = b ^ c ^ d
+	for(int i = 32; i < 48; ++i)
+	{
+		simd_md5_step(a, b, v_xor(v_xor(b, c), d), x[(3 * i + 5) & 15], i);
+		t = d; d = c; c = b; b = a; a = t;
+	}
+
+	// round 4: I(b,c,d) = c ^ (b | ~d)
+	V ones = v_set1<V>(0xffffffff);
+	for(int i = 48; i < 64; ++i)
+	{
+		simd_md5_step(a, b, v_xor(c, v_or(b, v_xor(d, ones))), x[(7 * i) & 15], i);
+		t = d; d = c; c = b; b = a; a = t;
+	}
+
+	v_store(state + 0 * Lanes, v_add(a, aa));
+	v_store(state + 1 * Lanes, v_add(b, bb));
+	v_store(state + 2 * Lanes, v_add(c, cc));
+	v_store(state + 3 * Lanes, v_add(d, dd));
+}
+
+template <typename V>
+static inline void simd_sha1_step(V &a, V &b, V &c, V &d, V &e, const V &f, const V &k, const V &w)
+{
+	V temp = v_add(v_add(v_rotl(a, 5), f), v_add(v_add(e, k), w));
+	e = d;
+	d = c;
+	c = v_rotl(b, 30);
+	b = a;
+	a = temp;
+}
+
+template <typename V>
+static inline V simd_sha1_schedule(V *w, int i)
+{
+	w[i & 15] = v_rotl(v_xor(v_xor(w[(i + 13) & 15], w[(i + 8) & 15]), v_xor(w[(i + 2) & 15], w[i & 15])), 1);
+	return w[i & 15];
+}
+
+template <typename V, int Lanes>
+static inline void simd_sha1_block(quint32 *state, const quint8 * const *blocks)
+{
+	V w[16];
+	for(int i = 0; i < 16; ++i)
+		w[i] = v_gather_be<V>(blocks, i);
+
+	V a = v_load<V>(state + 0 * Lanes);
+	V b = v_load<V>(state + 1 * Lanes);
+	V c = v_load<V>(state + 2 * Lanes);
+	V d = v_load<V>(state + 3 * Lanes);
+	V e = v_load<V>(state + 4 * Lanes);
+	V aa = a, bb = b, cc = c, dd = d, ee = e;
+
+	V k = v_set1<V>(0x5A827999);
+	for(int i = 0; i < 16; ++i)
+		simd_sha1_step(a, b, c, d, e, v_xor(v_and(b, v_xor(c, d)), d), k, w[i]);
+	for(int i = 16; i < 20; ++i)
+		simd_sha1_step(a, b, c, d, e, v_xor(v_and(b, v_xor(c, d)), d), k, simd_sha1_schedule(w, i));
+
+	k = v_set1<V>(0x6ED9EBA1);
+	for(int i = 20; i < 40; ++i)
+		simd_sha1_step(a, b, c, d, e, v_xor(v_xor(b, c), d), k, simd_sha1_schedule(w, i));
+
+	k = v_set1<V>(0x8F1BBCDC);
+	for(int i = 40; i < 60; ++i)
+		simd_sha1_step(a, b, c, d, e, v_or(v_and(b, c), v_and(d, v_or(b, c))), k, simd_sha1_schedule(w, i));
+
+	k = v_set1<V>(0xCA62C1D6);
+	for(int i = 60; i < 80; ++i)
+		simd_sha1_step(a, b, c, d, e, v_xor(v_xor(b, c), d), k, simd_sha1_schedule(w, i));
+
+	v_store(state + 0 * Lanes, v_add(a, aa));
+	v_store(state + 1 * Lanes, v_add(b, bb));
+	v_store(state + 2 * Lanes, v_add(c, cc));
+	v_store(state + 3 * Lanes, v_add(d, dd));
+	v_store(state + 4 * Lanes, v_add(e, ee));
+}
+
+template <typename V>
+static inline void simd_chacha_qr(V &a, V &b, V &c, V &d)
+{
+	a = v_add(a, b); d = v_rotl(v_xor(d, a), 16);
+	c = v_add(c, d); b = v_rotl(v_xor(b, c), 12);
+	a = v_add(a, b); d = v_rotl(v_xor(d, a), 8);
+	c = v_add(c, d); b = v_rotl(v_xor(b, c), 7);
+}
+
+// Lanes consecutive chacha20 blocks, the first one using the block counter
+//   in input[12] and input[13].  the output is laid out word by word, with
+//   one entry per lane for each word.
+template <typename V, int Lanes>
+static inline void simd_chacha_blocks(const quint32 *input, quint32 *out)
+{
+	quint32 lo[Lanes], hi[Lanes];
+	quint64 counter = ((quint64)input[13] << 32) | input[12];
+	for(int l = 0; l < Lanes; ++l)
+	{
+		lo[l] = (quint32)(counter + l);
+		hi[l] = (quint32)((counter + l) >> 32);
+	}
+
+	V x[16], orig[16];
+	for(int i = 0; i < 16; ++i)
+		x[i] = v_set1<V>(input[i]);
+	x[12] = v_load<V>(lo);
+	x[13] = v_load<V>(hi);
+	for(int i = 0; i < 16; ++i)
+		orig[i] = x[i];
+
+	for(int i = 0; i < 10; ++i)
+	{
+		simd_chacha_qr(x[0], x[4], x[8], x[12]);
+		simd_chacha_qr(x[1], x[5], x[9], x[13]);
+		simd_chacha_qr(x[2], x[6], x[10], x[14]);
+		simd_chacha_qr(x[3], x[7], x[11], x[15]);
+		simd_chacha_qr(x[0], x[5], x[10], x[15]);
+		simd_chacha_qr(x[1], x[6], x[11], x[12]);
+		simd_chacha_qr(x[2], x[7], x[8], x[13]);
+		simd_chacha_qr(x[3], x[4], x[9], x[14]);
+	}
+
+	for(int i = 0; i < 16; ++i)
+		v_store(out + i * Lanes, v_add(x[i], orig[i]));
+}
+
+}
+
+#endif
@@ -0,0 +1,169 @@
+/*
+ * qca_simd_sse2.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// 4-lane MD5, SHA1 and ChaCha20 kernels, and hex conversion.  this file is
+//   compiled with SSE2 enabled.
+
+#include "qca_simd.h"
+
+#include <QtEndian>
+#include <emmintrin.h>
+
+namespace QCA {
+
+struct V4
+{
+	__m128i v;
+};
+
+static inline V4 mk(__m128i v)
+{
+	V4 r;
+	r.v = v;
+	return r;
+}
+
+template <typename V> static inline V v_load(const quint32 *p);
+template <typename V> static inline V v_set1(quint32 x);
+template <typename V> static inline V v_gather_le(const quint8 * const *p, int i);
+template <typename V> static inline V v_gather_be(const quint8 * const *p, int i);
+
+template <> inline V4 v_load<V4>(const quint32 *p)
+{
+	return mk(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+static inline void v_store(quint32 *p, V4 a)
+{
+	_mm_storeu_si128(reinterpret_cast<__m128i*>(p), a.v);
+}
+
+template <> inline V4 v_set1<V4>(quint32 x)
+{
+	return mk(_mm_set1_epi32((int)x));
+}
+
+static inline V4 v_add(V4 a, V4 b)    { return mk(_mm_add_epi32(a.v, b.v)); }
+static inline V4 v_xor(V4 a, V4 b)    { return mk(_mm_xor_si128(a.v, b.v)); }
+static inline V4 v_and(V4 a, V4 b)    { return mk(_mm_and_si128(a.v, b.v)); }
+static inline V4 v_or(V4 a, V4 b)     { return mk(_mm_or_si128(a.v, b.v)); }
+static inline V4 v_andnot(V4 a, V4 b) { return mk(_mm_andnot_si128(a.v, b.v)); }
+
+static inline V4 v_rotl(V4 a, int n)
+{
+	return mk(_mm_or_si128(_mm_sll_epi32(a.v, _mm_cvtsi32_si128(n)), _mm_srl_epi32(a.v, _mm_cvtsi32_si128(32 - n))));
+}
+
+template <> inline V4 v_gather_le<V4>(const quint8 * const *p, int i)
+{
+	return mk(_mm_setr_epi32(
+		(int)qFromLittleEndian<quint32>(p[0] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[1] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[2] + 4 * i),
+		(int)qFromLittleEndian<quint32>(p[3] + 4 * i)));
+}
+
+template <> inline V4 v_gather_be<V4>(const quint8 * const *p, int i)
+{
+	return mk(_mm_setr_epi32(
+		(int)qFromBigEndian<quint32>(p[0] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[1] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[2] + 4 * i),
+		(int)qFromBigEndian<quint32>(p[3] + 4 * i)));
+}
+
+}
+
+#include "qca_simd_kernels.h"
+
+namespace QCA {
+
+void md5_block_x4_sse2(quint32 *state, const quint8 * const *blocks)
+{
+	simd_md5_block<V4, 4>(state, blocks);
+}
+
+void sha1_block_x4_sse2(quint32 *state, const quint8 * const *blocks)
+{
+	simd_sha1_block<V4, 4>(state, blocks);
+}
+
+void chacha_blocks_x4_sse2(const quint32 *input, quint32 *out)
+{
+	simd_chacha_blocks<V4, 4>(input, out);
+}
+
+// 0..15 to '0'..'9', 'a'..'f'
+static inline __m128i hex_digits(__m128i n)
+{
+	__m128i letters = _mm_and_si128(_mm_cmpgt_epi8(n, _mm_set1_epi8(9)), _mm_set1_epi8('a' - '0' - 10));
+	return _mm_add_epi8(_mm_add_epi8(n, _mm_set1_epi8('0')), letters);
+}
+
+int hex_encode_sse2(const quint8 *in, int len, char *out)
+{
+	const __m128i low = _mm_set1_epi8(0x0f);
+	int at = 0;
+	for(; at + 16 <= len; at += 16)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at));
+		__m128i hi = hex_digits(_mm_and_si128(_mm_srli_epi16(v, 4), low));
+		__m128i lo = hex_digits(_mm_and_si128(v, low));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * at), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + 2 * at + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+	return at;
+}
+
+// '0'..'9', 'a'..'f' and 'A'..'F' to 0..15.  valid gets all bits set in
+//   the positions holding hex digits.
+static inline __m128i hex_values(__m128i c, __m128i *valid)
+{
+	__m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('9' + 1), c));
+	__m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+	__m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)), _mm_cmpgt_epi8(_mm_set1_epi8('f' + 1), lower));
+	*valid = _mm_or_si128(digit, alpha);
+	return _mm_or_si128(
+		_mm_and_si128(digit, _mm_sub_epi8(c, _mm_set1_epi8('0'))),
+		_mm_and_si128(alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+}
+
+// pairs of values, high nibble first, to 16-bit words holding one byte each
+static inline __m128i hex_pairs(__m128i n)
+{
+	return _mm_or_si128(_mm_slli_epi16(_mm_and_si128(n, _mm_set1_epi16(0xff)), 4), _mm_srli_epi16(n, 8));
+}
+
+int hex_decode_sse2(const char *in, int len, quint8 *out)
+{
+	int at = 0;
+	for(; at + 32 <= len; at += 32)
+	{
+		__m128i va, vb;
+		__m128i a = hex_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at)), &va);
+		__m128i b = hex_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at + 16)), &vb);
+		if(_mm_movemask_epi8(_mm_and_si128(va, vb)) != 0xffff)
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + at / 2), _mm_packus_epi16(hex_pairs(a), hex_pairs(b)));
+	}
+	return at;
+}
+
+}
@@ -0,0 +1,129 @@
+/*
+ * qca_simd_ssse3.cpp - Qt Cryptographic Architecture
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301  USA
+ *
+ */
+
+// base64 conversion, 12 bytes to 16 characters at a time.  this file is
+//   compiled with SSSE3 enabled, and must only be called after checking for
+//   SSSE3 at runtime.
+//
+// the technique is the one described by Wojciech Mula and Daniel Lemire:
+//   bytes are shuffled so that each 32-bit word holds the 3 bytes of one
+//   group, the four 6-bit fields are moved into separate bytes with
+//   multiplies, and the fields are mapped to and from characters with
+//   small in-register lookup tables.
+
+#include "qca_simd.h"
+
+#include <tmmintrin.h>
+
+namespace QCA {
+
+// 12 bytes to 16 6-bit values, one per byte
+static inline __m128i b64_split(__m128i in)
+{
+	in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+	__m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+	__m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+	__m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+	__m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+	return _mm_or_si128(t1, t3);
+}
+
+// 6-bit values to characters, by adding an offset chosen by range
+static inline __m128i b64_chars(__m128i n)
+{
+	const __m128i offsets = _mm_setr_epi8(
+		'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+		'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62,
+		'/' - 63, 'A', 0, 0);
+
+	// 0..25 -> 13, 26..51 -> 0, 52..61 -> 1..10, 62 -> 11, 63 -> 12
+	__m128i index = _mm_subs_epu8(n, _mm_set1_epi8(51));
+	__m128i upper = _mm_cmpgt_epi8(_mm_set1_epi8(26), n);
+	index = _mm_or_si128(index, _mm_and_si128(upper, _mm_set1_epi8(13)));
+	return _mm_add_epi8(n, _mm_shuffle_epi8(offsets, index));
+}
+
+// characters to 6-bit values.  returns false if any character is not one
+//   of the 64 digits.
+static inline bool b64_values(__m128i c, __m128i *out)
+{
+	// a character is invalid if the classes of its high and low nibbles
+	//   share a bit
+	const __m128i lutLo = _mm_setr_epi8(
+		0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11,
+		0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b, 0x1b, 0x1a);
+	const __m128i lutHi = _mm_setr_epi8(
+		0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08,
+		0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10);
+	const __m128i lutRoll = _mm_setr_epi8(
+		0, 16, 19, 4, -65, -65, -71, -71,
+		0, 0, 0, 0, 0, 0, 0, 0);
+	const __m128i low = _mm_set1_epi8(0x0f);
+
+	__m128i hiNibbles = _mm_and_si128(_mm_srli_epi32(c, 4), low);
+	__m128i loNibbles = _mm_and_si128(c, low);
+	__m128i lo = _mm_shuffle_epi8(lutLo, loNibbles);
+	__m128i hi = _mm_shuffle_epi8(lutHi, hiNibbles);
+	if(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_and_si128(lo, hi), _mm_setzero_si128())) != 0)
+		return false;
+
+	// '/' shares its high nibble with '+', so it gets its own entry
+	__m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+	__m128i roll = _mm_shuffle_epi8(lutRoll, _mm_add_epi8(slash, hiNibbles));
+	*out = _mm_add_epi8(c, roll);
+	return true;
+}
+
+// 16 6-bit values to 12 bytes, in the low part of the result
+static inline __m128i b64_join(__m128i n)
+{
+	__m128i pairs = _mm_maddubs_epi16(n, _mm_set1_epi32(0x01400140));
+	__m128i words = _mm_madd_epi16(pairs, _mm_set1_epi32(0x00011000));
+	return _mm_shuffle_epi8(words, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+}
+
+int base64_encode_ssse3(const quint8 *in, int len, char *out)
+{
+	// each step reads 16 bytes and uses 12 of them
+	int at = 0;
+	for(; at + 16 <= len; at += 12)
+	{
+		__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + at / 3 * 4), b64_chars(b64_split(v)));
+	}
+	return at;
+}
+
+int base64_decode_ssse3(const char *in, int len, quint8 *out)
+{
+	// each step writes 16 bytes, of which 12 are used, so stop while
+	//   there is still room in out for the extra
+	int at = 0;
+	for(; at + 24 <= len; at += 16)
+	{
+		__m128i n;
+		if(!b64_values(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in + at)), &n))
+			break;
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + at / 4 * 3), b64_join(n));
+	}
+	return at;
+}
+
+}
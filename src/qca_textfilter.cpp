@@ -21,6 +21,10 @@
 
 #include "qca_textfilter.h"
 
+#include "qca_simd.h"
+
+#include <string.h>
+
 namespace QCA {
 
 //----------------------------------------------------------------------------
@@ -114,77 +118,68 @@ void Hex::clear()
 
 MemoryRegion Hex::update(const MemoryRegion &m)
 {
-	QByteArray a = m.toByteArray();
+	const char *in = m.constData();
+	int len = m.size();
 	if(_dir == Encode)
 	{
-		QByteArray out(a.size() * 2, 0);
-		int at = 0;
-		int c;
-		for(int n = 0; n < (int)a.size(); ++n)
+		QByteArray out(len * 2, 0);
+		char *p = out.data();
+		int at = hex_encode_accel((const quint8 *)in, len, p);
+		for(int n = at; n < len; ++n)
 		{
-			uchar lo = (uchar)a[n] & 0x0f;
-			uchar hi = (uchar)a[n] >> 4;
-			c = enhex(hi);
-			if(c == -1)
-			{
-				_ok = false;
-				break;
-			}
-			out[at++] = (char)c;
-			c = enhex(lo);
-			if(c == -1)
-			{
-				_ok = false;
-				break;
-			}
-			out[at++] = (char)c;
+			uchar lo = (uchar)in[n] & 0x0f;
+			uchar hi = (uchar)in[n] >> 4;
+			p[2 * n] = (char)enhex(hi);
+			p[2 * n + 1] = (char)enhex(lo);
 		}
-		if(!_ok)
-			return MemoryRegion();
-
 		return out;
 	}
 	else
 	{
-		uchar lo = 0;
-		uchar hi = 0;
-		bool flag = false;
-		if(partial)
-		{
-			hi = val;
-			flag = true;
-		}
-
-		QByteArray out(a.size() / 2, 0);
+		QByteArray out((len + (partial ? 1 : 0)) / 2, 0);
+		uchar *p = (uchar *)out.data();
 		int at = 0;
-		int c;
-		for(int n = 0; n < (int)a.size(); ++n)
+		int n = 0;
+
+		// finish the byte left over from the previous call
+		if(partial && len > 0)
 		{
-			c = dehex((char)a[n]);
+			int c = dehex(in[0]);
 			if(c == -1)
 			{
 				_ok = false;
-				break;
-			}
-			if(flag)
-			{
-				lo = (uchar)c;
-				uchar full = ((hi & 0x0f) << 4) + (lo & 0x0f);
-				out[at++] = full;
-				flag = false;
+				return MemoryRegion();
 			}
-			else
+			p[at++] = ((val & 0x0f) << 4) + c;
+			partial = false;
+			n = 1;
+		}
+
+		int done = hex_decode_accel(in + n, (len - n) & ~1, p + at);
+		n += done;
+		at += done / 2;
+
+		for(; n + 1 < len; n += 2)
+		{
+			int hi = dehex(in[n]);
+			int lo = dehex(in[n + 1]);
+			if(hi == -1 || lo == -1)
 			{
-				hi = (uchar)c;
-				flag = true;
+				_ok = false;
+				return MemoryRegion();
 			}
+			p[at++] = (uchar)((hi << 4) + lo);
 		}
-		if(!_ok)
-			return MemoryRegion();
 
-		if(flag)
+		if(n < len)
 		{
-			val = hi;
+			int c = dehex(in[n]);
+			if(c == -1)
+			{
+				_ok = false;
+				return MemoryRegion();
+			}
+			val = (uchar)c;
 			partial = true;
 		}
 		return out;
@@ -211,6 +206,7 @@ Base64::Base64(Direction dir)
 {
 	_lb_enabled = false;
 	_lb_column = 76;
+	clear();
 }
 
 void Base64::clear()
@@ -243,11 +239,16 @@ void Base64::setLineBreaksColumn(int column)
 		_lb_column = 76;
 }
 
-static QByteArray b64encode(const QByteArray &s)
+static int b64_encoded_size(int len)
+{
+	return (len + 2) / 3 * 4;
+}
+
+// encode len bytes to out, padding the last group if len is not a
+//   multiple of 3
+static void b64encode(const char *in, int len, char *out)
 {
-	int i;
-	int len = s.size();
-	static char tbl[] =
+	static const char tbl[] =
 		"ABCDEFGH"
 		"IJKLMNOP"
 		"QRSTUVWX"
@@ -257,21 +258,23 @@ static QByteArray b64encode(const QByteArray &s)
 		"wxyz0123"
 		"456789+/"
 		"=";
-	int a, b, c;
 
-	QByteArray p((len + 2) / 3 * 4, 0);
-	int at = 0;
-	for(i = 0; i < len; i += 3)
+	const uchar *s = (const uchar *)in;
+	int i = base64_encode_accel(s, len, out);
+	out += i / 3 * 4;
+
+	int a, b, c;
+	for(; i < len; i += 3)
 	{
-		a = ((unsigned char)s[i] & 3) << 4;
+		a = (s[i] & 3) << 4;
 		if(i + 1 < len)
 		{
-			a += (unsigned char)s[i + 1] >> 4;
-			b = ((unsigned char)s[i + 1] & 0xf) << 2;
+			a += s[i + 1] >> 4;
+			b = (s[i + 1] & 0xf) << 2;
 			if(i + 2 < len)
 			{
-				b += (unsigned char)s[i + 2] >> 6;
-				c = (unsigned char)s[i + 2] & 0x3f;
+				b += s[i + 2] >> 6;
+				c = s[i + 2] & 0x3f;
 			}
 			else
 				c = 64;
@@ -279,21 +282,69 @@ static QByteArray b64encode(const QByteArray &s)
 		else
 			b = c = 64;
 
-		p[at++] = tbl[(unsigned char)s[i] >> 2];
-		p[at++] = tbl[a];
-		p[at++] = tbl[b];
-		p[at++] = tbl[c];
+		*(out++) = tbl[s[i] >> 2];
+		*(out++) = tbl[a];
+		*(out++) = tbl[b];
+		*(out++) = tbl[c];
+	}
+}
+
+// append the encoding of len bytes to out.  if lfAt is more than zero, a
+//   line break is written after every lfAt characters, and col tracks the
+//   current column.
+static void b64encode_lines(const char *in, int len, QByteArray *out, int *col, int lfAt)
+{
+	if(len == 0)
+		return;
+
+	int chars = b64_encoded_size(len);
+	int breaks = lfAt > 0 ? (*col + chars) / lfAt : 0;
+	int at = out->size();
+	out->resize(at + chars + breaks);
+	char *p = out->data() + at;
+
+	if(lfAt <= 0)
+	{
+		b64encode(in, len, p);
+		return;
+	}
+
+	// encode a piece at a time into a small buffer, and copy it out a
+	//   line at a time
+	char buf[4096];
+	while(len > 0)
+	{
+		int n = qMin(len, 3072);
+		int size = b64_encoded_size(n);
+		b64encode(in, n, buf);
+		in += n;
+		len -= n;
+
+		for(int i = 0; i < size;)
+		{
+			int take = qMin(size - i, lfAt - *col);
+			memcpy(p, buf + i, take);
+			p += take;
+			i += take;
+			*col += take;
+			if(*col == lfAt)
+			{
+				*(p++) = '\n';
+				*col = 0;
+			}
+		}
 	}
-	return p;
 }
 
-static QByteArray b64decode(const QByteArray &s, bool *ok)
+// decode one group of 4 characters to out.  returns the number of bytes
+//   written, or -1 if the group is not valid.
+static int b64decode_group(const uchar *s, char *out)
 {
 	// -1 specifies invalid
 	// 64 specifies eof
 	// everything else specifies data
 
-	static signed char tbl[] =
+	static const signed char tbl[] =
 	{
 		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
 		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
@@ -313,197 +364,120 @@ static QByteArray b64decode(const QByteArray &s, bool *ok)
 		-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
 	};
 
-	// return value
-	QByteArray p;
-	*ok = true;
-
-	// this should be a multiple of 4
-	int len = s.size();
-	if(len % 4)
-	{
-		*ok = false;
-		return p;
-	}
-
-	p.resize(len / 4 * 3);
-
-	int i;
-	int at = 0;
-
-	int a, b, c, d;
-	c = d = 0;
-
-	for(i = 0; i < len; i += 4)
-	{
-		a = tbl[(int)s[i]];
-		b = tbl[(int)s[i + 1]];
-		c = tbl[(int)s[i + 2]];
-		d = tbl[(int)s[i + 3]];
-		if((a == 64 || b == 64) || (a < 0 || b < 0 || c < 0 || d < 0))
-		{
-			p.resize(0);
-			*ok = false;
-			return p;
-		}
-		p[at++] = ((a & 0x3F) << 2) | ((b >> 4) & 0x03);
-		p[at++] = ((b & 0x0F) << 4) | ((c >> 2) & 0x0F);
-		p[at++] = ((c & 0x03) << 6) | ((d >> 0) & 0x3F);
-	}
+	int a = tbl[s[0]];
+	int b = tbl[s[1]];
+	int c = tbl[s[2]];
+	int d = tbl[s[3]];
+	if((a == 64 || b == 64) || (a < 0 || b < 0 || c < 0 || d < 0))
+		return -1;
+	out[0] = ((a & 0x3F) << 2) | ((b >> 4) & 0x03);
+	out[1] = ((b & 0x0F) << 4) | ((c >> 2) & 0x0F);
+	out[2] = ((c & 0x03) << 6) | ((d >> 0) & 0x3F);
 
 	if(c & 64)
-		p.resize(at - 2);
+		return 1;
 	else if(d & 64)
-		p.resize(at - 1);
-
-	return p;
+		return 2;
+	return 3;
 }
 
-static int findLF(const QByteArray &in, int offset)
+static inline bool b64_is_space(char c)
 {
-	for(int n = offset; n < in.size(); ++n)
-	{
-		if(in[n] == '\n')
-			return n;
-	}
-	return -1;
+	return c == '\n' || c == '\r' || c == ' ' || c == '\t';
 }
 
-static QByteArray insert_linebreaks(const QByteArray &s, int *col, int lfAt)
+MemoryRegion Base64::update(const MemoryRegion &m)
 {
-	QByteArray out = s;
+	const char *in = m.constData();
+	int len = m.size();
+	if(len == 0)
+		return MemoryRegion();
 
-	int needed = (out.size() + *col) / lfAt;   // how many newlines needed?
-	if(needed > 0)
+	QByteArray out;
+	if(_dir == Encode)
 	{
-		int firstlen = lfAt - *col;                // length of first chunk
-		int at = firstlen + (lfAt * (needed - 1)); // position of last newline
-		int lastlen = out.size() - at;             // length of last chunk
+		int lfAt = _lb_enabled ? _lb_column : 0;
 
-		//printf("size=%d,needed=%d,firstlen=%d,at=%d,lastlen=%d\n", out.size(), needed, firstlen, at, lastlen);
-
-		// make room
-		out.resize(out.size() + needed);
-
-		// move backwards
-		for(int n = 0; n < needed; ++n)
+		// complete the group left over from the previous call
+		if(!partial.isEmpty())
 		{
-			char *p = out.data() + at;
-			int len;
-			if(n == 0)
-				len = lastlen;
-			else
-				len = lfAt;
-			memmove(p + needed - n, p, len);
-			p[needed - n - 1] = '\n';
-			at -= lfAt;
+			int take = qMin(3 - partial.size(), len);
+			partial.append(in, take);
+			in += take;
+			len -= take;
+			if(partial.size() < 3)
+				return MemoryRegion();
+			b64encode_lines(partial.constData(), 3, &out, &col, lfAt);
+			partial.resize(0);
 		}
 
-		*col = lastlen;
+		int eat = len % 3;
+		b64encode_lines(in, len - eat, &out, &col, lfAt);
+		partial = QByteArray(in + len - eat, eat);
+		return out;
 	}
-	else
-		*col += out.size();
-
-	return out;
-}
 
-static QByteArray remove_linebreaks(const QByteArray &s)
-{
-	QByteArray out = s;
+	// there can't be more output than this, and it's trimmed at the end
+	out.resize((partial.size() + len) / 4 * 3);
+	char *p = out.data();
+	int at = 0;
 
-	int removed = 0;
-	int at = findLF(out, 0);
-	while(at != -1)
+	// the decoder is a small state machine working straight from the
+	//   input: whole groups go to the vector code, which stops at anything
+	//   that isn't a base64 digit, and the characters around a line break
+	//   are collected one at a time.  at most 3 characters are carried
+	//   over to the next call.
+	uchar group[4];
+	int n = partial.size();
+	memcpy(group, partial.constData(), n);
+
+	const char *end = in + len;
+	while(in < end)
 	{
-		int next = findLF(out, at + 1);
-		int len;
-		if(next != -1)
-			len = next - at;
-		else
-			len = out.size() - at;
+		if(n == 0)
+		{
+			int done = base64_decode_accel(in, (end - in) & ~3, (quint8 *)p + at);
+			in += done;
+			at += done / 4 * 3;
+			if(in == end)
+				break;
+		}
 
-		if(len > 1)
+		char c = *(in++);
+		if(_lb_enabled && b64_is_space(c))
+			continue;
+		group[n++] = (uchar)c;
+		if(n == 4)
 		{
-			char *p = out.data() + at;
-			memmove(p - removed, p + 1, len - 1);
+			int ret = b64decode_group(group, p + at);
+			if(ret == -1)
+			{
+				_ok = false;
+				return MemoryRegion();
+			}
+			at += ret;
+			n = 0;
 		}
-		++removed;
-		at = next;
 	}
-	out.resize(out.size() - removed);
 
+	partial = QByteArray((const char *)group, n);
+	out.resize(at);
 	return out;
 }
 
-static void appendArray(QByteArray *a, const QByteArray &b)
-{
-	a->append(b);
-}
-
-MemoryRegion Base64::update(const MemoryRegion &m)
-{
-	QByteArray in;
-	if(_dir == Decode && _lb_enabled)
-		in = remove_linebreaks(m.toByteArray());
-	else
-		in = m.toByteArray();
-
-	if(in.isEmpty())
-		return MemoryRegion();
-
-	int chunk;
-	if(_dir == Encode)
-		chunk = 3;
-	else
-		chunk = 4;
-
-	int size = partial.size() + in.size();
-	if(size < chunk)
-	{
-		appendArray(&partial, in);
-		return MemoryRegion();
-	}
-
-	int eat = size % chunk;
-
-	// s = partial + a - eat
-	QByteArray s(partial.size() + in.size() - eat, 0);
-	memcpy(s.data(), partial.data(), partial.size());
-	memcpy(s.data() + partial.size(), in.data(), in.size() - eat);
-
-	partial.resize(eat);
-	memcpy(partial.data(), in.data() + in.size() - eat, eat);
-
-	if(_dir == Encode)
-	{
-		if(_lb_enabled)
-			return insert_linebreaks(b64encode(s), &col, _lb_column);
-		else
-			return b64encode(s);
-	}
-	else
-	{
-		bool ok;
-		QByteArray out = b64decode(s, &ok);
-		if(!ok)
-			_ok = false;
-		return out;
-	}
-}
-
 MemoryRegion Base64::final()
 {
+	QByteArray out;
 	if(_dir == Encode)
 	{
-		if(_lb_enabled)
-			return insert_linebreaks(b64encode(partial), &col, _lb_column);
-		else
-			return b64encode(partial);
+		b64encode_lines(partial.constData(), partial.size(), &out, &col, _lb_enabled ? _lb_column : 0);
+		partial.resize(0);
+		return out;
 	}
 	else
 	{
-		bool ok;
-		QByteArray out = b64decode(partial, &ok);
-		if(!ok)
+		// whatever is left over can't be a whole group
+		if(!partial.isEmpty())
 			_ok = false;
 		return out;
 	}
@@ -20,6 +20,7 @@
  */
 
 #include "qca_tools.h"
+#include "qca_core.h"
 
 #include "qdebug.h"
 
@@ -56,6 +57,10 @@ static bool can_lock()
 #endif
 }
 
+// from qca_securealloc.cpp
+Botan::Allocator *create_thread_allocator(Botan::Allocator *backing, int prealloc);
+int thread_allocator_capacity(int bytes);
+
 // Botan shouldn't throw any exceptions in our init/deinit.
 
 static Botan::Allocator *alloc = 0;
@@ -82,16 +87,30 @@ bool botan_init(int prealloc, bool mmap)
 		Botan::set_global_state(libstate);
 		Botan::global_state().load(modules);
 
+		// if memory can be locked, the thread caching allocator maps
+		//   and locks it itself.  otherwise it sits in front of one of
+		//   the botan pools.
+		Botan::Allocator *backing = 0;
 		if(can_lock())
 		{
-			Botan::global_state().set_default_allocator("locking");
 			secmem = true;
 		}
-		else if(mmap)
+		else if(secureMemoryPolicy() == SecureMemoryFailFast)
+		{
+			fprintf(stderr, "QCA: Unable to lock secure memory\n");
+			abort();
+		}
+		else if(mmap && Botan::global_state().get_allocator("mmap"))
 		{
-			Botan::global_state().set_default_allocator("mmap");
+			backing = Botan::global_state().get_allocator("mmap");
 			secmem = true;
 		}
+		else
+			backing = Botan::Allocator::get(true);
+
+		Botan::Allocator *threaded = create_thread_allocator(backing, prealloc * 1024);
+		Botan::global_state().add_allocator(threaded);
+		Botan::global_state().set_default_allocator(threaded->type());
 		alloc = Botan::Allocator::get(true);
 	}
 	catch(std::exception &)
@@ -107,6 +126,11 @@ void botan_deinit()
 {
 	try
 	{
+		// allocators are destroyed in the order they were added, but the
+		//   thread caches must give their slabs back before the pool
+		//   underneath is gone
+		if(alloc)
+			alloc->destroy();
 		alloc = 0;
 		Botan::set_global_state(0);
 	}
@@ -169,7 +193,20 @@ void *qca_secure_realloc(void *p, int bytes)
 	// backtrack to read the size value
 	char *c = (char *)p;
 	c -= sizeof(int);
-	int oldsize = ((int *)c)[0] - sizeof(int);
+	int oldtotal = ((int *)c)[0];
+	int oldsize = oldtotal - sizeof(int);
+
+	// if the block that was handed out already has room for the new size,
+	//   and would also be the one handed out for it, resize in place
+	int newtotal = bytes + sizeof(int);
+	int capacity = QCA::thread_allocator_capacity(oldtotal);
+	if(newtotal <= capacity && QCA::thread_allocator_capacity(newtotal) == capacity)
+	{
+		if(bytes < oldsize)
+			memset((char *)p + bytes, 0, oldsize - bytes);
+		((int *)c)[0] = newtotal;
+		return p;
+	}
 
 	// alloc the new chunk
 	char *new_p = (char *)qca_secure_alloc(bytes);
@@ -238,9 +275,11 @@ bool ai_new(alloc_info *ai, int size, bool sec)
 
 	if(sec)
 	{
+		// take the whole chunk the allocator would hand out anyway, so
+		//   that ai_resize() can grow into it later
 		try
 		{
-			ai->sbuf = new Botan::SecureVector<Botan::byte>((Botan::u32bit)size + 1);
+			ai->sbuf = new Botan::SecureVector<Botan::byte>((Botan::u32bit)thread_allocator_capacity(size + 1));
 		}
 		catch(std::exception &)
 		{
@@ -333,10 +372,21 @@ bool ai_resize(alloc_info *ai, int new_size)
 
 	if(ai->sec)
 	{
+		// resize in place if the buffer has room, and a new one would
+		//   not be any smaller.  bytes past the end are always zero.
+		int capacity = thread_allocator_capacity(new_size + 1);
+		if(ai->size > 0 && capacity == (int)ai->sbuf->size())
+		{
+			if(new_size < ai->size)
+				memset(ai->data + new_size, 0, ai->size - new_size);
+			ai->size = new_size;
+			return true;
+		}
+
 		Botan::SecureVector<Botan::byte> *new_buf;
 		try
 		{
-			new_buf = new Botan::SecureVector<Botan::byte>((Botan::u32bit)new_size + 1);
+			new_buf = new Botan::SecureVector<Botan::byte>((Botan::u32bit)capacity);
 		}
 		catch(std::exception &)
 		{
@@ -753,6 +803,160 @@ const SecureArray operator+(const SecureArray &a, const SecureArray &b)
 	return c.append(b);
 }
 
+//----------------------------------------------------------------------------
+// MemoryRegionView
+//----------------------------------------------------------------------------
+MemoryRegionView::MemoryRegionView(const QByteArray &from)
+:_data(from.constData()), _size(from.size()), _secure(false)
+{
+}
+
+MemoryRegionView::MemoryRegionView(const MemoryRegion &from)
+:_data(from.constData()), _size(from.size()), _secure(from.isSecure())
+{
+}
+
+MemoryRegionView MemoryRegionView::mid(int pos, int len) const
+{
+	if(pos < 0)
+		pos = 0;
+	if(pos > _size)
+		pos = _size;
+	if(len < 0 || len > _size - pos)
+		len = _size - pos;
+	return MemoryRegionView(_data + pos, len, _secure);
+}
+
+QByteArray MemoryRegionView::toByteArray() const
+{
+	return QByteArray(_data, _size);
+}
+
+//----------------------------------------------------------------------------
+// ChunkBuffer
+//----------------------------------------------------------------------------
+ChunkBuffer::ChunkBuffer(const QByteArray &from)
+:_offset(0), _size(0)
+{
+	append(from);
+}
+
+void ChunkBuffer::clear()
+{
+	_chunks.clear();
+	_offset = 0;
+	_size = 0;
+}
+
+void ChunkBuffer::append(const QByteArray &a)
+{
+	if(a.isEmpty())
+		return;
+	_chunks += a;
+	_size += a.size();
+}
+
+void ChunkBuffer::append(const ChunkBuffer &b)
+{
+	if(b.isEmpty())
+		return;
+
+	if(isEmpty())
+	{
+		*this = b;
+		return;
+	}
+
+	// only the first chunk of b can be partly consumed
+	_chunks += b._chunks.first().mid(b._offset);
+	for(int n = 1; n < b._chunks.count(); ++n)
+		_chunks += b._chunks[n];
+	_size += b._size;
+}
+
+MemoryRegionView ChunkBuffer::chunk(int index) const
+{
+	const QByteArray &a = _chunks[index];
+	if(index == 0)
+		return MemoryRegionView(a.constData() + _offset, a.size() - _offset);
+	else
+		return MemoryRegionView(a.constData(), a.size());
+}
+
+int ChunkBuffer::peek(char *data, int size) const
+{
+	int at = 0;
+	int offset = _offset;
+	for(int n = 0; n < _chunks.count() && at < size; ++n)
+	{
+		const QByteArray &a = _chunks[n];
+		int len = qMin(a.size() - offset, size - at);
+		memcpy(data + at, a.constData() + offset, len);
+		at += len;
+		offset = 0;
+	}
+	return at;
+}
+
+int ChunkBuffer::read(char *data, int size)
+{
+	int len = peek(data, size);
+	skip(len);
+	return len;
+}
+
+QByteArray ChunkBuffer::take(int size)
+{
+	if(size < 0 || size > _size)
+		size = _size;
+	if(size == 0)
+		return QByteArray();
+
+	// a whole chunk at the front is handed out as is
+	if(_offset == 0 && _chunks.first().size() == size)
+	{
+		_size -= size;
+		return _chunks.takeFirst();
+	}
+
+	QByteArray a;
+	a.resize(size);
+	read(a.data(), size);
+	return a;
+}
+
+void ChunkBuffer::skip(int size)
+{
+	if(size > _size)
+		size = _size;
+	_size -= size;
+	while(size > 0)
+	{
+		int left = _chunks.first().size() - _offset;
+		if(size < left)
+		{
+			_offset += size;
+			break;
+		}
+		size -= left;
+		_chunks.removeFirst();
+		_offset = 0;
+	}
+	if(_size == 0)
+		clear();
+}
+
+QByteArray ChunkBuffer::toByteArray() const
+{
+	if(_chunks.count() == 1 && _offset == 0)
+		return _chunks.first();
+
+	QByteArray a;
+	a.resize(_size);
+	peek(a.data(), _size);
+	return a;
+}
+
 //----------------------------------------------------------------------------
 // BigInteger
 //----------------------------------------------------------------------------
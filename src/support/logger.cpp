@@ -20,6 +20,12 @@
 
 #include "qca_support.h"
 
+#include "qca_plugin.h"
+
+#include <QDateTime>
+#include <QMutex>
+#include <QWaitCondition>
+
 namespace QCA {
 
 AbstractLogDevice::AbstractLogDevice(const QString &name, QObject *parent) :
@@ -47,15 +53,235 @@ void AbstractLogDevice::logBinaryMessage( const QByteArray &blob, Logger::Severi
         Q_UNUSED( severity );
 }
 
+void AbstractLogDevice::logRecords( const QList<Logger::Record> &records )
+{
+	for ( int i = 0; i < records.size(); ++i )
+	{
+		const Logger::Record &r = records[i];
+		if ( r.binary )
+			logBinaryMessage( r.blob, r.severity );
+		else
+			logTextMessage( r.message, r.severity );
+	}
+}
+
+//----------------------------------------------------------------------------
+// Logger::Private
+//----------------------------------------------------------------------------
+
+// the asynchronous queue is a bounded ring in which every cell carries a
+//   sequence number, so producers only need one compare-and-swap on the
+//   write position to claim a cell and no lock.  a cell is free for the
+//   producer at position pos when its sequence equals pos, and holds a
+//   message for the consumer when it equals pos + 1.  positions wrap at
+//   32 bits, so they are always compared by difference.
+class Logger::Private : public QThread
+{
+public:
+	class Cell
+	{
+	public:
+		QAtomicInt sequence;
+		Record record;
+	};
+
+	Logger *q;
+	Cell *cells;
+	int mask;
+	QAtomicInt async;
+	QAtomicInt enqueuePos;
+	QAtomicInt dropped;
+	QAtomicInt sleeping;
+	int dequeuePos;      // only used by the logging thread
+
+	QMutex mutex;        // guards the fields below, and the waits
+	QWaitCondition wake;
+	QWaitCondition drained;
+	int delivered;
+	bool stopping;
+
+	// devices may log from inside a device, hence recursive
+	QMutex deviceMutex;
+
+	Private(Logger *_q) : q(_q), cells(0), mask(0), dequeuePos(0), delivered(0), stopping(false), deviceMutex(QMutex::Recursive)
+	{
+	}
+
+	~Private()
+	{
+		delete[] cells;
+	}
+
+	static int diff(int a, int b)
+	{
+		return (int)((quint32)a - (quint32)b);
+	}
+
+	void allocate(int capacity)
+	{
+		int size = 2;
+		while(size < capacity && size < 0x40000000)
+			size *= 2;
+
+		if(size != mask + 1)
+		{
+			delete[] cells;
+			cells = new Cell[size];
+			mask = size - 1;
+		}
+		for(int n = 0; n < size; ++n)
+		{
+			cells[n].sequence.fetchAndStoreRelaxed(n);
+			cells[n].record = Record();
+		}
+		enqueuePos.fetchAndStoreRelaxed(0);
+		dropped.fetchAndStoreRelaxed(0);
+		dequeuePos = 0;
+		delivered = 0;
+		stopping = false;
+	}
+
+	void push(Severity severity, const QString &message, const QByteArray &blob, bool binary)
+	{
+		Cell *c;
+		int pos = atomicLoadAcquire(enqueuePos);
+		while(true)
+		{
+			c = &cells[pos & mask];
+			int d = diff(atomicLoadAcquire(c->sequence), pos);
+			if(d == 0)
+			{
+				if(enqueuePos.testAndSetRelaxed(pos, pos + 1))
+					break;
+			}
+			else if(d < 0)
+			{
+				// full
+				dropped.fetchAndAddRelaxed(1);
+				return;
+			}
+			pos = atomicLoadAcquire(enqueuePos);
+		}
+
+		c->record.severity = severity;
+		c->record.binary = binary;
+		c->record.message = message;
+		c->record.blob = blob;
+		c->record.time = QDateTime::currentMSecsSinceEpoch();
+		c->sequence.fetchAndStoreRelease(pos + 1);
+
+		// the logging thread only sleeps when it found the queue
+		//   empty, so the lock is not taken while it is busy
+		if(sleeping.testAndSetOrdered(1, 0))
+		{
+			QMutexLocker locker(&mutex);
+			wake.wakeOne();
+		}
+	}
+
+	bool ready() const
+	{
+		return diff(atomicLoadAcquire(cells[dequeuePos & mask].sequence), dequeuePos + 1) >= 0;
+	}
+
+	void take(QList<Record> *out, int max)
+	{
+		while(out->size() < max && ready())
+		{
+			Cell *c = &cells[dequeuePos & mask];
+			out->append(c->record);
+			c->record.message = QString();
+			c->record.blob = QByteArray();
+			c->sequence.fetchAndStoreRelease(dequeuePos + mask + 1);
+			++dequeuePos;
+		}
+	}
+
+	void deliver(const QList<Record> &batch)
+	{
+		QMutexLocker locker(&deviceMutex);
+		for(int n = 0; n < q->m_loggers.size(); ++n)
+			q->m_loggers[n]->logRecords(batch);
+	}
+
+	void start_thread(int capacity)
+	{
+		allocate(capacity);
+		start();
+		async.fetchAndStoreRelease(1);
+	}
+
+	void stop_thread()
+	{
+		async.fetchAndStoreRelease(0);
+		{
+			QMutexLocker locker(&mutex);
+			stopping = true;
+			wake.wakeOne();
+		}
+		wait();
+	}
+
+	void flush()
+	{
+		// a device flushing from the logging thread would wait on itself
+		if(!atomicLoadAcquire(async) || QThread::currentThread() == this)
+			return;
+
+		int target = atomicLoadAcquire(enqueuePos);
+		QMutexLocker locker(&mutex);
+		wake.wakeOne();
+		while(diff(delivered, target) < 0)
+			drained.wait(&mutex);
+	}
+
+protected:
+	virtual void run()
+	{
+		QList<Record> batch;
+		while(true)
+		{
+			batch.clear();
+			take(&batch, 256);
+			if(!batch.isEmpty())
+			{
+				deliver(batch);
+
+				QMutexLocker locker(&mutex);
+				delivered = dequeuePos;
+				drained.wakeAll();
+				continue;
+			}
+
+			QMutexLocker locker(&mutex);
+			// only stop once the queue is empty
+			if(stopping)
+				break;
+
+			// a producer that misses the flag is picked up on the
+			//   next timeout at the latest
+			sleeping.fetchAndStoreOrdered(1);
+			if(!ready())
+				wake.wait(&mutex, 100);
+			sleeping.fetchAndStoreOrdered(0);
+		}
+	}
+};
+
+//----------------------------------------------------------------------------
+// Logger
+//----------------------------------------------------------------------------
 Logger::Logger()
+	: m_logLevel(Logger::Notice)
 {
-        // d pointer?
-	m_logLevel = Logger::Notice;
+	d = new Private(this);
 }
 
 Logger::~Logger()
 {
-        // delete d;
+	if(atomicLoadAcquire(d->async))
+		d->stop_thread();
+	delete d;
 }
 
 QStringList Logger::currentLogDevices() const
@@ -65,12 +291,14 @@ QStringList Logger::currentLogDevices() const
 
 void Logger::registerLogDevice(AbstractLogDevice* logger)
 {
+	QMutexLocker locker(&d->deviceMutex);
         m_loggers.append( logger );
         m_loggerNames.append( logger->name() );
 }
 
 void Logger::unregisterLogDevice(const QString &loggerName)
 {
+	QMutexLocker locker(&d->deviceMutex);
         for ( int i = 0; i < m_loggers.size(); ++i )
         {
                 if ( m_loggers[i]->name() == loggerName )
@@ -91,12 +319,18 @@ void Logger::unregisterLogDevice(const QString &loggerName)
 
 void Logger::setLevel (Severity level)
 {
-	m_logLevel = level;
+	m_logLevel.fetchAndStoreRelaxed(level);
 }
 
 void Logger::logTextMessage(const QString &message, Severity severity )
 {
 	if (severity <= level ()) {
+		if (atomicLoadAcquire(d->async)) {
+			d->push(severity, message, QByteArray(), false);
+			return;
+		}
+
+		QMutexLocker locker(&d->deviceMutex);
 		for ( int i = 0; i < m_loggers.size(); ++i )
 		{
 			m_loggers[i]->logTextMessage( message, severity );
@@ -107,6 +341,12 @@ void Logger::logTextMessage(const QString &message, Severity severity )
 void Logger::logBinaryMessage(const QByteArray &blob, Severity severity )
 {
 	if (severity <= level ()) {
+		if (atomicLoadAcquire(d->async)) {
+			d->push(severity, QString(), blob, true);
+			return;
+		}
+
+		QMutexLocker locker(&d->deviceMutex);
 		for ( int i = 0; i < m_loggers.size(); ++i )
 		{
 			m_loggers[i]->logBinaryMessage( blob, severity );
@@ -114,6 +354,27 @@ void Logger::logBinaryMessage(const QByteArray &blob, Severity severity )
 	}
 }
 
+void Logger::setAsynchronous(bool enabled, int capacity)
+{
+	if (atomicLoadAcquire(d->async))
+		d->stop_thread();
+	if (enabled)
+		d->start_thread(capacity);
 }
 
+bool Logger::isAsynchronous() const
+{
+	return atomicLoadAcquire(d->async) != 0;
+}
+
+int Logger::droppedMessages() const
+{
+	return atomicLoadAcquire(d->dropped);
+}
 
+void Logger::flush()
+{
+	d->flush();
+}
+
+}
@@ -2714,11 +2714,12 @@ static void usage()
 	printf("usage: %s (options) [command]\n", EXENAME);
 	printf(" options: --pass=x, --newpass=x, --nonroots=x, --roots=x, --nosys,\n");
 	printf("          --noprompt, --ordered, --debug, --log-file=x, --log-level=n,\n");
-	printf("          --nobundle\n");
+	printf("          --nobundle, --readahead\n");
 	printf("\n");
 	printf(" help|--help|-h                        This help text\n");
 	printf(" version|--version|-v                  Print version information\n");
 	printf(" plugins                               List available plugins\n");
+	printf(" hash [type] [file(s)]                 Print the hash of files\n");
 	printf(" config [command]\n");
 	printf("   save [provider]                     Save default provider config\n");
 	printf("   edit [provider]                     Edit provider config\n");
@@ -2793,6 +2794,7 @@ int main(int argc, char **argv)
 	bool debug = false;
 	bool nosys = false;
 	bool nobundle = false;
+	bool readahead = false;
 	QString rootsFile, nonRootsFile;
 
 	for(int n = 0; n < args.count(); ++n)
@@ -2849,6 +2851,8 @@ int main(int argc, char **argv)
 			nosys = true;
 		else if(var == "nobundle")
 			nobundle = true;
+		else if(var == "readahead")
+			readahead = true;
 		else
 			known = false;
 
@@ -2936,6 +2940,38 @@ int main(int argc, char **argv)
 		return 0;
 	}
 
+	// hash files
+	if(args[0] == "hash")
+	{
+		if(args.count() < 3)
+		{
+			usage();
+			return 1;
+		}
+
+		QString type = args[1];
+		if(!QCA::isSupported(qPrintable(type)))
+		{
+			fprintf(stderr, "Error: need '%s' feature.\n", qPrintable(type));
+			return 1;
+		}
+
+		QCA::Hash hash(type);
+		int ret = 0;
+		for(int n = 2; n < args.count(); ++n)
+		{
+			QCA::MemoryRegion digest = hash.hashFile(args[n], readahead);
+			if(digest.isEmpty())
+			{
+				fprintf(stderr, "Error: can't read file [%s].\n", qPrintable(args[n]));
+				ret = 1;
+				continue;
+			}
+			printf("%s  %s\n", qPrintable(QCA::arrayToHex(digest.toByteArray())), qPrintable(args[n]));
+		}
+		return ret;
+	}
+
 	// config stuff
 	if(args[0] == "config")
 	{
@@ -28,6 +28,10 @@
 #include <QtCrypto>
 #include <QtTest/QtTest>
 
+#ifdef Q_OS_UNIX
+#include <sys/resource.h>
+#endif
+
 #ifdef QT_STATICPLUGIN
 #include "import_plugins.h"
 #endif
@@ -43,6 +47,12 @@ private slots:
     void test1();
     void test2_data();
     void test2();
+    void testLarge();
+    void testLineBreaks();
+    void testWhitespace();
+    void throughputBenchmark_data();
+    void throughputBenchmark();
+    void streamingBenchmark();
 private:
     QCA::Initializer* m_init;
 };
@@ -125,6 +135,208 @@ void Base64UnitTest::test2()
     QCOMPARE( QLatin1String(QCA::base64ToArray(encoded)), raw );
 }
 
+// data long enough for the vector code paths, with every byte value
+static QByteArray testData(int size)
+{
+    QByteArray data(size, 0);
+    for (int n = 0; n < size; ++n)
+	data[n] = (char)((n * 167 + (n >> 8)) & 0xff);
+    return data;
+}
+
+// feed a filter in pieces of the given size
+static QByteArray process(QCA::Base64 *filter, const QByteArray &in, int piece)
+{
+    filter->clear();
+    QByteArray out;
+    for (int at = 0; at < in.size(); at += piece)
+	out += filter->update(in.mid(at, piece)).toByteArray();
+    out += filter->final().toByteArray();
+    return out;
+}
+
+void Base64UnitTest::testLarge()
+{
+    QList<int> sizes;
+    sizes << 11 << 12 << 13 << 47 << 48 << 49 << 100 << 1000 << 4096 << 100001;
+    QList<int> pieces;
+    pieces << 1 << 7 << 64 << 1000000;
+    foreach (int size, sizes) {
+	QByteArray data = testData(size);
+	QByteArray encoded = QCA::Base64().encode(data).toByteArray();
+	QCOMPARE( encoded.size(), (size + 2) / 3 * 4 );
+	QCOMPARE( QCA::Base64().decode(encoded).toByteArray(), data );
+
+	foreach (int piece, pieces) {
+	    QCA::Base64 enc(QCA::Encode);
+	    QCOMPARE( process(&enc, data, piece), encoded );
+	    QCA::Base64 dec(QCA::Decode);
+	    QCOMPARE( process(&dec, encoded, piece), data );
+	    QVERIFY( dec.ok() );
+	}
+
+	// a bad character anywhere must be noticed
+	QByteArray broken = encoded;
+	broken[broken.size() / 2] = '*';
+	QCA::Base64 dec(QCA::Decode);
+	dec.decode(broken);
+	QVERIFY( !dec.ok() );
+    }
+}
+
+void Base64UnitTest::testLineBreaks()
+{
+    QByteArray data = testData(10000);
+    QByteArray plain = QCA::Base64().encode(data).toByteArray();
+
+    QList<int> columns;
+    columns << 1 << 3 << 4 << 64 << 76 << 77;
+    foreach (int column, columns) {
+	QByteArray expected;
+	for (int at = 0; at < plain.size(); at += column) {
+	    expected += plain.mid(at, column);
+	    if (at + column <= plain.size())
+		expected += '\n';
+	}
+
+	QCA::Base64 enc(QCA::Encode);
+	enc.setLineBreaksEnabled(true);
+	enc.setLineBreaksColumn(column);
+	QCOMPARE( process(&enc, data, 1000), expected );
+	QCOMPARE( process(&enc, data, 7), expected );
+
+	QCA::Base64 dec(QCA::Decode);
+	dec.setLineBreaksEnabled(true);
+	QCOMPARE( process(&dec, expected, 1000), data );
+	QCOMPARE( process(&dec, expected, 5), data );
+	QVERIFY( dec.ok() );
+    }
+
+    // without line breaks enabled, they are not valid input
+    QCA::Base64 dec(QCA::Decode);
+    dec.decode(QByteArray("YWJj\nYWJj"));
+    QVERIFY( !dec.ok() );
+}
+
+void Base64UnitTest::testWhitespace()
+{
+    QByteArray data = testData(5000);
+    QByteArray plain = QCA::Base64().encode(data).toByteArray();
+
+    // CRLF line endings, with stray spaces and tabs, some in the
+    //   middle of a group
+    QByteArray messy;
+    for (int at = 0; at < plain.size(); at += 76) {
+	messy += plain.mid(at, 76);
+	messy += (at / 76) % 3 == 0 ? " \t\r\n" : "\r\n";
+    }
+    messy.insert(10, ' ');
+    messy.insert(3, '\t');
+
+    QCA::Base64 dec(QCA::Decode);
+    dec.setLineBreaksEnabled(true);
+    QCOMPARE( process(&dec, messy, 100000), data );
+    QCOMPARE( process(&dec, messy, 3), data );
+    QVERIFY( dec.ok() );
+
+    QCA::Base64 strict(QCA::Decode);
+    strict.decode(messy);
+    QVERIFY( !strict.ok() );
+}
+
+
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("encode");
+    QTest::addColumn<bool>("lineBreaks");
+
+    QTest::newRow("encode 1KB") << 1024 << true << false;
+    QTest::newRow("encode 1MB") << 1024 * 1024 << true << false;
+    QTest::newRow("encode 1MB, line breaks") << 1024 * 1024 << true << true;
+    QTest::newRow("decode 1KB") << 1024 << false << false;
+    QTest::newRow("decode 1MB") << 1024 * 1024 << false << false;
+    QTest::newRow("decode 1MB, line breaks") << 1024 * 1024 << false << true;
+}
+
+void Base64UnitTest::throughputBenchmark()
+{
+    QFETCH( int, size );
+    QFETCH( bool, encode );
+    QFETCH( bool, lineBreaks );
+
+    QCA::Base64 filter(encode ? QCA::Encode : QCA::Decode);
+    filter.setLineBreaksEnabled(lineBreaks);
+    filter.setLineBreaksColumn(64);
+
+    QByteArray data = testData(size);
+    if (!encode) {
+	QCA::Base64 enc;
+	enc.setLineBreaksEnabled(lineBreaks);
+	enc.setLineBreaksColumn(64);
+	data = enc.encode(data).toByteArray();
+    }
+
+    QBENCHMARK {
+	filter.clear();
+	filter.update(data);
+	filter.final();
+    }
+    QVERIFY( filter.ok() );
+}
+
+// the largest resident set size of the process so far, in kilobytes, or
+//   -1 if it isn't known
+static qint64 peakRss()
+{
+#ifdef Q_OS_UNIX
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+	return -1;
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+void Base64UnitTest::streamingBenchmark()
+{
+    // line broken base64, produced and decoded a piece at a time.  4MB by
+    //   default, so that the normal test run stays quick; set
+    //   QCA_LARGE_BENCHMARKS for 256MB.
+    const int pieces = qgetenv("QCA_LARGE_BENCHMARKS").isEmpty() ? 64 : 4096;
+    QByteArray data = testData(64 * 1024);
+
+    QCA::Base64 enc(QCA::Encode);
+    enc.setLineBreaksEnabled(true);
+    enc.setLineBreaksColumn(76);
+    QCA::Base64 dec(QCA::Decode);
+    dec.setLineBreaksEnabled(true);
+
+    qint64 before = peakRss();
+    qint64 total = 0;
+    QBENCHMARK_ONCE {
+	enc.clear();
+	dec.clear();
+	for (int n = 0; n < pieces; ++n) {
+	    QByteArray encoded = enc.update(data).toByteArray();
+	    total += dec.update(encoded).size();
+	}
+	total += dec.update(enc.final()).size();
+	total += dec.final().size();
+    }
+
+    // reported rather than checked: the peak is a high-water mark for the
+    //   whole process, so earlier tests can hide the decoder's own use
+    qDebug() << "peak resident size before:" << before << "KB, after:" << peakRss() << "KB";
+
+    QVERIFY( dec.ok() );
+    QCOMPARE( total, (qint64)pieces * data.size() );
+}
+
 QTEST_MAIN(Base64UnitTest)
 
 #include "base64unittest.moc"
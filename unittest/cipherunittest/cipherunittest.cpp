@@ -497,6 +497,106 @@ void CipherUnitTest::aes128_ctr()
 	}
 }
 
+void CipherUnitTest::aes128_ctr_inplace_data()
+{
+	aes128_ctr_data();
+}
+
+// same as aes128_ctr, but writing over the input
+void CipherUnitTest::aes128_ctr_inplace()
+{
+	QStringList providersToTest;
+	providersToTest.append("qca-ossl");
+	providersToTest.append("qca-gcrypt");
+	providersToTest.append("qca-botan");
+	providersToTest.append("qca-nss");
+
+	foreach(const QString provider, providersToTest) {
+		if( !QCA::isSupported( "aes128-ctr", provider ) )
+			QWARN( QString( "AES128 CTR not supported for "+provider).toLocal8Bit() );
+		else {
+			QFETCH( QString, plainText );
+			QFETCH( QString, cipherText );
+			QFETCH( QString, keyText );
+			QFETCH( QString, ivText );
+
+			QCA::SymmetricKey key( QCA::hexToArray( keyText ) );
+			QCA::InitializationVector iv( QCA::hexToArray( ivText ) );
+			QCA::Cipher forwardCipher( QString( "aes128" ),
+									   QCA::Cipher::CTR,
+									   QCA::Cipher::NoPadding,
+									   QCA::Encode,
+									   key,
+									   iv,
+									   provider);
+
+			// two chunks, the first not a whole number of blocks
+			QByteArray buf = QCA::hexToArray( plainText );
+			int size = buf.size();
+			buf.resize( size + forwardCipher.blockSize() );
+			int len = forwardCipher.update( QCA::MemoryRegionView( buf.constData(), 20 ), buf.data(), buf.size() );
+			QCOMPARE( len, 20 );
+			len = forwardCipher.update( QCA::MemoryRegionView( buf.constData() + 20, size - 20 ), buf.data() + 20, buf.size() - 20 );
+			QCOMPARE( len, size - 20 );
+			QCOMPARE( forwardCipher.final( buf.data() + size, buf.size() - size ), 0 );
+			QVERIFY( forwardCipher.ok() );
+			QCOMPARE( QCA::arrayToHex( buf.left( size ) ), cipherText );
+
+			QCA::Cipher reverseCipher( QString( "aes128" ),
+									   QCA::Cipher::CTR,
+									   QCA::Cipher::NoPadding,
+									   QCA::Decode,
+									   key,
+									   iv,
+									   provider);
+			len = reverseCipher.update( QCA::MemoryRegionView( buf.constData(), size ), buf.data(), buf.size() );
+			QCOMPARE( len, size );
+			QVERIFY( reverseCipher.ok() );
+			QCOMPARE( QCA::arrayToHex( buf.left( size ) ), plainText );
+
+			// too small an output buffer is an error
+			QVERIFY( reverseCipher.update( QCA::MemoryRegionView( buf.constData(), size ), buf.data(), 1 ) < 0 );
+			QVERIFY( !reverseCipher.ok() );
+		}
+	}
+}
+
+void CipherUnitTest::aes128_ctr_buffer_benchmark_data()
+{
+	QTest::addColumn<bool>("callerBuffer");
+
+	QTest::newRow("allocating") << false;
+	QTest::newRow("caller buffer") << true;
+}
+
+void CipherUnitTest::aes128_ctr_buffer_benchmark()
+{
+	QFETCH( bool, callerBuffer );
+
+	if( !QCA::isSupported( "aes128-ctr" ) )
+#if QT_VERSION >= 0x050000
+		QSKIP( "AES128 CTR not supported" );
+#else
+		QSKIP( "AES128 CTR not supported", SkipSingle );
+#endif
+
+	QCA::SymmetricKey key( 16 );
+	QCA::InitializationVector iv( 16 );
+	QCA::Cipher cipher( QString( "aes128" ), QCA::Cipher::CTR, QCA::Cipher::NoPadding, QCA::Encode, key, iv );
+
+	// a stream of 1400 byte packets
+	QByteArray packet( 1400, 'x' );
+	QByteArray out( packet.size() + cipher.blockSize(), 0 );
+	QBENCHMARK {
+		for( int n = 0; n < 1000; ++n ) {
+			if( callerBuffer )
+				cipher.update( QCA::MemoryRegionView( packet ), out.data(), out.size() );
+			else
+				cipher.update( packet );
+		}
+	}
+}
+
 void CipherUnitTest::aes128_gcm_data()
 {
 	QTest::addColumn<QString>("plainText");
@@ -49,6 +49,10 @@ private slots:
 	void aes128_ofb();
 	void aes128_ctr_data();
 	void aes128_ctr();
+	void aes128_ctr_inplace_data();
+	void aes128_ctr_inplace();
+	void aes128_ctr_buffer_benchmark_data();
+	void aes128_ctr_buffer_benchmark();
 	void aes128_gcm_data();
 	void aes128_gcm();
 	void aes128_ccm_data();
@@ -39,6 +39,7 @@ private slots:
     void initTestCase();
     void cleanupTestCase();
     void testInsertRemovePlugin();
+    void testProviderCache();
 
 private:
     QCA::Initializer* m_init;
@@ -106,6 +107,40 @@ void ClientPlugin::testInsertRemovePlugin()
     QVERIFY(provider.isNull());
 }
 
+void ClientPlugin::testProviderCache()
+{
+    QCA::Hash first("sha1");
+    QVERIFY(first.context());
+
+    // the same lookup again must come out of the cache
+    QCA::resetProviderCacheStatistics();
+    QCA::Hash second("sha1");
+    QVERIFY(second.context());
+    QCOMPARE(QCA::providerCacheHits(), 1);
+    QCOMPARE(QCA::providerCacheMisses(), 0);
+
+    // changing the provider list must invalidate the cache
+    QPointer<TestClientProvider> provider = new TestClientProvider;
+    QVERIFY(QCA::insertProvider(provider, 10));
+    QCA::resetProviderCacheStatistics();
+    QCA::Hash third("sha1");
+    QVERIFY(third.context());
+    QCOMPARE(QCA::providerCacheHits(), 0);
+    QCOMPARE(QCA::providerCacheMisses(), 1);
+
+    QCA::setProviderPriority(providerName, 20);
+    QCA::resetProviderCacheStatistics();
+    QCA::Hash fourth("sha1");
+    QVERIFY(fourth.context());
+    QCOMPARE(QCA::providerCacheMisses(), 1);
+
+    QVERIFY(QCA::unloadProvider(providerName));
+    QCA::resetProviderCacheStatistics();
+    QCA::Hash fifth("sha1");
+    QVERIFY(fifth.context());
+    QCOMPARE(QCA::providerCacheMisses(), 1);
+}
+
 QTEST_MAIN(ClientPlugin)
 
 #include "clientplugin.moc"
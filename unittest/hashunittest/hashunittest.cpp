@@ -26,6 +26,7 @@
 #include <QtCrypto>
 #include <QtTest/QtTest>
 #include <QFile>
+#include <QTemporaryFile>
 
 #ifdef QT_STATICPLUGIN
 #include "import_plugins.h"
@@ -45,6 +46,7 @@ private slots:
     void md5test_data();
     void md5test();
     void md5filetest();
+    void hashFileTest();
     void sha0test_data();
     void sha0test();
     void sha0longtest();
@@ -69,6 +71,15 @@ private slots:
     void whirlpooltest_data();
     void whirlpooltest();
     void whirlpoollongtest();
+    void hashManyTest();
+    void treeHashTest();
+    void multiBufferTest_data();
+    void multiBufferTest();
+    void multiBufferBenchmark_data();
+    void multiBufferBenchmark();
+    void contextPoolTest();
+    void contextPoolBenchmark_data();
+    void contextPoolBenchmark();
 private:
     QCA::Initializer* m_init;
 };
@@ -264,6 +275,44 @@ void HashUnitTest::md5filetest()
     }
 }
 
+void HashUnitTest::hashFileTest()
+{
+    if(!QCA::isSupported("md5"))
+#if QT_VERSION >= 0x050000
+	QSKIP("MD5 not supported");
+#else
+	QSKIP("MD5 not supported", SkipSingle);
+#endif
+
+    for(int readAhead = 0; readAhead < 2; ++readAhead) {
+	QCA::Hash hashObj("md5");
+	QCOMPARE( QString( QCA::arrayToHex( hashObj.hashFile("./data/empty", readAhead).toByteArray() ) ),
+		  QString( "d41d8cd98f00b204e9800998ecf8427e" ) );
+	QCOMPARE( QString( QCA::arrayToHex( hashObj.hashFile("./data/twobytes", readAhead).toByteArray() ) ),
+		  QString( "5fc9808ed18e442ab4164c59f151e757" ) );
+	QCOMPARE( QString( QCA::arrayToHex( hashObj.hashFile("./data/twohundredbytes", readAhead).toByteArray() ) ),
+		  QString( "b91c1f114d942520ecdf7e84e580cda3" ) );
+	QVERIFY( hashObj.hashFile("./data/doesnotexist", readAhead).isEmpty() );
+    }
+
+    // big enough to go through several growing read chunks
+    QByteArray data(9 * 1024 * 1024 + 17, 0);
+    for(int n = 0; n < data.size(); ++n)
+	data[n] = (char)(n * 13);
+    QTemporaryFile f;
+    QVERIFY(f.open());
+    QCOMPARE(f.write(data), (qint64)data.size());
+    f.close();
+
+    QByteArray expected = QCA::Hash("md5").hash(data).toByteArray();
+    QCOMPARE(QCA::Hash("md5").hashFile(f.fileName()).toByteArray(), expected);
+    QCOMPARE(QCA::Hash("md5").hashFile(f.fileName(), true).toByteArray(), expected);
+    QVERIFY(f.open());
+    QCA::Hash hashObj("md5");
+    hashObj.update(&f);
+    QCOMPARE(hashObj.final().toByteArray(), expected);
+}
+
 void HashUnitTest::sha0test_data()
 {
     // These are extracted from OpenOffice.org 1.1.2, in sal/workben/t_digest.c
@@ -889,6 +938,242 @@ void HashUnitTest::whirlpoollongtest()
 }
 
 
+void HashUnitTest::hashManyTest()
+{
+    QStringList providersToTest;
+    providersToTest.append("default");
+    providersToTest.append("qca-ossl");
+    providersToTest.append("qca-botan");
+    providersToTest.append("qca-gcrypt");
+    providersToTest.append("qca-nss");
+
+    QList<QCA::MemoryRegion> messages;
+    messages.append(QByteArray(""));
+    messages.append(QByteArray("abc"));
+    messages.append(QByteArray(200, 'x'));
+    messages.append(QCA::SecureArray(QByteArray("message digest")));
+
+    foreach(QString provider, providersToTest) {
+	if(!QCA::isSupported("sha1", provider))
+	    continue;
+
+	QCA::Hash hash("sha1", provider);
+	hash.update(QByteArray("left over"));
+	QList<QCA::MemoryRegion> digests = hash.hashMany(messages);
+	QCOMPARE(digests.count(), messages.count());
+	for(int n = 0; n < messages.count(); ++n)
+	    QCOMPARE(digests[n].toByteArray(), QCA::Hash("sha1", provider).hash(messages[n]).toByteArray());
+
+	// the hash object must be usable afterwards
+	QCOMPARE(hash.hashToString(QByteArray("abc")), QString("a9993e364706816aba3e25717850c26c9cd0d89d"));
+	QVERIFY(hash.hashMany(QList<QCA::MemoryRegion>()).isEmpty());
+    }
+}
+
+void HashUnitTest::treeHashTest()
+{
+    if(!QCA::isSupported("sha256"))
+#if QT_VERSION >= 0x050000
+	QSKIP("SHA256 not supported");
+#else
+	QSKIP("SHA256 not supported", SkipSingle);
+#endif
+
+    // an empty message is a single empty leaf
+    QCA::TreeHash empty("sha256", 64);
+    QCOMPARE(empty.final().toByteArray(), QCA::Hash("sha256").hash(QByteArray(1, 0)).toByteArray());
+    QCOMPARE(empty.leafDigests().count(), 1);
+
+    QByteArray data(1000, 0);
+    for(int n = 0; n < data.size(); ++n)
+	data[n] = (char)(n * 3);
+
+    // build the tree by hand: 63 leaves of 16 bytes, the last one short
+    QList<QByteArray> level;
+    for(int n = 0; n < data.size(); n += 16)
+	level += QCA::Hash("sha256").hash(QByteArray(1, 0) + data.mid(n, 16)).toByteArray();
+    QCOMPARE(level.count(), 63);
+    QList<QByteArray> leaves = level;
+    while(level.count() > 1) {
+	QList<QByteArray> next;
+	for(int n = 0; n + 1 < level.count(); n += 2)
+	    next += QCA::Hash("sha256").hash(QByteArray(1, 1) + level[n] + level[n + 1]).toByteArray();
+	if(level.count() % 2)
+	    next += level.last();
+	level = next;
+    }
+
+    // feed it in pieces that don't line up with the leaves
+    QCA::TreeHash tree("sha256", 16);
+    QCOMPARE(tree.leafSize(), 16);
+    QCOMPARE(tree.type(), QString("sha256"));
+    for(int n = 0; n < data.size(); n += 37)
+	tree.update(data.mid(n, 37));
+    QByteArray root = tree.final().toByteArray();
+    QCOMPARE(root, level.first());
+
+    QList<QCA::MemoryRegion> digests = tree.leafDigests();
+    QCOMPARE(digests.count(), leaves.count());
+    for(int n = 0; n < digests.count(); ++n)
+	QCOMPARE(digests[n].toByteArray(), leaves[n]);
+    QCOMPARE(tree.hashLeaf(data.mid(160, 16)).toByteArray(), leaves[10]);
+    QCOMPARE(tree.rootFromLeaves(digests).toByteArray(), root);
+
+    // same again after a reset, all in one go
+    tree.clear();
+    QCOMPARE(tree.process(data).toByteArray(), root);
+
+    // a message that is an exact number of leaves gets no extra leaf
+    tree.clear();
+    tree.update(data.left(64));
+    tree.final();
+    QCOMPARE(tree.leafDigests().count(), 4);
+}
+
+void HashUnitTest::multiBufferTest_data()
+{
+    QTest::addColumn<QString>("algorithm");
+
+    QTest::newRow("md5") << QString("md5");
+    QTest::newRow("sha1") << QString("sha1");
+}
+
+// the default provider hashes batches of messages side by side, and the
+// padding differs around the block boundaries, so check all the lengths
+// up to a few blocks against hashing one message at a time.
+void HashUnitTest::multiBufferTest()
+{
+    QFETCH(QString, algorithm);
+
+    QList<QCA::MemoryRegion> messages;
+    for(int n = 0; n < 200; ++n) {
+	QByteArray msg(n, 0);
+	for(int i = 0; i < n; ++i)
+	    msg[i] = (char)(n * 7 + i);
+	messages.append(msg);
+    }
+
+    QCA::Hash hash(algorithm, "default");
+    QList<QCA::MemoryRegion> digests = hash.hashMany(messages);
+    QCOMPARE(digests.count(), messages.count());
+    for(int n = 0; n < messages.count(); ++n)
+	QCOMPARE(digests[n].toByteArray(), QCA::Hash(algorithm, "default").hash(messages[n]).toByteArray());
+
+    // a long message fed in pieces that don't line up with the blocks
+    QByteArray big(100000, 0);
+    for(int i = 0; i < big.size(); ++i)
+	big[i] = (char)(i * 31);
+    QCA::Hash piecewise(algorithm, "default");
+    for(int i = 0; i < big.size(); i += 1031)
+	piecewise.update(big.mid(i, 1031));
+    QCOMPARE(piecewise.final().toByteArray(), hash.hash(big).toByteArray());
+    if(QCA::isSupported(algorithm, "qca-ossl"))
+	QCOMPARE(hash.hash(big).toByteArray(), QCA::Hash(algorithm, "qca-ossl").hash(big).toByteArray());
+}
+
+void HashUnitTest::multiBufferBenchmark_data()
+{
+    QTest::addColumn<QString>("algorithm");
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("batched");
+
+    QTest::newRow("md5 64 single") << QString("md5") << 64 << false;
+    QTest::newRow("md5 64 batched") << QString("md5") << 64 << true;
+    QTest::newRow("md5 1024 single") << QString("md5") << 1024 << false;
+    QTest::newRow("md5 1024 batched") << QString("md5") << 1024 << true;
+    QTest::newRow("sha1 64 single") << QString("sha1") << 64 << false;
+    QTest::newRow("sha1 64 batched") << QString("sha1") << 64 << true;
+    QTest::newRow("sha1 1024 single") << QString("sha1") << 1024 << false;
+    QTest::newRow("sha1 1024 batched") << QString("sha1") << 1024 << true;
+}
+
+void HashUnitTest::multiBufferBenchmark()
+{
+    QFETCH(QString, algorithm);
+    QFETCH(int, size);
+    QFETCH(bool, batched);
+
+    QList<QCA::MemoryRegion> messages;
+    for(int n = 0; n < 64; ++n)
+	messages.append(QByteArray(size, (char)n));
+
+    QCA::Hash hash(algorithm, "default");
+    QBENCHMARK {
+	if(batched)
+	    hash.hashMany(messages);
+	else {
+	    for(int n = 0; n < messages.count(); ++n)
+		hash.hash(messages[n]);
+	}
+    }
+}
+
+void HashUnitTest::contextPoolTest()
+{
+    QStringList providersToTest;
+    providersToTest.append("default");
+    providersToTest.append("qca-ossl");
+    providersToTest.append("qca-botan");
+    providersToTest.append("qca-gcrypt");
+    providersToTest.append("qca-nss");
+
+    QCA::setContextPoolSize(4);
+    foreach(QString provider, providersToTest) {
+	if(!QCA::isSupported("sha1", provider))
+	    continue;
+
+	for(int n = 0; n < 3; ++n) {
+	    // leave some state behind in the pooled context
+	    const QCA::Provider::Context *used;
+	    {
+		QCA::Hash hash("sha1", provider);
+		hash.update(QByteArray("garbage"));
+		used = hash.context();
+	    }
+
+	    // the same context comes back, and must not remember it.  only
+	    //   update() and final() are used, as hashToString() would
+	    //   clear it first anyway.
+	    QCA::Hash hash("sha1", provider);
+	    QVERIFY(hash.context());
+	    QVERIFY(hash.context() == used);
+	    hash.update(QByteArray("ab"));
+	    hash.update(QByteArray("c"));
+	    QCOMPARE(QCA::arrayToHex(hash.final().toByteArray()), QString("a9993e364706816aba3e25717850c26c9cd0d89d"));
+	}
+    }
+    QCA::setContextPoolSize(0);
+    QCOMPARE(QCA::contextPoolSize(), 0);
+}
+
+void HashUnitTest::contextPoolBenchmark_data()
+{
+    QTest::addColumn<int>("poolSize");
+
+    QTest::newRow("unpooled") << 0;
+    QTest::newRow("pooled") << 4;
+}
+
+void HashUnitTest::contextPoolBenchmark()
+{
+    QFETCH(int, poolSize);
+
+    if(!QCA::isSupported("sha256"))
+#if QT_VERSION >= 0x050000
+	QSKIP("SHA256 not supported");
+#else
+	QSKIP("SHA256 not supported", SkipSingle);
+#endif
+
+    QByteArray message(64, 'a');
+    QCA::setContextPoolSize(poolSize);
+    QBENCHMARK {
+	for(int n = 0; n < 1000; ++n)
+	    QCA::Hash("sha256").hash(message);
+    }
+    QCA::setContextPoolSize(0);
+}
+
 QTEST_MAIN(HashUnitTest)
 
 #include "hashunittest.moc"
@@ -41,6 +41,9 @@ private slots:
     void testHexString();
     void testIncrementalUpdate();
     void testBrokenInput();
+    void testLarge();
+    void throughputBenchmark_data();
+    void throughputBenchmark();
 private:
     QCA::Initializer* m_init;
 };
@@ -115,6 +118,69 @@ void HexUnitTest::testBrokenInput()
     QCOMPARE(hexObject.ok(), false);
 }
 
+void HexUnitTest::testLarge()
+{
+    QByteArray data(1000, 0);
+    for (int n = 0; n < data.size(); ++n)
+	data[n] = (char)((n * 167 + (n >> 8)) & 0xff);
+
+    QString expected;
+    for (int n = 0; n < data.size(); ++n)
+	expected += QString("%1").arg((uchar)data[n], 2, 16, QChar('0'));
+
+    QCA::Hex hexObject;
+    QCOMPARE( hexObject.arrayToString(data), expected );
+    QCOMPARE( hexObject.stringToArray(expected).toByteArray(), data );
+    QCOMPARE( hexObject.stringToArray(expected.toUpper()).toByteArray(), data );
+
+    // odd sized pieces leave half a byte over each time
+    QByteArray text = expected.toLatin1();
+    hexObject.setup(QCA::Decode);
+    hexObject.clear();
+    QByteArray out;
+    for (int at = 0; at < text.size(); at += 77)
+	out += hexObject.update(text.mid(at, 77)).toByteArray();
+    out += hexObject.final().toByteArray();
+    QVERIFY( hexObject.ok() );
+    QCOMPARE( out, data );
+
+    // a bad digit deep inside the vector part
+    text[500] = 'g';
+    hexObject.setup(QCA::Decode);
+    hexObject.clear();
+    hexObject.update(text);
+    QCOMPARE( hexObject.ok(), false );
+}
+
+void HexUnitTest::throughputBenchmark_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("encode");
+
+    QTest::newRow("encode 1KB") << 1024 << true;
+    QTest::newRow("encode 1MB") << 1024 * 1024 << true;
+    QTest::newRow("decode 1KB") << 1024 << false;
+    QTest::newRow("decode 1MB") << 1024 * 1024 << false;
+}
+
+void HexUnitTest::throughputBenchmark()
+{
+    QFETCH( int, size );
+    QFETCH( bool, encode );
+
+    QByteArray data(size, 'x');
+    if (!encode)
+	data = QCA::Hex().encode(data).toByteArray();
+
+    QCA::Hex hexObject(encode ? QCA::Encode : QCA::Decode);
+    QBENCHMARK {
+	hexObject.clear();
+	hexObject.update(data);
+	hexObject.final();
+    }
+    QVERIFY( hexObject.ok() );
+}
+
 QTEST_MAIN(HexUnitTest)
 
 #include "hexunittest.moc"
@@ -46,6 +46,13 @@ private slots:
     void pbkdf2Tests();
 	void pbkdf2TimeTest();
     void pbkdf2extraTests();
+    void pbkdf2BatchTests();
+    void pbkdf2Benchmark_data();
+    void pbkdf2Benchmark();
+    void scryptTests();
+    void argon2idTests();
+    void memoryHardTimeTest();
+    void calibrationTest();
 private:
     QCA::Initializer* m_init;
 };
@@ -475,6 +482,271 @@ void KDFUnitTest::pbkdf2extraTests()
     }
 }
 
+void KDFUnitTest::pbkdf2BatchTests()
+{
+    QStringList providersToTest;
+    providersToTest.append("qca-ossl");
+    providersToTest.append("qca-gcrypt");
+    providersToTest.append("qca-botan");
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+
+    foreach(QString provider, providersToTest) {
+	if(!QCA::isSupported("pbkdf2(sha1)", provider)) {
+	    QWARN(QString("PBKDF version 2 with SHA1 not supported for "+provider).toLocal8Bit());
+	    continue;
+	}
+
+	// RFC6070, a key of two blocks
+	QCA::SecureArray password("passwordPASSWORDpassword");
+	QCA::InitializationVector salt(QCA::SecureArray("saltSALTsaltSALTsaltSALTsaltSALTsalt"));
+	QCA::PBKDF2 kdf("sha1", provider);
+	QCOMPARE( QCA::arrayToHex(kdf.makeKey(password, salt, 25, 4096).toByteArray()),
+		  QString("3d2eec4fe41c849b80c8d83662c0e44a8b291a964cf2f07038") );
+
+	// split keys and batches must match keys computed one at a time
+	QList<QCA::SecureArray> passwords;
+	for (int n = 0; n < 9; ++n)
+	    passwords += QCA::SecureArray(QByteArray("password") + QByteArray::number(n));
+	QList<QCA::InitializationVector> salts;
+	salts += salt;
+
+	pool->setMaxThreadCount(1);
+	QList<QCA::SymmetricKey> expected;
+	foreach(QCA::SecureArray p, passwords)
+	    expected += kdf.makeKey(p, salt, 100, 1000);
+	pool->setMaxThreadCount(qMax(threads, 4));
+
+	QList<QCA::SymmetricKey> keys = kdf.makeKeys(passwords, salts, 100, 1000);
+	QCOMPARE( keys.count(), passwords.count() );
+	for (int n = 0; n < keys.count(); ++n) {
+	    QCOMPARE( keys[n], expected[n] );
+	    QCOMPARE( kdf.makeKey(passwords[n], salt, 100, 1000), expected[n] );
+	}
+
+	// one password with many salts
+	QList<QCA::InitializationVector> manySalts;
+	for (int n = 0; n < 3; ++n)
+	    manySalts += QCA::InitializationVector(QCA::SecureArray(QByteArray("salt") + QByteArray::number(n)));
+	keys = kdf.makeKeys(passwords.mid(0, 1), manySalts, 45, 10);
+	QCOMPARE( keys.count(), 3 );
+	for (int n = 0; n < 3; ++n)
+	    QCOMPARE( keys[n], kdf.makeKey(passwords[0], manySalts[n], 45, 10) );
+
+	// lists that don't pair up
+	QVERIFY( kdf.makeKeys(passwords, manySalts, 20, 10).isEmpty() );
+	QVERIFY( kdf.makeKeys(QList<QCA::SecureArray>(), salts, 20, 10).isEmpty() );
+
+	pool->setMaxThreadCount(threads);
+    }
+}
+
+void KDFUnitTest::pbkdf2Benchmark_data()
+{
+    QTest::addColumn<QString>("provider");
+    QTest::addColumn<int>("keyLength");
+    QTest::addColumn<int>("passwords");
+    QTest::addColumn<bool>("threaded");
+
+    QStringList providers;
+    providers << "qca-ossl" << "qca-gcrypt" << "qca-botan";
+    foreach(QString provider, providers) {
+	QTest::newRow(QString(provider + " 128 bytes, one thread").toLatin1()) << provider << 128 << 1 << false;
+	QTest::newRow(QString(provider + " 128 bytes, all threads").toLatin1()) << provider << 128 << 1 << true;
+	QTest::newRow(QString(provider + " 32x20 bytes, one thread").toLatin1()) << provider << 20 << 32 << false;
+	QTest::newRow(QString(provider + " 32x20 bytes, all threads").toLatin1()) << provider << 20 << 32 << true;
+    }
+}
+
+void KDFUnitTest::pbkdf2Benchmark()
+{
+    QFETCH(QString, provider);
+    QFETCH(int, keyLength);
+    QFETCH(int, passwords);
+    QFETCH(bool, threaded);
+
+    if(!QCA::isSupported("pbkdf2(sha1)", provider)) {
+#if QT_VERSION >= 0x050000
+	QSKIP("PBKDF version 2 with SHA1 not supported");
+#else
+	QSKIP("PBKDF version 2 with SHA1 not supported", SkipSingle);
+#endif
+    }
+
+    QList<QCA::SecureArray> secrets;
+    for (int n = 0; n < passwords; ++n)
+	secrets += QCA::SecureArray(QByteArray("password") + QByteArray::number(n));
+    QList<QCA::InitializationVector> salts;
+    salts += QCA::InitializationVector(QCA::SecureArray("saltSALTsaltSALT"));
+
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+    if (!threaded)
+	pool->setMaxThreadCount(1);
+
+    QCA::PBKDF2 kdf("sha1", provider);
+    QList<QCA::SymmetricKey> keys;
+    QBENCHMARK {
+	keys = kdf.makeKeys(secrets, salts, keyLength, 20000);
+    }
+    pool->setMaxThreadCount(threads);
+
+    QCOMPARE( keys.count(), passwords );
+}
+
+void KDFUnitTest::scryptTests()
+{
+    if(!QCA::isSupported("scrypt")) {
+#if QT_VERSION >= 0x050000
+	QSKIP("scrypt not supported");
+#else
+	QSKIP("scrypt not supported", SkipSingle);
+#endif
+    }
+
+    // RFC7914, section 12
+    QCA::SCrypt kdf(65536, 16);
+    QCOMPARE( kdf.memoryCost(), 65536u );
+    QCOMPARE( kdf.parallelism(), 16 );
+    QCA::SymmetricKey key = kdf.makeKey(QCA::SecureArray("password"),
+					QCA::InitializationVector(QCA::SecureArray("NaCl")), 64, 1024);
+    QCOMPARE( QCA::arrayToHex(key.toByteArray()),
+	      QString("fdbabe1c9d3472007856e7190d01e9fe7c6ad7cbc8237830e77376634b373162"
+		      "2eaf30d92e22a3886ff109279d9830dac727afb94a83ee6d8360cbdfa2cc0640") );
+
+    // the lanes give the same result however many threads compute them
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+    pool->setMaxThreadCount(1);
+    QCA::SymmetricKey serial = kdf.makeKey(QCA::SecureArray("password"),
+					   QCA::InitializationVector(QCA::SecureArray("NaCl")), 64, 1024);
+    pool->setMaxThreadCount(threads);
+    QCOMPARE( serial, key );
+
+    // N must be a power of 2
+    QVERIFY( kdf.makeKey(QCA::SecureArray("password"),
+			 QCA::InitializationVector(QCA::SecureArray("NaCl")), 64, 1000).isEmpty() );
+}
+
+void KDFUnitTest::argon2idTests()
+{
+    if(!QCA::isSupported("argon2id")) {
+#if QT_VERSION >= 0x050000
+	QSKIP("argon2id not supported");
+#else
+	QSKIP("argon2id not supported", SkipSingle);
+#endif
+    }
+
+    // from the reference implementation's tests
+    QCA::Argon2id kdf(65536, 1);
+    QCA::SymmetricKey key = kdf.makeKey(QCA::SecureArray("password"),
+					QCA::InitializationVector(QCA::SecureArray("somesalt")), 32, 2);
+    QCOMPARE( QCA::arrayToHex(key.toByteArray()),
+	      QString("09316115d5cf24ed5a15a31a3ba326e5cf32edc24702987c02b6566f61913cf7") );
+
+    // several lanes, computed with and without helper threads
+    kdf.setMemoryCost(256);
+    kdf.setParallelism(4);
+    QThreadPool *pool = QThreadPool::globalInstance();
+    int threads = pool->maxThreadCount();
+    pool->setMaxThreadCount(1);
+    QCA::SymmetricKey serial = kdf.makeKey(QCA::SecureArray("password"),
+					   QCA::InitializationVector(QCA::SecureArray("somesalt")), 100, 3);
+    pool->setMaxThreadCount(qMax(threads, 4));
+    QCA::SymmetricKey parallel = kdf.makeKey(QCA::SecureArray("password"),
+					     QCA::InitializationVector(QCA::SecureArray("somesalt")), 100, 3);
+    pool->setMaxThreadCount(threads);
+    QCOMPARE( parallel.size(), 100 );
+    QCOMPARE( parallel, serial );
+
+    // too little memory for the lanes, and too short a salt
+    kdf.setMemoryCost(16);
+    QVERIFY( kdf.makeKey(QCA::SecureArray("password"),
+			 QCA::InitializationVector(QCA::SecureArray("somesalt")), 32, 1).isEmpty() );
+    kdf.setMemoryCost(256);
+    QVERIFY( kdf.makeKey(QCA::SecureArray("password"),
+			 QCA::InitializationVector(QCA::SecureArray("salt")), 32, 1).isEmpty() );
+}
+
+void KDFUnitTest::memoryHardTimeTest()
+{
+    QCA::SecureArray password("secret");
+    QCA::InitializationVector iv(QByteArray("saltsalt"));
+    unsigned int iterationCount;
+
+    if(QCA::isSupported("scrypt")) {
+	QCA::SCrypt kdf(16384);
+	QCA::SymmetricKey key1 = kdf.makeKey(password, iv, 32, 100, &iterationCount);
+	QVERIFY( iterationCount >= 2 && iterationCount <= 16384 );
+	QVERIFY( (iterationCount & (iterationCount - 1)) == 0 );
+	QCOMPARE( key1, kdf.makeKey(password, iv, 32, iterationCount) );
+    }
+
+    if(QCA::isSupported("argon2id")) {
+	QCA::Argon2id kdf(4096, 2);
+	QCA::SymmetricKey key1 = kdf.makeKey(password, iv, 32, 100, &iterationCount);
+	QVERIFY( iterationCount >= 1 );
+	QCOMPARE( key1, kdf.makeKey(password, iv, 32, iterationCount) );
+    }
+}
+
+void KDFUnitTest::calibrationTest()
+{
+    if(!QCA::isSupported("pbkdf2(sha1)")) {
+#if QT_VERSION >= 0x050000
+	QSKIP("PBKDF version 2 with SHA1 not supported");
+#else
+	QSKIP("PBKDF version 2 with SHA1 not supported", SkipSingle);
+#endif
+    }
+
+    QTemporaryFile file;
+    QVERIFY( file.open() );
+    QString profile = file.fileName();
+    file.close();
+
+    QCA::KeyDerivationFunction::clearCalibration();
+    QCA::KeyDerivationFunction::setCalibrationProfile(profile);
+    QCOMPARE( QCA::KeyDerivationFunction::calibrationProfile(), profile );
+
+    QCA::SecureArray password("secret");
+    QCA::InitializationVector iv(QByteArray("salt"));
+    QCA::PBKDF2 kdf;
+    unsigned int count1, count2;
+    QCA::SymmetricKey key1 = kdf.makeKey(password, iv, 40, 100, &count1);
+    QVERIFY( count1 >= 1 );
+    QCOMPARE( key1, kdf.makeKey(password, iv, 40, count1) );
+
+    // the measurement went into the profile
+    {
+	QSettings settings(profile, QSettings::IniFormat);
+	settings.beginGroup("kdf");
+	QVERIFY( !settings.allKeys().isEmpty() );
+    }
+
+    // a fresh process would load it again, and get the same answer
+    //   without measuring
+    QCA::KeyDerivationFunction::setCalibrationProfile(QString());
+    QCA::KeyDerivationFunction::clearCalibration();
+    QCA::KeyDerivationFunction::setCalibrationProfile(profile);
+    kdf.makeKey(password, iv, 40, 100, &count2);
+    QVERIFY( qAbs((qint64)count2 - (qint64)count1) <= (qint64)count1 / 1000 + 1 );
+
+    // longer keys get fewer iterations for the same time
+    kdf.makeKey(password, iv, 20, 100, &count2);
+    QVERIFY( count2 >= count1 );
+
+    QCA::KeyDerivationFunction::clearCalibration();
+    {
+	QSettings settings(profile, QSettings::IniFormat);
+	settings.beginGroup("kdf");
+	QVERIFY( settings.allKeys().isEmpty() );
+    }
+    QCA::KeyDerivationFunction::setCalibrationProfile(QString());
+}
+
 QTEST_MAIN(KDFUnitTest)
 
 #include "kdfunittest.moc"
@@ -25,11 +25,113 @@
 
 #include <QtCrypto>
 #include <QtTest/QtTest>
+#include <qcaprovider.h>
 
 #ifdef QT_STATICPLUGIN
 #include "import_plugins.h"
 #endif
 
+Q_DECLARE_METATYPE(QCA::KeyStoreEntry)
+Q_DECLARE_METATYPE(QList<QCA::KeyStoreEntry>)
+
+// a store held in memory, that the test changes from its own thread while
+//   the key store thread reads it
+static QMutex s_storeMutex;
+static QMap<QString, QString> s_storeEntries; // id to name
+static QAtomicInt s_entryListCalls;
+
+class TestEntryContext : public QCA::KeyStoreEntryContext
+{
+public:
+    QString _id, _name;
+
+    TestEntryContext(QCA::Provider *p, const QString &id, const QString &name)
+	: QCA::KeyStoreEntryContext(p), _id(id), _name(name)
+    {
+    }
+
+    QCA::Provider::Context *clone() const { return new TestEntryContext(*this); }
+    QCA::KeyStoreEntry::Type type() const { return QCA::KeyStoreEntry::TypeCertificate; }
+    QString id() const { return _id; }
+    QString name() const { return _name; }
+    QString storeId() const { return "test store"; }
+    QString storeName() const { return "Test Store"; }
+    QString serialize() const { return "test:" + _id + ':' + _name; }
+};
+
+class TestListContext : public QCA::KeyStoreListContext
+{
+    Q_OBJECT
+public:
+    static TestListContext *self;
+
+    TestListContext(QCA::Provider *p) : QCA::KeyStoreListContext(p) { self = this; }
+    ~TestListContext() { self = 0; }
+
+    QCA::Provider::Context *clone() const { return 0; }
+    QList<int> keyStores() { return QList<int>() << 0; }
+    QCA::KeyStore::Type type(int) const { return QCA::KeyStore::User; }
+    QString storeId(int) const { return "test store"; }
+    QString name(int) const { return "Test Store"; }
+
+    QList<QCA::KeyStoreEntry::Type> entryTypes(int) const
+    {
+	return QList<QCA::KeyStoreEntry::Type>() << QCA::KeyStoreEntry::TypeCertificate;
+    }
+
+    QList<QCA::KeyStoreEntryContext*> entryList(int)
+    {
+	s_entryListCalls.ref();
+	QMutexLocker locker(&s_storeMutex);
+	QList<QCA::KeyStoreEntryContext*> out;
+	QMap<QString, QString>::const_iterator it;
+	for (it = s_storeEntries.constBegin(); it != s_storeEntries.constEnd(); ++it)
+	    out += new TestEntryContext(provider(), it.key(), it.value());
+	return out;
+    }
+
+    // called from the test thread, the signal is queued to the key store
+    //   thread
+    void changed()
+    {
+	emit storeUpdated(0);
+    }
+};
+
+TestListContext *TestListContext::self = 0;
+
+class TestStoreProvider : public QCA::Provider
+{
+public:
+    int qcaVersion() const { return QCA_VERSION; }
+    QString name() const { return "testKeyStoreProvider"; }
+    QStringList features() const { return QStringList() << "keystorelist"; }
+
+    Context *createContext(const QString &type)
+    {
+	if (type == "keystorelist")
+	    return new TestListContext(this);
+	return 0;
+    }
+};
+
+static int entryListCalls()
+{
+#if QT_VERSION >= 0x050000
+    return s_entryListCalls.load();
+#else
+    return s_entryListCalls;
+#endif
+}
+
+static QStringList entryIds(const QList<QCA::KeyStoreEntry> &list)
+{
+    QStringList out;
+    foreach (const QCA::KeyStoreEntry &e, list)
+	out += e.id();
+    return out;
+}
+
 class KeyStore : public QObject
 {
   Q_OBJECT
@@ -38,6 +140,8 @@ private slots:
     void initTestCase();
     void cleanupTestCase();
     void nullKeystore();
+    void testEntryIndex();
+    void entryListBenchmark();
 private:
     QCA::Initializer* m_init;
 };
@@ -45,6 +149,11 @@ private:
 void KeyStore::initTestCase()
 {
     m_init = new QCA::Initializer;
+
+    for (int n = 0; n < 2000; ++n)
+	s_storeEntries.insert(QString("e%1").arg(n, 4, 10, QChar('0')), QString("entry %1").arg(n));
+    QCA::insertProvider(new TestStoreProvider);
+    qRegisterMetaType< QList<QCA::KeyStoreEntry> >();
 }
 
 void KeyStore::cleanupTestCase()
@@ -71,6 +180,75 @@ void KeyStore::nullKeystore()
     }
 }
 
+void KeyStore::testEntryIndex()
+{
+    QCA::KeyStoreManager::start("testKeyStoreProvider");
+    QCA::KeyStoreManager manager;
+    manager.waitForBusyFinished();
+
+    QCA::KeyStore store("test store", &manager);
+    QVERIFY( store.isValid() );
+    QVERIFY( TestListContext::self );
+
+    // the provider is asked once, however often the list is read
+    int calls = entryListCalls();
+    QList<QCA::KeyStoreEntry> list = store.entryList();
+    QCOMPARE( list.count(), 2000 );
+    for (int n = 0; n < 10; ++n)
+	QCOMPARE( store.entryList().count(), 2000 );
+    QCOMPARE( entryListCalls(), calls + 1 );
+
+    // changes arrive as a delta, and the unchanged entries are kept
+    QSignalSpy changedSpy(&store, SIGNAL(entriesChanged(const QList<QCA::KeyStoreEntry> &, const QList<QCA::KeyStoreEntry> &, const QStringList &)));
+    QSignalSpy updatedSpy(&store, SIGNAL(updated()));
+    s_storeMutex.lock();
+    s_storeEntries.insert("new", "new entry");
+    s_storeEntries.remove("e0001");
+    s_storeEntries.insert("e0002", "renamed");
+    s_storeMutex.unlock();
+    TestListContext::self->changed();
+
+    QElapsedTimer timer;
+    timer.start();
+    while (updatedSpy.isEmpty() && timer.elapsed() < 5000)
+	QTest::qWait(10);
+    QCOMPARE( updatedSpy.count(), 1 );
+    QCOMPARE( changedSpy.count(), 1 );
+
+    QList<QVariant> args = changedSpy.takeFirst();
+    QList<QCA::KeyStoreEntry> added = qvariant_cast< QList<QCA::KeyStoreEntry> >(args[0]);
+    QList<QCA::KeyStoreEntry> changed = qvariant_cast< QList<QCA::KeyStoreEntry> >(args[1]);
+    QStringList removed = args[2].toStringList();
+    QCOMPARE( entryIds(added), QStringList() << "new" );
+    QCOMPARE( entryIds(changed), QStringList() << "e0002" );
+    QCOMPARE( changed.first().name(), QString("renamed") );
+    QCOMPARE( removed, QStringList() << "e0001" );
+
+    calls = entryListCalls();
+    QList<QCA::KeyStoreEntry> after = store.entryList();
+    QCOMPARE( entryListCalls(), calls );
+    QCOMPARE( after.count(), 2000 );
+    QVERIFY( entryIds(after).contains("new") );
+    QVERIFY( !entryIds(after).contains("e0001") );
+}
+
+void KeyStore::entryListBenchmark()
+{
+    QCA::KeyStoreManager::start("testKeyStoreProvider");
+    QCA::KeyStoreManager manager;
+    manager.waitForBusyFinished();
+
+    QCA::KeyStore store("test store", &manager);
+    QVERIFY( store.isValid() );
+    store.entryList();
+
+    int count = 0;
+    QBENCHMARK {
+	count += store.entryList().count();
+    }
+    QVERIFY( count > 0 );
+}
+
 QTEST_MAIN(KeyStore)
 
 #include "keystore.moc"
@@ -25,6 +25,7 @@
 
 #include <QtCrypto>
 #include <QtTest/QtTest>
+#include <QSemaphore>
 
 #ifdef QT_STATICPLUGIN
 #include "import_plugins.h"
@@ -42,6 +43,9 @@ private slots:
     void logText2();
     void logBlob();
     void logLevel();
+    void asyncLogging();
+    void asyncDrops();
+    void filteredLogBenchmark();
 private:
     QCA::Initializer* m_init;
 };
@@ -104,6 +108,60 @@ private:
     QCA::Logger::Severity m_blobSeverity;
 };
 
+class BatchLogger : public QCA::AbstractLogDevice
+{
+public:
+    BatchLogger() : QCA::AbstractLogDevice( "batch logger" ), m_batches( 0 ), m_hold( false )
+    {}
+
+    ~BatchLogger()
+    {}
+
+    // blocks the logging thread in the first batch until release() is called
+    void hold()
+    {
+        m_hold = true;
+    }
+
+    void waitForHold()
+    {
+        m_entered.acquire();
+    }
+
+    void release()
+    {
+        m_resume.release();
+    }
+
+    void logRecords( const QList<QCA::Logger::Record> &records )
+    {
+        m_records += records;
+        ++m_batches;
+        if ( m_hold ) {
+            m_hold = false;
+            m_entered.release();
+            m_resume.acquire();
+        }
+    }
+
+    QList<QCA::Logger::Record> records() const
+    {
+        return m_records;
+    }
+
+    int batches() const
+    {
+        return m_batches;
+    }
+
+private:
+    QList<QCA::Logger::Record> m_records;
+    int m_batches;
+    volatile bool m_hold;
+    QSemaphore m_entered;
+    QSemaphore m_resume;
+};
+
 void LoggerUnitTest::initTestCase()
 {
     m_init = new QCA::Initializer;
@@ -287,6 +345,97 @@ void LoggerUnitTest::logLevel()
     delete lastlogger;
 }
 
+void LoggerUnitTest::asyncLogging()
+{
+    QCA::Logger *logSystem = QCA::logger();
+
+    BatchLogger *batchlogger = new BatchLogger;
+    logSystem->registerLogDevice( batchlogger );
+    logSystem->setLevel (QCA::Logger::Debug);
+
+    logSystem->setAsynchronous( true, 1024 );
+    QVERIFY( logSystem->isAsynchronous() );
+
+    QByteArray test( "abcd\x34" );
+    for ( int i = 0; i < 500; ++i ) {
+        QCA_logTextMessage ( QString::number( i ), QCA::Logger::Information );
+        if ( i % 100 == 0 )
+            logSystem->logBinaryMessage( test, QCA::Logger::Critical );
+    }
+    logSystem->flush();
+
+    QList<QCA::Logger::Record> records = batchlogger->records();
+    QCOMPARE( records.count(), 505 );
+    QCOMPARE( logSystem->droppedMessages(), 0 );
+    QVERIFY( batchlogger->batches() >= 1 );
+
+    // order is kept, and binary messages are passed as such
+    int text = 0;
+    for ( int i = 0; i < records.count(); ++i ) {
+        if ( records[i].binary ) {
+            QCOMPARE( records[i].blob, test );
+            QCOMPARE( records[i].severity, QCA::Logger::Critical );
+        }
+        else {
+            QCOMPARE( records[i].message, QString::number( text++ ) );
+            QCOMPARE( records[i].severity, QCA::Logger::Information );
+        }
+    }
+    QCOMPARE( text, 500 );
+
+    logSystem->setAsynchronous( false );
+    QVERIFY( !logSystem->isAsynchronous() );
+
+    logSystem->unregisterLogDevice( "batch logger" );
+    QCOMPARE( logSystem->currentLogDevices().count(), 0 );
+    delete batchlogger;
+}
+
+void LoggerUnitTest::asyncDrops()
+{
+    QCA::Logger *logSystem = QCA::logger();
+
+    BatchLogger *batchlogger = new BatchLogger;
+    logSystem->registerLogDevice( batchlogger );
+    logSystem->setLevel (QCA::Logger::Debug);
+
+    // hold the logging thread inside the first batch, so that the queue
+    //   fills up behind it
+    batchlogger->hold();
+    logSystem->setAsynchronous( true, 16 );
+    logSystem->logTextMessage( "first" );
+    batchlogger->waitForHold();
+
+    for ( int i = 0; i < 100; ++i )
+        logSystem->logTextMessage( QString::number( i ) );
+    QCOMPARE( logSystem->droppedMessages(), 100 - 16 );
+
+    batchlogger->release();
+    logSystem->flush();
+
+    QList<QCA::Logger::Record> records = batchlogger->records();
+    QCOMPARE( records.count(), 1 + 16 );
+    QCOMPARE( records.first().message, QString( "first" ) );
+    QCOMPARE( records.last().message, QString( "15" ) );
+
+    logSystem->setAsynchronous( false );
+    logSystem->unregisterLogDevice( "batch logger" );
+    delete batchlogger;
+}
+
+void LoggerUnitTest::filteredLogBenchmark()
+{
+    QCA::Logger *logSystem = QCA::logger();
+    logSystem->setLevel (QCA::Logger::Error);
+
+    QBENCHMARK {
+        for ( int i = 0; i < 100000; ++i )
+            QCA_logTextMessage ( QString::number( i ), QCA::Logger::Debug );
+    }
+
+    logSystem->setLevel (QCA::Logger::Debug);
+}
+
 QTEST_MAIN(LoggerUnitTest)
 
 #include "loggerunittest.moc"
@@ -0,0 +1,237 @@
+/**
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright
+ *   notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *   notice, this list of conditions and the following disclaimer in the
+ *   documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <QtCrypto>
+#include <QtTest/QtTest>
+
+#ifdef QT_STATICPLUGIN
+#include "import_plugins.h"
+#endif
+
+class RandomThread : public QThread
+{
+public:
+    RandomThread(int iterations) : m_iterations(iterations), m_ok(true) {}
+
+    bool ok() const { return m_ok; }
+
+protected:
+    void run()
+    {
+	for (int n = 0; n < m_iterations; ++n) {
+	    if (QCA::Random::randomArray(16).size() != 16)
+		m_ok = false;
+	    QCA::Random::randomInt();
+	}
+    }
+
+private:
+    int m_iterations;
+    bool m_ok;
+};
+
+static bool runThreads(int threads, int iterations)
+{
+    QList<RandomThread*> list;
+    for (int n = 0; n < threads; ++n)
+	list += new RandomThread(iterations);
+    foreach (RandomThread *t, list)
+	t->start();
+    bool ok = true;
+    foreach (RandomThread *t, list) {
+	t->wait();
+	if (!t->ok())
+	    ok = false;
+    }
+    qDeleteAll(list);
+    return ok;
+}
+
+class RandomUnitTest : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void initTestCase();
+    void cleanupTestCase();
+    void testStatic();
+    void testBuffered();
+    void testThreads();
+    void testDefaultProvider();
+    void defaultBenchmark_data();
+    void defaultBenchmark();
+    void contentionBenchmark_data();
+    void contentionBenchmark();
+
+private:
+    QCA::Initializer* m_init;
+};
+
+void RandomUnitTest::initTestCase()
+{
+    m_init = new QCA::Initializer;
+}
+
+void RandomUnitTest::cleanupTestCase()
+{
+    QCA::Random::setBufferSize(0);
+    delete m_init;
+}
+
+void RandomUnitTest::testStatic()
+{
+    QCOMPARE( QCA::Random::bufferSize(), 0 );
+
+    QCOMPARE( QCA::Random::randomArray(0).size(), 0 );
+    QCOMPARE( QCA::Random::randomArray(1).size(), 1 );
+    QCOMPARE( QCA::Random::randomArray(1000).size(), 1000 );
+
+    // 32 bytes coming out identical twice would mean a broken generator
+    QVERIFY( QCA::Random::randomArray(32) != QCA::Random::randomArray(32) );
+
+    QCA::Random rng;
+    QCOMPARE( rng.nextBytes(20).size(), 20 );
+}
+
+void RandomUnitTest::testBuffered()
+{
+    QCA::Random::setBufferSize(-5);
+    QCOMPARE( QCA::Random::bufferSize(), 0 );
+
+    QCA::Random::setBufferSize(256);
+    QCOMPARE( QCA::Random::bufferSize(), 256 );
+
+    // requests spanning a refill, and requests bigger than the buffer
+    QList<QCA::SecureArray> seen;
+    for (int n = 0; n < 40; ++n) {
+	QCA::SecureArray a = QCA::Random::randomArray(24);
+	QCOMPARE( a.size(), 24 );
+	QVERIFY( !seen.contains(a) );
+	seen += a;
+    }
+    QCOMPARE( QCA::Random::randomArray(1000).size(), 1000 );
+    QCOMPARE( QCA::Random::randomArray(256).size(), 256 );
+
+    QCA::Random::setBufferSize(0);
+    QCOMPARE( QCA::Random::bufferSize(), 0 );
+    QCOMPARE( QCA::Random::randomArray(24).size(), 24 );
+}
+
+void RandomUnitTest::testThreads()
+{
+    QVERIFY( runThreads(8, 1000) );
+
+    QCA::Random::setBufferSize(4096);
+    QVERIFY( runThreads(8, 1000) );
+    QCA::Random::setBufferSize(0);
+
+    // generators of finished threads must not break the next user
+    QCOMPARE( QCA::Random::randomArray(16).size(), 16 );
+}
+
+void RandomUnitTest::testDefaultProvider()
+{
+    QCA::Random rng("default");
+    QCOMPARE( rng.provider()->name(), QString("default") );
+
+    // sizes around the block and key boundaries of the generator
+    QList<int> sizes;
+    sizes << 0 << 1 << 31 << 32 << 33 << 63 << 64 << 65 << 1000 << 100000;
+    foreach (int size, sizes) {
+	QCA::SecureArray a = rng.nextBytes(size);
+	QCOMPARE( a.size(), size );
+	if (size >= 16)
+	    QVERIFY( a != rng.nextBytes(size) );
+    }
+
+    // a second generator must not repeat the first
+    QCA::Random other("default");
+    QVERIFY( rng.nextBytes(32) != other.nextBytes(32) );
+
+    // all byte values should turn up in a large sample
+    QCA::SecureArray big = rng.nextBytes(65536);
+    QVector<int> counts(256, 0);
+    for (int n = 0; n < big.size(); ++n)
+	++counts[(uchar)big[n]];
+    for (int n = 0; n < 256; ++n)
+	QVERIFY( counts[n] > 0 );
+}
+
+void RandomUnitTest::defaultBenchmark_data()
+{
+    QTest::addColumn<int>("size");
+
+    QTest::newRow("16 bytes") << 16;
+    QTest::newRow("1 KiB") << 1024;
+    QTest::newRow("1 MiB") << 1048576;
+    QTest::newRow("16 MiB") << 16777216;
+}
+
+void RandomUnitTest::defaultBenchmark()
+{
+    QFETCH( int, size );
+
+    QCA::Random rng("default");
+    QBENCHMARK {
+	rng.nextBytes(size);
+    }
+}
+
+void RandomUnitTest::contentionBenchmark_data()
+{
+    QTest::addColumn<int>("threads");
+    QTest::addColumn<int>("bufferSize");
+
+    QTest::newRow("1 thread") << 1 << 0;
+    QTest::newRow("2 threads") << 2 << 0;
+    QTest::newRow("4 threads") << 4 << 0;
+    QTest::newRow("8 threads") << 8 << 0;
+    QTest::newRow("16 threads") << 16 << 0;
+    QTest::newRow("32 threads") << 32 << 0;
+    QTest::newRow("64 threads") << 64 << 0;
+    QTest::newRow("1 thread, buffered") << 1 << 4096;
+    QTest::newRow("8 threads, buffered") << 8 << 4096;
+    QTest::newRow("64 threads, buffered") << 64 << 4096;
+}
+
+void RandomUnitTest::contentionBenchmark()
+{
+    QFETCH( int, threads );
+    QFETCH( int, bufferSize );
+
+    QCA::Random::setBufferSize(bufferSize);
+
+    // the same total amount of work for each row
+    int iterations = 64000 / threads;
+    bool ok = true;
+    QBENCHMARK {
+	if (!runThreads(threads, iterations))
+	    ok = false;
+    }
+    QCA::Random::setBufferSize(0);
+    QVERIFY( ok );
+}
+
+QTEST_MAIN(RandomUnitTest)
+
+#include "randomunittest.moc"
@@ -30,6 +30,53 @@
 #include "import_plugins.h"
 #endif
 
+// allocates and frees secure buffers of mixed sizes, keeping a few alive
+//   at a time, and checks that none of them is handed out twice
+class AllocThread : public QThread
+{
+public:
+    AllocThread(int iterations) : m_iterations(iterations), m_ok(true) {}
+
+    bool ok() const { return m_ok; }
+
+protected:
+    void run()
+    {
+	static const int sizes[] = { 16, 32, 48, 100, 256, 700, 2000, 5000 };
+	QCA::SecureArray live[8];
+	for (int n = 0; n < m_iterations; ++n) {
+	    int slot = n % 8;
+	    char mark = (char)(n & 0x7f);
+	    if (!live[slot].isEmpty() && live[slot][0] != live[slot][live[slot].size() - 1])
+		m_ok = false;
+	    live[slot] = QCA::SecureArray(sizes[(n * 7) % 8]);
+	    live[slot][0] = mark;
+	    live[slot][live[slot].size() - 1] = mark;
+	}
+    }
+
+private:
+    int m_iterations;
+    bool m_ok;
+};
+
+static bool runThreads(int threads, int iterations)
+{
+    QList<AllocThread*> list;
+    for (int n = 0; n < threads; ++n)
+	list += new AllocThread(iterations);
+    foreach (AllocThread *t, list)
+	t->start();
+    bool ok = true;
+    foreach (AllocThread *t, list) {
+	t->wait();
+	if (!t->ok())
+	    ok = false;
+    }
+    qDeleteAll(list);
+    return ok;
+}
+
 class SecureArrayUnitTest : public QObject
 {
     Q_OBJECT
@@ -38,6 +85,13 @@ private slots:
     void initTestCase();
     void cleanupTestCase();
     void testAll();
+    void testView();
+    void testChunkBuffer();
+    void testResize();
+    void testThreads();
+    void testStats();
+    void allocationBenchmark_data();
+    void allocationBenchmark();
 
 private:
     QCA::Initializer* m_init;
@@ -145,6 +199,218 @@ void SecureArrayUnitTest::testAll()
     QVERIFY( (secureArray[0] == (char)0x63) );
 }
 
+void SecureArrayUnitTest::testView()
+{
+    QByteArray bytes("0123456789");
+    QCA::MemoryRegionView view(bytes);
+    QCOMPARE( view.size(), 10 );
+    QVERIFY( view.data() == bytes.constData() );
+    QVERIFY( !view.isSecure() );
+    QCOMPARE( view.mid(3, 4).toByteArray(), QByteArray("3456") );
+    QCOMPARE( view.mid(8).toByteArray(), QByteArray("89") );
+    QCOMPARE( view.mid(8, 100).size(), 2 );
+    QVERIFY( view.mid(20).isEmpty() );
+    QVERIFY( QCA::MemoryRegionView().isEmpty() );
+
+    QCA::SecureArray secureArray(bytes);
+    QCA::MemoryRegionView secureView(secureArray);
+    QCOMPARE( secureView.isSecure(), secureArray.isSecure() );
+    QVERIFY( secureView.data() == secureArray.constData() );
+
+    // views must give the same results as copies, and leave the data alone
+    if ( QCA::isSupported("sha1") ) {
+	QCA::Hash hash("sha1");
+	hash.update( view.mid(0, 5) );
+	hash.update( view.mid(5) );
+	QCOMPARE( hash.final().toByteArray(), QCA::Hash("sha1").hash(bytes).toByteArray() );
+	QCOMPARE( bytes, QByteArray("0123456789") );
+    }
+    if ( QCA::isSupported("aes128-cbc-pkcs7") ) {
+	QCA::SymmetricKey key(16);
+	QCA::InitializationVector iv(16);
+	QCA::Cipher cipher("aes128", QCA::Cipher::CBC, QCA::Cipher::DefaultPadding, QCA::Encode, key, iv);
+	QByteArray out = cipher.update( view ).toByteArray();
+	out += cipher.final().toByteArray();
+	QCOMPARE( out, QCA::Cipher("aes128", QCA::Cipher::CBC, QCA::Cipher::DefaultPadding, QCA::Encode, key, iv).process(bytes).toByteArray() );
+    }
+}
+
+void SecureArrayUnitTest::testChunkBuffer()
+{
+    QByteArray a("0123456789");
+    QByteArray b("abcdef");
+
+    QCA::ChunkBuffer buf;
+    QVERIFY( buf.isEmpty() );
+    buf.append( a );
+    buf.append( QByteArray() );
+    buf.append( b );
+    QCOMPARE( buf.size(), 16 );
+    QCOMPARE( buf.chunkCount(), 2 );
+
+    // chunks are shared, not copied
+    QVERIFY( buf.chunk(0).data() == a.constData() );
+    QVERIFY( buf.chunk(1).data() == b.constData() );
+
+    char block[16];
+    QCOMPARE( buf.peek(block, 4), 4 );
+    QCOMPARE( QByteArray(block, 4), QByteArray("0123") );
+    QCOMPARE( buf.size(), 16 );
+
+    // reads cross chunk boundaries
+    QCOMPARE( buf.read(block, 12), 12 );
+    QCOMPARE( QByteArray(block, 12), QByteArray("0123456789ab") );
+    QCOMPARE( buf.size(), 4 );
+    QCOMPARE( buf.chunkCount(), 1 );
+    QCOMPARE( buf.chunk(0).toByteArray(), QByteArray("cdef") );
+
+    QCA::ChunkBuffer other(a);
+    other.append( buf );
+    QCOMPARE( other.toByteArray(), QByteArray("0123456789cdef") );
+
+    // a whole chunk at the front is taken without a copy
+    QByteArray whole = other.take(10);
+    QCOMPARE( whole, a );
+    QVERIFY( whole.constData() == a.constData() );
+    other.skip(1);
+    QCOMPARE( other.take(), QByteArray("def") );
+    QVERIFY( other.isEmpty() );
+
+    QCOMPARE( buf.read(block, sizeof(block)), 4 );
+    QVERIFY( buf.isEmpty() );
+    QCOMPARE( buf.read(block, sizeof(block)), 0 );
+    QVERIFY( buf.take().isEmpty() );
+
+    // the source arrays are left alone
+    QCOMPARE( a, QByteArray("0123456789") );
+    QCOMPARE( b, QByteArray("abcdef") );
+}
+
+void SecureArrayUnitTest::testResize()
+{
+    // growing and shrinking within and across the allocator size classes
+    QCA::SecureArray array(10);
+    array.fill('a');
+    QList<int> sizes;
+    sizes << 20 << 50 << 60 << 64 << 100 << 3000 << 4096 << 10000 << 100 << 5 << 0 << 30;
+    int prev = 10;
+    foreach (int size, sizes) {
+	array.resize(size);
+	QCOMPARE( array.size(), size );
+	for (int n = 0; n < size; ++n) {
+	    if (n < prev)
+		QCOMPARE( array[n], 'a' );
+	    else
+		QCOMPARE( array[n], (char)0 );
+	}
+	array.fill('a');
+	prev = size;
+    }
+
+    // shrinking then growing again must not bring back the old bytes
+    QCA::SecureArray shrink(40);
+    shrink.fill('x');
+    shrink.resize(8);
+    shrink.resize(40);
+    QCOMPARE( shrink.toByteArray(), QByteArray(8, 'x') + QByteArray(32, 0) );
+
+    // the raw functions used by the gcrypt plugin
+    char *p = (char *)qca_secure_realloc(0, 10);
+    QVERIFY( p != 0 );
+    memset(p, 'b', 10);
+    p = (char *)qca_secure_realloc(p, 40);
+    QCOMPARE( QByteArray(p, 10), QByteArray(10, 'b') );
+    memset(p, 'c', 40);
+    p = (char *)qca_secure_realloc(p, 6000);
+    QCOMPARE( QByteArray(p, 40), QByteArray(40, 'c') );
+    p = (char *)qca_secure_realloc(p, 20);
+    QCOMPARE( QByteArray(p, 20), QByteArray(20, 'c') );
+    qca_secure_free(p);
+}
+
+void SecureArrayUnitTest::testThreads()
+{
+    QVERIFY( runThreads(8, 2000) );
+
+    // buffers freed by threads that have finished must still be usable
+    QCA::SecureArray a(100);
+    QCOMPARE( a.size(), 100 );
+}
+
+void SecureArrayUnitTest::testStats()
+{
+    QCOMPARE( QCA::secureMemoryPolicy(), QCA::SecureMemoryGrow );
+
+    QCA::SecureMemoryStats before = QCA::secureMemoryStats();
+    QVERIFY( before.bytesInPool > 0 );
+    QCOMPARE( before.bytesInPool, before.bytesLocked + before.bytesUnlocked );
+    QVERIFY( before.peakBytesInPool >= before.bytesInPool );
+    if ( !QCA::haveSecureMemory() )
+	QVERIFY( before.fallbackEvents > 0 );
+
+    // enough to need more than the preallocated pool, in small and large pieces
+    QList<QCA::SecureArray> arrays;
+    for (int n = 0; n < 200; ++n)
+	arrays += QCA::SecureArray(1000);
+    arrays += QCA::SecureArray(100000);
+
+    QCA::SecureMemoryStats during = QCA::secureMemoryStats();
+    QVERIFY( during.bytesInUse >= before.bytesInUse + 200 * 1000 + 100000 );
+    QVERIFY( during.bytesInPool >= during.bytesInUse );
+    QVERIFY( during.peakBytesInPool >= during.bytesInPool );
+    QVERIFY( during.fragmentation() >= 0.0 && during.fragmentation() <= 1.0 );
+
+    arrays.clear();
+    QCA::SecureMemoryStats after = QCA::secureMemoryStats();
+    QCOMPARE( after.bytesInUse, before.bytesInUse );
+    QCOMPARE( after.peakBytesInPool, during.peakBytesInPool );
+
+    // buffers of a few pages are reused, rather than mapped each time
+    {
+	QCA::SecureArray medium(10000);
+    }
+    qint64 pool = QCA::secureMemoryStats().bytesInPool;
+    {
+	QCA::SecureArray medium(10000);
+	QCOMPARE( QCA::secureMemoryStats().bytesInPool, pool );
+    }
+
+    // the pool grows by the configured amount, in any case by whole slabs
+    QCA::setSecureMemoryPolicy(QCA::SecureMemoryGrow, 1024 * 1024);
+    for (int n = 0; n < 2000; ++n)
+	arrays += QCA::SecureArray(1000);
+    QVERIFY( QCA::secureMemoryStats().bytesInPool >= 2000 * 1000 );
+    arrays.clear();
+    QCA::setSecureMemoryPolicy(QCA::SecureMemoryGrow);
+}
+
+void SecureArrayUnitTest::allocationBenchmark_data()
+{
+    QTest::addColumn<int>("threads");
+
+    QTest::newRow("1 thread") << 1;
+    QTest::newRow("2 threads") << 2;
+    QTest::newRow("4 threads") << 4;
+    QTest::newRow("8 threads") << 8;
+    QTest::newRow("16 threads") << 16;
+    QTest::newRow("32 threads") << 32;
+    QTest::newRow("64 threads") << 64;
+}
+
+void SecureArrayUnitTest::allocationBenchmark()
+{
+    QFETCH( int, threads );
+
+    // the same total amount of work for each row
+    int iterations = 128000 / threads;
+    bool ok = true;
+    QBENCHMARK {
+	if (!runThreads(threads, iterations))
+	    ok = false;
+    }
+    QVERIFY( ok );
+}
+
 QTEST_MAIN(SecureArrayUnitTest)
 
 #include "securearrayunittest.moc"